@@ -0,0 +1,123 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+#include "bench.h"
+#include "gdsparse.h"
+#include "gdsobject_ogl.h"
+#include "renderer.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <sys/time.h>
+
+#ifndef EGL_NO_CONFIG_KHR
+	#define EGL_NO_CONFIG_KHR ((EGLConfig)0)
+#endif
+
+// Cells that can be drawn, without the window manager of GDSParse_ogl
+class BenchParse : public GDSParse
+{
+public:
+	BenchParse(class GDSProcess *process) : GDSParse(process, false) {}
+	class GDSObject *NewObject(char *Name) { return new GDSObject_ogl(Name); }
+};
+
+double bench_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+GDSProcess *bench_process(char *processfile)
+{
+	GDSProcess *process = new GDSProcess();
+	process->Parse(processfile);
+	if(!process->IsValid() || process->LayerCount()==0)
+	{
+		v_printf(-1, "Error: %s is not a valid process file\n", processfile);
+		return NULL;
+	}
+	return process;
+}
+
+GDSObject_ogl *bench_load(GDSProcess *process, char *gdsfile, char *topcell)
+{
+	FILE *iptr = fopen(gdsfile, "rb");
+	if(!iptr)
+	{
+		v_printf(-1, "Error: Unable to open %s.\n", gdsfile);
+		return NULL;
+	}
+
+	// The file stays open, cells are loaded from it on demand
+	BenchParse *world = new BenchParse(process);
+	if(world->Parse(iptr, topcell))
+	{
+		v_printf(-1, "Error: Unable to parse %s.\n", gdsfile);
+		return NULL;
+	}
+
+	// As GDSParse_ogl::SetTopcell and initWorld do
+	GDSObject_ogl *top = NULL;
+	if(topcell)
+		top = (GDSObject_ogl*) world->_Objects->SearchObject(topcell);
+	if(!top)
+		top = (GDSObject_ogl*) world->_Objects->GetTopObject();
+	if(!top)
+	{
+		v_printf(-1, "Error: No topcell in %s.\n", gdsfile);
+		return NULL;
+	}
+	world->LoadCell(top);
+	top->countTotalPoints();
+	top->collapseHierachy();
+	return top;
+}
+
+bool bench_context()
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+
+	// Surfaceless where Mesa has it, otherwise the default display
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#endif
+	if(display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API))
+	{
+		v_printf(-1, "Error: No EGL display for OpenGL.\n");
+		return false;
+	}
+
+	// No surface either, benchmarks that draw make a framebuffer object
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, NULL);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		v_printf(-1, "Error: No OpenGL context without a surface.\n");
+		return false;
+	}
+
+	init_render();
+	return true;
+}
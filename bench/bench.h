@@ -0,0 +1,34 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "gds_globals.h"
+
+// Shared by the headless benchmarks, built with "make bench" in linux/
+
+double bench_time(); // Wall clock, in seconds
+class GDSProcess *bench_process(char *processfile); // NULL on error
+class GDSObject_ogl *bench_load(class GDSProcess *process, char *gdsfile, char *topcell); // Top cell, parsed and collapsed like the viewer does, NULL on error
+bool bench_context(); // OpenGL context without a window, with the renderer initialized
+
+#endif // __BENCH_H__
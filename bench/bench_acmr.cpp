@@ -0,0 +1,62 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+// Vertex cache order of the generated index buffers. Builds the geometry
+// below the top cell as the viewer uploads it, and reports the average
+// cache miss ratio (ACMR, misses per triangle) before and after the
+// triangles of each recipe are ordered, see Renderer::finishRecipe.
+
+#include "bench.h"
+#include "gdsobject_ogl.h"
+#include "process_cfg.h"
+#include "renderer.h"
+
+int main(int argc, char **argv)
+{
+	if(argc < 3)
+	{
+		printf("Usage: %s <process file> <gds file> [topcell]\n", argv[0]);
+		return 1;
+	}
+
+	verbose_output = 0; // Errors only
+	GDSProcess *process = bench_process(argv[1]);
+	if(!process)
+		return 1;
+	GDSObject_ogl *top = bench_load(process, argv[2], argc > 3 ? argv[3] : NULL);
+	if(!top)
+		return 1;
+	renderer.setCacheStatistics(true);
+	if(!bench_context())
+		return 1;
+
+	double start = bench_time();
+	top->UploadToVRAM();
+	renderer.forceFlush();
+	double seconds = bench_time() - start;
+
+	unsigned long indices, before, after;
+	renderer.cacheStatistics(&indices, &before, &after);
+	indices = max(indices, 1UL);
+	printf("%lu triangles built and uploaded in %.3f s\n", indices/3, seconds);
+	printf("ACMR %.3f before ordering, %.3f after, FIFO cache of %d vertices\n", 3.0*before/indices, 3.0*after/indices, VERTEX_CACHE_SIZE);
+	return 0;
+}
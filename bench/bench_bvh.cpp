@@ -0,0 +1,122 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+// Culling of the hierarchy at several zoom levels. Looks straight down on
+// the middle and on the lower left corner of the top cell, zooming in from
+// the whole design, and times RenderList with all layers hidden, so only
+// the traversal of the reference trees is left, see GDSObject_ogl::RenderList.
+// Then draws the same views once to count what is left in view.
+
+#include "bench.h"
+#include "gdsobject_ogl.h"
+#include "process_cfg.h"
+#include "renderer.h"
+#include <math.h>
+
+#define BENCH_SECONDS 0.5 // Per view
+#define BENCH_ZOOMS 5
+
+static void show(GDSProcess *process, bool visible)
+{
+	for(struct ProcessLayer *layer = process->GetLayer(); layer; layer = layer->Next)
+		process->ChangeVisibility(layer, visible);
+}
+
+static void frame(GDSObject_ogl *top, float x, float y, float width)
+{
+	// Height that shows width across with the field of view of the viewer
+	float h = width/2/tanf(25.0f*3.14159265f/180.0f);
+	float zfar = max(h*8.0f, 30.0f);
+	MATRIX4X4 projection, view;
+	projection.SetPerspective(50.0f, 1.0f, zfar/1024.0f, zfar*1.5f);
+	view.SetTranslation(VECTOR3D(-x, -y, -h));
+
+	total_tris = 0;
+	total_draws = 0;
+	top->PrepareRender(projection, view);
+	top->RenderList(view, false);
+	top->EndRender();
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 3)
+	{
+		printf("Usage: %s <process file> <gds file> [topcell]\n", argv[0]);
+		return 1;
+	}
+
+	verbose_output = 0; // Errors only
+	GDSProcess *process = bench_process(argv[1]);
+	if(!process)
+		return 1;
+	GDSObject_ogl *top = bench_load(process, argv[2], argc > 3 ? argv[3] : NULL);
+	if(!top || !bench_context())
+		return 1;
+	if(!renderer.offlineFramebuffer(64, 64))
+	{
+		v_printf(-1, "Error: No framebuffer object.\n");
+		return 1;
+	}
+
+	// Geometry and the reference trees, before the first frame
+	double start = bench_time();
+	top->UploadToVRAM();
+	renderer.forceFlush();
+	GDSBB bounds = top->GetTotalBoundary();
+	show(process, false);
+	frame(top, 0.0f, 0.0f, 1.0f);
+	printf("Geometry and reference trees built in %.3f s\n", bench_time() - start);
+
+	float width = max(bounds.max.X - bounds.min.X, bounds.max.Y - bounds.min.Y);
+	float zooms[BENCH_ZOOMS] = {1, 4, 16, 64, 256};
+	for(int z=0; z<BENCH_ZOOMS; z++)
+	{
+		for(int corner=0; corner<2; corner++)
+		{
+			float w = width/zooms[z];
+			float x = corner ? bounds.min.X + w/2 : (bounds.min.X + bounds.max.X)/2;
+			float y = corner ? bounds.min.Y + w/2 : (bounds.min.Y + bounds.max.Y)/2;
+
+			// Traversal alone
+			show(process, false);
+			int frames = 0;
+			start = bench_time();
+			do
+			{
+				frame(top, x, y, w);
+				frames++;
+			}while(bench_time() - start < BENCH_SECONDS);
+			double traversal = (bench_time() - start)/frames;
+
+			// What is drawn
+			show(process, true);
+			start = bench_time();
+			frame(top, x, y, w);
+			glFinish();
+			double drawn = bench_time() - start;
+
+			printf("Zoom %4.0fx %s: traversal %8.3f ms, drawn in %8.3f ms with %lu draws and %lu triangles\n",
+				zooms[z], corner ? "corner" : "middle", traversal*1000, drawn*1000, total_draws, total_tris);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,95 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+// Path outlining as the parser does it, queued per structure and expanded
+// together, see GDSPathExpander. Routes metal-like wires: Manhattan center
+// lines with a bend at every point, for each PATHTYPE and a range of
+// lengths, and reports the time per path and per point.
+
+#include "bench.h"
+#include "gdsobject.h"
+#include "gdspathexpand.h"
+
+#define BENCH_SECONDS 0.5 // Per path type and length
+#define BENCH_POINTS 400000 // Of all paths of one length together
+#define BENCH_LENGTHS 5
+
+// Wire of points on a 5nm grid, turning at every point
+static GDSPath *route(int type, unsigned int points)
+{
+	float width = 0.05f*(1 + rand()%4); // Half of it, as the parser stores it
+	GDSPath *path = new GDSPath(type, 0.0f, 0.2f, points, width, 0.03f, 0.07f, NULL);
+	float x = 0.005f*(rand()%200000), y = 0.005f*(rand()%200000);
+	for(unsigned int i=0; i<points; i++)
+	{
+		path->AddPoint(i, x, y);
+		float step = 0.005f*(40 + rand()%560) * (rand()%2 ? 1 : -1);
+		if(i%2)
+			y += step;
+		else
+			x += step;
+	}
+	return path;
+}
+
+int main()
+{
+	int types[4] = {0, 1, 2, 4};
+	unsigned int lengths[BENCH_LENGTHS] = {2, 4, 16, 128, 1024};
+	GDSPathExpander expander;
+
+	srand(1);
+	for(int t=0; t<4; t++)
+	{
+		for(int l=0; l<BENCH_LENGTHS; l++)
+		{
+			vector<GDSPath*> paths(BENCH_POINTS/lengths[l]);
+			vector<GDSPolygon*> polygons(paths.size());
+			for(unsigned int i=0; i<paths.size(); i++)
+			{
+				paths[i] = route(types[t], lengths[l]);
+				polygons[i] = new GDSPolygon(0.0f, 0.2f, NULL);
+			}
+
+			int runs = 0;
+			double start = bench_time();
+			do
+			{
+				for(unsigned int i=0; i<paths.size(); i++)
+					expander.Add(paths[i], polygons[i]);
+				expander.Expand();
+				runs++;
+			}while(bench_time() - start < BENCH_SECONDS);
+			double seconds = (bench_time() - start)/runs;
+
+			unsigned long outline = 0;
+			for(unsigned int i=0; i<paths.size(); i++)
+			{
+				outline += polygons[i]->GetPoints();
+				delete paths[i];
+				delete polygons[i];
+			}
+			printf("PATHTYPE %d, %6u paths of %4u points: %8.1f ns per path, %6.1f ns per point, %lu outline points\n",
+				types[t], (unsigned int)paths.size(), lengths[l], seconds*1e9/paths.size(), seconds*1e9/BENCH_POINTS, outline);
+		}
+	}
+	return 0;
+}
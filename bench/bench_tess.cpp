@@ -0,0 +1,120 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+// Tesselation of non-Manhattan polygons with a growing number of points,
+// which go to the ear clipper of GDSPolygon::Triangulate. Reports the time
+// per polygon and checks that the triangles cover the polygon area.
+
+#include "bench.h"
+#include "gdspolygon.h"
+
+#define BENCH_SECONDS 0.5 // Per shape and size
+#define BENCH_SIZES 6
+#define BENCH_SHAPES 3
+
+// Random radius around the center, star shaped so always simple
+static void star(vector<Point2D> &coords, unsigned int n)
+{
+	for(unsigned int i=0; i<n; i++)
+	{
+		double angle = 2*M_PI*i/n;
+		double radius = 50.0*(1 + rand()%1000/1000.0);
+		coords.push_back(Point2D((float)(radius*cos(angle)), (float)(radius*sin(angle))));
+	}
+}
+
+// Bar with teeth slanted at 45 degrees, like angled routing
+static void comb(vector<Point2D> &coords, unsigned int n)
+{
+	unsigned int teeth = (n-2)/4;
+	for(unsigned int i=0; i<teeth; i++)
+	{
+		float x = 2.0f*i;
+		coords.push_back(Point2D(x, 1.0f));
+		coords.push_back(Point2D(x+5.0f, 6.0f));
+		coords.push_back(Point2D(x+6.0f, 6.0f));
+		coords.push_back(Point2D(x+1.0f, 1.0f));
+	}
+	coords.push_back(Point2D(2.0f*teeth, 0.0f));
+	coords.push_back(Point2D(0.0f, 0.0f));
+}
+
+// Round guard ring, cut open by a narrow slit
+static void ring(vector<Point2D> &coords, unsigned int n)
+{
+	double slit = 0.001;
+	for(unsigned int i=0; i<n/2; i++)
+	{
+		double angle = slit + (2*M_PI - 2*slit)*i/(n/2-1);
+		coords.push_back(Point2D((float)(100.0*cos(angle)), (float)(100.0*sin(angle))));
+	}
+	for(unsigned int i=0; i<n/2; i++)
+	{
+		double angle = 2*M_PI - slit - (2*M_PI - 2*slit)*i/(n/2-1);
+		coords.push_back(Point2D((float)(95.0*cos(angle)), (float)(95.0*sin(angle))));
+	}
+}
+
+static double area(const Point2D &a, const Point2D &b, const Point2D &c)
+{
+	return fabs(((double)b.X-a.X)*((double)c.Y-a.Y) - ((double)c.X-a.X)*((double)b.Y-a.Y))/2;
+}
+
+int main()
+{
+	const char *names[BENCH_SHAPES] = {"star", "comb", "ring"};
+	void (*shapes[BENCH_SHAPES])(vector<Point2D>&, unsigned int) = {star, comb, ring};
+	unsigned int sizes[BENCH_SIZES] = {64, 256, 1024, 4096, 16384, 65536};
+	GDSTesselation out;
+
+	srand(1);
+	for(int s=0; s<BENCH_SHAPES; s++)
+	{
+		for(int i=0; i<BENCH_SIZES; i++)
+		{
+			vector<Point2D> coords;
+			shapes[s](coords, sizes[i]);
+			unsigned int n = coords.size();
+
+			int runs = 0;
+			double start = bench_time();
+			do
+			{
+				out.indices.clear();
+				out.rects.clear();
+				GDSPolygon::Tesselate(&coords[0], n, out);
+				runs++;
+			}while(bench_time() - start < BENCH_SECONDS);
+			double seconds = (bench_time() - start)/runs;
+
+			// The triangles should add up to the polygon
+			double outline = 0, covered = 0;
+			for(unsigned int j=0; j<n; j++)
+				outline += (double)coords[j].X*coords[(j+1)%n].Y - (double)coords[(j+1)%n].X*coords[j].Y;
+			outline = fabs(outline)/2;
+			for(unsigned int j=0; j+2<out.indices.size(); j+=3)
+				covered += area(coords[out.indices[j]], coords[out.indices[j+1]], coords[out.indices[j+2]]);
+
+			printf("%s of %5u points: %9.3f ms, %5u triangles, area off by %.2g%%\n", names[s], n, seconds*1e3,
+				(unsigned int)out.indices.size()/3, 100*fabs(covered - outline)/outline);
+		}
+	}
+	return 0;
+}
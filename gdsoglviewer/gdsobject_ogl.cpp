@@ -68,6 +68,117 @@ void init_render()
 // GDSObject Class
 
 GDSObject_ogl::GDSObject_ogl(char *Name) : GDSObject(Name){
+	has_tree_bbox = false;
+	tree_empty = true;
+}
+
+static MATRIX4X4 RefMatrix(const GDSMat &mat)
+{
+	return MATRIX4X4(mat[0], mat[1], 0.0f, 0.0f, mat[2], mat[3], 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, mat[4], mat[5], 0.0f, 1.0f);
+}
+
+// Corners that end the top and bottom triangles of a polygon, where their
+// normals go. Every triangle needs one, and no two may follow each other on
+// the outline, so that each wall can end on a corner of its own. Alternate
+// corners do for most polygons. Otherwise the triangles are coloured with
+// three colours, a colour per corner of each triangle, and the corners of
+// one colour are taken. False if neither works.
+static bool ProvokingCorners(const int *indices, unsigned int triangles, unsigned int points, vector<bool> &faces)
+{
+	int e=1, o=1;
+	for(unsigned int j=0;j<triangles;j++)
+	{
+		if((indices[j*3+0]%2)==0 && (indices[j*3+1]%2)==0 && (indices[j*3+2]%2)==0)
+			o=0;
+		if((indices[j*3+0]%2)==1 && (indices[j*3+1]%2)==1 && (indices[j*3+2]%2)==1)
+			e=0;
+	}
+	if(!(e==0 && o==0) && !(e==1 && o==0 && triangles%2==1))
+	{
+		for(unsigned int j=0; j<points; j++)
+			faces[j] = (e==1 && o==0) ? j%2==0 : j%2==1;
+		return true;
+	}
+
+	// Triangles sharing an edge sit next to each other once sorted
+	vector<pair<pair<int, int>, unsigned int> > edges;
+	for(unsigned int j=0;j<triangles;j++)
+		for(int k=0; k<3; k++)
+		{
+			int a = indices[j*3+k], b = indices[j*3+(k+1)%3];
+			edges.push_back(make_pair(make_pair(min(a, b), max(a, b)), j));
+		}
+	sort(edges.begin(), edges.end());
+
+	vector<int> color(points, -1);
+	vector<bool> done(triangles, false);
+	vector<unsigned int> stack;
+	for(unsigned int j=0;j<triangles;j++) // Degenerate ones are dropped anyway
+		done[j] = indices[j*3+0] == indices[j*3+1] || indices[j*3+1] == indices[j*3+2] || indices[j*3+2] == indices[j*3+0];
+	for(unsigned int j=0;j<triangles;j++)
+	{
+		if(done[j])
+			continue;
+		for(int k=0; k<3; k++) // Start with any colours not yet taken
+			if(color[indices[j*3+k]] < 0)
+				for(int c=0; c<3; c++)
+					if(color[indices[j*3+0]] != c && color[indices[j*3+1]] != c && color[indices[j*3+2]] != c)
+					{
+						color[indices[j*3+k]] = c;
+						break;
+					}
+		if(color[indices[j*3+0]] < 0 || color[indices[j*3+0]] == color[indices[j*3+1]] || color[indices[j*3+1]] == color[indices[j*3+2]] || color[indices[j*3+2]] == color[indices[j*3+0]])
+			return false;
+		done[j] = true;
+		stack.push_back(j);
+
+		// The third corner of a neighbour takes the colour left over
+		while(stack.size())
+		{
+			unsigned int t = stack.back();
+			stack.pop_back();
+			for(int k=0; k<3; k++)
+			{
+				int a = indices[t*3+k], b = indices[t*3+(k+1)%3];
+				pair<int, int> edge = make_pair(min(a, b), max(a, b));
+				vector<pair<pair<int, int>, unsigned int> >::iterator it = lower_bound(edges.begin(), edges.end(), make_pair(edge, 0u));
+				for(; it != edges.end() && it->first == edge; it++)
+				{
+					unsigned int n = it->second;
+					if(done[n])
+						continue;
+					for(int l=0; l<3; l++)
+					{
+						int w = indices[n*3+l];
+						if(w == a || w == b)
+							continue;
+						if(color[w] < 0)
+							color[w] = 3 - color[a] - color[b];
+						else if(color[w] != 3 - color[a] - color[b])
+							return false;
+					}
+					if(color[indices[n*3+0]] == color[indices[n*3+1]] || color[indices[n*3+1]] == color[indices[n*3+2]] || color[indices[n*3+2]] == color[indices[n*3+0]])
+						return false;
+					done[n] = true;
+					stack.push_back(n);
+				}
+			}
+		}
+	}
+
+	for(int c=0; c<3; c++)
+	{
+		unsigned int j;
+		for(j=0; j<points; j++)
+			if(color[j] == c && color[(j+1)%points] == c)
+				break;
+		if(j < points)
+			continue;
+		for(j=0; j<points; j++)
+			faces[j] = color[j] == c;
+		return true;
+	}
+	return false;
 }
 
 GDSObject_ogl::~GDSObject_ogl()
@@ -76,35 +187,37 @@ GDSObject_ogl::~GDSObject_ogl()
 }
 
 // New, vertex list based rendering
-void GDSObject_ogl::OutputOGLVertices2(struct ProcessLayer *do_layer, render_layer_t *data)
+void GDSObject_ogl::OutputOGLVertices2(const vector<GDSPolygon*> &polygons, render_layer_t *data)
 {
-	struct ProcessLayer *layer;
 	float largest_dimension = 0.0; // Largest dimension of an object
 	float xmin, ymin, zmin, xmax, ymax, zmax;
 	class GDSPolygon *polygon;
     float dx, dy;
-    vector<int> *indices; // Pointer to index array of the triangles
+    const Point2D *coords; // Points of the polygon, relative to its offset
+    Point2D offset;
+    const int *indices; // Pointer to index array of the triangles
+    unsigned int points, triangles;
     int tp=0, bp=0, tp2=0, bp2=0; // Top and bottom pointer into the vertex array
     int v[3]; // Indices of a triangle
+    vector<bool> faces; // Corners ending the top and bottom triangles
     
 	zmin = xmin = ymin = 100000; zmax = xmax = ymax = -10000;
 
-    for(unsigned long i=0; i<PolygonItems.size(); i++)
+    for(unsigned long i=0; i<polygons.size(); i++)
     {
-        polygon = PolygonItems[i];
-        layer = polygon->GetLayer();
-        if(do_layer && layer!= do_layer)
-            continue;
-
+        polygon = polygons[i];
+        coords = polygon->GetCoords();
+        offset = polygon->GetOffset();
+        points = polygon->GetPoints();
 
         float z1 = polygon->GetHeight();
         float z2 = polygon->GetHeight() + polygon->GetThickness();
         float x0, y0;
         
         //Bbox
-        for(unsigned int j=0; j<polygon->GetPoints(); j++){
-            x0 = polygon->GetXCoords(j);
-            y0 = polygon->GetYCoords(j);
+        for(unsigned int j=0; j<points; j++){
+            x0 = coords[j].X + offset.X;
+            y0 = coords[j].Y + offset.Y;
             
             xmin = fmin(xmin, x0);
             ymin = fmin(ymin, y0);
@@ -113,25 +226,34 @@ void GDSObject_ogl::OutputOGLVertices2(struct ProcessLayer *do_layer, render_lay
         }
         zmin = z1;
         zmax = z2;
+
+        // Manhattan outlines that are cheaper as rectangles are drawn from them
+        if(polygon->GetNumRectangles())
+        {
+            OutputOGLRectangles(polygon, z1, z2, largest_dimension);
+            continue;
+        }
         
         // Send vertices to vertex buffer
         tp = tp2 = renderer.getCurIndex(); // Top pointer
-        for(unsigned int j=0; j<polygon->GetPoints(); j++)
-            renderer.addVertex((GLfloat) polygon->GetXCoords(j), (GLfloat) polygon->GetYCoords(j),z2);
+        for(unsigned int j=0; j<points; j++)
+            renderer.addVertex((GLfloat) (coords[j].X + offset.X), (GLfloat) (coords[j].Y + offset.Y),z2);
         bp = bp2 = renderer.getCurIndex(); // Bottom pointer
-        for(unsigned int j=0; j<polygon->GetPoints(); j++)
-            renderer.addVertex((GLfloat) polygon->GetXCoords(j), (GLfloat) polygon->GetYCoords(j),z1);
+        for(unsigned int j=0; j<points; j++)
+            renderer.addVertex((GLfloat) (coords[j].X + offset.X), (GLfloat) (coords[j].Y + offset.Y),z1);
         
         // Assemble triangles
 		indices = polygon->GetIndices();
-		if(!indices)
-			continue;
+		triangles = polygon->GetNumIndices()/3;
         
-        // Largest dimension
-        for(unsigned int j=0;j<indices->size()/3;j++)
+        // Largest dimension, the offset drops out
+        for(unsigned int j=0;j<triangles;j++)
         {
-            dx = fmax(fmax(fabs(polygon->GetXCoords((*indices)[j*3+0]) - polygon->GetXCoords((*indices)[j*3+1])), fabs(polygon->GetXCoords((*indices)[j*3+0]) - polygon->GetXCoords((*indices)[j*3+2]))), fabs(polygon->GetXCoords((*indices)[j*3+1]) - polygon->GetXCoords((*indices)[j*3+2])));
-            dy = fmax(fmax(fabs(polygon->GetYCoords((*indices)[j*3+0]) - polygon->GetYCoords((*indices)[j*3+1])), fabs(polygon->GetYCoords((*indices)[j*3+0]) - polygon->GetYCoords((*indices)[j*3+2]))), fabs(polygon->GetYCoords((*indices)[j*3+1]) - polygon->GetYCoords((*indices)[j*3+2])));
+            const Point2D &A = coords[indices[j*3+0]];
+            const Point2D &B = coords[indices[j*3+1]];
+            const Point2D &C = coords[indices[j*3+2]];
+            dx = fmax(fmax(fabs(A.X - B.X), fabs(A.X - C.X)), fabs(B.X - C.X));
+            dy = fmax(fmax(fabs(A.Y - B.Y), fabs(A.Y - C.Y)), fabs(B.Y - C.Y));
             if(fmax(dx,dy)/fmin(dx,dy) > 2.0f)
                 largest_dimension = fmax(fmin(dx, dy)/0.5f, largest_dimension);
             else
@@ -139,49 +261,32 @@ void GDSObject_ogl::OutputOGLVertices2(struct ProcessLayer *do_layer, render_lay
             
         }        
 		
-        // Even-odd ordering?
-        int e=1;
-        int o=1;
-        for(unsigned int j=0;j<indices->size()/3;j++)
-        {
-            v[0] = (*indices)[j*3+0];
-            v[1] = (*indices)[j*3+1];
-            v[2] = (*indices)[j*3+2];
-            
-            if((v[0]%2)==0 && (v[1]%2)==0 && (v[2]%2)==0)
-                o=0;
-            if((v[0]%2)==1 && (v[1]%2)==1 && (v[2]%2)==1)
-                e=0;
-        }
-        if( (e==0 && o==0) || (e==1 && o==0 && (indices->size()/3)%2==1)) // Oh oh, we need to duplicate vertices for the boundary
+        // Corners ending the top and bottom triangles
+        faces.assign(points, false);
+        if(!ProvokingCorners(indices, triangles, points, faces)) // Oh oh, we need to duplicate vertices for the boundary
         {
             // Duplicate vertices
             tp2 = renderer.getCurIndex(); // Top pointer
-            for(unsigned int j=0; j<polygon->GetPoints(); j++)
-                renderer.addVertex((GLfloat) polygon->GetXCoords(j), (GLfloat) polygon->GetYCoords(j),z2);
+            for(unsigned int j=0; j<points; j++)
+                renderer.addVertex((GLfloat) (coords[j].X + offset.X), (GLfloat) (coords[j].Y + offset.Y),z2);
             bp2 = renderer.getCurIndex(); // Bottom pointer
-            for(unsigned int j=0; j<polygon->GetPoints(); j++)
-                renderer.addVertex((GLfloat) polygon->GetXCoords(j), (GLfloat) polygon->GetYCoords(j),z1);	
+            for(unsigned int j=0; j<points; j++)
+                renderer.addVertex((GLfloat) (coords[j].X + offset.X), (GLfloat) (coords[j].Y + offset.Y),z1);	
 
-			e = 0;
-			o = 1;
+            for(unsigned int j=0; j<points; j++)
+                faces[j] = j%2==1;
         }
-		if(e==1 && o==1)
-		{
-			e = 0;
-			o = 1;
-		}
         
         // Stream top
-        for(unsigned int j=0;j<indices->size()/3;j++)
+        for(unsigned int j=0;j<triangles;j++)
         {
-            v[0] = (*indices)[j*3+0];
-            v[1] = (*indices)[j*3+1];
-            v[2] = (*indices)[j*3+2];
+            v[0] = indices[j*3+0];
+            v[1] = indices[j*3+1];
+            v[2] = indices[j*3+2];
             
-			if( (e && v[1]%2==0) || (o && v[1]%2==1) )
+			if(faces[v[1]])
                 renderer.addTriangle(tp+v[2], tp+v[0], tp+v[1]);
-            else if( (e && v[2]%2==0) || (o && v[2]%2==1))
+            else if(faces[v[2]])
                 renderer.addTriangle(tp+v[0], tp+v[1], tp+v[2]);            
             else
                 renderer.addTriangle(tp+v[1], tp+v[2], tp+v[0]);
@@ -189,15 +294,15 @@ void GDSObject_ogl::OutputOGLVertices2(struct ProcessLayer *do_layer, render_lay
         }
         
         // Stream bottom
-        for(unsigned int j=0;j<indices->size()/3;j++)
+        for(unsigned int j=0;j<triangles;j++)
         {
-            v[0] = (*indices)[j*3+0];
-            v[1] = (*indices)[j*3+1];
-            v[2] = (*indices)[j*3+2];
+            v[0] = indices[j*3+0];
+            v[1] = indices[j*3+1];
+            v[2] = indices[j*3+2];
             
-			if( (e && v[1]%2==0) || (o && v[1]%2==1) )
+			if(faces[v[1]])
 				renderer.addTriangle(bp+v[0], bp+v[2], bp+v[1]);                
-            else if( (e && v[2]%2==0) || (o && v[2]%2==1))
+            else if(faces[v[2]])
                 renderer.addTriangle(bp+v[1], bp+v[0], bp+v[2]);
             else
                 renderer.addTriangle(bp+v[2], bp+v[1], bp+v[0]);
@@ -205,12 +310,12 @@ void GDSObject_ogl::OutputOGLVertices2(struct ProcessLayer *do_layer, render_lay
         }
         
         // Stream boundary
-        for(unsigned int j=0;j<polygon->GetPoints();j++)
+        for(unsigned int j=0;j<points;j++)
         {
             v[0] = j+0;
-            v[1] = (j+1)%(polygon->GetPoints());
+            v[1] = (j+1)%points;
             
-            if(v[1]%2!=o)
+            if(!faces[v[1]])
             {
                 renderer.addTriangle(bp2+v[0], bp2+v[1], tp2+v[1]);
                 renderer.addTriangle(tp2+v[0], bp2+v[0], tp2+v[1]);
@@ -232,12 +337,151 @@ void GDSObject_ogl::OutputOGLVertices2(struct ProcessLayer *do_layer, render_lay
 	data->largest_dimension = largest_dimension;
 }
 
+void GDSObject_ogl::OutputOGLRectangles(GDSPolygon *polygon, float z1, float z2, float &largest_dimension)
+{
+	vector<unsigned int> corners; // Outline without the points halfway a straight run
+	const float *rects = polygon->GetRectangles();
+	const Point2D *coords = polygon->GetCoords();
+	Point2D offset = polygon->GetOffset(); // Points and rectangles of shared shapes are relative
+	vector<Point2D> outline; // Absolute points of the corners
+	vector<pair<float, float> > keys; // Every corner of the outline and the rectangles, sorted
+	vector<int> top, bottom; // Vertex of each key, -1 if none yet
+	vector<int> ring; // Position of each key in the outline, -1 if none
+	vector<bool> bridge; // Walls run both ways, the keyholes into holes of merged layers
+	bool twice = false; // A corner visited twice
+	unsigned int n = polygon->GetPoints();
+	unsigned int m = polygon->GetNumRectangles()*4;
+	float area = 0.0f;
+	float dx, dy;
+	int tp, bp, v[4], key[4];
+
+	for(unsigned int j=0; j<n; j++)
+	{
+		const Point2D &P = coords[(j+n-1)%n];
+		const Point2D &J = coords[j];
+		const Point2D &Q = coords[(j+1)%n];
+		area += J.X*Q.Y - Q.X*J.Y;
+
+		if(P.X == J.X && J.X == Q.X)
+			continue;
+		if(P.Y == J.Y && J.Y == Q.Y)
+			continue;
+		corners.push_back(j);
+	}
+	if(area < 0.0f)
+		reverse(corners.begin(), corners.end()); // Walls face outwards
+	for(unsigned int j=0; j<corners.size(); j++)
+		outline.push_back(Point2D(coords[corners[j]].X + offset.X, coords[corners[j]].Y + offset.Y));
+
+	// Look up corners in one sorted table, polygons are small and many
+	keys.reserve(corners.size() + m);
+	for(unsigned int j=0; j<corners.size(); j++)
+		keys.push_back(make_pair(outline[j].X, outline[j].Y));
+	for(unsigned int j=0; j<m; j+=4)
+	{
+		for(unsigned int k=0; k<4; k++)
+			keys.push_back(make_pair(rects[j + ((k==1 || k==2) ? 2 : 0)] + offset.X, rects[j + ((k>=2) ? 3 : 1)] + offset.Y));
+	}
+	sort(keys.begin(), keys.end());
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+	top.assign(keys.size(), -1);
+	bottom.assign(keys.size(), -1);
+	ring.assign(keys.size(), -1);
+
+	// Stream walls, one per straight run
+	tp = renderer.getCurIndex(); // Top pointer
+	bridge.resize(corners.size(), false);
+	for(unsigned int j=0; j<corners.size(); j++)
+	{
+		int key = lower_bound(keys.begin(), keys.end(), make_pair(outline[j].X, outline[j].Y)) - keys.begin();
+		if(ring[key] >= 0)
+			twice = true;
+		ring[key] = j;
+		top[key] = tp+j; // Shared with the top
+		renderer.addVertex((GLfloat) outline[j].X, (GLfloat) outline[j].Y, z2);
+	}
+	bp = renderer.getCurIndex(); // Bottom pointer
+	for(unsigned int j=0; j<corners.size(); j++)
+		renderer.addVertex((GLfloat) outline[j].X, (GLfloat) outline[j].Y, z1);
+
+	if(twice)
+	{
+		set<pair<pair<float, float>, pair<float, float> > > runs;
+		for(unsigned int j=0; j<corners.size(); j++)
+			runs.insert(make_pair(make_pair(outline[j].X, outline[j].Y), make_pair(outline[(j+1)%corners.size()].X, outline[(j+1)%corners.size()].Y)));
+		for(unsigned int j=0; j<corners.size(); j++)
+			bridge[j] = runs.count(make_pair(make_pair(outline[(j+1)%corners.size()].X, outline[(j+1)%corners.size()].Y), make_pair(outline[j].X, outline[j].Y))) > 0;
+	}
+
+	for(unsigned int j=0; j<corners.size(); j++)
+	{
+		// Both triangles end on the bottom vertex owned by this wall
+		unsigned int k = (j+1)%corners.size();
+		if(bridge[j])
+			continue;
+		renderer.addTriangle(tp+j, bp+j, bp+k);
+		renderer.addTriangle(tp+k, tp+j, bp+k);
+		numtris+=2;
+	}
+
+	// Stream top and bottom, corners are shared between rectangles. All top vertices face up
+	for(unsigned int j=0; j<m; j+=4)
+	{
+		dx = rects[j+2] - rects[j+0];
+		dy = rects[j+3] - rects[j+1];
+		if(fmax(dx,dy)/fmin(dx,dy) > 2.0f)
+			largest_dimension = fmax(fmin(dx, dy)/0.5f, largest_dimension);
+		else
+			largest_dimension = fmax(fmin(dx, dy)/3.0f, largest_dimension);
+
+		for(unsigned int k=0; k<4; k++)
+		{
+			float x = rects[j + ((k==1 || k==2) ? 2 : 0)] + offset.X;
+			float y = rects[j + ((k>=2) ? 3 : 1)] + offset.Y;
+			key[k] = lower_bound(keys.begin(), keys.end(), make_pair(x, y)) - keys.begin();
+			if(top[key[k]] < 0)
+				top[key[k]] = renderer.addVertex((GLfloat) x, (GLfloat) y, z2);
+			v[k] = top[key[k]];
+		}
+		renderer.addTriangle(v[0], v[1], v[2]);
+		renderer.addTriangle(v[0], v[2], v[3]);
+
+		// The bottom ring belongs to the walls, both triangles end on a corner of our own
+		int own = -1;
+		for(unsigned int k=0; k<4; k++)
+		{
+			float x = rects[j + ((k==1 || k==2) ? 2 : 0)] + offset.X;
+			float y = rects[j + ((k>=2) ? 3 : 1)] + offset.Y;
+			if(bottom[key[k]] >= 0)
+				v[k] = bottom[key[k]];
+			else if(ring[key[k]] >= 0)
+				v[k] = bp + ring[key[k]];
+			else
+				v[k] = bottom[key[k]] = renderer.addVertex((GLfloat) x, (GLfloat) y, z1);
+			if(v[k] < bp || v[k] >= bp+(int)corners.size())
+				own = k;
+		}
+		if(own < 0)
+		{
+			own = 2;
+			v[own] = bottom[key[own]] = renderer.addVertex((GLfloat) (rects[j+2] + offset.X), (GLfloat) (rects[j+3] + offset.Y), z1);
+		}
+		renderer.addTriangle(v[(own+2)%4], v[(own+1)%4], v[own]);
+		renderer.addTriangle(v[(own+3)%4], v[(own+2)%4], v[own]);
+		numtris+=4;
+	}
+
+	// Give renderer the chance to flush its buffers
+	renderer.allowFlush();
+}
+
 void
 GDSObject_ogl::BuildLists()
 {
 	render_layer_t render_layer;
 	struct ProcessLayer *layer;
-	bool found;
+	vector<int> slots; // Entry in layer_list by layer position, -1 if none yet
+	vector<vector<GDSPolygon*> > polygons; // Of each entry in layer_list
 
 	if(PolygonItems.empty() && PathItems.empty())
 		return;
@@ -256,20 +500,12 @@ GDSObject_ogl::BuildLists()
 			if(!layer)
 				continue;
 
-			// Try to find layer
-			found = false;
-			for(unsigned long j=0;j<layer_list.size();j++)
-			{
-				if(layer_list[j].layer == layer)
-				{
-					found = true;
-					break;
-				}
-			}
-
 			// New layer?
-			if(!found)
+			if(layer->Position >= (int)slots.size())
+				slots.resize(layer->Position+1, -1);
+			if(slots[layer->Position] < 0)
 			{
+				slots[layer->Position] = layer_list.size();
 				render_layer.layer = layer;
 				render_layer.display_list = 0;
 				layer_list.push_back(render_layer);
@@ -281,24 +517,16 @@ GDSObject_ogl::BuildLists()
 		for(unsigned long i=0; i<PolygonItems.size(); i++)
 		{
 			// Get layer
-			layer = PolygonItems[i]->GetLayer();
+			layer = GetPolygonLayer(i);
 			if(!layer)
 				continue;
 
-			// Try to find layer
-			found = false;
-			for(unsigned long j=0;j<layer_list.size();j++)
-			{
-				if(layer_list[j].layer == layer)
-				{
-					found = true;
-					break;
-				}
-			}
-
 			// New layer?
-			if(!found)
+			if(layer->Position >= (int)slots.size())
+				slots.resize(layer->Position+1, -1);
+			if(slots[layer->Position] < 0)
 			{
+				slots[layer->Position] = layer_list.size();
 				render_layer.layer = layer;
 				render_layer.display_list = 0;
 				layer_list.push_back(render_layer);
@@ -306,13 +534,25 @@ GDSObject_ogl::BuildLists()
 		}
 	}
 
+	// Sort the polygons by layer, once instead of a pass per layer. Merged
+	// layers draw their union instead
+	polygons.resize(layer_list.size());
+	for(unsigned long i=0; i<PolygonItems.size(); i++)
+	{
+		layer = GetPolygonLayer(i);
+		if(layer && (inUnion.empty() || !inUnion[i]))
+			polygons[slots[layer->Position]].push_back(PolygonItems[i]);
+	}
+	for(unsigned long i=0; i<UnionItems.size(); i++)
+		polygons[slots[UnionItems[i]->GetLayer()->Position]].push_back(UnionItems[i]);
+
 	// Output geometry for each layer
 	total_listtris = 0;
 	for(unsigned long i=0;i<layer_list.size();i++)
 	{
 		numtris = 0;
         layer_list[i].renderRecipe = renderer.beginObject();
-		OutputOGLVertices2(layer_list[i].layer, &layer_list[i]);
+		OutputOGLVertices2(polygons[i], &layer_list[i]);
         renderer.endObject();
         
 		layer_list[i].numtris = numtris;
@@ -329,7 +569,7 @@ GDSObject_ogl::BuildLists()
 
 	}
 	
-	v_printf(1, "Object %s created with %d triangles.\n", Name, total_listtris);
+	v_printf(1, "Object %s created with %d triangles.\n", GetName(), total_listtris);
 }
 
 void GDSObject_ogl::PrepareRender(MATRIX4X4 projection_view, MATRIX4X4 object_view)
@@ -362,6 +602,187 @@ void GDSObject_ogl::UploadToVRAM()
 		((GDSObject_ogl*)refs[i]->object)->UploadToVRAM();	
 }
 
+bool GDSObject_ogl::GetTreeBBox(AA_BOUNDING_BOX &bounds)
+{
+	if(!has_tree_bbox)
+	{
+		if(!layer_list.size() && (!PolygonItems.empty() || !PathItems.empty()) )
+			BuildLists();
+
+		tree_empty = layer_list.empty();
+		if(!tree_empty)
+			tree_bbox = bbox;
+
+		// The corner elements bound the rest of an array
+		AA_BOUNDING_BOX child, t, r;
+		vector<VECTOR3D> ref_bounds(2*refs.size());
+		ref_order.clear();
+		for(unsigned int i=0;i<refs.size();i++)
+		{
+			GDSRef *ref = refs[i];
+			if(!((GDSObject_ogl*)ref->object)->GetTreeBBox(child))
+				continue;
+
+			unsigned int columns = ref->array ? ref->array->columns-1 : 0;
+			unsigned int rows = ref->array ? ref->array->rows-1 : 0;
+			for(unsigned int k=0;k<4;k++)
+			{
+				t = child;
+				t.Mult(RefMatrix(ref->element((k&1) ? columns : 0, (k&2) ? rows : 0)));
+				if(k == 0)
+					r = t;
+				else
+					r.AddBounds(t);
+			}
+			ref_bounds[2*i] = r.mins;
+			ref_bounds[2*i+1] = r.maxes;
+			ref_order.push_back(i);
+
+			if(tree_empty)
+				tree_bbox = r;
+			else
+				tree_bbox.AddBounds(r);
+			tree_empty = false;
+		}
+
+		ref_tree.clear();
+		if(!ref_order.empty())
+			BuildRefTree(ref_bounds, 0, (unsigned int)ref_order.size());
+		has_tree_bbox = true;
+	}
+
+	bounds = tree_bbox;
+	return !tree_empty;
+}
+
+// Orders references by the center of their bounds along one axis
+struct RefCenterLess
+{
+	const vector<VECTOR3D> *ref_bounds;
+	int axis;
+
+	RefCenterLess(const vector<VECTOR3D> *ref_bounds, int axis) : ref_bounds(ref_bounds), axis(axis) {}
+	bool operator()(unsigned int a, unsigned int b) const
+	{
+		const float *A0 = (const float*)&(*ref_bounds)[2*a], *A1 = (const float*)&(*ref_bounds)[2*a+1];
+		const float *B0 = (const float*)&(*ref_bounds)[2*b], *B1 = (const float*)&(*ref_bounds)[2*b+1];
+		return A0[axis]+A1[axis] < B0[axis]+B1[axis];
+	}
+};
+
+#define REF_LEAF_SIZE 4
+
+// Top down, halving the references along the axis their centers spread most
+void GDSObject_ogl::BuildRefTree(const vector<VECTOR3D> &ref_bounds, unsigned int first, unsigned int last)
+{
+	ref_node_t node;
+	VECTOR3D low, high; // Of the centers
+	unsigned int index = (unsigned int)ref_tree.size();
+
+	node.mins = ref_bounds[2*ref_order[first]];
+	node.maxes = ref_bounds[2*ref_order[first]+1];
+	low = high = node.mins+node.maxes;
+	for(unsigned int k=first+1;k<last;k++)
+	{
+		const VECTOR3D &mins = ref_bounds[2*ref_order[k]], &maxes = ref_bounds[2*ref_order[k]+1];
+		VECTOR3D center = mins+maxes;
+		node.mins.x = min(node.mins.x, mins.x); node.maxes.x = max(node.maxes.x, maxes.x);
+		node.mins.y = min(node.mins.y, mins.y); node.maxes.y = max(node.maxes.y, maxes.y);
+		node.mins.z = min(node.mins.z, mins.z); node.maxes.z = max(node.maxes.z, maxes.z);
+		low.x = min(low.x, center.x); high.x = max(high.x, center.x);
+		low.y = min(low.y, center.y); high.y = max(high.y, center.y);
+		low.z = min(low.z, center.z); high.z = max(high.z, center.z);
+	}
+	node.first = first;
+	node.count = 0;
+	node.skip = index+1;
+	ref_tree.push_back(node);
+
+	if(last-first <= REF_LEAF_SIZE)
+	{
+		ref_tree[index].count = last-first;
+		return;
+	}
+
+	VECTOR3D spread = high-low;
+	int axis = 0;
+	if(spread.y > spread.x)
+		axis = 1;
+	if(spread.z > max(spread.x, spread.y))
+		axis = 2;
+	unsigned int middle = (first+last)/2;
+	nth_element(ref_order.begin()+first, ref_order.begin()+middle, ref_order.begin()+last, RefCenterLess(&ref_bounds, axis));
+
+	BuildRefTree(ref_bounds, first, middle);
+	BuildRefTree(ref_bounds, middle, last);
+	ref_tree[index].skip = (unsigned int)ref_tree.size();
+}
+
+// Draws the elements of a reference that can be in view. Element (column, row)
+// lies column and row steps away from the first one, so the distance of its
+// corners to a frustum plane is linear in both. Per plane this limits the
+// columns of every row, no element is tested on its own. With in_view all of
+// them are known to be.
+void GDSObject_ogl::RenderRef(GDSRef *ref, MATRIX4X4 object_view, bool HQ, bool in_view)
+{
+	GDSObject_ogl *child = (GDSObject_ogl*)ref->object;
+	AA_BOUNDING_BOX bounds;
+	VECTOR3D column, row;
+	GDSArrayClip clips[6];
+	unsigned int first, last;
+	float farthest, distance;
+
+	if(!child->GetTreeBBox(bounds))
+		return;
+
+	if(in_view)
+	{
+		for(unsigned int i=0;i<(ref->array ? ref->array->rows : 1);i++)
+			for(unsigned int j=0;j<(ref->array ? ref->array->columns : 1);j++)
+				child->RenderList(object_view * RefMatrix(ref->element(j, i)), HQ);
+		return;
+	}
+
+	// Exploded layers also move up by half their height
+	for(unsigned long i=0;i<8;i++)
+		bounds.vertices[i].z *= 1.0f+1.5f*exploded_fraction;
+	bounds.Mult(object_view * RefMatrix(ref->mat));
+
+	if(ref->array)
+	{
+		column = object_view.GetRotatedVector3D(VECTOR3D(ref->array->mag*ref->array->dx1, ref->array->mag*ref->array->dy1, 0.0f));
+		row = object_view.GetRotatedVector3D(VECTOR3D(ref->array->mag*ref->array->dx2, ref->array->mag*ref->array->dy2, 0.0f));
+	}
+	else
+		column = row = VECTOR3D(0.0f, 0.0f, 0.0f);
+
+	// Element translations are rounded to 0.001
+	float margin = 0.001f*object_view.GetRotatedVector3D(VECTOR3D(1.0f, 1.0f, 0.0f)).GetLength();
+
+	for(unsigned int i=0;i<6;i++)
+	{
+		const PLANE &plane = frustum.planes[i];
+		farthest = plane.GetDistance(bounds.vertices[0]);
+		for(unsigned int k=1;k<8;k++)
+		{
+			distance = plane.GetDistance(bounds.vertices[k]);
+			if(distance > farthest)
+				farthest = distance;
+		}
+		clips[i].a = plane.normal.DotProduct(column);
+		clips[i].b = plane.normal.DotProduct(row);
+		clips[i].c = farthest + EPSILON + margin;
+	}
+
+	for(unsigned int i=0;i<(ref->array ? ref->array->rows : 1);i++)
+	{
+		if(!ref->clipRow(clips, 6, i, first, last))
+			continue;
+		for(unsigned int j=first;j<=last;j++)
+			child->RenderList(object_view * RefMatrix(ref->element(j, i)), HQ);
+	}
+}
+
 #define  Pr  .299
 #define  Pg  .587
 #define  Pb  .114
@@ -383,10 +804,60 @@ void GDSObject_ogl::RenderList(MATRIX4X4 object_view, bool HQ)
         renderer.forceFlush();
     }
     
-    // Go to sub cells
-	MATRIX4X4 M;
-	for(unsigned int i=0;i<refs.size();i++)
-		((GDSObject_ogl*)refs[i]->object)->RenderList(object_view * MATRIX4X4(refs[i]->mat[0], refs[i]->mat[1], 0.0f, 0.0f, refs[i]->mat[2], refs[i]->mat[3], 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, refs[i]->mat[4], refs[i]->mat[5], 0.0f, 1.0f), HQ);
+    // Go to sub cells that can be in view, a node of the hierarchy at a time
+	AA_BOUNDING_BOX tree;
+	if(!refs.empty() && GetTreeBBox(tree))
+	{
+		// Frustum planes in cell coordinates, distances stay those in view
+		PLANE planes[6];
+		VECTOR3D origin = object_view * VECTOR3D(0.0f, 0.0f, 0.0f);
+		for(unsigned int k=0;k<6;k++)
+		{
+			planes[k].normal = object_view.GetInverseRotatedVector3D(frustum.planes[k].normal);
+			planes[k].intercept = frustum.planes[k].GetDistance(origin);
+		}
+
+		// Exploded layers also move up by half their height
+		float stretch = 1.0f+1.5f*exploded_fraction;
+
+		unsigned int inside = 0; // Nodes before this one are in view entirely
+		for(unsigned int i=0;i<ref_tree.size();)
+		{
+			const ref_node_t &node = ref_tree[i];
+			if(i >= inside)
+			{
+				bool all = true;
+				unsigned int k;
+				for(k=0;k<6;k++)
+				{
+					// Distance of the corners farthest in front and behind
+					const VECTOR3D &n = planes[k].normal;
+					float front = planes[k].intercept, back = planes[k].intercept;
+					front += n.x * (n.x > 0.0f ? node.maxes.x : node.mins.x);
+					back += n.x * (n.x > 0.0f ? node.mins.x : node.maxes.x);
+					front += n.y * (n.y > 0.0f ? node.maxes.y : node.mins.y);
+					back += n.y * (n.y > 0.0f ? node.mins.y : node.maxes.y);
+					front += n.z * stretch * (n.z > 0.0f ? node.maxes.z : node.mins.z);
+					back += n.z * stretch * (n.z > 0.0f ? node.mins.z : node.maxes.z);
+					if(front < -EPSILON)
+						break;
+					if(back < EPSILON)
+						all = false;
+				}
+				if(k < 6)
+				{
+					i = node.skip;
+					continue;
+				}
+				if(all)
+					inside = node.skip;
+			}
+
+			for(unsigned int k=0;k<node.count;k++)
+				RenderRef(refs[ref_order[node.first+k]], object_view, HQ, i < inside);
+			i++;
+		}
+	}
 
 	// Frustum
 	AA_BOUNDING_BOX bounds;
@@ -563,11 +1034,12 @@ GDSObject_ogl::DeleteBuffers()
 	for(unsigned long i=0;i<layer_list.size();i++)
 	{
         if(layer_list[i].renderRecipe)
+        {
             renderer.deleteRecipe(layer_list[i].renderRecipe);
+            mem_tris -= layer_list[i].numtris; // Other cells may keep theirs
+        }
         layer_list[i].renderRecipe = NULL;
 	}
 	layer_list.clear();
-	
-	mem_tris = 0;
-    mem_total = 0;
+	has_tree_bbox = false;
 }
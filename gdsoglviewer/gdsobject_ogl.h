@@ -37,6 +37,14 @@ typedef struct render_layer_t
     renderRecipe_t *renderRecipe;
 }render_layer_t;
 
+// Node of the bounding volume hierarchy over the references of a cell, depth first
+typedef struct ref_node_t
+{
+	VECTOR3D mins, maxes; // Of everything drawn below, in cell coordinates
+	unsigned int first, count; // References of a leaf, in ref_order
+	unsigned int skip; // Next node when this one is out of view
+}ref_node_t;
+
 typedef struct drawvert_t{
 	GLfloat vertex[3];
 	GLfloat normal[3];
@@ -46,7 +54,15 @@ class GDSObject_ogl : public GDSObject
 {
 private:
 	AA_BOUNDING_BOX bbox; // 3D Bounding box
+	AA_BOUNDING_BOX tree_bbox; // Including everything below
+	bool has_tree_bbox, tree_empty;
 	unsigned long	numtris;
+	vector<ref_node_t> ref_tree; // Built with the tree bounding box
+	vector<unsigned int> ref_order; // References that draw something, leaf by leaf
+
+	bool GetTreeBBox(AA_BOUNDING_BOX &bounds); // False if nothing is drawn below
+	void BuildRefTree(const vector<VECTOR3D> &ref_bounds, unsigned int first, unsigned int last);
+	void RenderRef(GDSRef *ref, MATRIX4X4 object_view, bool HQ, bool in_view);
 	
 
 public:
@@ -56,7 +72,8 @@ public:
 	~GDSObject_ogl();
 
     void UploadToVRAM();
-	void OutputOGLVertices2(struct ProcessLayer *do_layer, render_layer_t *data);
+	void OutputOGLVertices2(const vector<class GDSPolygon*> &polygons, render_layer_t *data);
+	void OutputOGLRectangles(class GDSPolygon *polygon, float z1, float z2, float &largest_dimension);
 	
 	void PrepareRender(MATRIX4X4 projection_view, MATRIX4X4 object_view);
 	void EndRender();
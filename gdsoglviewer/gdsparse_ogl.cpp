@@ -42,6 +42,8 @@ GDSParse_ogl::GDSParse_ogl(class GDSProcess *process, bool generate_process) : G
 	_first_move = false;
 	_temp_mouse = false;
 	_turbo = false;
+	_merge = false;
+	_budget = FLATTEN_BUDGET;
     
 	sub_layer = NULL;
 	substrate = NULL;
@@ -79,11 +81,15 @@ class GDSObject *GDSParse_ogl::NewObject(char *Name)
 	return new class GDSObject_ogl(Name);
 }
 
-int GDSParse_ogl::SetTopcell(const char *topcell)
+int GDSParse_ogl::SetTopcell(const char *topcell, bool reload)
 {
 	// Cleanup? -> this can be moved somewhere else..
-	for(unsigned int i=0;i<_Objects->getNumObjects();i++)
-		((GDSObject_ogl*)_Objects->getObject(i))->DeleteBuffers();
+	// After a reload the remaining buffers belong to unchanged cells
+	if(!reload)
+	{
+		for(unsigned int i=0;i<_Objects->getNumObjects();i++)
+			((GDSObject_ogl*)_Objects->getObject(i))->DeleteBuffers();
+	}
 	if(substrate)
 	{
 		renderer.deleteRecipe(substrate); // Throw away substrate
@@ -101,10 +107,13 @@ int GDSParse_ogl::SetTopcell(const char *topcell)
 		if(topcell)
 			v_printf(1, "Topcell \"%s\" is not in the gds.\n", topcell);
         _topcell = (GDSObject_ogl*) _Objects->GetTopObject();  //Try to find a new good topcell
+		if(_topcell && _Objects->GetNumRoots() > 1)
+			v_printf(1, "Found %d cells that are not referenced, picking the deepest.\n", _Objects->GetNumRoots());
 	}
     
     if(_topcell)
     {
+		LoadCell(_topcell); // Geometry of cells outside the first top cell is decoded on demand
 		v_printf(1, "Picking \"%s\" as topcell.\n\n", _topcell->GetName());
         return 1; // Valid topcell
     }
@@ -112,16 +121,29 @@ int GDSParse_ogl::SetTopcell(const char *topcell)
 	return 0; // Invalid topcell
 }
 
+void GDSParse_ogl::SetMerge(bool merge)
+{
+	_merge = merge;
+}
+
+void GDSParse_ogl::SetFlattenBudget(unsigned long budget)
+{
+	_budget = budget;
+}
+
 void GDSParse_ogl::initWorld()
 {
     v_printf(1, "Building hierarchy.. ");
     
-    // Absorb small objects into larger objects
+    // Copy cells into their parents where that saves draw calls, see GDSFlattenPlan
     _topcell->countTotalPoints();
-    _topcell->collapseHierachy();
+    _topcell->collapseHierachy(_budget);
 
 	 v_printf(1, "done\n\n");
 
+	if(_merge)
+		MergePolygons(_topcell); // Cells collapsed before keep their union
+
 	 ProcessLayer *layer = _process->GetLayer(255, 0); //Try to find the substrate layer
 	 if(!layer)
 	 {
@@ -452,13 +474,13 @@ void GDSParse_ogl::gl_draw()
 				}
 			}*/
 
-			if(wm->query_update(_iptr))
+			if(wm->update && wm->query_update(_iptr))
 			{
 				char tmp[256];
 				strcpy(tmp, _topcell->GetName());
 				v_printf(1, "GDS has been updated, reloading..\n");
 				Reload();
-				SetTopcell(tmp); // This is not elegant..
+				SetTopcell(tmp, true); // This is not elegant..
 				initWorld();
 			}
 		}
@@ -498,6 +520,10 @@ void GDSParse_ogl::gl_draw_world(int width, int height, bool HQ)
 
 	// Find the top cell and draw
 	total_tris = 0;
+	total_draws = 0;
+	total_states = 0;
+	total_draws_unsorted = 0;
+	total_states_unsorted = 0;
 
 	_topcell->PrepareRender(projection, view);
 	_topcell->RenderList(view, HQ);
@@ -904,6 +930,10 @@ void GDSParse_ogl::gl_event( int event, int data, int xpos, int ypos , bool shif
                 if(control)
                     renderer.wireframe = !renderer.wireframe;
                 break;
+        case KEY_I:
+                if(control)
+                    renderer.instancing = !renderer.instancing;
+                break;
 		default:
 			break;
 		}
@@ -928,9 +958,9 @@ void GDSParse_ogl::display_perfmon()
 
 	// Draw border
 	glColor4f(0.5f, 0.5f, 0.5f, 1.0f);
-	gl_square(wm->screenWidth - 270.0f, wm->screenHeight - 20.0f, wm->screenWidth - 20.0f, wm->screenHeight - 70.0f, 1);
+	gl_square(wm->screenWidth - 270.0f, wm->screenHeight - 20.0f, wm->screenWidth - 20.0f, wm->screenHeight - 130.0f, 1);
 	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-	gl_square(wm->screenWidth - 270.0f, wm->screenHeight - 20.0f, wm->screenWidth - 20.0f, wm->screenHeight - 70.0f, 0);
+	gl_square(wm->screenWidth - 270.0f, wm->screenHeight - 20.0f, wm->screenWidth - 20.0f, wm->screenHeight - 130.0f, 0);
 
 	// Text
 	gl_printf(1.0f, 1.0f, 1.0f, 0.4f, wm->screenWidth - 250, wm->screenHeight - 40, "FPS:            %5.1f", drawfps);
@@ -942,6 +972,15 @@ void GDSParse_ogl::display_perfmon()
 		gl_printf(1.0f, 1.0f, 1.0f, 0.4f, wm->screenWidth - 250, wm->screenHeight - 60, "Triangles: %9.1fM", total_tris/1000000.0f);
 	else
 		gl_printf(1.0f, 1.0f, 1.0f, 0.4f, wm->screenWidth - 250, wm->screenHeight - 60, "Triangles: %9dG", total_tris/1000000000);
+	// Unsorted in brackets, every layer drawn on its own as the hierarchy is walked
+	gl_printf(1.0f, 1.0f, 1.0f, 0.4f, wm->screenWidth - 250, wm->screenHeight - 80, "Draw calls: %6lu (%lu)", total_draws, total_draws_unsorted);
+	gl_printf(1.0f, 1.0f, 1.0f, 0.4f, wm->screenWidth - 250, wm->screenHeight - 100, "States:     %6lu (%lu)", total_states, total_states_unsorted);
+
+	// Geometry in VRAM, and how much of it deleted cells left free
+	unsigned long bytes, spare, largest;
+	int ranges;
+	renderer.heapStatistics(&bytes, &spare, &ranges, &largest);
+	gl_printf(1.0f, 1.0f, 1.0f, 0.4f, wm->screenWidth - 250, wm->screenHeight - 120, "VRAM: %6.1fMB %3.0f%% free", bytes/1024.0f/1024.0f, bytes ? 100.0f*spare/bytes : 0.0f);
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_LIGHTING);
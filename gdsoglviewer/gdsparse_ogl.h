@@ -32,6 +32,8 @@ class GDSParse_ogl : public GDSParse
 private:
 	bool _perfmon;
 	bool _turbo;
+	bool _merge; // Draw the union of each layer
+	unsigned long _budget; // Megabytes for flattening the hierarchy
 	int _frames;
 	bool firstrun;
 
@@ -74,7 +76,9 @@ public:
 
 	class GDSObject *NewObject(char *Name);
 
-	int SetTopcell(const char *topcell);
+	int SetTopcell(const char *topcell, bool reload = false);
+	void SetMerge(bool merge);
+	void SetFlattenBudget(unsigned long budget);
     void initWorld();
 	void buildSubstrate();
 	int gl_init();
@@ -26,6 +26,7 @@
 
 #include "gds_globals.h"
 #include "renderer.h"
+#include <functional>
 
 #if defined(WIN32)
 	#include "glext.h"
@@ -51,12 +52,28 @@
 #ifndef GL_EXT_framebuffer_blit
 	#pragma message "  GL_EXT_framebuffer_multisample not available during compiling."
 #endif
+#ifndef GL_ARB_draw_instanced
+	#pragma message "  GL_ARB_draw_instanced not available during compiling."
+#endif
+#ifndef GL_ARB_instanced_arrays
+	#pragma message "  GL_ARB_instanced_arrays not available during compiling."
+#endif
+#ifndef GL_ARB_copy_buffer
+	#pragma message "  GL_ARB_copy_buffer not available during compiling."
+#endif
+#ifndef GL_ARB_draw_elements_base_vertex
+	#pragma message "  GL_ARB_draw_elements_base_vertex not available during compiling."
+#endif
+#ifndef GL_EXT_multi_draw_arrays
+	#pragma message "  GL_EXT_multi_draw_arrays not available during compiling."
+#endif
 // Extension Function Pointers
 #ifdef GL_ARB_vertex_buffer_object
 PFNGLGENBUFFERSARBPROC glGenBuffersARB = NULL;					// VBO Name Generation Procedure
 PFNGLBINDBUFFERARBPROC glBindBufferARB = NULL;					// VBO Bind Procedure
 PFNGLBUFFERDATAARBPROC glBufferDataARB = NULL;					// VBO Data Loading Procedure
 PFNGLDELETEBUFFERSARBPROC glDeleteBuffersARB = NULL;			// VBO Deletion Procedure
+PFNGLBUFFERSUBDATAARBPROC glBufferSubDataARB = NULL;			// VBO Data Replacing Procedure
 #endif
 #ifdef GL_ARB_shader_objects
 PFNGLCREATESHADEROBJECTARBPROC glCreateShaderObjectARB = NULL;
@@ -86,20 +103,79 @@ PFNGLRENDERBUFFERSTORAGEMULTISAMPLEEXTPROC glRenderbufferStorageMultisampleEXT =
 #ifdef GL_EXT_framebuffer_blit
 PFNGLBLITFRAMEBUFFEREXTPROC glBlitFramebufferEXT = NULL;
 #endif
+#ifdef GL_ARB_vertex_program
+PFNGLVERTEXATTRIBPOINTERARBPROC glVertexAttribPointerARB = NULL;
+PFNGLENABLEVERTEXATTRIBARRAYARBPROC glEnableVertexAttribArrayARB = NULL;
+PFNGLDISABLEVERTEXATTRIBARRAYARBPROC glDisableVertexAttribArrayARB = NULL;
+#endif
+#ifdef GL_ARB_vertex_shader
+PFNGLGETATTRIBLOCATIONARBPROC glGetAttribLocationARB = NULL;
+#endif
+#ifdef GL_ARB_draw_instanced
+PFNGLDRAWELEMENTSINSTANCEDARBPROC glDrawElementsInstancedARB = NULL;
+#endif
+#ifdef GL_ARB_instanced_arrays
+PFNGLVERTEXATTRIBDIVISORARBPROC glVertexAttribDivisorARB = NULL;
+#endif
+#ifdef GL_ARB_copy_buffer
+PFNGLCOPYBUFFERSUBDATAPROC glCopyBufferSubData = NULL;
+#endif
+#ifdef GL_ARB_draw_elements_base_vertex
+PFNGLDRAWELEMENTSBASEVERTEXPROC glDrawElementsBaseVertex = NULL;
+PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC glDrawElementsInstancedBaseVertex = NULL;
+PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC glMultiDrawElementsBaseVertex = NULL;
+#endif
 #endif // __APPLE__
 
+// Everything instanced rendering needs
+#if defined(GL_ARB_vertex_buffer_object) && defined(GL_ARB_shader_objects) && defined(GL_ARB_vertex_program) && defined(GL_ARB_vertex_shader) && defined(GL_ARB_draw_instanced) && defined(GL_ARB_instanced_arrays)
+	#define INSTANCED_RENDERING
+#endif
+
+// Indices counting from a base vertex
+#if defined(GL_ARB_vertex_buffer_object) && defined(GL_ARB_draw_elements_base_vertex)
+	#define BASE_VERTEX
+#endif
+
+// Everything the geometry heap needs
+#if defined(GL_ARB_vertex_buffer_object) && defined(GL_ARB_copy_buffer)
+	#define GEOMETRY_HEAP
+#endif
+
+// Several ranges of indices in one draw, each with its base vertex
+#if defined(BASE_VERTEX) && defined(GL_EXT_multi_draw_arrays)
+	#define MULTI_DRAW
+#endif
+
 Renderer renderer;
 unsigned long	total_tris;
+unsigned long	total_draws;
+unsigned long	total_states;
+unsigned long	total_draws_unsorted;
+unsigned long	total_states_unsorted;
 
 const char vertexProgramSource[512] = "void main(){	gl_FrontColor = gl_Color*(vec4(0.7,0.7,0.7,1.0) + vec4(0.5,0.5,0.5,0.0)*max(dot(gl_NormalMatrix *gl_Normal, vec3(0.0,-0.89,-0.45)),0.0)); gl_Position = ftransform(); }";
 //const char vertexProgramSource[512] = "void main(){	gl_FrontColor = vec4(0.5,0.5,0.5,1.0); gl_Position = ftransform(); }";
 const char fragmentProgramSource[512] = "void main(){ float z = gl_FragCoord.z / gl_FragCoord.w; float fogFactor = exp( -gl_Fog.density  * z ); fogFactor = clamp(fogFactor, 0.0, 1.0); gl_FragColor.rgb = gl_Color.rgb*fogFactor; gl_FragColor.a = gl_Color.a; }";
 //const char fragmentProgramSource[512] = "void main(){gl_FragColor = gl_Color; }";
 
+// Same lighting and fog as the fixed pipeline, with the modelview and color of each instance as attributes.
+// Normals go through the inverse transpose, the cofactors over the determinant, unnormalized like there.
+const char instanceVertexProgramSource[1024] = "attribute vec4 instanceColumn0; attribute vec4 instanceColumn1; attribute vec4 instanceColumn2; attribute vec4 instanceColumn3; attribute vec4 instanceColor; "
+	"void main(){ vec4 eye = mat4(instanceColumn0, instanceColumn1, instanceColumn2, instanceColumn3) * gl_Vertex; "
+	"vec3 a = instanceColumn0.xyz; vec3 b = instanceColumn1.xyz; vec3 c = instanceColumn2.xyz; "
+	"vec3 normal = mat3(cross(b, c), cross(c, a), cross(a, b)) * gl_Normal / dot(a, cross(b, c));\n"
+	"#ifdef COMPACT_VERTICES\n normal = normalize(normal);\n#endif\n"
+	"gl_FrontColor = instanceColor*(vec4(0.7,0.7,0.7,1.0) + vec4(0.5,0.5,0.5,0.0)*max(dot(normal, vec3(0.0,-0.894427,-0.447214)),0.0)); "
+	"gl_FogFragCoord = abs(eye.z); gl_Position = gl_ProjectionMatrix * eye; }";
+const char instanceFragmentProgramSource[512] = "void main(){ float fogFactor = clamp(exp(-gl_Fog.density * gl_FogFragCoord), 0.0, 1.0); gl_FragColor = vec4(mix(gl_Fog.color.rgb, gl_Color.rgb, fogFactor), gl_Color.a); }";
+
 renderQueue_t *renderQueue = NULL;
 int queueLength = 0;
 int queueMax = 0;
 
+#define INSTANCE_FLOATS 20 // Matrix and color
+
 void
 Renderer::loadGLExtensions()
 {
@@ -111,6 +187,7 @@ Renderer::loadGLExtensions()
     glBindBufferARB = (PFNGLBINDBUFFERARBPROC) wglGetProcAddress("glBindBufferARB");
     glBufferDataARB = (PFNGLBUFFERDATAARBPROC) wglGetProcAddress("glBufferDataARB");
     glDeleteBuffersARB = (PFNGLDELETEBUFFERSARBPROC) wglGetProcAddress("glDeleteBuffersARB");
+    glBufferSubDataARB = (PFNGLBUFFERSUBDATAARBPROC) wglGetProcAddress("glBufferSubDataARB");
 #endif
 #ifdef GL_ARB_shader_objects
     glCreateShaderObjectARB = (PFNGLCREATESHADEROBJECTARBPROC)  wglGetProcAddress("glCreateShaderObjectARB");
@@ -140,6 +217,28 @@ Renderer::loadGLExtensions()
 #ifdef GL_EXT_framebuffer_blit
     glBlitFramebufferEXT = (PFNGLBLITFRAMEBUFFERPROC) wglGetProcAddress("glBlitFramebuffer");
 #endif
+#ifdef GL_ARB_vertex_program
+    glVertexAttribPointerARB = (PFNGLVERTEXATTRIBPOINTERARBPROC) wglGetProcAddress("glVertexAttribPointerARB");
+    glEnableVertexAttribArrayARB = (PFNGLENABLEVERTEXATTRIBARRAYARBPROC) wglGetProcAddress("glEnableVertexAttribArrayARB");
+    glDisableVertexAttribArrayARB = (PFNGLDISABLEVERTEXATTRIBARRAYARBPROC) wglGetProcAddress("glDisableVertexAttribArrayARB");
+#endif
+#ifdef GL_ARB_vertex_shader
+    glGetAttribLocationARB = (PFNGLGETATTRIBLOCATIONARBPROC) wglGetProcAddress("glGetAttribLocationARB");
+#endif
+#ifdef GL_ARB_draw_instanced
+    glDrawElementsInstancedARB = (PFNGLDRAWELEMENTSINSTANCEDARBPROC) wglGetProcAddress("glDrawElementsInstancedARB");
+#endif
+#ifdef GL_ARB_instanced_arrays
+    glVertexAttribDivisorARB = (PFNGLVERTEXATTRIBDIVISORARBPROC) wglGetProcAddress("glVertexAttribDivisorARB");
+#endif
+#ifdef GL_ARB_copy_buffer
+    glCopyBufferSubData = (PFNGLCOPYBUFFERSUBDATAPROC) wglGetProcAddress("glCopyBufferSubData");
+#endif
+#ifdef GL_ARB_draw_elements_base_vertex
+    glDrawElementsBaseVertex = (PFNGLDRAWELEMENTSBASEVERTEXPROC) wglGetProcAddress("glDrawElementsBaseVertex");
+    glDrawElementsInstancedBaseVertex = (PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC) wglGetProcAddress("glDrawElementsInstancedBaseVertex");
+    glMultiDrawElementsBaseVertex = (PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC) wglGetProcAddress("glMultiDrawElementsBaseVertex");
+#endif
 #else
     // Get Pointers To The GL Functions
 #ifdef GL_ARB_vertex_buffer_object
@@ -147,6 +246,7 @@ Renderer::loadGLExtensions()
     glBindBufferARB = (PFNGLBINDBUFFERARBPROC) glXGetProcAddress((const GLubyte *) "glBindBufferARB");
     glBufferDataARB = (PFNGLBUFFERDATAARBPROC) glXGetProcAddress((const GLubyte *) "glBufferDataARB");
     glDeleteBuffersARB = (PFNGLDELETEBUFFERSARBPROC) glXGetProcAddress((const GLubyte *) "glDeleteBuffersARB");
+    glBufferSubDataARB = (PFNGLBUFFERSUBDATAARBPROC) glXGetProcAddress((const GLubyte *) "glBufferSubDataARB");
 #endif
 #ifdef GL_ARB_shader_objects
     glCreateShaderObjectARB = (PFNGLCREATESHADEROBJECTARBPROC)  glXGetProcAddress((const GLubyte *) "glCreateShaderObjectARB");
@@ -177,6 +277,28 @@ Renderer::loadGLExtensions()
 #ifdef GL_EXT_framebuffer_blit
     glBlitFramebufferEXT = (PFNGLBLITFRAMEBUFFEREXTPROC) glXGetProcAddress((const GLubyte *) "glBlitFramebufferEXT");
 #endif
+#ifdef GL_ARB_vertex_program
+    glVertexAttribPointerARB = (PFNGLVERTEXATTRIBPOINTERARBPROC) glXGetProcAddress((const GLubyte *) "glVertexAttribPointerARB");
+    glEnableVertexAttribArrayARB = (PFNGLENABLEVERTEXATTRIBARRAYARBPROC) glXGetProcAddress((const GLubyte *) "glEnableVertexAttribArrayARB");
+    glDisableVertexAttribArrayARB = (PFNGLDISABLEVERTEXATTRIBARRAYARBPROC) glXGetProcAddress((const GLubyte *) "glDisableVertexAttribArrayARB");
+#endif
+#ifdef GL_ARB_vertex_shader
+    glGetAttribLocationARB = (PFNGLGETATTRIBLOCATIONARBPROC) glXGetProcAddress((const GLubyte *) "glGetAttribLocationARB");
+#endif
+#ifdef GL_ARB_draw_instanced
+    glDrawElementsInstancedARB = (PFNGLDRAWELEMENTSINSTANCEDARBPROC) glXGetProcAddress((const GLubyte *) "glDrawElementsInstancedARB");
+#endif
+#ifdef GL_ARB_instanced_arrays
+    glVertexAttribDivisorARB = (PFNGLVERTEXATTRIBDIVISORARBPROC) glXGetProcAddress((const GLubyte *) "glVertexAttribDivisorARB");
+#endif
+#ifdef GL_ARB_copy_buffer
+    glCopyBufferSubData = (PFNGLCOPYBUFFERSUBDATAPROC) glXGetProcAddress((const GLubyte *) "glCopyBufferSubData");
+#endif
+#ifdef GL_ARB_draw_elements_base_vertex
+    glDrawElementsBaseVertex = (PFNGLDRAWELEMENTSBASEVERTEXPROC) glXGetProcAddress((const GLubyte *) "glDrawElementsBaseVertex");
+    glDrawElementsInstancedBaseVertex = (PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC) glXGetProcAddress((const GLubyte *) "glDrawElementsInstancedBaseVertex");
+    glMultiDrawElementsBaseVertex = (PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC) glXGetProcAddress((const GLubyte *) "glMultiDrawElementsBaseVertex");
+#endif
 #endif
 #endif
 }
@@ -213,54 +335,41 @@ Renderer::IsExtensionSupported2( char* szTargetExtension )
 	return false;
 }
 
+// Empty VBO, buffers are made when it is uploaded
+static VBO2_t*
+newVBO()
+{
+    VBO2_t *vbo = new VBO2_t;
+    vbo->numObjects = 0;
+    vbo->vertbuffer = 0;
+    vbo->indexbuffer = 0;
+    vbo->size = 0;
+    vbo->numVertices = vbo->numIndices = 0;
+    vbo->liveVertices = vbo->liveIndices = 0;
+    vbo->freeVertices = vbo->freeIndices = NULL;
+    vbo->recipes = NULL;
+    vbo->next = NULL;
+    vbo->prev = NULL;
+    return vbo;
+}
+
 void
 Renderer::emitTriangles()
 {
-	// Do the normals
-	float nx, ny, nz;
-	float dx1, dy1, dz1;
-	float dx2, dy2, dz2;
-	float l;
-	for(int j=0;j<numIndices/3;j++)
-	{
-		dx1 = drawverts[indices[j*3+2]].vertex[0]-drawverts[indices[j*3+1]].vertex[0];
-		dy1 = drawverts[indices[j*3+2]].vertex[1]-drawverts[indices[j*3+1]].vertex[1];
-		dz1 = drawverts[indices[j*3+2]].vertex[2]-drawverts[indices[j*3+1]].vertex[2];
-		dx2 = drawverts[indices[j*3+2]].vertex[0]-drawverts[indices[j*3]].vertex[0];
-		dy2 = drawverts[indices[j*3+2]].vertex[1]-drawverts[indices[j*3]].vertex[1];
-		dz2 = drawverts[indices[j*3+2]].vertex[2]-drawverts[indices[j*3]].vertex[2];		
-		nx = dy1*dz2 - dz1*dy2;
-		ny = dz1*dx2 - dx1*dz2;
-		nz = dx1*dy2 - dy1*dx2;
-		l = sqrt(nx*nx + ny*ny + nz*nz);
-		nx = nx / l; ny = ny / l; nz = nz / l;
-
-		//drawverts[indices[j*3+0]].normal[0] = nx;
-		//drawverts[indices[j*3+0]].normal[1] = ny;
-		//drawverts[indices[j*3+0]].normal[2] = nz;
-
-		//drawverts[indices[j*3+1]].normal[0] = nx;
-		//drawverts[indices[j*3+1]].normal[1] = ny;
-		//drawverts[indices[j*3+1]].normal[2] = nz;
-
-		drawverts[indices[j*3+2]].normal[0] = nx;
-		drawverts[indices[j*3+2]].normal[1] = ny;
-		drawverts[indices[j*3+2]].normal[2] = nz;
-	}
-    
 	if(enableVBO)
 	{
 #ifdef GL_ARB_vertex_buffer_object
-		// Put in buffer
+		// Put in buffer, as much as was written
 		glGenBuffersARB( 1, &curVBO->vertbuffer );
 		glBindBufferARB( GL_ARRAY_BUFFER_ARB, curVBO->vertbuffer );
-		//glBufferDataARB( GL_ARRAY_BUFFER_ARB, numDrawverts*sizeof(drawvert2_t), drawverts, GL_STATIC_DRAW_ARB );
-		glBufferDataARB( GL_ARRAY_BUFFER_ARB, Renderer_SIZE*sizeof(drawvert2_t), drawverts, GL_STATIC_DRAW_ARB ); // Upload whole block
+		glBufferDataARB( GL_ARRAY_BUFFER_ARB, numDrawverts*vertexSize, uploadVertices(0), GL_STATIC_DRAW_ARB );
         
 		glGenBuffersARB( 1, &curVBO->indexbuffer );
 		glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, curVBO->indexbuffer );
-		//glBufferDataARB( GL_ELEMENT_ARRAY_BUFFER_ARB, numIndices*sizeof(GLushort), indices, GL_STATIC_DRAW_ARB );
-		glBufferDataARB( GL_ELEMENT_ARRAY_BUFFER_ARB, Renderer_SIZE*VERTEX_INDEX_RATIO*sizeof(GLushort), indices, GL_STATIC_DRAW_ARB ); // Upload whole block
+		glBufferDataARB( GL_ELEMENT_ARRAY_BUFFER_ARB, numIndices*sizeof(GLushort), uploadIndices(0, numIndices), GL_STATIC_DRAW_ARB );
+		curVBO->size = numDrawverts*vertexSize + numIndices*sizeof(GLushort);
+		curVBO->numVertices = numDrawverts;
+		curVBO->numIndices = numIndices;
         
 		// Unbind
 		glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
@@ -269,31 +378,516 @@ Renderer::emitTriangles()
 #endif
 	}
 	else
-		glDrawElements (GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, indices);
+		glDrawElements (GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, indices);
     
-    // Count number of VBOs and report statistics
-    int count = 0;
+    // Add up the VBOs and report statistics
+    unsigned long vram = 0;
     VBO2_t *point = firstVBO;
     while(point)
     {
-        count++;
+        vram += point->size;
         point=point->next;
     }
     
 	if(enableVBO)
-		v_printf(2, "  VBO %d and %d uploaded with %d vertices and %d indices (%4.1fMB VRAM total).\n", curVBO->vertbuffer, curVBO->indexbuffer, numDrawverts, numIndices, Renderer_SIZE*(24.0f+VERTEX_INDEX_RATIO*2.0f)*count/1024.0f/1024.0f);
+		v_printf(2, "  VBO %d and %d uploaded with %d vertices and %d indices (%4.1fMB VRAM total, ACMR %.3f -> %.3f).\n", curVBO->vertbuffer, curVBO->indexbuffer, numDrawverts, numIndices, vram/1024.0f/1024.0f, 3.0f*cacheMisses[0]/max(numIndices, 1), 3.0f*cacheMisses[1]/max(numIndices, 1));
         
 	numDrawverts = 0;
 	numIndices = 0;
+	cacheMisses[0] = cacheMisses[1] = 0;
     
     // Generate new VBO_t
-    curVBO->next = new VBO2_t;
+    curVBO->next = newVBO();
     curVBO->next->prev = curVBO;
     curVBO = curVBO->next;
-    curVBO->numObjects = 0;
-    curVBO->vertbuffer = 0;
-    curVBO->indexbuffer = 0;
-    curVBO->next = NULL;
+}
+
+// Indices as they go up, narrowed to GLushort in the space for ordering
+const void*
+Renderer::uploadIndices(int first, int count)
+{
+	GLushort *narrow = (GLushort*) ordered;
+	for(int i=0; i<count; i++)
+		narrow[i] = (GLushort) indices[first+i];
+	return narrow;
+}
+
+// Vertices as they go up, compact ones were packed with their recipe
+const void*
+Renderer::uploadVertices(int first)
+{
+	if(enableCompact)
+		return packedverts + first;
+	return drawverts + first;
+}
+
+// Positions against the bounds of the recipe, normals scaled the other way so they stay square to the faces once decoded
+void
+Renderer::packRecipe()
+{
+	float mins[3] = {curRecipe->bounds.mins.x, curRecipe->bounds.mins.y, curRecipe->bounds.mins.z};
+	float scale[3] = {curRecipe->bounds.maxes.x, curRecipe->bounds.maxes.y, curRecipe->bounds.maxes.z};
+	for(int k=0; k<3; k++)
+	{
+		scale[k] = (scale[k]-mins[k])/65535.0f;
+		if(scale[k] <= 0.0f)
+			scale[k] = 1.0f;
+	}
+	curRecipe->decode.SetScale(VECTOR3D(scale[0], scale[1], scale[2]));
+	curRecipe->decode.SetTranslationPart(VECTOR3D(mins[0]+32768.0f*scale[0], mins[1]+32768.0f*scale[1], mins[2]+32768.0f*scale[2]));
+
+	for(int i=recipeVertex; i<numDrawverts; i++)
+	{
+		const drawvert2_t *in = &drawverts[i];
+		compactvert_t *out = &packedverts[i];
+		float normal[3], l = 0.0f;
+		for(int k=0; k<3; k++)
+		{
+			float q = floor((in->vertex[k]-mins[k])/scale[k] + 0.5f) - 32768.0f;
+			out->vertex[k] = (GLshort) max(-32768.0f, min(32767.0f, q));
+			normal[k] = in->normal[k]*scale[k];
+			l += normal[k]*normal[k];
+		}
+		l = sqrt(l);
+		for(int k=0; k<3; k++)
+			out->normal[k] = l > 0.0f ? (GLbyte) floor(normal[k]/l*127.0f + 0.5f) : 0; // Not a provoking vertex otherwise
+		out->vertex[3] = 0;
+		out->normal[3] = 0;
+	}
+}
+
+// Free ranges, kept in order and merged with their neighbours
+static void
+freeRange(heapRange_t **list, int first, int count)
+{
+	while(*list && (*list)->first + (*list)->count < first)
+		list = &(*list)->next;
+
+	heapRange_t *range = *list;
+	if(range && range->first + range->count == first)
+	{
+		// After this one, maybe up to the next
+		range->count += count;
+		if(range->next && range->next->first == first + count)
+		{
+			heapRange_t *next = range->next;
+			range->count += next->count;
+			range->next = next->next;
+			delete next;
+		}
+	}
+	else if(range && range->first == first + count)
+	{
+		range->first = first;
+		range->count += count;
+	}
+	else
+	{
+		range = new heapRange_t;
+		range->first = first;
+		range->count = count;
+		range->next = *list;
+		*list = range;
+	}
+}
+
+// Smallest free range that fits
+static heapRange_t**
+fitRange(heapRange_t **list, int count)
+{
+	heapRange_t **best = NULL;
+	for(; *list; list = &(*list)->next)
+	{
+		if((*list)->count >= count && (!best || (*list)->count < (*best)->count))
+			best = list;
+	}
+	return best;
+}
+
+static int
+takeRange(heapRange_t **range, int count)
+{
+	int first = (*range)->first;
+	(*range)->first += count;
+	(*range)->count -= count;
+	if(!(*range)->count)
+	{
+		heapRange_t *empty = *range;
+		*range = empty->next;
+		delete empty;
+	}
+	return first;
+}
+
+static void
+clearRanges(heapRange_t **list)
+{
+	while(*list)
+	{
+		heapRange_t *range = *list;
+		*list = range->next;
+		delete range;
+	}
+}
+
+void
+Renderer::addToVBO(renderRecipe_t *recipe, VBO2_t *vbo)
+{
+	recipe->VBO = vbo;
+	recipe->heapPrev = NULL;
+	recipe->heapNext = vbo->recipes;
+	if(vbo->recipes)
+		vbo->recipes->heapPrev = recipe;
+	vbo->recipes = recipe;
+	vbo->numObjects++;
+}
+
+void
+Renderer::removeFromVBO(renderRecipe_t *recipe)
+{
+	VBO2_t *vbo = recipe->VBO;
+	if(recipe->heapNext)
+		recipe->heapNext->heapPrev = recipe->heapPrev;
+	if(recipe->heapPrev)
+		recipe->heapPrev->heapNext = recipe->heapNext;
+	else
+		vbo->recipes = recipe->heapNext;
+	vbo->numObjects--;
+}
+
+// The finished recipe gets indices counting from its first vertex, which fit
+// GLushort however large the buffer is. With the heap it then moves from the
+// staging buffers into the best fitting room deleted recipes left in an
+// uploaded VBO. Without such room it is uploaded with the rest.
+void
+Renderer::placeRecipe()
+{
+	int nv = numDrawverts - recipeVertex;
+	int ni = curRecipe->numIndices;
+	curRecipe->firstVertex = recipeVertex;
+	curRecipe->numVertices = nv;
+	if(enableCompact)
+		packRecipe();
+	if(!enableVBO || !nv)
+		return;
+
+	for(int i=curRecipe->firstIndex; i<numIndices; i++)
+		indices[i] -= recipeVertex;
+	if(!enableHeap)
+		return;
+
+#ifdef GEOMETRY_HEAP
+	VBO2_t *vbo;
+	heapRange_t **vertexRange = NULL, **indexRange = NULL;
+	for(vbo = firstVBO; vbo; vbo = vbo->next)
+	{
+		if(vbo == curVBO)
+			continue;
+		vertexRange = fitRange(&vbo->freeVertices, nv);
+		indexRange = fitRange(&vbo->freeIndices, ni);
+		if(vertexRange && indexRange)
+			break;
+	}
+	if(!vbo)
+	{
+		curVBO->liveVertices += nv;
+		curVBO->liveIndices += ni;
+		return;
+	}
+
+	int first = takeRange(vertexRange, nv);
+	int firstIndex = takeRange(indexRange, ni);
+	glBindBufferARB( GL_ARRAY_BUFFER_ARB, vbo->vertbuffer );
+	glBufferSubDataARB( GL_ARRAY_BUFFER_ARB, first*vertexSize, nv*vertexSize, uploadVertices(recipeVertex) );
+	glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, vbo->indexbuffer );
+	glBufferSubDataARB( GL_ELEMENT_ARRAY_BUFFER_ARB, firstIndex*sizeof(GLushort), ni*sizeof(GLushort), uploadIndices(curRecipe->firstIndex, ni) );
+	glBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+	glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, 0 );
+	boundVBO = NULL;
+
+	// Out of the staging buffers
+	numDrawverts = recipeVertex;
+	numIndices = curRecipe->firstIndex;
+	removeFromVBO(curRecipe);
+	addToVBO(curRecipe, vbo);
+	curRecipe->firstVertex = first;
+	curRecipe->firstIndex = firstIndex;
+	vbo->liveVertices += nv;
+	vbo->liveIndices += ni;
+#endif
+}
+
+// Live recipes copied together into buffers of their size
+void
+Renderer::compactVBO(VBO2_t *vbo)
+{
+#ifdef GEOMETRY_HEAP
+	unsigned long size = vbo->size;
+	GLuint buffers[2];
+	glGenBuffersARB( 2, buffers );
+
+	int first = 0;
+	glBindBufferARB( GL_COPY_READ_BUFFER, vbo->vertbuffer );
+	glBindBufferARB( GL_COPY_WRITE_BUFFER, buffers[0] );
+	glBufferDataARB( GL_COPY_WRITE_BUFFER, vbo->liveVertices*vertexSize, NULL, GL_STATIC_DRAW_ARB );
+	for(renderRecipe_t *recipe = vbo->recipes; recipe; recipe = recipe->heapNext)
+	{
+		glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, recipe->firstVertex*vertexSize, first*vertexSize, recipe->numVertices*vertexSize );
+		recipe->firstVertex = first;
+		first += recipe->numVertices;
+	}
+
+	first = 0;
+	glBindBufferARB( GL_COPY_READ_BUFFER, vbo->indexbuffer );
+	glBindBufferARB( GL_COPY_WRITE_BUFFER, buffers[1] );
+	glBufferDataARB( GL_COPY_WRITE_BUFFER, vbo->liveIndices*sizeof(GLushort), NULL, GL_STATIC_DRAW_ARB );
+	for(renderRecipe_t *recipe = vbo->recipes; recipe; recipe = recipe->heapNext)
+	{
+		glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, recipe->firstIndex*sizeof(GLushort), first*sizeof(GLushort), recipe->numIndices*sizeof(GLushort) );
+		recipe->firstIndex = first;
+		first += recipe->numIndices;
+	}
+	glBindBufferARB( GL_COPY_READ_BUFFER, 0 );
+	glBindBufferARB( GL_COPY_WRITE_BUFFER, 0 );
+
+	glDeleteBuffersARB(1, &vbo->vertbuffer);
+	glDeleteBuffersARB(1, &vbo->indexbuffer);
+	vbo->vertbuffer = buffers[0];
+	vbo->indexbuffer = buffers[1];
+	vbo->numVertices = vbo->liveVertices;
+	vbo->numIndices = vbo->liveIndices;
+	vbo->size = vbo->numVertices*vertexSize + vbo->numIndices*sizeof(GLushort);
+	clearRanges(&vbo->freeVertices);
+	clearRanges(&vbo->freeIndices);
+	boundVBO = NULL;
+
+	v_printf(2, "  VBO %d and %d compacted from %4.1fMB to %4.1fMB.\n", vbo->vertbuffer, vbo->indexbuffer, size/1024.0f/1024.0f, vbo->size/1024.0f/1024.0f);
+#endif
+}
+
+// VBOs that are half free after recipes were deleted
+void
+Renderer::compactHeap()
+{
+	for(VBO2_t *vbo = firstVBO; vbo; vbo = vbo->next)
+	{
+		unsigned long live = vbo->liveVertices*vertexSize + vbo->liveIndices*sizeof(GLushort);
+		if(vbo != curVBO && vbo->numObjects > 0 && live*2 < vbo->size)
+			compactVBO(vbo);
+	}
+	heapDirty = false;
+
+	unsigned long bytes, spare, largest;
+	int ranges;
+	heapStatistics(&bytes, &spare, &ranges, &largest);
+	v_printf(2, "  Geometry heap of %4.1fMB, %4.1fMB free in %d ranges (%.0f%% fragmented).\n", bytes/1024.0f/1024.0f, spare/1024.0f/1024.0f, ranges, spare ? 100.0f-100.0f*largest/spare : 0.0f);
+}
+
+// Bytes of the VBOs, free room in them, the number of free ranges and the largest
+void
+Renderer::heapStatistics(unsigned long *bytes, unsigned long *spare, int *ranges, unsigned long *largest)
+{
+	*bytes = *spare = *largest = 0;
+	*ranges = 0;
+	for(VBO2_t *vbo = firstVBO; vbo; vbo = vbo->next)
+	{
+		*bytes += vbo->size;
+		if(!enableHeap || !vbo->size)
+			continue;
+		*spare += vbo->size - vbo->liveVertices*vertexSize - vbo->liveIndices*sizeof(GLushort);
+		for(heapRange_t *range = vbo->freeVertices; range; range = range->next)
+		{
+			*largest = max(*largest, (unsigned long)(range->count*vertexSize));
+			(*ranges)++;
+		}
+		for(heapRange_t *range = vbo->freeIndices; range; range = range->next)
+		{
+			*largest = max(*largest, (unsigned long)(range->count*sizeof(GLushort)));
+			(*ranges)++;
+		}
+	}
+}
+
+// Misses of a FIFO cache of VERTEX_CACHE_SIZE over the indices
+static unsigned long
+countCacheMisses(const GLuint *indices, int count)
+{
+	GLuint cache[VERTEX_CACHE_SIZE];
+	unsigned long misses = 0;
+	int head = 0, size = 0, k;
+
+	for(int i=0; i<count; i++)
+	{
+		for(k=0; k<size && cache[k]!=indices[i]; k++);
+		if(k < size)
+			continue;
+		misses++;
+		cache[head] = indices[i];
+		head = (head+1)%VERTEX_CACHE_SIZE;
+		size = min(size+1, VERTEX_CACHE_SIZE);
+	}
+	return misses;
+}
+
+// Indices of all recipes finished since init, and their misses, if they were counted
+void
+Renderer::cacheStatistics(unsigned long *total, unsigned long *before, unsigned long *after)
+{
+	*total = cacheIndices;
+	*before = cacheTotals[0];
+	*after = cacheTotals[1];
+}
+
+// Normals of the current recipe, then its triangles ordered after Sander,
+// Nehab and Barczak, Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw (Tipsify). Fans around one vertex at a time, then moves on to a
+// vertex still in the cache that has triangles left. The normal goes with the
+// last vertex of a triangle, so triangles keep their vertex order, and the
+// normals are done in the order the triangles came in. Degenerate ones, which
+// would leave a broken normal behind, are dropped.
+void
+Renderer::finishRecipe()
+{
+	GLuint *tris = indices + curRecipe->firstIndex;
+	int count = (numIndices - curRecipe->firstIndex)/3;
+	int first = numDrawverts, last = 0;
+	int n = 0;
+
+	if(count <= 0)
+		return;
+
+	unsigned long before = 0;
+	if(countCache)
+		before = countCacheMisses(tris, count*3);
+
+	// Do the normals, dropping the triangles without area
+	float nx, ny, nz;
+	float dx1, dy1, dz1;
+	float dx2, dy2, dz2;
+	float l;
+	for(int j=0; j<count; j++)
+	{
+		const GLfloat *A = drawverts[tris[j*3+0]].vertex;
+		const GLfloat *B = drawverts[tris[j*3+1]].vertex;
+		const GLfloat *C = drawverts[tris[j*3+2]].vertex;
+		dx1 = C[0]-B[0]; dy1 = C[1]-B[1]; dz1 = C[2]-B[2];
+		dx2 = C[0]-A[0]; dy2 = C[1]-A[1]; dz2 = C[2]-A[2];
+		nx = dy1*dz2 - dz1*dy2;
+		ny = dz1*dx2 - dx1*dz2;
+		nz = dx1*dy2 - dy1*dx2;
+		l = sqrt(nx*nx + ny*ny + nz*nz);
+		if(l == 0.0f)
+			continue;
+
+		drawverts[tris[j*3+2]].normal[0] = nx / l;
+		drawverts[tris[j*3+2]].normal[1] = ny / l;
+		drawverts[tris[j*3+2]].normal[2] = nz / l;
+		for(int k=0; k<3; k++)
+		{
+			tris[n*3+k] = tris[j*3+k];
+			first = min(first, (int)tris[n*3+k]);
+			last = max(last, (int)tris[n*3+k]);
+		}
+		n++;
+	}
+	numIndices -= (count-n)*3;
+	curRecipe->numIndices -= (count-n)*3;
+	count = n;
+
+	// Each vertex misses once whatever the order, when all fit in the cache
+	int verts = last-first+1;
+	if(verts > VERTEX_CACHE_SIZE)
+		orderTriangles(tris, count, first, verts);
+
+	if(countCache)
+	{
+		unsigned long after = countCacheMisses(tris, count*3);
+		cacheMisses[0] += before; // Only reported per upload
+		cacheMisses[1] += after;
+		cacheIndices += count*3;
+		cacheTotals[0] += before;
+		cacheTotals[1] += after;
+	}
+}
+
+// Tipsify over the count triangles of tris, whose vertices run from first
+void
+Renderer::orderTriangles(GLuint *tris, int count, int first, int verts)
+{
+	// Triangles of each vertex, counted from first
+	int *offsets = vertexTriangles, *live = vertexLive, *stamp = vertexStamp;
+	memset(offsets, 0, (verts+1)*sizeof(int));
+	memset(stamp, 0, verts*sizeof(int));
+	memset(emitted, 0, count*sizeof(bool));
+	for(int i=0; i<count*3; i++)
+		offsets[tris[i]-first+1]++;
+	for(int v=0; v<verts; v++)
+	{
+		live[v] = offsets[v+1];
+		offsets[v+1] += offsets[v];
+	}
+	for(int i=0; i<count*3; i++)
+		adjacency[offsets[tris[i]-first]++] = i/3;
+	for(int v=verts; v>0; v--)
+		offsets[v] = offsets[v-1]; // Filling moved each to the start of the next
+	offsets[0] = 0;
+
+	int fan = tris[0]-first;
+	int time = VERTEX_CACHE_SIZE+1;
+	int cursor = 0, deadends = 0, out = 0;
+	while(fan >= 0)
+	{
+		// Emit the triangles around the fanning vertex
+		int start = out;
+		for(int a=offsets[fan]; a<offsets[fan+1]; a++)
+		{
+			int t = adjacency[a];
+			if(emitted[t])
+				continue;
+			for(int k=0; k<3; k++)
+			{
+				int v = tris[t*3+k]-first;
+				ordered[out++] = tris[t*3+k];
+				deadend[deadends++] = v;
+				live[v]--;
+				if(time-stamp[v] > VERTEX_CACHE_SIZE)
+					stamp[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Next, the vertex just used that stays in the cache longest with its fan
+		fan = -1;
+		int best = -1;
+		for(int c=start; c<out; c++)
+		{
+			int v = ordered[c]-first;
+			if(live[v] <= 0)
+				continue;
+			int priority = 0;
+			if(time-stamp[v]+2*live[v] <= VERTEX_CACHE_SIZE)
+				priority = time-stamp[v];
+			if(priority > best)
+			{
+				best = priority;
+				fan = v;
+			}
+		}
+
+		// Dead end, back to a recent vertex with triangles left, else the next one in order
+		while(fan < 0 && deadends > 0)
+		{
+			if(live[deadend[--deadends]] > 0)
+				fan = deadend[deadends];
+		}
+		for(; fan < 0 && cursor < verts; cursor++)
+		{
+			if(live[cursor] > 0)
+				fan = cursor;
+		}
+	}
+
+	memcpy(tris, ordered, count*3*sizeof(GLuint));
 }
 
 void
@@ -315,6 +909,8 @@ Renderer::deleteVBO(VBO2_t *vbo)
     if(firstVBO==vbo)
         firstVBO = vbo->next;
     
+    clearRanges(&vbo->freeVertices);
+    clearRanges(&vbo->freeIndices);
     delete vbo;
 }
 
@@ -387,6 +983,53 @@ Renderer::loadShaderProgram()
 #endif
 }
 
+bool
+Renderer::loadInstanceProgram()
+{
+#ifdef INSTANCED_RENDERING
+    GLhandleARB vertex = glCreateShaderObjectARB(GL_VERTEX_SHADER_ARB);
+	GLhandleARB fragment = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
+    
+    const char *vs[2] = {enableCompact ? "#define COMPACT_VERTICES\n" : "", instanceVertexProgramSource}; // Normals of compact vertices are rescaled
+    const char *fs = instanceFragmentProgramSource;
+    
+    glShaderSourceARB(vertex, 2, vs,NULL);
+	glShaderSourceARB(fragment, 1, &fs,NULL);
+    
+    glCompileShaderARB(vertex);
+	glCompileShaderARB(fragment);
+    
+    printShaderInfoLog(vertex);
+	printShaderInfoLog(fragment);
+    
+    instanceProgram = glCreateProgramObjectARB();
+    
+    glAttachObjectARB(instanceProgram,vertex);
+	glAttachObjectARB(instanceProgram,fragment);
+    
+	glLinkProgramARB(instanceProgram);
+    printProgramInfoLog(instanceProgram);
+
+	GLint linked = 0;
+	glGetObjectParameterivARB(instanceProgram, GL_OBJECT_LINK_STATUS_ARB, &linked);
+	if(!linked)
+		return false;
+
+	const char *names[5] = {"instanceColumn0", "instanceColumn1", "instanceColumn2", "instanceColumn3", "instanceColor"};
+	for(int i=0;i<5;i++)
+	{
+		instanceAttribs[i] = glGetAttribLocationARB(instanceProgram, names[i]);
+		if(instanceAttribs[i] < 0)
+			return false;
+	}
+
+	glGenBuffersARB(1, &instanceBuffer);
+	return true;
+#else
+	return false;
+#endif
+}
+
 
 // Public members
 
@@ -396,9 +1039,36 @@ Renderer::Renderer()
 	enableShaders = false;
 	enableFBO = false;
 	enableMultiSample = false;
+	enableInstancing = false;
+	grouping = false;
+	enableHeap = false;
+	heapDirty = false;
+	enableMultiDraw = false;
+	batching = false;
     numDrawverts = 0;
     numIndices = 0;
+    recipeVertex = 0;
+    poolSize = GEOMETRY_POOL;
+    compactVertices = false;
+    enableCompact = false;
+    vertexSize = sizeof(drawvert2_t);
+    bufferSize = 0;
+    boundVBO = NULL;
+    boundVertex = 0;
+    enableBaseVertex = false;
+    drawverts = NULL;
+    packedverts = NULL;
+    indices = NULL;
+    vertexTriangles = vertexLive = vertexStamp = NULL;
+    adjacency = deadend = NULL;
+    emitted = NULL;
+    ordered = NULL;
+    cacheMisses[0] = cacheMisses[1] = 0;
+    countCache = false;
+    cacheIndices = 0;
+    cacheTotals[0] = cacheTotals[1] = 0;
     wireframe = false;
+    instancing = true;
     savedImages = 1;
 }
 
@@ -407,6 +1077,35 @@ Renderer::~Renderer()
     if(renderQueue)
         delete(renderQueue);
     renderQueue = NULL;
+
+	free(drawverts);
+	free(packedverts);
+	free(indices);
+	free(vertexTriangles);
+	free(vertexLive);
+	free(vertexStamp);
+	free(adjacency);
+	free(deadend);
+	free(emitted);
+	free(ordered);
+}
+
+void
+Renderer::setGeometryPool(int megabytes)
+{
+	poolSize = megabytes;
+}
+
+void
+Renderer::setCompactVertices(bool enable)
+{
+	compactVertices = enable;
+}
+
+void
+Renderer::setCacheStatistics(bool enable)
+{
+	countCache = enable;
 }
 
 void
@@ -427,6 +1126,15 @@ Renderer::init()
 #else
 	v_printf(1, "Compiled without GL_ARB_vertex_buffer_object headers!\n");
 #endif
+
+	// Vertex cache misses, reported per upload
+	countCache = countCache || verbose_output >= 2;
+
+	// Compact vertices, decoded by the matrix each recipe is drawn with
+	enableCompact = compactVertices && enableVBO;
+	vertexSize = enableCompact ? sizeof(compactvert_t) : sizeof(drawvert2_t);
+	if( enableCompact )
+		v_printf(1, "Compact vertices of %d bytes.\n", vertexSize);
     
     // Detect shader program extension, disabled for now for compatibility with Intel bloatware
 #ifdef GL_ARB_shader_objects
@@ -442,6 +1150,57 @@ Renderer::init()
 #else
 	v_printf(1, "Compiled without GL_ARB_shader_objects headers!\n");
 #endif
+
+	// Detect instanced rendering, drawn from VBOs by a shader of its own
+#ifdef INSTANCED_RENDERING
+	enableInstancing = enableVBO && IsExtensionSupported2((char*) "GL_ARB_shader_objects") && IsExtensionSupported2((char*) "GL_ARB_vertex_shader")
+		&& IsExtensionSupported2((char*) "GL_ARB_draw_instanced") && IsExtensionSupported2((char*) "GL_ARB_instanced_arrays");
+	if( enableInstancing )
+	{
+		enableInstancing = loadInstanceProgram();
+		if( enableInstancing )
+			v_printf(1, "GL_ARB_draw_instanced and GL_ARB_instanced_arrays found.\n");
+		else
+			v_printf(1, "Instancing shader failed, drawing instances one by one.\n");
+	}
+	else
+		v_printf(1, "GL_ARB_draw_instanced or GL_ARB_instanced_arrays not found.\n");
+#else
+	v_printf(1, "Compiled without GL_ARB_draw_instanced headers!\n");
+#endif
+
+	// Detect base vertex, recipes are drawn from their first vertex without moving the pointers
+#ifdef BASE_VERTEX
+	enableBaseVertex = enableVBO && IsExtensionSupported2((char*) "GL_ARB_draw_elements_base_vertex");
+	if( enableBaseVertex )
+		v_printf(1, "GL_ARB_draw_elements_base_vertex found.\n");
+	else
+		v_printf(1, "GL_ARB_draw_elements_base_vertex not found.\n");
+#else
+	v_printf(1, "Compiled without GL_ARB_draw_elements_base_vertex headers!\n");
+#endif
+
+	// Detect the geometry heap, copies between buffers
+#ifdef GEOMETRY_HEAP
+	enableHeap = enableVBO && IsExtensionSupported2((char*) "GL_ARB_copy_buffer");
+	if( enableHeap )
+		v_printf(1, "GL_ARB_copy_buffer found.\n");
+	else
+		v_printf(1, "GL_ARB_copy_buffer not found.\n");
+#else
+	v_printf(1, "Compiled without GL_ARB_copy_buffer headers!\n");
+#endif
+
+	// Detect multi-draw, commands sharing their state are drawn at once
+#ifdef MULTI_DRAW
+	enableMultiDraw = enableBaseVertex && IsExtensionSupported2((char*) "GL_EXT_multi_draw_arrays");
+	if( enableMultiDraw )
+		v_printf(1, "GL_EXT_multi_draw_arrays found.\n");
+	else
+		v_printf(1, "GL_EXT_multi_draw_arrays not found.\n");
+#else
+	v_printf(1, "Compiled without GL_EXT_multi_draw_arrays headers!\n");
+#endif
     
 	// Detect framebuffer extension
 	GLint max_samples = 0;
@@ -473,13 +1232,28 @@ Renderer::init()
 #endif
 #endif
     
+    // Buffer size, 64K vertices or as many as fit the pool. The indices stay GLushort, recipes are split at 64K vertices
+    bufferSize = Renderer_SIZE;
+    if(enableVBO && poolSize > 0)
+    {
+        bufferSize = (int) min((double)poolSize*1024*1024/(vertexSize+VERTEX_INDEX_RATIO*sizeof(GLushort)), 64.0*1024*1024);
+        bufferSize = max(bufferSize, 2048);
+        v_printf(2, "  Geometry pool of %dMB, %d vertices per buffer\n", poolSize, bufferSize);
+    }
+    drawverts = (drawvert2_t*)malloc(sizeof(drawvert2_t)*bufferSize);
+    if(enableCompact)
+        packedverts = (compactvert_t*)malloc(sizeof(compactvert_t)*bufferSize);
+    indices = (GLuint*)malloc(sizeof(GLuint)*bufferSize*VERTEX_INDEX_RATIO);
+    vertexTriangles = (int*)malloc(sizeof(int)*(bufferSize+1));
+    vertexLive = (int*)malloc(sizeof(int)*bufferSize);
+    vertexStamp = (int*)malloc(sizeof(int)*bufferSize);
+    adjacency = (int*)malloc(sizeof(int)*bufferSize*VERTEX_INDEX_RATIO);
+    deadend = (int*)malloc(sizeof(int)*bufferSize*VERTEX_INDEX_RATIO);
+    emitted = (bool*)malloc(sizeof(bool)*(bufferSize*VERTEX_INDEX_RATIO/3+1));
+    ordered = (GLuint*)malloc(sizeof(GLuint)*bufferSize*VERTEX_INDEX_RATIO);
+    
     //Build first VBO
-    firstVBO = new VBO2_t;
-    firstVBO->numObjects = 0;
-    firstVBO->vertbuffer = 0;
-    firstVBO->indexbuffer = 0;
-    firstVBO->next = NULL;
-    firstVBO->prev = NULL;
+    firstVBO = newVBO();
     curVBO = firstVBO;
     
     //Build small renderqueue
@@ -515,6 +1289,8 @@ Renderer::beginRender(FRUSTUM frustum)
 #endif
     
     queueLength = 0;
+    grouping = enableInstancing && instancing;
+    batching = true;
     
     // State
     glDisable(GL_BLEND);
@@ -528,6 +1304,12 @@ Renderer::beginRender(FRUSTUM frustum)
     glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
 	modelview.LoadIdentity();
+    
+    unsortedVBO = boundVBO;
+    unsortedModelview = modelview;
+    unsortedCull = cull_type;
+    unsortedBlending = blending;
+    unsortedColor = cur_color;
     this->frustum = frustum;
     
     if(wireframe)
@@ -542,18 +1324,32 @@ Renderer::beginRender(FRUSTUM frustum)
 	glEnable(GL_LIGHTING);
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_FOG);
+	if(enableCompact)
+		glEnable(GL_NORMALIZE); // Decoding scales them
 }
 
 void
 Renderer::endRender()
 {
+    // Opaque instances first, or the other commands sorted, then the transparent ones one by one and in order
+    flushInstances();
+    flushCommands();
+    grouping = false;
+    batching = false;
+
     // Empty Queue
     for(int i=0;i<queueLength;i++)
         renderObject(renderQueue[i].recipe, &renderQueue[i].mat , &renderQueue[i].color , false);
     queueLength = 0;
     
+    // Deleted recipes left room the new ones did not fill?
+    if(heapDirty)
+        compactHeap();
+    
     // Disable states
 //    glDisable( GL_MULTISAMPLE );
+	if(enableCompact)
+		glDisable(GL_NORMALIZE);
     boundVBO = NULL;
 	if(enableVBO)
 	{
@@ -706,11 +1502,13 @@ Renderer::beginObject()
 {
     curRecipe = new renderRecipe_t;
     curRecipe->next = NULL;
-    curRecipe->VBO = curVBO;
-    curVBO->numObjects++;
+    addToVBO(curRecipe, curVBO);
     curRecipe->firstIndex= numIndices;
+    recipeVertex = numDrawverts;
 	curRecipe->displaylist = 0;
     curRecipe->numIndices = 0;
+    curRecipe->firstVertex = curRecipe->numVertices = 0;
+	curRecipe->numInstances[0] = curRecipe->numInstances[1] = 0;
     curRecipe->bounds.SetFromMinsMaxes(VECTOR3D(10000.0f, 10000.0f, 10000.0f), VECTOR3D(-10000.0f, -10000.0f, -10000.0f));
     
 	if(!enableVBO)
@@ -770,10 +1568,17 @@ void
 Renderer::allowFlush()
 {
     // Flush with 2K buffers for display list renderers (weird bug with icestm and Exceed 3D combination)
-    if( (enableVBO && (numDrawverts > Renderer_SIZE-256 || numIndices > (Renderer_SIZE-256)*VERTEX_INDEX_RATIO)) || (!enableVBO && (numDrawverts > 2048-256 || numIndices > (2048-256)*VERTEX_INDEX_RATIO)))
+    bool full = (enableVBO && (numDrawverts > bufferSize-256 || numIndices > (bufferSize-256)*VERTEX_INDEX_RATIO)) || (!enableVBO && (numDrawverts > 2048-256 || numIndices > (2048-256)*VERTEX_INDEX_RATIO));
+    
+    // Recipes are culled one by one and their indices are GLushort, keep them as small as in 64K buffers
+    bool split = enableVBO && numDrawverts-recipeVertex > Renderer_SIZE-256;
+    
+    if(full || split)
     {
-        // Upload VBO
-        emitTriangles();
+        finishRecipe();
+        placeRecipe();
+        if(full)
+            emitTriangles(); // Upload VBO
         
 		if(enableVBO)
 		{
@@ -781,12 +1586,14 @@ Renderer::allowFlush()
 			curRecipe->next = new renderRecipe_t;
 			curRecipe = curRecipe->next;
 			curRecipe->next = NULL;
-			curRecipe->VBO = curVBO;
+			addToVBO(curRecipe, curVBO);
 			curRecipe->displaylist = 0;
-			curVBO->numObjects++;
 			curRecipe->firstIndex= numIndices;
 			curRecipe->numIndices = 0;
+			curRecipe->firstVertex = curRecipe->numVertices = 0;
+			curRecipe->numInstances[0] = curRecipe->numInstances[1] = 0;
             curRecipe->bounds.SetFromMinsMaxes(VECTOR3D(10000.0f, 10000.0f, 10000.0f), VECTOR3D(-10000.0f, -10000.0f, -10000.0f));
+			recipeVertex = numDrawverts;
 		}
     }
 }
@@ -794,7 +1601,9 @@ Renderer::allowFlush()
 void
 Renderer::endObject()
 {
-    if(numDrawverts > Renderer_SIZE-256 || numIndices > (Renderer_SIZE-256)*VERTEX_INDEX_RATIO || (!enableVBO))
+    finishRecipe();
+    placeRecipe();
+    if(numDrawverts > bufferSize-256 || numIndices > (bufferSize-256)*VERTEX_INDEX_RATIO || (!enableVBO))
         emitTriangles();
     
 	if(!enableVBO)
@@ -831,79 +1640,422 @@ Renderer::renderObject(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color,
     // Check bounding box
     bounds = recipe->bounds;
     bounds.Mult(*mat);
-    if(frustum.IsAABoundingBoxInside(bounds))
+    bool inside = frustum.IsAABoundingBoxInside(bounds);
+    
+    // Compact positions are decoded along with the rest
+    MATRIX4X4 decoded;
+    MATRIX4X4 *view = mat;
+    if(inside && enableCompact)
+    {
+        decoded = *mat * recipe->decode;
+        view = &decoded;
+    }
+    
+    if(inside)
+        countUnsorted(recipe, view, color);
+    if(inside && grouping)
+        addInstance(recipe, view, color); // Drawn with the others in endRender
+    else if(inside && batching)
+        addCommand(recipe, view, color); // Sorted with the others in endRender
+    else if(inside)
     {
         //State
-        if(modelview != *mat)
+        setModelview(view);
+        setCullFace(view->NegativeTrace() ? GL_FRONT : GL_BACK);
+        setBlending(color->GetW() < 0.99f);
+        bindRecipe(recipe);
+        setColor(color);
+        
+        drawRecipe(recipe);
+    }
+    
+    // Next batch
+    if(recipe->next)
+        renderObject(recipe->next, mat, color, transparent);
+}
+
+// State changes, each one counted
+void
+Renderer::setModelview(MATRIX4X4 *mat)
+{
+    if(modelview == *mat)
+        return;
+    glLoadMatrixf((GLfloat*) mat);
+    modelview = *mat;
+    total_states++;
+}
+
+void
+Renderer::setCullFace(GLint type)
+{
+    if(cull_type == type)
+        return;
+    glCullFace(type);
+    cull_type = type;
+    total_states++;
+}
+
+void
+Renderer::setBlending(bool enable)
+{
+    if(blending == enable)
+        return;
+    if(enable)
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+    blending = enable;
+    total_states++;
+}
+
+void
+Renderer::setColor(VECTOR4D *color)
+{
+    if(cur_color == *color)
+        return;
+    glColor4f(color->GetX(), color->GetY(), color->GetZ(), color->GetW());
+    cur_color = *color;
+    total_states++;
+}
+
+void
+Renderer::bindRecipe(renderRecipe_t *recipe)
+{
+    VBO2_t *vbo = recipe->VBO;
+    int first = enableBaseVertex ? 0 : recipe->firstVertex;
+    if((vbo == boundVBO && first == boundVertex) || !enableVBO)
+        return;
+#ifdef GL_ARB_vertex_buffer_object
+    char *base = (char*) NULL + first*vertexSize;
+    glBindBufferARB( GL_ARRAY_BUFFER_ARB, vbo->vertbuffer ); // Instances may have taken it
+    glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, vbo->indexbuffer );
+    if(enableCompact)
+    {
+        glVertexPointer (3, GL_SHORT, sizeof(compactvert_t), base);
+        glNormalPointer (GL_BYTE, sizeof(compactvert_t), base+4*sizeof(GLshort));
+    }
+    else
+    {
+        glVertexPointer (3, GL_FLOAT, sizeof(drawvert2_t), base);
+        glNormalPointer (GL_FLOAT, sizeof(drawvert2_t), base+3*sizeof(GLfloat));
+    }
+    boundVBO = vbo;
+    boundVertex = first;
+    total_states++;
+#endif
+}
+
+// The state changes and draws of this recipe, had it been drawn on its own right away
+void
+Renderer::countUnsorted(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color)
+{
+    if(unsortedModelview != *mat)
+    {
+        unsortedModelview = *mat;
+        total_states_unsorted++;
+        GLint type = mat->NegativeTrace() ? GL_FRONT : GL_BACK;
+        if(unsortedCull != type)
         {
-            glLoadMatrixf((GLfloat*) mat);
-            modelview = *mat;
-            
-            // Update cullface?
-            bool t = mat->NegativeTrace();
-            if(t && cull_type==GL_BACK)
-            {
-                glCullFace(GL_FRONT);
-                cull_type = GL_FRONT;
-            }
-            else if (!t && cull_type==GL_FRONT)
-            {
-                glCullFace(GL_BACK);
-                cull_type = GL_BACK;
-            }
+            unsortedCull = type;
+            total_states_unsorted++;
         }
-        if(!blending && color->GetW() < 0.99f)
+    }
+    if(unsortedBlending != (color->GetW() < 0.99f))
+    {
+        unsortedBlending = !unsortedBlending;
+        total_states_unsorted++;
+    }
+    if(enableVBO && unsortedVBO != recipe->VBO)
+    {
+        unsortedVBO = recipe->VBO;
+        total_states_unsorted++;
+    }
+    if(unsortedColor != *color)
+    {
+        unsortedColor = *color;
+        total_states_unsorted++;
+    }
+    total_draws_unsorted++;
+}
+
+void
+Renderer::drawRecipe(renderRecipe_t *recipe)
+{
+    if(enableVBO)
+    {
+        // Draw the triangles
+#ifdef BASE_VERTEX
+        if(enableBaseVertex)
+            glDrawElementsBaseVertex(GL_TRIANGLES, recipe->numIndices, GL_UNSIGNED_SHORT, (char *) NULL+recipe->firstIndex*sizeof(GLushort), recipe->firstVertex);
+        else
+#endif
+        glDrawElements(GL_TRIANGLES, recipe->numIndices, GL_UNSIGNED_SHORT, (char *) NULL+recipe->firstIndex*sizeof(GLushort));
+    }
+    else
+        glCallList(recipe->displaylist);
+    
+    total_tris += recipe->numIndices / 3;
+    total_draws++;
+}
+
+void
+Renderer::addCommand(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color)
+{
+    // The layers of a cell come one after the other with the same matrix
+    if(commandMatrices.empty() || commandMatrices.back() != *mat)
+        commandMatrices.push_back(*mat);
+    
+    drawCommand_t command;
+    command.recipe = recipe;
+    command.matrix = commandMatrices.size()-1;
+    command.state = (color->GetW() < 0.99f ? DRAW_BLEND : 0) | (mat->NegativeTrace() ? DRAW_MIRRORED : 0);
+    command.order = commands.size();
+    command.color = *color;
+    commands.push_back(command);
+}
+
+static bool
+sameColor(const drawCommand_t &a, const drawCommand_t &b)
+{
+    return a.color == b.color;
+}
+
+static bool
+colorBefore(const drawCommand_t &a, const drawCommand_t &b)
+{
+    if(a.color.x != b.color.x)
+        return a.color.x < b.color.x;
+    if(a.color.y != b.color.y)
+        return a.color.y < b.color.y;
+    if(a.color.z != b.color.z)
+        return a.color.z < b.color.z;
+    return a.color.w < b.color.w;
+}
+
+// Opaque commands by buffer, cull face, then color or matrix, whichever changes less, translucent ones after them as they came.
+// Buffers go by their name rather than their address, so the order does not change from run to run.
+// Display lists leave every buffer unnamed, those fall back on the address to keep the order strict
+class CommandOrder
+{
+public:
+    bool colorsFirst;
+
+    CommandOrder(bool colorsFirst) : colorsFirst(colorsFirst) {}
+    bool operator()(const drawCommand_t &a, const drawCommand_t &b) const
+    {
+        if((a.state & DRAW_BLEND) != (b.state & DRAW_BLEND))
+            return !(a.state & DRAW_BLEND);
+        if(a.state & DRAW_BLEND)
+            return a.order < b.order;
+        if(a.recipe->VBO->vertbuffer != b.recipe->VBO->vertbuffer)
+            return a.recipe->VBO->vertbuffer < b.recipe->VBO->vertbuffer;
+        if(a.recipe->VBO != b.recipe->VBO)
+            return less<VBO2_t*>()(a.recipe->VBO, b.recipe->VBO);
+        if(a.state != b.state)
+            return a.state < b.state;
+        if(colorsFirst && !sameColor(a, b))
+            return colorBefore(a, b);
+        if(a.matrix != b.matrix)
+            return a.matrix < b.matrix;
+        if(!sameColor(a, b))
+            return colorBefore(a, b);
+        if(a.recipe->firstIndex != b.recipe->firstIndex)
+            return a.recipe->firstIndex < b.recipe->firstIndex;
+        return a.order < b.order;
+    }
+};
+
+static bool
+sameState(const drawCommand_t &a, const drawCommand_t &b)
+{
+    return a.state == b.state && a.recipe->VBO == b.recipe->VBO && a.matrix == b.matrix && a.color == b.color;
+}
+
+// Commands sharing their state in one draw
+void
+Renderer::flushCommands()
+{
+    int commandLength = commands.size();
+    if(!commandLength)
+        return;
+    
+    // Fewer layer colors than matrices? Only counted as far as it matters
+    commandColors.clear();
+    for(int i=0;i<commandLength && commandColors.size()<commandMatrices.size();i++)
+        if(find(commandColors.begin(), commandColors.end(), commands[i].color) == commandColors.end())
+            commandColors.push_back(commands[i].color);
+    sort(commands.begin(), commands.end(), CommandOrder(commandColors.size() < commandMatrices.size()));
+    multiCounts.resize(commandLength);
+    multiFirsts.resize(commandLength);
+    multiBases.resize(commandLength);
+    multiOffsets.resize(commandLength);
+    
+    for(int i=0;i<commandLength;)
+    {
+        drawCommand_t *command = &commands[i];
+        
+        // State
+        setModelview(&commandMatrices[command->matrix]);
+        setCullFace((command->state & DRAW_MIRRORED) ? GL_FRONT : GL_BACK);
+        setBlending((command->state & DRAW_BLEND) != 0);
+        bindRecipe(command->recipe);
+        setColor(&command->color);
+        
+        if(!enableVBO)
         {
-            glEnable(GL_BLEND);
-            blending = true;
+            drawRecipe(command->recipe);
+            i++;
+            continue;
         }
-        else if(blending && color->GetW() >= 0.99f)
+        
+        // Ranges of this command and the following ones, each with its own base vertex
+        int n = 0;
+        for(;i<commandLength && sameState(*command, commands[i]);i++)
         {
-            glDisable(GL_BLEND);
-            blending = false;
+            renderRecipe_t *recipe = commands[i].recipe;
+            if(!n || enableMultiDraw)
+            {
+                multiCounts[n] = recipe->numIndices;
+                multiFirsts[n] = recipe->firstIndex;
+                multiBases[n] = recipe->firstVertex;
+                n++;
+            }
+            else
+                break;
+            total_tris += recipe->numIndices / 3;
         }
+        total_draws++;
         
-        // Bind geometry?
-        if(recipe->VBO != boundVBO && enableVBO)
+        if(n == 1)
         {
-#ifdef GL_ARB_vertex_buffer_object
-            // Bind buffers
-            glBindBufferARB( GL_ARRAY_BUFFER_ARB, recipe->VBO->vertbuffer );
-            glBindBufferARB( GL_ELEMENT_ARRAY_BUFFER_ARB, recipe->VBO->indexbuffer );
-            glVertexPointer (3, GL_FLOAT, sizeof(drawvert2_t), (char*) NULL);
-            glNormalPointer (GL_FLOAT, sizeof(drawvert2_t), (char*) (3*sizeof(GLfloat)));
-            boundVBO = recipe->VBO;
+#ifdef BASE_VERTEX
+            if(enableBaseVertex)
+                glDrawElementsBaseVertex(GL_TRIANGLES, multiCounts[0], GL_UNSIGNED_SHORT, (char *) NULL+multiFirsts[0]*sizeof(GLushort), multiBases[0]);
+            else
 #endif
+            glDrawElements(GL_TRIANGLES, multiCounts[0], GL_UNSIGNED_SHORT, (char *) NULL+multiFirsts[0]*sizeof(GLushort));
+            continue;
         }
         
-        // Render geometry
-        if(*color != cur_color)
+#ifdef MULTI_DRAW
+        for(int k=0;k<n;k++)
+            multiOffsets[k] = (char *) NULL+multiFirsts[k]*sizeof(GLushort);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, &multiCounts[0], GL_UNSIGNED_SHORT, &multiOffsets[0], n, &multiBases[0]);
+#endif
+    }
+    
+    commands.clear();
+    commandMatrices.clear();
+}
+
+void
+Renderer::addInstance(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color)
+{
+    // First instance of this recipe?
+    if(!recipe->numInstances[0] && !recipe->numInstances[1])
+        instanceGroups.push_back(recipe);
+    recipe->numInstances[mat->NegativeTrace() ? 1 : 0]++;
+    
+    renderQueue_t instance;
+    instance.recipe = recipe;
+    instance.mat = *mat;
+    instance.color = *color;
+    instanceQueue.push_back(instance);
+}
+
+// One draw per recipe and cull face, with the instances in a single buffer for the frame
+void
+Renderer::flushInstances()
+{
+#ifdef INSTANCED_RENDERING
+    if(instanceQueue.empty())
+        return;
+    
+    // Each recipe gets a run of the buffer, mirrored instances after the others
+    int first = 0;
+    for(unsigned int i=0;i<instanceGroups.size();i++)
+    {
+        for(int t=0;t<2;t++)
         {
-            glColor4f(color->GetX(), color->GetY(), color->GetZ(), color->GetW());
-            cur_color = *color;
+            instanceGroups[i]->firstInstance[t] = first;
+            first += instanceGroups[i]->numInstances[t];
         }
-        
-        if(enableVBO)
+    }
+    instanceData.resize(instanceQueue.size()*INSTANCE_FLOATS);
+    for(unsigned int i=0;i<instanceQueue.size();i++)
+    {
+        renderQueue_t *instance = &instanceQueue[i];
+        int n = instance->recipe->firstInstance[instance->mat.NegativeTrace() ? 1 : 0]++;
+        memcpy(&instanceData[n*INSTANCE_FLOATS], &instance->mat, 16*sizeof(GLfloat));
+        memcpy(&instanceData[n*INSTANCE_FLOATS+16], &instance->color, 4*sizeof(GLfloat));
+    }
+    
+    glBindBufferARB( GL_ARRAY_BUFFER_ARB, instanceBuffer );
+    glBufferDataARB( GL_ARRAY_BUFFER_ARB, instanceData.size()*sizeof(GLfloat), &instanceData[0], GL_STREAM_DRAW_ARB );
+    glUseProgramObjectARB(instanceProgram);
+    for(int k=0;k<5;k++)
+    {
+        glEnableVertexAttribArrayARB(instanceAttribs[k]);
+        glVertexAttribDivisorARB(instanceAttribs[k], 1);
+    }
+    
+    // Opaque layers first, then the translucent ones over them
+    for(int pass=0;pass<2;pass++)
+    for(unsigned int i=0;i<instanceGroups.size();i++)
+    {
+        renderRecipe_t *recipe = instanceGroups[i];
+        for(int t=0;t<2;t++)
         {
-            // Draw the triangles
-            glDrawElements(GL_TRIANGLES, recipe->numIndices, GL_UNSIGNED_SHORT, (char *) NULL+recipe->firstIndex*sizeof(GLushort));
+            int count = recipe->numInstances[t];
+            if(!count)
+                continue;
+            first = recipe->firstInstance[t] - count;
+            float alpha = instanceData[first*INSTANCE_FLOATS+19]; // Same for all instances of a layer
+            if((alpha < 0.99f) != (pass == 1))
+                continue;
+            
+            // State
+            setCullFace(t ? GL_FRONT : GL_BACK);
+            setBlending(alpha < 0.99f);
+            bindRecipe(recipe);
+            
+            // Point at the instances, the pointers keep their buffer
+            glBindBufferARB( GL_ARRAY_BUFFER_ARB, instanceBuffer );
+            for(int k=0;k<5;k++)
+                glVertexAttribPointerARB(instanceAttribs[k], 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS*sizeof(GLfloat), (char *) NULL+(first*INSTANCE_FLOATS+k*4)*sizeof(GLfloat));
+            
+#ifdef BASE_VERTEX
+            if(enableBaseVertex)
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, recipe->numIndices, GL_UNSIGNED_SHORT, (char *) NULL+recipe->firstIndex*sizeof(GLushort), count, recipe->firstVertex);
+            else
+#endif
+            glDrawElementsInstancedARB(GL_TRIANGLES, recipe->numIndices, GL_UNSIGNED_SHORT, (char *) NULL+recipe->firstIndex*sizeof(GLushort), count);
+            
+            total_tris += recipe->numIndices / 3 * count;
+            total_draws++;
         }
-        else
-            glCallList(recipe->displaylist);
-        
-        total_tris += recipe->numIndices / 3;
-        
     }
+    for(unsigned int i=0;i<instanceGroups.size();i++)
+        instanceGroups[i]->numInstances[0] = instanceGroups[i]->numInstances[1] = 0;
     
-    // Next batch
-    if(recipe->next)
-        renderObject(recipe->next, mat, color, transparent);
+    for(int k=0;k<5;k++)
+    {
+        glVertexAttribDivisorARB(instanceAttribs[k], 0);
+        glDisableVertexAttribArrayARB(instanceAttribs[k]);
+    }
+    glUseProgramObjectARB(enableShaders ? shaderProgram : 0);
+#endif
+    instanceQueue.clear();
+    instanceGroups.clear();
 }
 
 void
 Renderer::forceFlush()
 {
-    emitTriangles();
+    if(numDrawverts || !enableVBO)
+        emitTriangles();
+    if(enableHeap)
+        compactHeap();
 }
 
 void
@@ -914,9 +2066,19 @@ Renderer::deleteRecipe(renderRecipe_t *recipe)
     
     if(recipe->VBO)
     {
-        recipe->VBO->numObjects--;
-        if(recipe->VBO->numObjects<1)
-            deleteVBO(recipe->VBO);
+        VBO2_t *vbo = recipe->VBO;
+        removeFromVBO(recipe);
+        if(vbo->numObjects<1 && vbo!=curVBO)
+            deleteVBO(vbo);
+        else if(enableHeap && recipe->numVertices)
+        {
+            // Room for the next recipes, compacted after the frame
+            freeRange(&vbo->freeVertices, recipe->firstVertex, recipe->numVertices);
+            freeRange(&vbo->freeIndices, recipe->firstIndex, recipe->numIndices);
+            vbo->liveVertices -= recipe->numVertices;
+            vbo->liveIndices -= recipe->numIndices;
+            heapDirty = true;
+        }
     }
 	if(recipe->displaylist)
 		glDeleteLists(recipe->displaylist, 1);
@@ -22,6 +22,7 @@
 #define GDS3D_Renderer_h
 
 #include "../math/Maths.h"
+#include <vector>
 
 // This is the only place gl.h should be included!
 #ifdef WIN32
@@ -37,19 +38,43 @@
 	#define GLhandleARB GLuint
 #endif
 
-#define Renderer_SIZE 1024*64 // 64K buffers max (GLushort limit)
+#define Renderer_SIZE 1024*64 // 64K buffers and recipes max (GLushort limit)
 #define VERTEX_INDEX_RATIO 5
+#define GEOMETRY_POOL 8 // Megabytes per buffer by default
+#define VERTEX_CACHE_SIZE 16 // Post-transform cache the triangles are ordered for, FIFO
 
 typedef struct drawvert2_t{
 	GLfloat vertex[3];
 	GLfloat normal[3];
 }drawvert2_t;
 
+// Half the size, positions quantized to the bounds of their recipe
+typedef struct compactvert_t{
+	GLshort vertex[4]; // Last one unused
+	GLbyte normal[4];
+}compactvert_t;
+
+typedef struct heapRange_t{
+    int first;
+    int count;
+    struct heapRange_t *next;
+}heapRange_t;
+
 typedef struct VBO2_t{
 	// VBO extension
     GLuint vertbuffer;
     GLuint indexbuffer;
     int numObjects;
+    unsigned long size; // Bytes uploaded
+    
+    // Heap, deleted recipes leave room for new ones
+    int numVertices; // Room in the buffers
+    int numIndices;
+    int liveVertices;
+    int liveIndices;
+    heapRange_t *freeVertices; // In order and merged
+    heapRange_t *freeIndices;
+    struct renderRecipe_t *recipes;
     
     struct VBO2_t *next;
     struct VBO2_t *prev;
@@ -59,14 +84,23 @@ typedef struct renderRecipe_t{
     VBO2_t   *VBO;
     int     firstIndex;
     int     numIndices;
+    int     firstVertex; // Indices count from here
+    int     numVertices;
     
     // Bounding box of geometry
     AA_BOUNDING_BOX bounds;
+    MATRIX4X4 decode; // Compact positions into it
 
 	// Fallback display lists
 	GLuint displaylist;
+
+	// Instances this frame, by cull face
+	int     numInstances[2];
+	int     firstInstance[2];
     
     struct  renderRecipe_t* next;
+    struct  renderRecipe_t* heapNext; // In its VBO
+    struct  renderRecipe_t* heapPrev;
 }renderRecipe_t;
 
 typedef struct renderQueue_t{
@@ -75,13 +109,43 @@ typedef struct renderQueue_t{
     VECTOR4D color;
 }renderQueue_t;
 
+typedef struct drawCommand_t{
+    renderRecipe_t *recipe;
+    int     matrix; // In the matrices of the frame
+    int     state; // DRAW_BLEND and DRAW_MIRRORED
+    int     order; // Of submission
+    VECTOR4D color;
+}drawCommand_t;
+
+#define DRAW_MIRRORED 1 // Front faces culled
+#define DRAW_BLEND 2
+
 class Renderer
 {
 private:
-    drawvert2_t  drawverts[Renderer_SIZE]; // Glfloat are 4 bytes each
+    drawvert2_t  *drawverts; // Glfloat are 4 bytes each
+    compactvert_t *packedverts; // As they are uploaded, for compact vertices
     int         numDrawverts;
-    GLushort    indices[Renderer_SIZE*VERTEX_INDEX_RATIO]; // Gluint (4 bytes) not native to ATI R300. GLushort is 2 bytes.
+    int         vertexSize; // Of the uploaded vertices
+    GLuint      *indices; // Uploaded as GLushort counting from the first vertex of their recipe, Gluint (4 bytes) not native to ATI R300
     int         numIndices;
+    int         poolSize; // Megabytes per buffer, 0 for 64K buffers
+    bool        compactVertices; // Asked for, used with VBOs only
+    bool        enableCompact;
+    int         bufferSize; // Vertices per buffer
+    unsigned long cacheMisses[2]; // Of the indices since the last upload, before and after ordering
+    bool        countCache; // Misses counted, always with verbose output
+    unsigned long cacheIndices; // Since init, with the misses below
+    unsigned long cacheTotals[2];
+
+    // Triangle ordering, by vertex from the first one of the recipe
+    int         *vertexTriangles; // Start of its triangles in adjacency
+    int         *vertexLive; // Triangles not emitted yet
+    int         *vertexStamp; // Time it entered the cache
+    int         *adjacency;
+    int         *deadend; // Vertices emitted, most recent last
+    bool        *emitted;
+    GLuint      *ordered;
 
 	// Framebuffer
 	GLuint	FBO;
@@ -99,19 +163,63 @@ private:
     VBO2_t   *curVBO;
     VBO2_t   *firstVBO;
     renderRecipe_t *curRecipe;
+    int     recipeVertex; // First vertex of the current recipe
     VBO2_t  *boundVBO;
+    int     boundVertex; // The pointers start at, without base vertex
+    bool    enableBaseVertex; // Recipes drawn from their first vertex, otherwise the pointers move there
     
     // Shaders
     GLhandleARB  vertexProgram;
     GLhandleARB  fragmentProgram;
     GLhandleARB  shaderProgram;
+    GLhandleARB  instanceProgram;
+    GLint        instanceAttribs[5]; // Matrix columns and color
     void	loadGLExtensions();
     bool    IsExtensionSupported2( char* szTargetExtension );
     void    emitTriangles();
+    void    finishRecipe(); // Normals and vertex cache order of its triangles, before they are emitted
+    void    orderTriangles(GLuint *tris, int count, int first, int verts);
     void    deleteVBO(VBO2_t *vbo);
     void    printShaderInfoLog(GLhandleARB obj);
     void    printProgramInfoLog(GLhandleARB obj);
     void    loadShaderProgram();
+    bool    loadInstanceProgram();
+
+    // Instancing, the visible instances of each recipe are drawn at once
+    bool        enableInstancing;
+    bool        grouping; // This frame
+    GLuint      instanceBuffer;
+    std::vector<renderQueue_t> instanceQueue; // Kept from frame to frame, like the ones below
+    std::vector<renderRecipe_t*> instanceGroups; // Recipes with instances
+    std::vector<GLfloat> instanceData; // Matrix and color, as uploaded
+    void        addInstance(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color);
+    void        flushInstances();
+    
+    // Command list, the other draws of a frame sorted by state and merged where they share it
+    bool        enableMultiDraw;
+    bool        batching; // This frame
+    std::vector<drawCommand_t> commands; // Kept from frame to frame, like the ones below
+    std::vector<MATRIX4X4> commandMatrices;
+    std::vector<VECTOR4D> commandColors; // Different ones, counted as far as it matters
+    std::vector<GLsizei> multiCounts; // Index ranges of one draw
+    std::vector<GLint> multiFirsts;
+    std::vector<GLint> multiBases;
+    std::vector<const GLvoid*> multiOffsets;
+    void        addCommand(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color);
+    void        flushCommands();
+    void        drawRecipe(renderRecipe_t *recipe);
+    
+    // Geometry heap, recipes are moved about in their VBOs
+    bool        enableHeap;
+    bool        heapDirty; // Recipes deleted since the last compaction
+    void        addToVBO(renderRecipe_t *recipe, VBO2_t *vbo);
+    void        removeFromVBO(renderRecipe_t *recipe);
+    void        placeRecipe(); // Into the room of deleted recipes, if there is any
+    void        compactVBO(VBO2_t *vbo);
+    void        compactHeap();
+    const void* uploadIndices(int first, int count);
+    const void* uploadVertices(int first);
+    void        packRecipe(); // Into compact vertices, once its bounds are known
     
     // State
     GLint       cull_type; // Backface culling
@@ -119,6 +227,19 @@ private:
     FRUSTUM     frustum; // For bounding box culling
     bool        blending;
     VECTOR4D    cur_color;
+    void        setModelview(MATRIX4X4 *mat);
+    void        setCullFace(GLint type);
+    void        setBlending(bool enable);
+    void        setColor(VECTOR4D *color);
+    void        bindRecipe(renderRecipe_t *recipe); // Its VBO, and the pointers at its first vertex without base vertex
+    
+    // State as drawing everything in the order it came would have left it
+    VBO2_t      *unsortedVBO;
+    MATRIX4X4   unsortedModelview;
+    GLint       unsortedCull;
+    bool        unsortedBlending;
+    VECTOR4D    unsortedColor;
+    void        countUnsorted(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color);
     
     // TGA saving
     int savedImages;
@@ -128,6 +249,9 @@ public:
                         Renderer();
                         ~Renderer();
     void                init();
+    void                setGeometryPool(int megabytes); // Before init, 0 for 64K buffers
+    void                setCompactVertices(bool enable); // Before init, 12 instead of 24 bytes per vertex
+    void                setCacheStatistics(bool enable); // Before init, count vertex cache misses without verbose output
     void                beginRender(FRUSTUM frustum);
     void                endRender();
     void                setWireframe(bool enable);
@@ -147,6 +271,8 @@ public:
     void                renderObject(renderRecipe_t *recipe, MATRIX4X4 *mat, VECTOR4D *color, bool transparent);
     void                forceFlush();
     void                deleteRecipe(renderRecipe_t *recipe);
+    void                heapStatistics(unsigned long *bytes, unsigned long *spare, int *ranges, unsigned long *largest);
+    void                cacheStatistics(unsigned long *total, unsigned long *before, unsigned long *after); // Misses of all recipes, before and after ordering
 
 	// 2D Rendering
 	void				start2D(int width, int height);
@@ -159,10 +285,15 @@ public:
 	int                 tgaGrabScreenSeries(char *filename);
     
     bool        wireframe; // Wireframe rendering
+    bool        instancing; // Instanced rendering, if the hardware has it
 
 };
 
 extern Renderer renderer;
 extern unsigned long total_tris;
+extern unsigned long total_draws;
+extern unsigned long total_states;
+extern unsigned long total_draws_unsorted; // Drawing every layer on its own, in the order of the hierarchy
+extern unsigned long total_states_unsorted;
 
 #endif
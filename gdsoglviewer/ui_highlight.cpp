@@ -377,10 +377,37 @@ UIHighlight::Event(int event, int data, int xpos, int ypos , bool shift, bool co
 
 // This is where the trace magic happens..
 
+// Clips the elements of an array to those whose boundary can overlap the box,
+// both in world coordinates. Steps along the array are linear, so the four
+// sides give four half planes of columns and rows.
+static void
+clipArray(GDSRef *ref, const GDSMat &object_mat, const GDSBB &box, GDSArrayClip *clips)
+{
+	GDSArray *array = ref->array;
+	GDSBB first = ref->object->GetTotalBoundary();
+	first.transform(object_mat * ref->mat);
+
+	// World steps of a column and a row
+	float cx = array->mag*(object_mat[0]*array->dx1 + object_mat[2]*array->dy1);
+	float cy = array->mag*(object_mat[1]*array->dx1 + object_mat[3]*array->dy1);
+	float rx = array->mag*(object_mat[0]*array->dx2 + object_mat[2]*array->dy2);
+	float ry = array->mag*(object_mat[1]*array->dx2 + object_mat[3]*array->dy2);
+
+	// Margin of GDSBB and of the rounded element translations
+	double margin = 0.001*(1.0 + fabs(object_mat[0]) + fabs(object_mat[2]) + fabs(object_mat[1]) + fabs(object_mat[3]));
+
+	clips[0].a = -cx; clips[0].b = -rx; clips[0].c = box.max.X - first.min.X + margin;
+	clips[1].a = cx; clips[1].b = rx; clips[1].c = first.max.X - box.min.X + margin;
+	clips[2].a = -cy; clips[2].b = -ry; clips[2].c = box.max.Y - first.min.Y + margin;
+	clips[3].a = cy; clips[3].b = ry; clips[3].c = first.max.Y - box.min.Y + margin;
+}
+
 void 
 UIHighlight::tracePoint(float x, float y, GDSObject *obj, GDSMat object_mat, ProcessLayer *layer)
 {
 	GDSPolygon poly;	
+	ProcessLayer *poly_layer;
+	GDSBB bb;
 
 	// Is it within the boundary of this object?
 	GDSBB boundary = obj->GetTotalBoundary();
@@ -388,15 +415,20 @@ UIHighlight::tracePoint(float x, float y, GDSObject *obj, GDSMat object_mat, Pro
 	if(!boundary.isPointInside(Point2D(x, y)))
 		return;
 
-	// Check object polygons
+	// Check object polygons, layers and bounds come from the arena arrays
 	for(unsigned int i=0;i<obj->PolygonItems.size();i++)
 	{
-		poly = *obj->PolygonItems[i];
+		poly_layer = obj->GetPolygonLayer(i);
+		if(!poly_layer->Show || poly_layer != layer)
+			continue;
 
-		//
-		if(!poly.GetLayer()->Show || poly.GetLayer() != layer)
+		bb = *obj->GetPolygonBBox(i);
+		bb.transform(object_mat);
+		if(!bb.isPointInside(Point2D(x, y)))
 			continue;
 
+		poly = *obj->PolygonItems[i];
+
 		// Transform polygon
 		poly.transformPoints(object_mat);
 
@@ -420,9 +452,29 @@ UIHighlight::tracePoint(float x, float y, GDSObject *obj, GDSMat object_mat, Pro
 		cur_object = obj;
 	}	
 
-	// Propagate through hierarchy
+	// Propagate through hierarchy, only the elements of arrays around the point
+	GDSBB point;
+	GDSArrayClip clips[4];
+	unsigned int first, last;
+	point.addPoint(Point2D(x, y));
 	for(unsigned int i=0;i<obj->refs.size();i++)
-		tracePoint(x, y, obj->refs[i]->object, object_mat * obj->refs[i]->mat, layer);
+	{
+		GDSRef *ref = obj->refs[i];
+		if(!ref->array)
+		{
+			tracePoint(x, y, ref->object, object_mat * ref->mat, layer);
+			continue;
+		}
+
+		clipArray(ref, object_mat, point, clips);
+		for(unsigned int row=0;row<ref->array->rows;row++)
+		{
+			if(!ref->clipRow(clips, 4, row, first, last))
+				continue;
+			for(unsigned int column=first;column<=last;column++)
+				tracePoint(x, y, ref->object, object_mat * ref->element(column, row), layer);
+		}
+	}
 }
 
 void 
@@ -485,15 +537,34 @@ UIHighlight::intersectTraverse(GDSPolygon *poly, GDSMat poly_mat, GDSObject *obj
 	// Intersect with this object
 	intersectPolyOnObject(poly, poly_mat, object, object_mat);
 
-	// Go to sub cells
+	// Go to sub cells, only the elements of arrays around the polygon
+	GDSArrayClip clips[4];
+	unsigned int first, last;
 	for(unsigned int i=0;i<object->refs.size();i++)
-		intersectTraverse(poly, poly_mat, object->refs[i]->object, object_mat * object->refs[i]->mat);
+	{
+		GDSRef *ref = object->refs[i];
+		if(!ref->array)
+		{
+			intersectTraverse(poly, poly_mat, ref->object, object_mat * ref->mat);
+			continue;
+		}
+
+		clipArray(ref, object_mat, bb, clips);
+		for(unsigned int row=0;row<ref->array->rows;row++)
+		{
+			if(!ref->clipRow(clips, 4, row, first, last))
+				continue;
+			for(unsigned int column=first;column<=last;column++)
+				intersectTraverse(poly, poly_mat, ref->object, object_mat * ref->element(column, row));
+		}
+	}
 }
 
 void 
 UIHighlight::intersectPolyOnObject(GDSPolygon *poly, GDSMat poly_mat, GDSObject *object, GDSMat object_mat)
 {
 	GDSPolygon *target_poly;
+	ProcessLayer *target_layer;
 
 	// Transform poly into worldspace -> do this on root level
 	GDSPolygon transformed_poly = *poly;
@@ -507,29 +578,29 @@ UIHighlight::intersectPolyOnObject(GDSPolygon *poly, GDSMat poly_mat, GDSObject
 
 	for(unsigned int i=0;i<object->PolygonItems.size();i++)
 	{
-		target_poly = object->PolygonItems[i];
-
-		// Possible reject on layers
-		if(!target_poly->GetLayer()->Show)
+		// Possible reject on layers, from the arena arrays
+		target_layer = object->GetPolygonLayer(i);
+		if(!target_layer->Show)
 			continue;
-		if(target_poly->GetLayer() != poly->GetLayer())
+		if(target_layer != poly->GetLayer())
 		{			
-			if(target_poly->GetLayer()->Height > poly->GetLayer()->Height+poly->GetLayer()->Thickness + 1.0f)
+			if(target_layer->Height > poly->GetLayer()->Height+poly->GetLayer()->Thickness + 1.0f)
 				continue; // Too high
-			if(target_poly->GetLayer()->Height + target_poly->GetLayer()->Thickness + 1.0f < poly->GetLayer()->Height)
+			if(target_layer->Height + target_layer->Thickness + 1.0f < poly->GetLayer()->Height)
 				continue; // Too low
-			if(target_poly->GetLayer()->Metal == poly->GetLayer()->Metal)
+			if(target_layer->Metal == poly->GetLayer()->Metal)
 				continue; // Only jump between VIA -> METAL or METAL -> VIA
 		}
 		else
 		{
-			if(!target_poly->GetLayer()->Metal)
+			if(!target_layer->Metal)
 				continue; // Do not intersect within VIA layers
 		}
 
 		// Do bounds overlap?
-		if(!GDSBB::intersect(*transformed_poly.GetBBox(), *target_poly->GetBBox()))
+		if(!GDSBB::intersect(*transformed_poly.GetBBox(), *object->GetPolygonBBox(i)))
 			continue;		
+		target_poly = object->PolygonItems[i];
 
 		// Do we already have this polygon?
 		map<GDSMat, ObjectInstance>::iterator cur_instance = instances.find(object_mat);
@@ -34,7 +34,7 @@ void WinTopmap::build_topcell_list(class GDSObject *object, struct ListItem *par
 	newitem->Text = object->GetName();
 
 	// Select item if it corresponds to the topcell (listview will prevent double selections automatically, only first occurence will be selected)
-	if (strcmp(newitem->Text.c_str(), wm->getWorld()->_topcell->GetName()) == 0)
+	if (object == wm->getWorld()->_topcell)
 		newitem->Selected = true;
 	else
 		newitem->Selected = false;
@@ -81,7 +81,9 @@ WinTopmap::WinTopmap()
 	SetSingleSelect(true);
 	SetSorted(true);
 
-	build_topcell_list(wm->getWorld()->_Objects->GetTopObject(), NULL);
+	// Every cell that is not referenced can be a top cell
+	for (unsigned int i = 0; i < wm->getWorld()->_Objects->GetNumRoots(); i++)
+		build_topcell_list(wm->getWorld()->_Objects->GetRoot(i), NULL);
 
 	// Always expand first item in the list
 	if (GetFirst() && GetFirst()->Children.size() > 0)
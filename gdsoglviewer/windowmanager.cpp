@@ -53,13 +53,18 @@ void WindowManager::printUsage()
 {
 	v_printf(1, "\n");
 	v_printf(1, "GDS3D is a program for viewing a GDSII file in 3D.\n");
-	v_printf(1, "Usage: GDS3D -p process.txt -i input.gds [-t topcell] [-f] [-u] [-h] [-v]\n\n");
+	v_printf(1, "Usage: GDS3D -p process.txt -i input.gds [-t topcell] [-f] [-u] [-n] [-m] [-b megabytes] [-g megabytes] [-c] [-h] [-v]\n\n");
 	v_printf(1, "Options\n");
 	v_printf(1, " -p\t\tSpecify process file\n");
 	v_printf(1, " -i\t\tInput GDSII file\n");
 	v_printf(1, " -t\t\tSpecify top cell name\n");
 	v_printf(1, " -f\t\tFullscreen mode\n");
 	v_printf(1, " -u\t\tDon't check GDS for update\n");
+	v_printf(1, " -n\t\tDon't use the scene cache\n");
+	v_printf(1, " -m\t\tMerge the polygons of each layer, hiding inner walls\n");
+	v_printf(1, " -b\t\tMemory for flattening the hierarchy in MB, default %d\n", FLATTEN_BUDGET);
+	v_printf(1, " -g\t\tSize of each geometry buffer in MB, default %d, 0 for 64K vertices\n", GEOMETRY_POOL);
+	v_printf(1, " -c\t\tCompact vertices, less video memory at a slight loss of precision\n");
 	v_printf(1, " -h\t\tDisplay this help\n");
 	v_printf(1, " -v\t\tVerbose output\n\n");
 }
@@ -82,6 +87,11 @@ bool WindowManager::commandLineParameters(int argc, char *argv[])
 	char *gdsfile=NULL;
 	char *processfile=NULL;
 	char *topcell=NULL;
+	bool cache=true;
+	bool merge=false;
+	int budget=FLATTEN_BUDGET;
+	int pool=GEOMETRY_POOL;
+	bool compact=false;
 
 	for(int i=1; i<argc; i++){
 		if(argv[i][0] == '-'){
@@ -117,6 +127,28 @@ bool WindowManager::commandLineParameters(int argc, char *argv[])
 				verbose_output++;
 			}else if(strncmp(argv[i], "-u", strlen("-u"))==0){
 				update=0;
+			}else if(strncmp(argv[i], "-n", strlen("-n"))==0){
+				cache=false;
+			}else if(strncmp(argv[i], "-m", strlen("-m"))==0){
+				merge=true;
+			}else if(strncmp(argv[i], "-b", strlen("-b"))==0){
+				if(i==argc-1 || atoi(argv[i+1]) < 0){
+					v_printf(-1, "Error: -b switch given but no memory budget specified.\n\n");
+					printUsage();
+					return false;
+				}else{
+					budget = atoi(argv[i+1]);
+				}
+			}else if(strncmp(argv[i], "-g", strlen("-g"))==0){
+				if(i==argc-1 || atoi(argv[i+1]) < 0){
+					v_printf(-1, "Error: -g switch given but no buffer size specified.\n\n");
+					printUsage();
+					return false;
+				}else{
+					pool = atoi(argv[i+1]);
+				}
+			}else if(strncmp(argv[i], "-c", strlen("-c"))==0){
+				compact=true;
 			}else{
 				v_printf(1, "Unknown commandline option given: ");
 				v_printf(1, argv[i]);
@@ -156,13 +188,22 @@ bool WindowManager::commandLineParameters(int argc, char *argv[])
 	{
         v_printf(1, "Opening GDS file \"%s\"..\n\n", gdsfile);
         
+		htime *loadtime = new_timer();
+		timer(loadtime, 1);
+
 		world = new GDSParse_ogl(process, false);
+		if(cache)
+			world->SetCacheFile(gdsfile);
+		world->SetMerge(merge);
+		world->SetFlattenBudget(budget);
+		renderer.setGeometryPool(pool);
+		renderer.setCompactVertices(compact);
 		filename = gdsfile;
 		techname = processfile;
 		if(!world->Parse(iptr, topcell))
 		{
-			if(!update)
-				fclose(iptr);
+			v_printf(1, "GDS file parsed in %.2f seconds.\n\n", timer(loadtime, 0));
+			// Keep the file open, cells are loaded from it on demand
 			if(!world->SetTopcell(topcell))
 			{
 				//delete process;
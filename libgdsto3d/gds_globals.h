@@ -35,6 +35,7 @@
 #include <list>
 #include <set>
 #include <map>
+#include <algorithm>
 using namespace std;
 
 extern int verbose_output;
@@ -73,6 +74,15 @@ void v_printf(const int level, const char *fmt, ...); // Message feedback
 #endif
 
 
+// Orders C strings in maps and sets
+struct CompareName
+{
+	bool operator()(const char *a, const char *b) const
+	{
+		return strcmp(a, b) < 0;
+	}
+};
+
 // Move these gds specifications
 #ifdef WIN32
 	#include <stdint.h>
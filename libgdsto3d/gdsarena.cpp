@@ -0,0 +1,129 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdsarena.h"
+
+// GDSPolygonArena Class
+GDSPolygonArena::GDSPolygonArena()
+{
+	used = size = total = 0;
+	scan = NULL;
+}
+
+GDSPolygonArena::~GDSPolygonArena()
+{
+	if(scan)
+		delete scan;
+	for(unsigned int i=0;i<blocks.size();i++)
+		delete [] blocks[i];
+}
+
+GDSPolygon *GDSPolygonArena::NewPolygon()
+{
+	if(!total++)
+	{
+		first._Arena = this;
+		return &first;
+	}
+
+	// Blocks double with the cell, so small cells waste little
+	if(used == size)
+	{
+		size = std::min(total-1, (unsigned int)GDS_ARENA_BLOCK);
+		blocks.push_back(new GDSPolygon[size]);
+		used = 0;
+	}
+	blocks.back()[used]._Arena = this;
+	return &blocks.back()[used++];
+}
+
+// More of the array unused than it is worth keeping
+static bool Slack(unsigned long capacity, unsigned long used)
+{
+	return capacity - used > capacity/GDS_ARENA_SLACK;
+}
+
+void GDSPolygonArena::Pack(const vector<GDSPolygon*> &items)
+{
+	unsigned long points = 0, triangles = 0, rectangles = 0;
+	unsigned int packed = GetCount();
+	vector<Point2D> packedCoords;
+	vector<int> packedIndices;
+	vector<float> packedRects;
+	GDSPolygon *polygon;
+
+	for(unsigned int i=0;i<items.size();i++)
+	{
+		polygon = items[i];
+		points += polygon->_Points;
+		triangles += polygon->_Indices;
+		rectangles += polygon->_Rects;
+	}
+
+	// Shared and moved polygons leave their ranges behind, and the arrays grew by doubling.
+	// The ranges left are copied in the order of the items
+	bool squeezeCoords = Slack(coords.capacity(), points);
+	bool squeezeIndices = Slack(indices.capacity(), triangles);
+	bool squeezeRects = Slack(rects.capacity(), rectangles);
+	if(squeezeCoords || squeezeIndices || squeezeRects)
+	{
+		packedCoords.reserve(squeezeCoords ? points : 0);
+		packedIndices.reserve(squeezeIndices ? triangles : 0);
+		packedRects.reserve(squeezeRects ? rectangles : 0);
+		for(unsigned int i=0;i<items.size();i++)
+		{
+			polygon = items[i];
+			if(squeezeCoords)
+			{
+				packedCoords.insert(packedCoords.end(), coords.begin()+polygon->_First, coords.begin()+polygon->_First+polygon->_Points);
+				polygon->_First = packedCoords.size()-polygon->_Points;
+			}
+			if(squeezeIndices)
+			{
+				packedIndices.insert(packedIndices.end(), indices.begin()+polygon->_FirstIndex, indices.begin()+polygon->_FirstIndex+polygon->_Indices);
+				polygon->_FirstIndex = packedIndices.size()-polygon->_Indices;
+			}
+			if(squeezeRects)
+			{
+				packedRects.insert(packedRects.end(), rects.begin()+polygon->_FirstRect, rects.begin()+polygon->_FirstRect+polygon->_Rects);
+				polygon->_FirstRect = packedRects.size()-polygon->_Rects;
+			}
+		}
+		if(squeezeCoords)
+			coords.swap(packedCoords);
+		if(squeezeIndices)
+			indices.swap(packedIndices);
+		if(squeezeRects)
+			rects.swap(packedRects);
+	}
+
+	// Layers and bounds to scan, from the polygons added since
+	if(items.size() < packed + GDS_ARENA_PACK)
+		return;
+	if(!scan)
+		scan = new GDSPolygonScan();
+	scan->layers.reserve(items.size());
+	scan->bboxes.reserve(items.size());
+	for(unsigned int i=packed;i<items.size();i++)
+	{
+		scan->layers.push_back(items[i]->_Layer);
+		scan->bboxes.push_back(items[i]->bbox);
+	}
+}
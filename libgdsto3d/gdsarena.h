@@ -0,0 +1,93 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSARENA_H__
+#define __GDSARENA_H__
+
+#include "gds_globals.h"
+#include "gdspolygon.h"
+
+#define GDS_ARENA_BLOCK 1024 // Polygons in the largest block
+#define GDS_ARENA_PACK 8 // Fewer new polygons are not worth the scan arrays
+#define GDS_ARENA_SLACK 8 // Arrays with more than an eighth unused are squeezed
+
+// Geometry of one cell. The polygons come from blocks that never move, and
+// their points, triangles and rectangles go straight into contiguous arrays
+// which the polygons only view. A cell of a million rectangles then takes a
+// few dozen allocations instead of three million. Shared polygons keep their
+// shape and leave their points behind, Pack() squeezes those out.
+class GDSPolygonArena
+{
+private:
+	vector<GDSPolygon*>	blocks;
+	unsigned int		used; // Of the last block
+	unsigned int		size; // Of the last block
+	unsigned int		total; // Polygons in the arena
+	class GDSPolygonScan	*scan; // Made once enough polygons are packed
+
+public:
+	vector<Point2D>		coords;
+	vector<int>		indices;
+	vector<float>		rects; // X0,Y0,X1,Y1
+
+private:
+	GDSPolygon		first; // Most cells hold a single polygon, it needs no block
+
+public:
+	GDSPolygonArena();
+	~GDSPolygonArena();
+
+	GDSPolygon *NewPolygon(); // Stays where it is until the arena goes
+	void Pack(const vector<GDSPolygon*> &items); // Squeezes the arrays, layers and bounds of items past GetCount() go into the scan arrays
+	unsigned int GetCount() const; // Packed polygons, the first ones of the items
+	struct ProcessLayer *GetLayer(unsigned int index) const; // Of a packed polygon
+	GDSBB *GetBBox(unsigned int index) const; // Likewise
+	bool isPrivate() const; // Made by a polygon outside any cell, for itself alone
+};
+
+// Per packed polygon, scanned without touching the polygons
+class GDSPolygonScan
+{
+public:
+	vector<struct ProcessLayer*>	layers;
+	vector<GDSBB>		bboxes;
+};
+
+inline unsigned int GDSPolygonArena::GetCount() const
+{
+	return scan ? scan->layers.size() : 0;
+}
+
+inline struct ProcessLayer *GDSPolygonArena::GetLayer(unsigned int index) const
+{
+	return scan->layers[index];
+}
+
+inline GDSBB *GDSPolygonArena::GetBBox(unsigned int index) const
+{
+	return &scan->bboxes[index];
+}
+
+inline bool GDSPolygonArena::isPrivate() const
+{
+	return total == 0;
+}
+
+#endif // __GDSARENA_H__
@@ -0,0 +1,518 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdscache.h"
+#include "gdsparse.h"
+#include "gdsrecord.h"
+
+#define GDS_CACHE_BYTEORDER 0x01020304
+
+GDSCache::GDSCache(const char *filename, const byte *gds, size_t size, class GDSProcess *process)
+{
+	vector<struct ProcessLayer*> layers;
+	struct ProcessLayer *layer;
+	int32_t values[2];
+
+	_filename = new char[strlen(filename)+1];
+	strcpy(_filename, filename);
+
+	_gdshash = Hash(gds, size, 0);
+	_gdssize = size;
+
+	// Only the layer properties that end up in the geometry
+	GetLayers(process, layers);
+	_processhash = Hash(NULL, 0, layers.size());
+	for(unsigned int i=0; i<layers.size(); i++){
+		layer = layers[i];
+		values[0] = layer->Layer;
+		values[1] = layer->Datatype;
+		_processhash = Hash((const byte*)values, sizeof(values), _processhash);
+		_processhash = Hash((const byte*)&layer->Height, sizeof(float), _processhash);
+		_processhash = Hash((const byte*)&layer->Thickness, sizeof(float), _processhash);
+	}
+}
+
+GDSCache::~GDSCache()
+{
+	delete [] _filename;
+}
+
+void GDSCache::GetLayers(class GDSProcess *process, vector<struct ProcessLayer*> &layers)
+{
+	struct ProcessLayer *layer;
+
+	layers.clear();
+	if(!process)
+		return;
+
+	for(layer = process->GetLayer(); layer; layer = layer->Next)
+		layers.push_back(layer);
+}
+
+// 64-bit hash over whole words, four independent lanes to keep up with memory
+uint64_t GDSCache::Hash(const byte *data, size_t size, uint64_t seed)
+{
+	const uint64_t prime = 0x9E3779B97F4A7C15ULL;
+	uint64_t lane[4], word[4];
+	uint64_t h;
+	size_t i = 0;
+
+	for(int j=0; j<4; j++)
+		lane[j] = seed + prime*(j+1);
+
+	for(; i+32<=size; i+=32)
+	{
+		memcpy(word, data+i, 32);
+		for(int j=0; j<4; j++){
+			lane[j] = (lane[j] ^ word[j]) * 0xFF51AFD7ED558CCDULL;
+			lane[j] ^= lane[j] >> 32;
+		}
+	}
+
+	h = (uint64_t)size * prime;
+	for(int j=0; j<4; j++)
+		h = (h ^ lane[j]) * 0xC4CEB9FE1A85EC53ULL;
+
+	for(; i<size; i++)
+		h = (h ^ data[i]) * prime;
+
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return h;
+}
+
+bool GDSCache::Load(class GDSParse *parse)
+{
+	GDSRecordReader file;
+	const GDSCacheHeader *header;
+	const GDSCacheObject *objects;
+	const GDSCachePolygon *polygons;
+	const GDSCachePath *paths;
+	const GDSCacheSRef *srefs;
+	const GDSCacheARef *arefs;
+	const float *points, *rects, *pathpoints;
+	const int32_t *indices;
+	const char *names;
+	const byte *data;
+	size_t size, expected;
+	vector<struct ProcessLayer*> layers;
+	vector<GDSObject*> created;
+	GDSObject *object;
+	GDSPolygon *polygon;
+	FILE *iptr;
+
+	iptr = fopen(_filename, "rb");
+	if(!iptr)
+		return false;
+
+	if(!file.Open(iptr) || !file.IsMapped()){
+		fclose(iptr);
+		return false;
+	}
+	data = file.GetData(0);
+	size = file.GetSize();
+
+	// Is this cache made for this GDS and process?
+	header = (const GDSCacheHeader*)data;
+	if(size < sizeof(GDSCacheHeader) || memcmp(header->magic, GDS_CACHE_MAGIC, 8) || header->version != GDS_CACHE_VERSION ||
+		header->byteorder != GDS_CACHE_BYTEORDER || header->headersize != sizeof(GDSCacheHeader) ||
+		header->gdshash != _gdshash || header->gdssize != _gdssize || header->processhash != _processhash){
+		v_printf(1, "Scene cache is out of date.\n");
+		fclose(iptr);
+		return false;
+	}
+
+	expected = sizeof(GDSCacheHeader) + header->objects*sizeof(GDSCacheObject) + header->polygons*sizeof(GDSCachePolygon) +
+		header->paths*sizeof(GDSCachePath) + header->srefs*sizeof(GDSCacheSRef) + header->arefs*sizeof(GDSCacheARef) +
+		(header->points*2 + header->rects*4 + header->pathpoints*2)*sizeof(float) + header->indices*sizeof(int32_t) + header->names;
+	if(size != expected || header->names == 0 || data[size-1] != 0){
+		v_printf(1, "Scene cache is damaged.\n");
+		fclose(iptr);
+		return false;
+	}
+
+	objects = (const GDSCacheObject*)(data + sizeof(GDSCacheHeader));
+	polygons = (const GDSCachePolygon*)(objects + header->objects);
+	paths = (const GDSCachePath*)(polygons + header->polygons);
+	srefs = (const GDSCacheSRef*)(paths + header->paths);
+	arefs = (const GDSCacheARef*)(srefs + header->srefs);
+	points = (const float*)(arefs + header->arefs);
+	indices = (const int32_t*)(points + header->points*2);
+	rects = (const float*)(indices + header->indices);
+	pathpoints = rects + header->rects*4;
+	names = (const char*)(pathpoints + header->pathpoints*2);
+
+	GetLayers(parse->_process, layers);
+
+	for(uint64_t i=0; i<header->objects; i++){
+		if(objects[i].name >= header->names){
+			v_printf(1, "Scene cache is damaged.\n");
+			fclose(iptr);
+			return false;
+		}
+	}
+
+	// Create all objects first, references point forward as well
+	for(uint64_t i=0; i<header->objects; i++)
+		created.push_back(parse->_Objects->AddObject(parse->NewObject((char*)names + objects[i].name)));
+
+	// All ranges are checked on the fly, the tables were sized above
+	uint64_t polygon_i = 0, path_i = 0, sref_i = 0, aref_i = 0, point_i = 0, index_i = 0, rect_i = 0, pathpoint_i = 0;
+	bool damaged = false;
+	for(uint64_t i=0; i<header->objects && !damaged; i++){
+		object = created[i];
+
+		for(uint32_t j=0; j<objects[i].polygons && !damaged; j++, polygon_i++){
+			if(polygon_i >= header->polygons){
+				damaged = true;
+				break;
+			}
+			const GDSCachePolygon &p = polygons[polygon_i];
+			if(p.layer < 0 || p.layer >= (int32_t)layers.size() ||
+				point_i + p.points > header->points || index_i + p.indices > header->indices || rect_i + p.rects > header->rects){
+				damaged = true;
+				break;
+			}
+
+			polygon = object->GetArena()->NewPolygon();
+			*polygon = GDSPolygon(p.height, p.thickness, layers[p.layer]);
+			object->PolygonItems.push_back(polygon);
+			polygon->AddPoints(points + point_i*2, p.points);
+			for(uint32_t k=0; k<p.indices; k++){
+				if((uint32_t)indices[index_i+k] >= p.points)
+					damaged = true;
+			}
+			polygon->SetTesselation((const int*)indices + index_i, p.indices, rects + rect_i*4, p.rects*4);
+			point_i += p.points;
+			index_i += p.indices;
+			rect_i += p.rects;
+		}
+
+		for(uint32_t j=0; j<objects[i].paths && !damaged; j++, path_i++){
+			if(path_i >= header->paths){
+				damaged = true;
+				break;
+			}
+			const GDSCachePath &p = paths[path_i];
+			if(p.layer < 0 || p.layer >= (int32_t)layers.size() || pathpoint_i + p.points > header->pathpoints){
+				damaged = true;
+				break;
+			}
+
+			object->PathItems.push_back(new GDSPath(p.type, p.height, p.thickness, p.points, p.width, p.bgnextn, p.endextn, layers[p.layer]));
+			object->PathItems.back()->SetPoints(pathpoints + pathpoint_i*2);
+			pathpoint_i += p.points;
+		}
+
+		for(uint32_t j=0; j<objects[i].srefs && !damaged; j++, sref_i++){
+			if(sref_i >= header->srefs || srefs[sref_i].object >= header->objects){
+				damaged = true;
+				break;
+			}
+			const GDSCacheSRef &s = srefs[sref_i];
+
+			object->AddSRef(created[s.object]->GetID(), s.x, s.y, s.flipped, s.mag);
+			object->SetSRefRotation(s.rotate[0], s.rotate[1], s.rotate[2]);
+			object->SRefItems.back()->object = created[s.object];
+		}
+
+		for(uint32_t j=0; j<objects[i].arefs && !damaged; j++, aref_i++){
+			if(aref_i >= header->arefs || arefs[aref_i].object >= header->objects){
+				damaged = true;
+				break;
+			}
+			const GDSCacheARef &a = arefs[aref_i];
+
+			object->AddARef(created[a.object]->GetID(), a.x1, a.y1, a.x2, a.y2, a.x3, a.y3, a.columns, a.rows, a.flipped, a.mag);
+			object->SetARefRotation(a.rotate[0], a.rotate[1], a.rotate[2]);
+			object->ARefItems.back()->object = created[a.object];
+		}
+
+		object->PointCount = objects[i].pointcount;
+		object->RecordHash = objects[i].recordhash;
+		object->missingRefs = (objects[i].flags & GDS_CACHE_MISSINGREFS) != 0;
+
+		if(objects[i].flags & GDS_CACHE_PENDING){
+			if(objects[i].offset + objects[i].length > _gdssize){
+				damaged = true;
+				break;
+			}
+			GDSStructure &structure = parse->_Pending[object];
+			structure.object = object;
+			structure.offset = objects[i].offset;
+			structure.length = objects[i].length;
+		}
+	}
+	fclose(iptr);
+
+	if(damaged){
+		v_printf(1, "Scene cache is damaged.\n");
+		delete parse->_Objects;
+		parse->_Objects = new GDSObjectList;
+		parse->_Pending.clear();
+		return false;
+	}
+
+	parse->_units = header->units;
+	parse->_PathElements = (long)header->counters[0];
+	parse->_BoundaryElements = (long)header->counters[1];
+	parse->_BoxElements = (long)header->counters[2];
+	parse->_TextElements = (long)header->counters[3];
+	parse->_SRefElements = (long)header->counters[4];
+	parse->_ARefElements = (long)header->counters[5];
+
+	v_printf(1, "Loaded %d cells from the scene cache.\n", (int)header->objects);
+	return true;
+}
+
+bool GDSCache::Save(class GDSParse *parse)
+{
+	GDSCacheHeader header;
+	GDSCacheObject cobject;
+	GDSCachePolygon cpolygon;
+	GDSCachePath cpath;
+	GDSCacheSRef csref;
+	GDSCacheARef caref;
+	GDSObjectList *list = parse->_Objects;
+	GDSObject *object;
+	GDSPolygon *polygon;
+	GDSPath *path;
+	map<GDSObject*, uint32_t> objectindex;
+	map<GDSObject*, GDSStructure>::iterator pending;
+	vector<int32_t> indices;
+	vector<float> XY;
+	bool result;
+	FILE *optr;
+
+	char *tempname = new char[strlen(_filename)+5];
+	sprintf(tempname, "%s.tmp", _filename);
+
+	// Count everything for the header
+	memset(&header, 0, sizeof(header));
+	memset(&cobject, 0, sizeof(cobject)); // No stray bytes in the padding
+	memcpy(header.magic, GDS_CACHE_MAGIC, 8);
+	header.version = GDS_CACHE_VERSION;
+	header.byteorder = GDS_CACHE_BYTEORDER;
+	header.headersize = sizeof(GDSCacheHeader);
+	header.units = parse->_units;
+	header.gdshash = _gdshash;
+	header.gdssize = _gdssize;
+	header.processhash = _processhash;
+	header.objects = list->getNumObjects();
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		objectindex[object] = i;
+		header.names += strlen(object->GetName())+1;
+		header.polygons += object->PolygonItems.size();
+		header.paths += object->PathItems.size();
+		header.srefs += object->SRefItems.size();
+		header.arefs += object->ARefItems.size();
+		for(unsigned int j=0; j<object->PolygonItems.size(); j++){
+			polygon = object->PolygonItems[j];
+			header.points += polygon->GetPoints();
+			header.indices += polygon->GetNumIndices();
+			header.rects += polygon->GetNumRectangles();
+		}
+		for(unsigned int j=0; j<object->PathItems.size(); j++)
+			header.pathpoints += object->PathItems[j]->GetPoints();
+	}
+	header.counters[0] = parse->_PathElements;
+	header.counters[1] = parse->_BoundaryElements;
+	header.counters[2] = parse->_BoxElements;
+	header.counters[3] = parse->_TextElements;
+	header.counters[4] = parse->_SRefElements;
+	header.counters[5] = parse->_ARefElements;
+
+	optr = fopen(tempname, "wb");
+	if(!optr){
+		v_printf(1, "Unable to write scene cache \"%s\".\n", _filename);
+		delete [] tempname;
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, optr);
+
+	uint32_t name = 0;
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		pending = parse->_Pending.find(object);
+		cobject.recordhash = object->RecordHash;
+		cobject.offset = pending != parse->_Pending.end() ? pending->second.offset : 0;
+		cobject.length = pending != parse->_Pending.end() ? pending->second.length : 0;
+		cobject.name = name;
+		cobject.pointcount = object->PointCount;
+		cobject.flags = (object->missingRefs ? GDS_CACHE_MISSINGREFS : 0) | (pending != parse->_Pending.end() ? GDS_CACHE_PENDING : 0);
+		cobject.polygons = object->PolygonItems.size();
+		cobject.paths = object->PathItems.size();
+		cobject.srefs = object->SRefItems.size();
+		cobject.arefs = object->ARefItems.size();
+		fwrite(&cobject, sizeof(cobject), 1, optr);
+		name += strlen(object->GetName())+1;
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->PolygonItems.size(); j++){
+			polygon = object->PolygonItems[j];
+			cpolygon.height = polygon->GetHeight();
+			cpolygon.thickness = polygon->GetThickness();
+			cpolygon.layer = polygon->GetLayer() ? polygon->GetLayer()->Position : -1;
+			cpolygon.points = polygon->GetPoints();
+			cpolygon.indices = polygon->GetNumIndices();
+			cpolygon.rects = polygon->GetNumRectangles();
+			fwrite(&cpolygon, sizeof(cpolygon), 1, optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->PathItems.size(); j++){
+			path = object->PathItems[j];
+			cpath.type = path->GetType();
+			cpath.height = path->GetHeight();
+			cpath.thickness = path->GetThickness();
+			cpath.width = path->GetWidth();
+			cpath.bgnextn = path->GetBgnExtn();
+			cpath.endextn = path->GetEndExtn();
+			cpath.layer = path->GetLayer() ? path->GetLayer()->Position : -1;
+			cpath.points = path->GetPoints();
+			fwrite(&cpath, sizeof(cpath), 1, optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->SRefItems.size(); j++){
+			SRefElement *sref = object->SRefItems[j];
+			csref.object = objectindex[sref->object];
+			csref.x = sref->X;
+			csref.y = sref->Y;
+			csref.mag = sref->Mag;
+			csref.rotate[0] = sref->Rotate.X;
+			csref.rotate[1] = sref->Rotate.Y;
+			csref.rotate[2] = sref->Rotate.Z;
+			csref.flipped = sref->Flipped;
+			fwrite(&csref, sizeof(csref), 1, optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->ARefItems.size(); j++){
+			ARefElement *aref = object->ARefItems[j];
+			caref.object = objectindex[aref->object];
+			caref.x1 = aref->X1;
+			caref.y1 = aref->Y1;
+			caref.x2 = aref->X2;
+			caref.y2 = aref->Y2;
+			caref.x3 = aref->X3;
+			caref.y3 = aref->Y3;
+			caref.mag = aref->Mag;
+			caref.rotate[0] = aref->Rotate.X;
+			caref.rotate[1] = aref->Rotate.Y;
+			caref.rotate[2] = aref->Rotate.Z;
+			caref.columns = aref->Columns;
+			caref.rows = aref->Rows;
+			caref.flipped = aref->Flipped;
+			fwrite(&caref, sizeof(caref), 1, optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->PolygonItems.size(); j++){
+			polygon = object->PolygonItems[j];
+			const Point2D *coords = polygon->GetCoords();
+			Point2D offset = polygon->GetOffset();
+			XY.resize(polygon->GetPoints()*2); // Shared shapes are stored with every polygon
+			for(unsigned int k=0; k<polygon->GetPoints(); k++){
+				XY[k*2+0] = coords[k].X + offset.X;
+				XY[k*2+1] = coords[k].Y + offset.Y;
+			}
+			if(!XY.empty())
+				fwrite(&XY[0], sizeof(float), XY.size(), optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->PolygonItems.size(); j++){
+			polygon = object->PolygonItems[j];
+			indices.assign(polygon->GetIndices(), polygon->GetIndices() + polygon->GetNumIndices());
+			if(!indices.empty())
+				fwrite(&indices[0], sizeof(int32_t), indices.size(), optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->PolygonItems.size(); j++){
+			polygon = object->PolygonItems[j];
+			const float *rects = polygon->GetRectangles();
+			Point2D offset = polygon->GetOffset();
+			XY.resize(polygon->GetNumRectangles()*4); // Absolute, like the points
+			for(unsigned int k=0; k<XY.size(); k+=2){
+				XY[k+0] = rects[k+0] + offset.X;
+				XY[k+1] = rects[k+1] + offset.Y;
+			}
+			if(!XY.empty())
+				fwrite(&XY[0], sizeof(float), XY.size(), optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		for(unsigned int j=0; j<object->PathItems.size(); j++){
+			path = object->PathItems[j];
+			XY.resize(path->GetPoints()*2);
+			for(unsigned int k=0; k<path->GetPoints(); k++){
+				XY[k*2] = path->GetXCoords(k);
+				XY[k*2+1] = path->GetYCoords(k);
+			}
+			if(!XY.empty())
+				fwrite(&XY[0], sizeof(float), XY.size(), optr);
+		}
+	}
+
+	for(unsigned int i=0; i<list->getNumObjects(); i++){
+		object = list->getObject(i);
+		fwrite(object->GetName(), 1, strlen(object->GetName())+1, optr);
+	}
+
+	result = !ferror(optr);
+	if(fclose(optr) != 0)
+		result = false;
+
+	// Replace the old cache only when the new one is complete
+	if(result){
+		remove(_filename);
+		result = rename(tempname, _filename) == 0;
+	}
+	if(!result){
+		v_printf(1, "Unable to write scene cache \"%s\".\n", _filename);
+		remove(tempname);
+	}else{
+		v_printf(2, "Scene cache written to \"%s\".\n", _filename);
+	}
+
+	delete [] tempname;
+	return result;
+}
@@ -0,0 +1,146 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSCACHE_H__
+#define __GDSCACHE_H__
+
+#include "gds_globals.h"
+#include "process_cfg.h"
+#include <stdint.h>
+
+#define GDS_CACHE_EXTENSION ".g3dcache"
+#define GDS_CACHE_MAGIC "GDS3DSC"
+#define GDS_CACHE_VERSION 4 // Bump on every change to the layout below
+
+// The cache file is the header followed by these tables, back to back:
+// objects, polygons, paths, srefs, arefs, polygon coordinates (X,Y floats),
+// triangle indices, rectangles (X0,Y0,X1,Y1 floats), path coordinates and
+// the zero terminated cell names. Every object owns the next run of entries
+// in each table, every polygon the next run of coordinates, indices and
+// rectangles. Numbers are in host byte order.
+typedef struct GDSCacheHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byteorder; // 0x01020304 as written by the host
+	uint32_t	headersize;
+	float		units;
+	uint64_t	gdshash;
+	uint64_t	gdssize;
+	uint64_t	processhash;
+
+	uint64_t	objects;
+	uint64_t	polygons;
+	uint64_t	paths;
+	uint64_t	srefs;
+	uint64_t	arefs;
+	uint64_t	points; // Polygon coordinates
+	uint64_t	indices;
+	uint64_t	rects;
+	uint64_t	pathpoints;
+	uint64_t	names; // Bytes
+
+	// Element counters of the original parse, for the summary
+	int64_t		counters[6];
+} GDSCacheHeader;
+
+#define GDS_CACHE_MISSINGREFS	1
+#define GDS_CACHE_PENDING	2 // Geometry not decoded, offset and length locate its records
+
+typedef struct GDSCacheObject
+{
+	uint64_t	recordhash;
+	uint64_t	offset;
+	uint64_t	length;
+	uint32_t	name; // Offset in the name table
+	int32_t		pointcount;
+	uint32_t	flags;
+	uint32_t	polygons;
+	uint32_t	paths;
+	uint32_t	srefs;
+	uint32_t	arefs;
+} GDSCacheObject;
+
+typedef struct GDSCachePolygon
+{
+	float		height;
+	float		thickness;
+	int32_t		layer; // Position in the process layer list
+	uint32_t	points;
+	uint32_t	indices;
+	uint32_t	rects;
+} GDSCachePolygon;
+
+typedef struct GDSCachePath
+{
+	int32_t		type;
+	float		height;
+	float		thickness;
+	float		width;
+	float		bgnextn;
+	float		endextn;
+	int32_t		layer;
+	uint32_t	points;
+} GDSCachePath;
+
+typedef struct GDSCacheSRef
+{
+	uint32_t	object; // Resolved reference
+	float		x, y;
+	float		mag;
+	float		rotate[3];
+	int32_t		flipped;
+} GDSCacheSRef;
+
+typedef struct GDSCacheARef
+{
+	uint32_t	object; // Resolved reference
+	float		x1, y1, x2, y2, x3, y3;
+	float		mag;
+	float		rotate[3];
+	int32_t		columns, rows;
+	int32_t		flipped;
+} GDSCacheARef;
+
+// Binary snapshot of a parsed and tesselated library. It is keyed by a hash
+// of the GDS contents and of the process layers, so a stale cache is never
+// used. The hierarchy is stored before collapsing, because that depends on
+// the top cell picked at runtime.
+class GDSCache
+{
+private:
+	char		*_filename;
+	uint64_t	_gdshash;
+	uint64_t	_gdssize;
+	uint64_t	_processhash;
+
+	void GetLayers(class GDSProcess *process, vector<struct ProcessLayer*> &layers);
+
+public:
+	GDSCache(const char *filename, const byte *gds, size_t size, class GDSProcess *process);
+	~GDSCache();
+
+	bool Load(class GDSParse *parse); // Fills the object list of parse
+	bool Save(class GDSParse *parse);
+
+	static uint64_t Hash(const byte *data, size_t size, uint64_t seed);
+};
+
+#endif // __GDSCACHE_H__
@@ -51,7 +51,7 @@ typedef struct SRefElement {
 	float X;
 	float Y;
 	float Mag;
-	char *Name;
+	int NameID; // In gds_names, -1 if it is not a known cell
 	Transform Rotate;
 	int Flipped;
 
@@ -69,7 +69,7 @@ typedef struct ARefElement {
 	float Mag;
 	int Columns;
 	int Rows;
-	char *Name;
+	int NameID; // In gds_names, -1 if it is not a known cell
 	Transform Rotate;
 	int Flipped;
 
@@ -0,0 +1,309 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdsflatten.h"
+#include "gdsobject.h"
+#include <limits.h>
+
+#define FLATTEN_NONE	0xFFFFFFFF // Not seen yet
+#define FLATTEN_SEEN	0xFFFFFFFE // Below it, keeps a loop of references from recursing forever
+
+GDSFlattenPlan::GDSFlattenPlan(unsigned long budget)
+{
+	_Budget = (unsigned long)((double)budget*1024*1024/FLATTEN_POINT_BYTES);
+	_Spent = 0;
+	_Copied = 0;
+	_Kept = 0;
+}
+
+// Depth first, children before their parents
+void GDSFlattenPlan::Order(GDSObject *object, vector<GDSObject*> &order)
+{
+	_Index[object->GetID()] = FLATTEN_SEEN;
+	for(unsigned int i=0;i<object->refs.size();i++)
+	{
+		if(_Index[object->refs[i]->object->GetID()] == FLATTEN_NONE)
+			Order(object->refs[i]->object, order);
+	}
+	order.push_back(object);
+}
+
+// Cheapest on top of the heap
+static bool costlier(const pair<double, unsigned int> &a, const pair<double, unsigned int> &b)
+{
+	return a > b;
+}
+
+void GDSFlattenPlan::Flat(unsigned int cell)
+{
+	FlattenCell &child = _Cells[cell];
+	for(unsigned int i=child.parents;i<child.parents+child.numParents;i++)
+	{
+		double cost = 0; // Points per draw call saved
+		if(!child.layers.empty())
+			cost = child.points/(_Cells[_Groups[_Parents[i]].parent].instances*child.layers.size());
+		else if(child.points)
+			continue; // Nothing drawn, nothing to gain
+		_Ready.push_back(pair<double, unsigned int>(cost, _Parents[i]));
+		push_heap(_Ready.begin(), _Ready.end(), costlier);
+	}
+}
+
+bool GDSFlattenPlan::Copy(FlattenGroup &group, unsigned long count)
+{
+	FlattenCell &parent = _Cells[group.parent];
+	FlattenCell &child = _Cells[group.child];
+	unsigned long copied = 0;
+	bool all = true;
+
+	for(unsigned int i=0;i<group.numRefs;i++)
+	{
+		unsigned int ref = _Refs[group.refs+i];
+		GDSArray *array = parent.object->refs[ref]->array;
+		unsigned long elements = parent.object->refs[ref]->count();
+		if(copied+elements > count)
+		{
+			all = false;
+			if(!array)
+				continue;
+			unsigned int line = min(array->columns, array->rows);
+			elements = (count-copied)/line*line; // The rows or columns that fit
+			if(!elements)
+				continue;
+		}
+		_Copy[parent.refs+ref] = elements;
+		copied += elements;
+	}
+	if(!copied)
+		return all;
+	_Spent += copied*child.points;
+	_Copied += copied;
+	parent.points += copied*child.points;
+
+	if(includes(parent.layers.begin(), parent.layers.end(), child.layers.begin(), child.layers.end()))
+		return all;
+	vector<int> layers;
+	set_union(parent.layers.begin(), parent.layers.end(), child.layers.begin(), child.layers.end(), back_inserter(layers));
+	parent.layers.swap(layers);
+	return all;
+}
+
+void GDSFlattenPlan::Build(GDSObject *top)
+{
+	vector<GDSObject*> order;
+	_Index.assign(gds_names.GetCount(), FLATTEN_NONE);
+	Order(top, order);
+
+	_Cells.resize(order.size());
+	for(unsigned int i=0;i<order.size();i++)
+		_Index[order[i]->GetID()] = i;
+
+	for(unsigned int i=0;i<_Cells.size();i++)
+	{
+		FlattenCell &cell = _Cells[i];
+		GDSObject *object = order[i];
+		cell.object = object;
+		cell.refs = _Children.size();
+		cell.instances = 0;
+		cell.points = object->PointCount;
+		cell.draws = 0;
+		cell.pending = 0;
+		cell.parents = 0;
+		cell.numParents = 0;
+		if(object->collapsed)
+			_Spent += min(object->FlattenedPoints, _Budget-_Spent); // Kept from before, on reload
+		for(unsigned int j=0;j<object->refs.size();j++)
+			_Children.push_back(_Index[object->refs[j]->object->GetID()]);
+
+		// Layers drawn by the cell itself
+		for(unsigned int j=0;j<object->PolygonItems.size();j++)
+		{
+			ProcessLayer *layer = object->GetPolygonLayer(j);
+			if(layer)
+				cell.layers.push_back(layer->Position);
+		}
+		sort(cell.layers.begin(), cell.layers.end());
+		cell.layers.erase(unique(cell.layers.begin(), cell.layers.end()), cell.layers.end());
+	}
+	_Copy.assign(_Children.size(), 0);
+
+	// Placements, parents before their children
+	_Cells.back().instances = 1;
+	for(int i=_Cells.size()-1;i>=0;i--)
+	{
+		for(unsigned int j=0;j<order[i]->refs.size();j++)
+		{
+			unsigned int child = _Children[_Cells[i].refs+j];
+			if(child < (unsigned int)i)
+				_Cells[child].instances += _Cells[i].instances*order[i]->refs[j]->count();
+		}
+	}
+
+	// References by parent and child, cells collapsed before keep what they have
+	vector<pair<unsigned int, unsigned int> > refs; // Child and reference
+	_Groups.reserve(_Children.size());
+	_Refs.reserve(_Children.size());
+	for(unsigned int i=0;i<_Cells.size();i++)
+	{
+		FlattenCell &cell = _Cells[i];
+		if(order[i]->collapsed)
+			continue;
+
+		refs.clear();
+		for(unsigned int j=0;j<order[i]->refs.size();j++)
+			refs.push_back(pair<unsigned int, unsigned int>(_Children[cell.refs+j], j));
+		sort(refs.begin(), refs.end());
+		for(unsigned int j=0;j<refs.size();j++)
+		{
+			if(!j || refs[j].first != refs[j-1].first)
+			{
+				FlattenGroup group;
+				group.parent = i;
+				group.child = refs[j].first;
+				group.refs = _Refs.size();
+				group.numRefs = 0;
+				_Groups.push_back(group);
+				_Cells[group.child].numParents++;
+				cell.pending++;
+			}
+			_Refs.push_back(refs[j].second);
+			_Groups.back().numRefs++;
+		}
+	}
+
+	// Groups by child
+	unsigned int first = 0;
+	for(unsigned int i=0;i<_Cells.size();i++)
+	{
+		_Cells[i].parents = first;
+		first += _Cells[i].numParents;
+		_Cells[i].numParents = 0;
+	}
+	_Parents.resize(first);
+	for(unsigned int i=0;i<_Groups.size();i++)
+	{
+		FlattenCell &child = _Cells[_Groups[i].child];
+		_Parents[child.parents+child.numParents++] = i;
+	}
+
+	for(unsigned int i=0;i<_Cells.size();i++)
+	{
+		if(order[i]->refs.empty())
+			Flat(i);
+	}
+
+	// Cheapest first, a parent becomes flat when its last group is copied
+	while(!_Ready.empty() && _Ready.front().first <= FLATTEN_DRAW_POINTS)
+	{
+		FlattenGroup &group = _Groups[_Ready.front().second];
+		pop_heap(_Ready.begin(), _Ready.end(), costlier);
+		_Ready.pop_back();
+
+		unsigned long points = _Cells[group.child].points;
+		unsigned long count = ULONG_MAX;
+		if(points > 0)
+			count = (_Budget-_Spent)/points;
+		if(Copy(group, count) && !--_Cells[group.parent].pending)
+			Flat(group.parent);
+	}
+
+	// What is left to draw
+	for(unsigned int i=0;i<_Cells.size();i++)
+	{
+		FlattenCell &cell = _Cells[i];
+		cell.draws = cell.layers.size();
+		for(unsigned int j=0;j<order[i]->refs.size();j++)
+		{
+			unsigned int kept = order[i]->refs[j]->count()-_Copy[cell.refs+j];
+			unsigned int child = _Children[cell.refs+j];
+			if(child < i)
+				cell.draws += _Cells[child].draws*kept;
+			_Kept += kept;
+		}
+	}
+
+	v_printf(1, "%lu of %lu references copied, %.1f of %.0f MB, %.0f draw calls per frame.. ", _Copied, _Copied+_Kept,
+		(double)_Spent*FLATTEN_POINT_BYTES/(1024*1024), (double)_Budget*FLATTEN_POINT_BYTES/(1024*1024), _Cells.back().draws);
+}
+
+void GDSFlattenPlan::Apply()
+{
+	vector<GDSRef*> kept;
+	for(unsigned int i=0;i<_Cells.size();i++)
+	{
+		GDSObject *object = _Cells[i].object;
+		if(object->collapsed)
+			continue;
+		object->FlattenedPoints = _Cells[i].points-object->PointCount;
+
+		// Copies of the children, which are done by now
+		kept.clear();
+		for(unsigned int j=0;j<object->refs.size();j++)
+		{
+			GDSRef *ref = object->refs[j];
+			unsigned int copied = _Copy[_Cells[i].refs+j];
+			if(!copied)
+			{
+				kept.push_back(ref);
+				continue;
+			}
+
+			if(copied == ref->count())
+			{
+				if(!ref->array)
+					object->TransformAddObject(ref->object, ref->mat);
+				else
+				{
+					for(unsigned int row=0;row<ref->array->rows;row++)
+						for(unsigned int column=0;column<ref->array->columns;column++)
+							object->TransformAddObject(ref->object, ref->element(column, row));
+				}
+				delete ref; // Remember refs are new
+				continue;
+			}
+
+			// Part of an array, keep the rows or columns left
+			GDSArray *array = ref->array;
+			if(array->rows <= array->columns)
+			{
+				for(unsigned int column=0;column<copied/array->rows;column++)
+					for(unsigned int row=0;row<array->rows;row++)
+						object->TransformAddObject(ref->object, ref->element(column, row));
+				array->firstColumn += copied/array->rows;
+				array->columns -= copied/array->rows;
+			}
+			else
+			{
+				for(unsigned int row=0;row<copied/array->columns;row++)
+					for(unsigned int column=0;column<array->columns;column++)
+						object->TransformAddObject(ref->object, ref->element(column, row));
+				array->firstRow += copied/array->columns;
+				array->rows -= copied/array->columns;
+			}
+			ref->mat = ref->element(0, 0);
+			kept.push_back(ref);
+		}
+		object->refs.swap(kept);
+
+		object->PackPolygons(); // The flattened copies as well
+		object->noHierarchy = object->refs.empty();
+		object->collapsed = true;
+	}
+}
@@ -0,0 +1,80 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSFLATTEN_H__
+#define __GDSFLATTEN_H__
+
+#include "gds_globals.h"
+
+#define FLATTEN_DRAW_POINTS	2000 // Points copied to save one draw call per frame
+#define FLATTEN_POINT_BYTES	56 // Memory of a copied point, about 20 in RAM and 36 in VRAM
+#define FLATTEN_BUDGET		1024 // Megabytes of copies by default
+
+// Decides for every reference below a cell whether to copy the geometry of
+// the referenced cell into its parent, or to keep drawing it as an instance.
+// Every instance costs a draw call per layer each frame, a copy costs memory
+// once, however often the parent is placed. The references from a parent to
+// a child are copied as a group, cheapest per draw call saved first, as long
+// as that is below FLATTEN_DRAW_POINTS and the budget lasts. A child can only
+// be copied once nothing is left below it. Arrays are copied by rows or by
+// columns, whichever are shorter.
+class GDSFlattenPlan
+{
+private:
+	typedef struct FlattenCell
+	{
+		class GDSObject *object;
+		unsigned int refs; // First in _Children and _Copy
+		double instances; // Placements below the top
+		unsigned long points; // Including the copies
+		vector<int> layers; // Positions, sorted, including the copies
+		double draws; // Per frame for a single placement
+		unsigned int pending; // Groups below it not copied yet
+		unsigned int parents, numParents; // In _Parents
+	} FlattenCell;
+
+	typedef struct FlattenGroup
+	{
+		unsigned int parent, child;
+		unsigned int refs, numRefs; // In _Refs
+	} FlattenGroup;
+
+	vector<FlattenCell> _Cells; // Children before their parents
+	vector<unsigned int> _Index; // Into _Cells, by the ID of the name
+	vector<unsigned int> _Children; // Cell of every reference
+	vector<unsigned int> _Copy; // Elements of every reference, arrays copy whole rows or columns
+	vector<FlattenGroup> _Groups;
+	vector<unsigned int> _Refs; // Of each group, counted from the first of the parent
+	vector<unsigned int> _Parents; // Groups that copy each cell
+	vector<pair<double, unsigned int> > _Ready; // Heap of the groups of flat children, by points per draw call saved
+	unsigned long _Budget, _Spent; // Points
+	unsigned long _Copied, _Kept; // Placements, arrays count every element
+
+	void Order(class GDSObject *object, vector<class GDSObject*> &order);
+	void Flat(unsigned int cell); // Its parents can copy it now
+	bool Copy(FlattenGroup &group, unsigned long count); // At most count placements, true if the whole group fit
+
+public:
+	GDSFlattenPlan(unsigned long budget); // In megabytes
+	void Build(class GDSObject *top);
+	void Apply(); // Copies the planned references and drops them, then packs every cell
+};
+
+#endif // __GDSFLATTEN_H__
@@ -0,0 +1,73 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+#include "gdsnames.h"
+
+GDSNameTable gds_names;
+
+GDSNameTable::GDSNameTable()
+{
+}
+
+GDSNameTable::~GDSNameTable()
+{
+	for(unsigned int i=0;i<names.size();i++)
+		delete [] names[i];
+}
+
+int GDSNameTable::Intern(const char *name)
+{
+	map<const char*, int, CompareName>::iterator it;
+	char *copy;
+
+	it = ids.find(name);
+	if(it != ids.end())
+		return it->second;
+
+	copy = new char[strlen(name)+1];
+	strcpy(copy, name);
+	names.push_back(copy);
+	ids[copy] = names.size()-1;
+
+	return names.size()-1;
+}
+
+int GDSNameTable::Find(const char *name)
+{
+	map<const char*, int, CompareName>::iterator it;
+
+	it = ids.find(name);
+	if(it == ids.end())
+		return -1;
+
+	return it->second;
+}
+
+const char *GDSNameTable::GetName(int id)
+{
+	assert(id >= 0 && id < (int)names.size());
+	return names[id];
+}
+
+int GDSNameTable::GetCount()
+{
+	return names.size();
+}
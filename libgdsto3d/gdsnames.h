@@ -0,0 +1,50 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+#ifndef __GDSNAMES_H__
+#define __GDSNAMES_H__
+
+#include "gds_globals.h"
+
+// Interned cell names. Every distinct name gets a dense ID that stays valid
+// for the rest of the program, also across reloads, so references are linked
+// by indexing instead of comparing strings.
+// Intern() is not thread safe. The parallel parse only calls Find(), all
+// structure names are interned while indexing.
+class GDSNameTable
+{
+private:
+	vector<char*>	names;
+	map<const char*, int, CompareName> ids;
+
+public:
+	GDSNameTable();
+	~GDSNameTable();
+
+	int Intern(const char *name); // Adds the name if it is new
+	int Find(const char *name); // -1 if unknown
+	const char *GetName(int id);
+	int GetCount();
+};
+
+extern GDSNameTable gds_names;
+
+#endif // __GDSNAMES_H__
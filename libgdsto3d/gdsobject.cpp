@@ -24,26 +24,38 @@
 
 
 
-#define HIERARCHY_LIMIT  30000
 
 GDSObject::GDSObject(char *NewName)
 {
     PointCount = 0;
+    FlattenedPoints = 0;
     noHierarchy = false;
 	collapsed = false;
 
 	hasBoundary = false;
+
+	RecordHash = 0;
+	missingRefs = false;
+
+	instances = 0;
+	depth = -1;
+
+	arena = NULL;
+	merged = false;
     
-	Name = new char[strlen(NewName)+1];
-	strcpy(Name, NewName); 
+	ID = gds_names.Intern(NewName);
 
     PCell = false;
 }
 
 GDSObject::~GDSObject()
 {
-	for(unsigned int i=0;i<PolygonItems.size();i++)
-		delete PolygonItems[i];
+	// Polygons go with the arena
+	if(arena)
+		delete arena;
+
+	for(unsigned int i=0;i<UnionItems.size();i++)
+		delete UnionItems[i];
 
 	for(unsigned int i=0;i<PathItems.size();i++)
 		delete PathItems[i];
@@ -52,23 +64,13 @@ GDSObject::~GDSObject()
 		delete TextItems[i];
 
 	for(unsigned int i=0;i<SRefItems.size();i++)
-	{
-		if(SRefItems[i]->Name)
-			delete [] SRefItems[i]->Name;
 		delete SRefItems[i];
-	}
 
 	for(unsigned int i=0;i<ARefItems.size();i++)
-	{
-		if(ARefItems[i]->Name)
-			delete [] ARefItems[i]->Name;
 		delete ARefItems[i];
-	}
 
 	for(unsigned int i=0;i<refs.size();i++)		
 		delete refs[i];	
-    
-	delete [] Name;
 }
 
 void GDSObject::AddText(float newX, float newY, float newZ, bool newFlipped, float newMag, int newVJust, int newHJust, struct ProcessLayer *newlayer)
@@ -85,14 +87,22 @@ class GDSText *GDSObject::GetCurrentText()
 	}
 }
 
-char *GDSObject::GetName()
+const char *GDSObject::GetName()
+{
+	return gds_names.GetName(ID);
+}
+
+int GDSObject::GetID()
 {
-	return Name;
+	return ID;
 }
 
 void GDSObject::AddPolygon(float Height, float Thickness, int Points, struct ProcessLayer *layer)
 {
-	PolygonItems.push_back(new class GDSPolygon(Height, Thickness, layer));
+	GDSPolygon *polygon = GetArena()->NewPolygon();
+
+	*polygon = GDSPolygon(Height, Thickness, layer);
+	PolygonItems.push_back(polygon);
 
     PointCount += Points*2;
 }
@@ -105,12 +115,24 @@ class GDSPolygon *GDSObject::GetCurrentPolygon()
         return NULL;
 }
 
-void GDSObject::AddSRef(char *Name, float X, float Y, int Flipped, float Mag)
+void GDSObject::PackPolygons()
+{
+	if(arena)
+		arena->Pack(PolygonItems);
+}
+
+GDSPolygonArena *GDSObject::GetArena()
+{
+	if(!arena)
+		arena = new GDSPolygonArena();
+	return arena;
+}
+
+void GDSObject::AddSRef(int NameID, float X, float Y, int Flipped, float Mag)
 {
 	SRefElement *NewSRef = new SRefElement;
       
-	NewSRef->Name = new char[strlen(Name)+1];
-	strcpy(NewSRef->Name, Name);
+	NewSRef->NameID = NameID;
 	NewSRef->X = X;
 	NewSRef->Y = Y;
 	NewSRef->Rotate.X = 0.0;
@@ -134,12 +156,11 @@ void GDSObject::SetSRefRotation(float X, float Y, float Z)
 	}
 }
 
-void GDSObject::AddARef(char *Name, float X1, float Y1, float X2, float Y2, float X3, float Y3, int Columns, int Rows, int Flipped, float Mag)
+void GDSObject::AddARef(int NameID, float X1, float Y1, float X2, float Y2, float X3, float Y3, int Columns, int Rows, int Flipped, float Mag)
 {
 	ARefElement *NewARef = new ARefElement;
     
-	NewARef->Name = new char[strlen(Name)+1];
-	strcpy(NewARef->Name, Name);
+	NewARef->NameID = NameID;
 	NewARef->X1 = X1;
 	NewARef->Y1 = Y1;
 	NewARef->X2 = X2;
@@ -369,9 +390,26 @@ GDSBB GDSObject::GetTotalBoundary()
 
 	for(unsigned int i=0;i<refs.size();i++)
 	{
-		t = refs[i]->object->GetTotalBoundary();
+		GDSBB child = refs[i]->object->GetTotalBoundary();
+		t = child;
 		t.transform(refs[i]->mat);
 		BB.merge(t);
+
+		// The corner elements bound the rest of an array
+		if(refs[i]->array)
+		{
+			unsigned int columns = refs[i]->array->columns-1;
+			unsigned int rows = refs[i]->array->rows-1;
+			t = child;
+			t.transform(refs[i]->element(columns, 0));
+			BB.merge(t);
+			t = child;
+			t.transform(refs[i]->element(0, rows));
+			BB.merge(t);
+			t = child;
+			t.transform(refs[i]->element(columns, rows));
+			BB.merge(t);
+		}
 	}
 
 	boundary = BB;
@@ -400,17 +438,18 @@ void GDSObject::ConnectReferences(class GDSObjectList *Objects)
 {
 	GDSMat M;
 	float dx1, dx2, dy1, dy2;
-	int i,j;
 
     //Find SRef objects
 	for(unsigned int k=0;k<SRefItems.size();k++)
 	{
 		SRefElement *sref = SRefItems[k];
-		sref->object = Objects->SearchObject(sref->Name);
+		if(!sref->object) // Already resolved by the scene cache?
+			sref->object = Objects->SearchObject(sref->NameID);
 
 		// If not found, remove from SRef list
 		if(!sref->object)
 		{
+			missingRefs = true;
 			SRefItems.erase(SRefItems.begin()+k);
 			k--; // Check the new SRef on this index again
 			continue;
@@ -450,11 +489,13 @@ void GDSObject::ConnectReferences(class GDSObjectList *Objects)
 	for(unsigned int k=0;k<ARefItems.size();k++)
 	{
 		ARefElement *aref = ARefItems[k];
-		aref->object = Objects->SearchObject(aref->Name);
+		if(!aref->object)
+			aref->object = Objects->SearchObject(aref->NameID);
 
 		// If not found, remove from ARef list
 		if(!aref->object)
 		{
+			missingRefs = true;
 			ARefItems.erase(ARefItems.begin()+k);
 			k--; // Check the new ARef on this index again
 			continue;
@@ -465,44 +506,77 @@ void GDSObject::ConnectReferences(class GDSObjectList *Objects)
 		dx2 = (float)(aref->X3 - aref->X1) / (float)aref->Rows;
 		dy2 = (float)(aref->Y3 - aref->Y1) / (float)aref->Rows;
 
-		for(i=0; i<aref->Rows; i++)
+		// Decode 2D transformation matrix of the first element
+		GDSRef *newRef = new GDSRef;
+		newRef->object = aref->object;
+
+		newRef->mat.loadIdentity();
+		if(aref->Mag!=1.0)
 		{
-			for(j=0; j<aref->Columns; j++)
-			{
-				// Decode 2D transformation matrix
-				GDSRef *newRef = new GDSRef;
-				newRef->object = aref->object;
-
-				// Build transformation matrix      
-				newRef->mat.loadIdentity();
-				if(aref->Mag!=1.0)
-				{
-					M.setScaling(aref->Mag, aref->Mag);
-					newRef->mat = newRef->mat * M;
-				}
-				M.setTranslation(aref->X1+dx1*(float)j+dx2*(float)i, aref->Y1+dy2*(float)i+dy1*(float)j);
-				newRef->mat = newRef->mat * M;
-				if(aref->Rotate.Y)
-				{
-					M.setRotation(-aref->Rotate.Y);
-					newRef->mat = newRef->mat * M;
-				}
-				if(aref->Flipped)
-				{
-					M.setScaling(1.0f, -1.0f);
-					newRef->mat = newRef->mat * M;
-				}
-				
-				// Round matrix to avoid small errors
-				newRef->mat.Round();
+			M.setScaling(aref->Mag, aref->Mag);
+			newRef->mat = newRef->mat * M;
+		}
+		M.setTranslation(aref->X1, aref->Y1);
+		newRef->mat = newRef->mat * M;
+		if(aref->Rotate.Y)
+		{
+			M.setRotation(-aref->Rotate.Y);
+			newRef->mat = newRef->mat * M;
+		}
+		if(aref->Flipped)
+		{
+			M.setScaling(1.0f, -1.0f);
+			newRef->mat = newRef->mat * M;
+		}
 
-				// Add
-				refs.push_back(newRef);
-			}
+		// Round matrix to avoid small errors
+		newRef->mat.Round();
+
+		// One reference for all elements, they only differ in translation
+		if(aref->Columns > 1 || aref->Rows > 1)
+		{
+			newRef->array = new GDSArray;
+			newRef->array->columns = aref->Columns;
+			newRef->array->rows = aref->Rows;
+			newRef->array->firstColumn = 0;
+			newRef->array->firstRow = 0;
+			newRef->array->x = aref->X1;
+			newRef->array->y = aref->Y1;
+			newRef->array->dx1 = dx1;
+			newRef->array->dy1 = dy1;
+			newRef->array->dx2 = dx2;
+			newRef->array->dy2 = dy2;
+			newRef->array->mag = aref->Mag;
 		}
+
+		// Add
+		refs.push_back(newRef);
 	}
 }
 
+bool GDSRef::clipRow(const GDSArrayClip *clips, unsigned int num, unsigned int row, unsigned int &first, unsigned int &last) const
+{
+	double low = 0.0;
+	double high = array ? array->columns-1 : 0.0;
+
+	for(unsigned int i=0;i<num;i++)
+	{
+		double c = clips[i].c+clips[i].b*row;
+		if(clips[i].a > 0.0)
+			low = max(low, -c/clips[i].a);
+		else if(clips[i].a < 0.0)
+			high = min(high, -c/clips[i].a);
+		else if(c < 0.0)
+			return false; // Parallel to the row and outside
+	}
+	if(low > high)
+		return false;
+
+	first = (unsigned int)ceil(low);
+	last = (unsigned int)floor(high);
+	return first <= last;
+}
+
 unsigned int GDSObject::GetNumSRefs()
 {
 	return SRefItems.size();
@@ -530,11 +604,106 @@ bool GDSObject::isPCell()
 	return PCell;
 }
 
+void GDSObject::SetRecordHash(uint64_t hash)
+{
+	RecordHash = hash;
+}
+
+uint64_t GDSObject::GetRecordHash()
+{
+	return RecordHash;
+}
+
+bool GDSObject::hasMissingRefs()
+{
+	return missingRefs;
+}
+
+bool GDSObject::isMerged()
+{
+	return merged;
+}
+
+void GDSObject::SetMerged()
+{
+	merged = true;
+}
+
+void GDSObject::AddUnion(const vector<unsigned int> &polygons, const vector<GDSPolygon*> &outlines)
+{
+	if(polygons.empty())
+		return;
+	if(inUnion.empty())
+		inUnion.resize(PolygonItems.size(), false);
+	for(unsigned int i=0;i<polygons.size();i++)
+		inUnion[polygons[i]] = true;
+	UnionItems.insert(UnionItems.end(), outlines.begin(), outlines.end());
+}
+
+void GDSObject::ClearParents()
+{
+	parents.clear();
+	instances = 0;
+	depth = -1;
+}
+
+void GDSObject::AddParent(GDSObject *parent, unsigned int count)
+{
+	// The references of one parent are added back to back
+	if(parents.empty() || parents.back() != parent)
+		parents.push_back(parent);
+	instances += count;
+}
+
+unsigned int GDSObject::GetNumParents()
+{
+	return parents.size();
+}
+
+GDSObject* GDSObject::GetParent(unsigned int index)
+{
+	assert(index < parents.size());
+	return parents[index];
+}
+
+unsigned int GDSObject::GetInstances()
+{
+	return instances;
+}
+
+int GDSObject::countDepth()
+{
+	GDSObject *child;
+	int result = 0;
+
+	if(depth >= 0)
+		return depth;
+	if(depth == -2)
+		return 0; // Reference loop, do not follow it again
+	depth = -2;
+
+	for(unsigned int i=0;i<SRefItems.size();i++)
+	{
+		child = SRefItems[i]->object;
+		if(child)
+			result = max(result, child->countDepth()+1);
+	}
+	for(unsigned int i=0;i<ARefItems.size();i++)
+	{
+		child = ARefItems[i]->object;
+		if(child)
+			result = max(result, child->countDepth()+1);
+	}
+
+	depth = result;
+	return depth;
+}
+
 void GDSObject::printHierarchy(int depth)
 {
     for(int i=0;i<depth;i++)
         v_printf(2, "  ");
-    v_printf(2, "%s, %d total points\n", Name, AccumPointCount);
+    v_printf(2, "%s, %d total points\n", GetName(), AccumPointCount);
     
     if(noHierarchy)
         return;
@@ -556,9 +725,14 @@ void GDSObject::printHierarchy(int depth)
 
 int GDSObject::countTotalPoints()
 {
+	// Collapsing moved the geometry of absorbed cells into this one, keep the original count
+	if(collapsed)
+		return AccumPointCount;
+
     AccumPointCount = PointCount;
-    char * dummy2 = NULL;
-    char *dummy3 = NULL;
+    const char *Name = GetName();
+    const char *dummy2 = NULL;
+    const char *dummy3 = NULL;
     
     // PCell detection, try to find something like __1018272
     dummy2 = strstr(Name, "__");
@@ -620,52 +794,17 @@ int GDSObject::countTotalPoints()
                 AccumPointCount += obj->countTotalPoints();          
     }*/
 	for(unsigned int i=0;i<refs.size();i++)
-		AccumPointCount += refs[i]->object->countTotalPoints();
+		AccumPointCount += refs[i]->count()*refs[i]->object->countTotalPoints();
     
     return AccumPointCount;
 }
 
-void GDSObject::collapseHierachy()
+void GDSObject::collapseHierachy(unsigned long budget)
 {
-    // Traverse hierarchy
-	//v_printf(1, ".");
-    for(unsigned int i=0;i<SRefItems.size();i++)
-	{
-		if(!SRefItems[i]->object->collapsed)
-            SRefItems[i]->object->collapseHierachy();
-	}
-	for(unsigned int i=0;i<ARefItems.size();i++)
-	{
-		if(!ARefItems[i]->object->collapsed)
-            ARefItems[i]->object->collapseHierachy();
-	}
-  
-    // Collapse total cell?
-    if(AccumPointCount < HIERARCHY_LIMIT)
-        noHierarchy = true;
-    
-	GDSObject *obj;
-	vector<int> remove;
-	for(unsigned int i=0;i<refs.size();i++)
-	{
-		obj = refs[i]->object;
-		if(noHierarchy || obj->AccumPointCount < HIERARCHY_LIMIT/10)
-		{
-			remove.push_back(i);
-			TransformAddObject(obj, refs[i]->mat);
-		}
-	}
-	// This really hurts performance
-	if(remove.size() > 0)
-	{
-		for(int i=remove.size()-1;i>=0;i--)
-        {
-            delete refs[remove[i]]; // Remember refs are new
-			refs.erase(refs.begin()+remove[i]);
-        }
-	}
-
-	collapsed = true;
+	// Copy or keep every reference below, see GDSFlattenPlan
+	GDSFlattenPlan plan(budget);
+	plan.Build(this);
+	plan.Apply();
 }
 
 void GDSObject::TransformAddObject(GDSObject *obj, GDSMat mat)
@@ -677,6 +816,10 @@ void GDSObject::TransformAddObject(GDSObject *obj, GDSMat mat)
     {
 		for(unsigned long i=0; i<obj->PolygonItems.size(); i++)
         {
+			// Translated copies share the points and triangles of the original
+			if(mat.isTranslation() && !obj->PolygonItems[i]->GetShape())
+				obj->PolygonItems[i]->Share(obj->PolygonItems[i]->ShapeHash());
+
 			// Copy the polygon into the object
             AddPolygon(obj->PolygonItems[i]->GetHeight(), obj->PolygonItems[i]->GetThickness(),obj->PolygonItems[i]->GetPoints(), obj->PolygonItems[i]->GetLayer());
 			polygon = GetCurrentPolygon();
@@ -693,14 +836,16 @@ void GDSObject::TransformAddObject(GDSObject *obj, GDSMat mat)
 }
 
 bool 
-GDSObject::referencesToObject(char *name)
+GDSObject::referencesToObject(const char *name)
 {
+    int id = gds_names.Find(name);
+
     //SRefs
    for(unsigned int i=0;i<SRefItems.size();i++)
 	{
         SRefElement *sref = SRefItems[i];        
 		
-            if(!strcmp(sref->object->GetName(), name))
+            if(sref->object->GetID() == id)
                return true;           
 	}
     
@@ -710,7 +855,7 @@ GDSObject::referencesToObject(char *name)
 		ARefElement *aref = ARefItems[i];
         
 	
-            if(!strcmp(aref->object->GetName(), name))
+            if(aref->object->GetID() == id)
                 return true;          
 	}
     
@@ -27,15 +27,68 @@
 #include "gdspath.h"
 #include "gdstext.h"
 #include "gdspolygon.h"
+#include "gdsarena.h"
+#include "gdsnames.h"
+#include "gdsflatten.h"
+#include <stdint.h>
+
+// Elements of an AREF, element (column, row) is placed at
+// mag*(x+dx1*column+dx2*row, y+dy1*column+dy2*row)
+typedef struct GDSArray
+{
+	unsigned int	columns, rows;
+	unsigned int	firstColumn, firstRow; // Of the first element, the ones before are copied into the parent
+	float			x, y;
+	float			dx1, dy1, dx2, dy2; // Column and row step
+	float			mag;
+}GDSArray;
+
+// Half plane a*column+b*row+c >= 0 of the elements of an array
+typedef struct GDSArrayClip
+{
+	double a, b, c;
+}GDSArrayClip;
 
 typedef struct GDSRef
 {
 	GDSObject	*object;
-	GDSMat		mat;
+	GDSMat		mat; // Of the first element of an array
+	GDSArray	*array; // NULL for a single placement
+
+	GDSRef() {array = NULL;};
+	~GDSRef() {delete array;};
+	unsigned int count() const; // Placements
+	GDSMat element(unsigned int column, unsigned int row) const;
+	bool clipRow(const GDSArrayClip *clips, unsigned int num, unsigned int row, unsigned int &first, unsigned int &last) const; // Columns inside all clips
 }GDSRef;
 
+inline unsigned int GDSRef::count() const
+{
+	if(!array)
+		return 1;
+	return array->columns*array->rows;
+}
+
+// Same arithmetic as a matrix built for the element alone
+inline GDSMat GDSRef::element(unsigned int column, unsigned int row) const
+{
+	if(!array)
+		return mat;
+
+	column += array->firstColumn;
+	row += array->firstRow;
+	float X = array->x+array->dx1*(float)column+array->dx2*(float)row;
+	float Y = array->y+array->dy2*(float)row+array->dy1*(float)column;
+	GDSMat M(mat[0], mat[1], mat[2], mat[3], array->mag*X, array->mag*Y);
+	M.Round();
+	return M;
+}
+
 class GDSObject
 {
+	friend class GDSCache; // Reads and restores the parsed data
+	friend class GDSFlattenPlan; // Copies the references it planned
+
 protected:
 	// Temporary data for parsing	
 	vector<GDSPath*> PathItems;
@@ -45,18 +98,32 @@ protected:
 	
     int PointCount;
     int AccumPointCount;
+    unsigned long FlattenedPoints; // Of the copies made by GDSFlattenPlan
     bool noHierarchy;
 
 	bool hasBoundary;
 	GDSBB boundary;
 
-	char *Name;
+	int ID; // Of the name in gds_names
 	bool PCell; // After PCell detection
 	bool collapsed;
 
+	uint64_t RecordHash; // Of the structure records, to spot changed cells on reload
+	bool missingRefs; // Some references did not resolve
+
+	// Reverse references, filled by GDSObjectList
+	vector<GDSObject*> parents;
+	unsigned int instances;
+	int depth; // -1 if not counted yet
+
+	GDSPolygonArena *arena; // Owns the polygons, made with the first one
+	bool merged; // Union of the layers worked out, see GDSParse::MergePolygons
+
 public:
 	// Please move to private...
 	vector<GDSPolygon*> PolygonItems; 	
+	vector<GDSPolygon*> UnionItems; // Outlines of merged layers, drawn instead of the polygons they cover
+	vector<bool> inUnion; // Per polygon, empty unless a layer was merged
 	vector<GDSRef*> refs; // Use these references for rendering
 
 	GDSObject(char *Name);
@@ -67,9 +134,13 @@ public:
 	class GDSText *GetCurrentText();
 	void AddPolygon(float Height, float Thickness, int Points, struct ProcessLayer *layer);
 	class GDSPolygon *GetCurrentPolygon();
-	void AddSRef(char *Name, float X, float Y, int Flipped, float Mag);
+	void PackPolygons(); // Squeezes the arena and scans the new polygons, once they are tesselated
+	GDSPolygonArena *GetArena(); // Made on first use
+	struct ProcessLayer *GetPolygonLayer(unsigned int index); // From the arena while packed
+	GDSBB *GetPolygonBBox(unsigned int index); // Likewise
+	void AddSRef(int NameID, float X, float Y, int Flipped, float Mag);
 	void SetSRefRotation(float X, float Y, float Z);
-	void AddARef(char *Name, float X1, float Y1, float X2, float Y2, float X3, float Y3, int Columns, int Rows, int Flipped, float Mag);
+	void AddARef(int NameID, float X1, float Y1, float X2, float Y2, float X3, float Y3, int Columns, int Rows, int Flipped, float Mag);
 	void SetARefRotation(float X, float Y, float Z);
 	void AddPath(int PathType, float Height, float Thickness, int Points, float Width, float BgnExtn, float EndExtn, struct ProcessLayer *layer);
 	class GDSPath *GetCurrentPath();
@@ -78,20 +149,49 @@ public:
 	void TransformAddObject(GDSObject *obj, GDSMat mat);
 
 	// Get stuff
-	char *GetName();    
-	bool referencesToObject(char *name);
+	const char *GetName();
+	int GetID();    
+	bool referencesToObject(const char *name);
 	GDSBB GetTotalBoundary();
 	bool isPCell();
 	unsigned int GetNumSRefs();
 	SRefElement* GetSRef(unsigned int index);
 	unsigned int GetNumARefs();
 	ARefElement* GetARef(unsigned int index);
+	void SetRecordHash(uint64_t hash);
+	uint64_t GetRecordHash();
+	bool hasMissingRefs();
+	bool isMerged();
+	void SetMerged();
+	void AddUnion(const vector<unsigned int> &polygons, const vector<GDSPolygon*> &outlines); // Drawn instead of the polygons
+
+	// Where used, valid after GDSObjectList built its reference graph
+	void ClearParents();
+	void AddParent(GDSObject *parent, unsigned int count);
+	unsigned int GetNumParents();
+	GDSObject* GetParent(unsigned int index);
+	unsigned int GetInstances(); // Placements in all parents, arrays count every element
+	int countDepth(); // Longest chain of references below this cell
     
     // Flatten lower part of hierarchy
     void printHierarchy(int);
     int countTotalPoints();
-    void collapseHierachy();   
+    void collapseHierachy(unsigned long budget = FLATTEN_BUDGET); // Megabytes of copied geometry
 };
 
+inline struct ProcessLayer *GDSObject::GetPolygonLayer(unsigned int index)
+{
+	if(arena && index < arena->GetCount())
+		return arena->GetLayer(index);
+	return PolygonItems[index]->GetLayer();
+}
+
+inline GDSBB *GDSObject::GetPolygonBBox(unsigned int index)
+{
+	if(arena && index < arena->GetCount())
+		return arena->GetBBox(index);
+	return PolygonItems[index]->GetBBox();
+}
+
 #endif // __GDSOBJECT_H__
 
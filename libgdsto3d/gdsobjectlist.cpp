@@ -40,6 +40,8 @@ ObjectTree::~ObjectTree()
 GDSObjectList::GDSObjectList()
 {
 	tree = NULL;
+	bynamedirty = false;
+	graphdirty = true;
 }
 
 GDSObjectList::~GDSObjectList()
@@ -53,50 +55,121 @@ GDSObjectList::~GDSObjectList()
 
 GDSObject *GDSObjectList::AddObject(class GDSObject *newobject)
 {
+	int id = newobject->GetID();
+
 	objects.push_back(newobject);
+	graphdirty = true;
+
+	if(id >= (int)byname.size())
+		byname.resize(id+1, NULL);
+	if(!byname[id])
+		byname[id] = newobject;
 
 	return newobject;
 }
 
 GDSObject *GDSObjectList::SearchObject(const char *Name)
 {
-	for(unsigned int i=0;i<objects.size();i++)
+	return SearchObject(gds_names.Find(Name));
+}
+
+GDSObject *GDSObjectList::SearchObject(int ID)
+{
+	if(bynamedirty)
 	{
-		if(strcmp(Name, objects[i]->GetName())==0)
-			return objects[i];
+		byname.assign(gds_names.GetCount(), NULL);
+		for(unsigned int i=0;i<objects.size();i++)
+		{
+			if(objects[i] && !byname[objects[i]->GetID()])
+				byname[objects[i]->GetID()] = objects[i];
+		}
+		bynamedirty = false;
 	}
 
-	return NULL;
+	if(ID < 0 || ID >= (int)byname.size())
+		return NULL;
+	return byname[ID];
 }
 
 void GDSObjectList::ConnectReferences()
 {
 	for(unsigned int i=0;i<objects.size();i++)
 		objects[i]->ConnectReferences(this);
+	graphdirty = true;
+}
+
+// Parents, instance counts and depths of all cells in one pass over the references
+void GDSObjectList::BuildGraph()
+{
+	GDSObject *object, *child;
+
+	for(unsigned int i=0;i<objects.size();i++)
+	{
+		if(objects[i])
+			objects[i]->ClearParents();
+	}
+
+	for(unsigned int i=0;i<objects.size();i++)
+	{
+		object = objects[i];
+		if(!object)
+			continue;
+		for(unsigned int j=0;j<object->GetNumSRefs();j++)
+		{
+			child = object->GetSRef(j)->object;
+			if(child)
+				child->AddParent(object, 1);
+		}
+		for(unsigned int j=0;j<object->GetNumARefs();j++)
+		{
+			child = object->GetARef(j)->object;
+			if(child)
+				child->AddParent(object, object->GetARef(j)->Columns*object->GetARef(j)->Rows);
+		}
+	}
+
+	roots.clear();
+	for(unsigned int i=0;i<objects.size();i++)
+	{
+		object = objects[i];
+		if(!object)
+			continue;
+		object->countDepth();
+		if(!object->GetNumParents())
+			roots.push_back(object);
+	}
+
+	graphdirty = false;
 }
 
 
 GDSObject *
 GDSObjectList::GetTopObject()
 {
-    // Loop through objects
-    for(unsigned int i=0;i<objects.size();i++)
+	GDSObject *top = NULL;
+
+	// Deepest object that is not referenced by any other objects, the first one on a tie
+	for(unsigned int i=0;i<GetNumRoots();i++)
 	{
-        bool found = false;
-        for(unsigned int j=0;j<objects.size();j++)
-		{
-            GDSObject *obj = objects[j];
-            
-            if(obj->referencesToObject(objects[i]->GetName()))
-            {
-                found = true;
-                break;
-            }
-        }
-        if(!found) // Object is not referenced by any other objects
-            return objects[i];
-    }
-    return NULL;
+		if(!top || roots[i]->countDepth() > top->countDepth())
+			top = roots[i];
+	}
+	return top;
+}
+
+unsigned int GDSObjectList::GetNumRoots()
+{
+	if(graphdirty)
+		BuildGraph();
+	return roots.size();
+}
+
+GDSObject* GDSObjectList::GetRoot(unsigned int index)
+{
+	if(graphdirty)
+		BuildGraph();
+	assert(index < roots.size());
+	return roots[index];
 }
 
 unsigned int	GDSObjectList::getNumObjects()
@@ -110,6 +183,23 @@ GDSObject* GDSObjectList::getObject(unsigned int index)
 	return objects[index];
 }
 
+GDSObject* GDSObjectList::setObject(unsigned int index, GDSObject *newobject)
+{
+	GDSObject *object;
+
+	assert(index < objects.size());
+	object = objects[index];
+	objects[index] = newobject;
+	graphdirty = true;
+
+	// Same name in the same slot keeps the lookup valid
+	if(newobject && object->GetID() == newobject->GetID() && byname[object->GetID()] == object)
+		byname[object->GetID()] = newobject;
+	else
+		bynamedirty = true;
+	return object;
+}
+
 void GDSObjectList::buildObjectTree()
 {
 	if(tree)
@@ -45,6 +45,16 @@ private:
 	// List of all the objects
 	vector<GDSObject*> objects;
 
+	// First object with each name, indexed by name ID
+	vector<GDSObject*> byname;
+	bool bynamedirty; // Rebuild before the next search
+
+	// Cells no other cell references, in list order
+	vector<GDSObject*> roots;
+	bool graphdirty; // Rebuild the reference graph before the next query
+
+	void BuildGraph();
+
 	// Tree of all object instances for net highlighting
 	ObjectTree	*tree;
 
@@ -54,9 +64,13 @@ public:
 
 	GDSObject *AddObject(class GDSObject *newobject);
 	GDSObject *SearchObject(const char *Name);
+	GDSObject *SearchObject(int ID);
 	GDSObject *GetTopObject();
+	unsigned int GetNumRoots();
+	GDSObject *GetRoot(unsigned int index);
 	unsigned int	getNumObjects();
 	GDSObject* getObject(unsigned int index);
+	GDSObject* setObject(unsigned int index, GDSObject *newobject); // Returns the old object
 
 	void ConnectReferences();
 
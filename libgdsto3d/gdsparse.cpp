@@ -19,23 +19,22 @@
 //  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
 
 #include "gdsparse.h"
+#include "gdsthread.h"
+#include "gdscache.h"
+#include "gdsunion.h"
 #include "../math/Maths.h"
 
 extern int verbose_output;
 
-#ifndef endian_swap_long
-    #define endian_swap_long(w) ( ((w&0xff)<<24) | ((w&0xff00)<<8) | ((w&0xff0000)>>8) | ((w&0xff000000)>>24) )
-#endif
-#ifndef endian_swap_short
-    #define endian_swap_short(w) ( ((w&0xff)<<8) | ((w&0xff00)>>8) )
-#endif
-
 GDSParse::GDSParse (class GDSProcess *process, bool generate_process)
 {
 	_iptr = NULL;
 	_optr = NULL;
 	_libname = NULL;
+	_cachefile = NULL;
 	_sname = NULL;
+	_snameid = -1;
+	_newnames = true;
 	_textstring = NULL;
 	_Objects = NULL;
 
@@ -63,6 +62,7 @@ GDSParse::GDSParse (class GDSProcess *process, bool generate_process)
 	_angle = 0.0;
 	_units = 0.0;
 	_recordlen = 0;
+	_recptr = NULL;
 	_CurrentObject = NULL;
 
 	_use_outfile = false;
@@ -72,13 +72,11 @@ GDSParse::GDSParse (class GDSProcess *process, bool generate_process)
 
 	_process = process;
 
+	_quiet = false;
+	_elements = GDS_PARSE_ALL;
+
 	for(int i=0; i<70; i++){
-		_unsupported[i] = false;
-	}
-	for(int i=0; i<257; i++){
-		for(int j=0; j<257; j++){
-			_layer_warning[i][j] = false;
-		}
+		_unsupported[i] = NULL;
 	}
 }
 
@@ -93,6 +91,9 @@ GDSParse::~GDSParse ()
 	if(_textstring){
 		delete [] _textstring;
 	}
+	if(_cachefile){
+		delete [] _cachefile;
+	}
 	if(_Objects){
 		delete _Objects;
 	}
@@ -119,666 +120,1323 @@ void GDSParse::Reload()
 {
 	if(_Objects)
 	{
+		if(!ReloadChanged()){
+			return;
+		}
+
 		delete _Objects;
 		_Objects = new GDSObjectList;
 		ParseFile(this->_topcellname);
 	}
 }
 
+void GDSParse::SetCacheFile(const char *gdsfile)
+{
+	if(_cachefile){
+		delete [] _cachefile;
+		_cachefile = NULL;
+	}
+	if(gdsfile){
+		_cachefile = new char[strlen(gdsfile)+strlen(GDS_CACHE_EXTENSION)+1];
+		sprintf(_cachefile, "%s%s", gdsfile, GDS_CACHE_EXTENSION);
+	}
+}
+
 bool GDSParse::ParseFile(char *topcell)
 {
-	byte recordtype, datatype;
-	char *tempstr;
-	struct ProcessLayer *layer = NULL;
-    
-    float BgnExtn;
-    float EndExtn;
-    float extn_x, extn_x2;
-    float extn_y, extn_y2;
-    float angleX[1024]; // HACK
-    float angleY[1024]; // HACK
-    Point2D points[8];
+	GDSCache *cache = NULL;
+	bool result;
 
 	this->_topcellname = topcell;
-    _currentelement = elNone;
+	_Pending.clear();
 
-	if(!_iptr){
+	if(!_reader.Open(_iptr)){
 		return true;
 	}
 
-	fseek(_iptr, 0, SEEK_SET);
-	while(!feof(_iptr)){
-		_recordlen = GetTwoByteSignedInt();
-		fread(&recordtype, 1, 1, _iptr);
-		fread(&datatype, 1, 1, _iptr);
-		_recordlen -= 4;
-		switch(recordtype){
-			case rnHeader:
-				v_printf(3, "HEADER\n");
-				ParseHeader();
-				break;
-			case rnBgnLib:
-				v_printf(3, "BGNLIB\n");
-				while(_recordlen){
-					GetTwoByteSignedInt();
+	// The cache is keyed on the file contents, so it needs the mapped file
+	if(_cachefile && _reader.IsMapped() && !_generate_process){
+		cache = new GDSCache(_cachefile, _reader.GetData(0), _reader.GetSize(), _process);
+		if(cache->Load(this)){
+			_reader.Close();
+			delete cache;
+			_Objects->ConnectReferences();
+			TesselatePolygons(); // Shapes are not cached, the polygons share them again
+			return LoadCell(GetTopcell(topcell));
+		}
+	}
+
+	// Structures are independent until ConnectReferences, so a mapped file can be
+	// parsed by all cores. At first only the references are decoded, the geometry
+	// follows for the top cell and for other cells once they are picked.
+	// The streaming reader and process generation stay serial and decode everything.
+	if(_reader.IsMapped() && !_generate_process && verbose_output < 3){
+		result = IndexStructures();
+		if(!result){
+			for(unsigned int i=0; i<_Structures.size(); i++){
+				_Pending[_Structures[i].object] = _Structures[i];
+			}
+			result = ParseStructures(GDS_PARSE_REFS);
+		}
+	}else{
+		result = ParseRecords();
+	}
+	_reader.Close();
+
+	if(!result){
+		//Added for substrate
+		_BoundaryElements++;
+		_currentlayer = 255;
+		_currentdatatype = 0;
+		AddSubstrate(topcell);
+		_Objects->ConnectReferences();
+		TesselatePolygons(); // Only the serial parser decoded geometry yet
+
+		result = LoadCell(GetTopcell(topcell));
+		if(!result && cache){
+			cache->Save(this);
+		}
+	}
+	if(cache){
+		delete cache;
+	}
+
+	return result;
+}
+
+GDSObject *GDSParse::GetTopcell(const char *topcell)
+{
+	GDSObject *object = NULL;
+
+	if(topcell){
+		object = _Objects->SearchObject(topcell);
+	}
+	if(!object){
+		object = _Objects->GetTopObject();
+	}
+	return object;
+}
+
+bool GDSParse::LoadCell(GDSObject *object)
+{
+	vector<GDSObject*> objects;
+
+	if(object){
+		objects.push_back(object);
+	}
+	return LoadCells(objects);
+}
+
+// Decodes the geometry of the given cells and everything they reference
+bool GDSParse::LoadCells(const vector<GDSObject*> &objects)
+{
+	vector<GDSObject*> stack(objects);
+	vector<GDSObject*> decoded;
+	set<GDSObject*> visited;
+	map<GDSObject*, GDSStructure>::iterator it;
+	GDSObject *object;
+	bool result;
+
+	if(_Pending.empty()){
+		return false;
+	}
+
+	while(!stack.empty()){
+		object = stack.back();
+		stack.pop_back();
+		if(!visited.insert(object).second){
+			continue;
+		}
+
+		it = _Pending.find(object);
+		if(it != _Pending.end()){
+			_Structures.push_back(it->second);
+			_Pending.erase(it);
+		}
+		for(unsigned int i=0; i<object->GetNumSRefs(); i++){
+			stack.push_back(object->GetSRef(i)->object);
+		}
+		for(unsigned int i=0; i<object->GetNumARefs(); i++){
+			stack.push_back(object->GetARef(i)->object);
+		}
+	}
+	if(_Structures.empty()){
+		return false;
+	}
+
+	// The file stays open, it may have changed since it was indexed
+	result = !_reader.Open(_iptr) || !_reader.IsMapped();
+	for(unsigned int i=0; i<_Structures.size() && !result; i++){
+		if(_Structures[i].offset + _Structures[i].length > _reader.GetSize()){
+			result = true;
+		}
+	}
+	if(result){
+		v_printf(1, "Could not load the geometry of %d cells, the GDS file changed.\n", (int)_Structures.size());
+		_Structures.clear();
+	}else{
+		for(unsigned int i=0; i<_Structures.size(); i++){
+			decoded.push_back(_Structures[i].object);
+		}
+		result = ParseStructures(GDS_PARSE_GEOMETRY);
+		TesselatePolygons(decoded);
+		if(result){
+			v_printf(1, "Could not load the geometry of some cells, the GDS file changed.\n");
+		}
+	}
+	_reader.Close();
+
+	return result;
+}
+
+bool GDSParse::ParseRecords()
+{
+	byte recordtype, datatype;
+
+	_currentelement = elNone;
+
+	while(_reader.NextRecord(recordtype, datatype, _recptr, _recordlen)){
+		if(!ParseRecord(recordtype)){
+			return recordtype != rnEndLib;
+		}
+	}
+	return false;
+}
+
+// Pass 1: create the objects in file order and remember where their records are
+bool GDSParse::IndexStructures()
+{
+	byte recordtype, datatype;
+	GDSStructure structure;
+	bool instructure = false;
+
+	_Structures.clear();
+	_currentelement = elNone;
+
+	while(_reader.NextRecord(recordtype, datatype, _recptr, _recordlen)){
+		if(instructure){
+			if(recordtype == rnEndStr){
+				structure.length = _reader.Tell() + 4 + _recordlen - structure.offset;
+				_Structures.push_back(structure);
+				instructure = false;
+			}
+			continue;
+		}
+
+		if(recordtype == rnStrName){
+			structure.offset = _reader.Tell() + 4 + _recordlen;
+			ParseStrName();
+			structure.object = _CurrentObject;
+			instructure = true;
+			continue;
+		}
+
+		if(!ParseRecord(recordtype)){
+			return recordtype != rnEndLib;
+		}
+	}
+	return false;
+}
+
+// Reparses only the structures whose records changed since the last parse.
+// Cells that reference a changed cell are reparsed too, because collapsing
+// copied the old geometry into them. All other objects are moved over as
+// they are, keeping their collapsed geometry and GPU buffers. Geometry is
+// decoded again for the reparsed cells that had it before.
+bool GDSParse::ReloadChanged()
+{
+	GDSObjectList *old = _Objects;
+	GDSObject *object, *child;
+	vector<int> oldindex, newindex; // By name ID, first structure with the name
+	int index;
+	map<GDSObject*, GDSStructure> pending;
+	vector<GDSStructure> structures;
+	vector<GDSObject*> decode;
+	vector<int> reuse; // Index in the old list, or -1 to parse again
+	vector<bool> used;
+	unsigned int refcount, j;
+	bool changed;
+	int parsed = 0;
+
+	if(_generate_process || verbose_output >= 3){
+		return true;
+	}
+	oldindex.resize(gds_names.GetCount(), -1);
+	for(unsigned int i=0; i<old->getNumObjects(); i++){
+		object = old->getObject(i);
+		if(!object->GetRecordHash()){
+			return true; // Not parsed from a mapped file
+		}
+		if(oldindex[object->GetID()] < 0){
+			oldindex[object->GetID()] = i;
+		}
+	}
+	used.resize(old->getNumObjects(), false);
+
+	if(!_reader.Open(_iptr)){
+		return true;
+	}
+	if(!_reader.IsMapped()){
+		_reader.Close();
+		return true;
+	}
+
+	_Objects = new GDSObjectList;
+	if(IndexStructures()){
+		_reader.Close();
+		delete _Objects;
+		_Objects = old;
+		return true;
+	}
+	structures.swap(_Structures);
+	oldindex.resize(gds_names.GetCount(), -1); // New names
+	newindex.resize(gds_names.GetCount(), -1);
+
+	// Unchanged cells, unless one of their references did not resolve last
+	// time, the missing cell may have been added
+	for(unsigned int i=0; i<structures.size(); i++){
+		object = structures[i].object;
+		object->SetRecordHash(GDSCache::Hash(_reader.GetData(structures[i].offset), structures[i].length, 0));
+		if(newindex[object->GetID()] < 0){
+			newindex[object->GetID()] = i;
+		}
+
+		index = oldindex[object->GetID()];
+		if(index >= 0 && !used[index] && !old->getObject(index)->hasMissingRefs() &&
+			old->getObject(index)->GetRecordHash() == object->GetRecordHash()){
+			used[index] = true;
+			reuse.push_back(index);
+		}else{
+			reuse.push_back(-1);
+		}
+	}
+
+	// A cell referencing a cell that is parsed again or gone holds a stale
+	// collapsed copy of it. Collapsing only drops refs, so the old objects
+	// still list all their references.
+	do{
+		changed = false;
+		for(unsigned int i=0; i<structures.size(); i++){
+			if(reuse[i] < 0){
+				continue;
+			}
+
+			object = old->getObject(reuse[i]);
+			refcount = object->GetNumSRefs() + object->GetNumARefs();
+			for(j=0; j<refcount; j++){
+				if(j < object->GetNumSRefs()){
+					child = object->GetSRef(j)->object;
+				}else{
+					child = object->GetARef(j-object->GetNumSRefs())->object;
 				}
-				break;
-			case rnLibName:
-				v_printf(3, "LIBNAME ");
-				ParseLibName();
-				break;
-			case rnUnits:
-				v_printf(3, "UNITS\n");
-				ParseUnits();
-				break;
-			case rnEndLib:
-				v_printf(3, "ENDLIB\n");
-				fseek(_iptr, 0, SEEK_END);
-        //Added for substrate
-      	_BoundaryElements++;
-        _currentlayer = 255;
-        _currentdatatype = 0;
-        AddSubstrate(topcell);
-                _Objects->ConnectReferences();
-
-				return 0;
-				break;
-			case rnEndStr:
-				v_printf(3, "ENDSTR\n");				
 
-				// Reset transformation matrix
-				_currentstrans = 0;
-				break;
-			case rnEndEl:
-				v_printf(3, "ENDEL\n\n");
-                
-                // End of path, text or boundary
-                switch(_currentelement){
-                    case elBoundary:
-                        if(_CurrentObject)
-                        {
-                            if(_CurrentObject->GetCurrentPolygon())
-							{
-                                _CurrentObject->GetCurrentPolygon()->Orientate(); // Check normal pointing
-								_CurrentObject->GetCurrentPolygon()->Tesselate();
-							}
-                        }
-                        break;
-					case elPath:
-                        
-                        if(_CurrentObject)
-                        {
-                            if(_CurrentObject->GetCurrentPath())
-                            {
-                                GDSPath *path;
-                                path = _CurrentObject->GetCurrentPath();
-                                _CurrentObject->AddPolygon(path->GetHeight(), path->GetThickness(), path->GetPoints()*2, path->GetLayer());
-                                GDSPolygon* poly = _CurrentObject->GetCurrentPolygon();
-                                
-                                ProcessLayer *layer = path->GetLayer();
-                                
-                                if(path->GetWidth() && layer){
-                                    switch(path->GetType()){
-                                        case 1:
-                                        case 2:
-                                            BgnExtn = path->GetWidth(); /* Width has already been scaled to half */
-                                            EndExtn = path->GetWidth();
-                                            break;
-                                        case 4:
-                                            BgnExtn = path->GetBgnExtn();
-                                            EndExtn = path->GetEndExtn();
-                                            break;
-                                        default:
-                                            BgnExtn = 0.0;
-                                            EndExtn = 0.0;
-                                            break;
-                                    }
-                                    
-                                    float dx, dy;
-                                    // Cache angles
-                                    for(unsigned long j=0; j<path->GetPoints()-1; j++){
-                                        dx = path->GetXCoords(j) - path->GetXCoords(j+1);
-                                        dy = path->GetYCoords(j+1) - path->GetYCoords(j);
-                                        
-                                        /* This is only run once each time the program is run, so we can more afford the expensive trig functions.
-                                         Sort the above out properly later. */
-                                        angleX[j] = cos(atan2(dx, dy));
-                                        angleY[j] = sin(atan2(dx, dy));
-                                    }
-                                    
-                                    // Make path
-                                    float angleX_1;
-                                    float angleY_1;
-                                    float angleX_2;
-                                    float angleY_2;
-                                    float l; // Normalization
-                                    Point2D P[256];
-                                    
-									extn_x = extn_y = extn_x2 = extn_y2 = 0.0;
-                                    for(unsigned long j=0; j<path->GetPoints()-1; j++){
-                                        if(j==0){
-                                            extn_x = BgnExtn * angleY[j];
-                                            extn_y = BgnExtn * angleX[j];
-											extn_x2 = EndExtn * angleY[j];
-                                            extn_y2 = EndExtn * angleX[j];
-                                            angleX_1 = angleX[j]; 
-                                            angleY_1 = angleY[j];
-                                            if(path->GetPoints()>2){
-                                                angleX_2 = (angleX[j]+angleX[j+1])/2;
-                                                angleY_2 = (angleY[j]+angleY[j+1])/2;
-                                            }
-                                            else{
-                                                angleX_2 = angleX[j]; 
-                                                angleY_2 = angleY[j];
-                                            }
-                                            
-                                        }
-                                        else if(j==path->GetPoints()-2){
-											extn_x = BgnExtn * angleY[j];
-                                            extn_y = BgnExtn * angleX[j];
-                                            extn_x2 = EndExtn * angleY[j];
-                                            extn_y2 = EndExtn * angleX[j];
-                                            angleX_1 = (angleX[j]+angleX[j-1])/2;
-                                            angleY_1 = (angleY[j]+angleY[j-1])/2;
-                                            angleX_2 = angleX[j]; 
-                                            angleY_2 = angleY[j];
-                                        }else{
-											extn_x = extn_y = extn_x2 = extn_y2 = 0.0;
-                                            //extn_x = 0.0;
-                                            //extn_y = 0.0;
-                                            angleX_1 = (angleX[j]+angleX[j-1])/2;
-                                            angleY_1 = (angleY[j]+angleY[j-1])/2;
-                                            angleX_2 = (angleX[j]+angleX[j+1])/2;
-                                            angleY_2 = (angleY[j]+angleY[j+1])/2;
-                                        }
-                                        
-                                        // Normalize
-                                        l = sqrt(angleX_1*angleX_1+angleY_1*angleY_1);
-                                        if(l>0.01){
-                                            angleX_1 /= l; angleY_1 /= l;
-                                        }
-                                        l = sqrt(angleX_2*angleX_2+angleY_2*angleY_2);
-                                        if(l>0.01){
-                                            angleX_2 /= l; angleY_2 /= l;
-                                        }
-                                        
-                                        // Readjust path width
-                                        l = (angleX_1*angleX[j]+angleY_1*angleY[j]);
-                                        if(l>0.01){
-                                            angleX_1 /= l; angleY_1 /= l;
-                                        }
-                                        l = (angleX_2*angleX[j]+angleY_2*angleY[j]);
-                                        if(l>0.01){
-                                            angleX_2 /= l; angleY_2 /= l;
-                                        }
-                                        
-                                        // 1
-                                        if(j==0){
-                                            points[0].X = path->GetXCoords(j) - path->GetWidth() * angleX_1 + extn_x;// + offx;
-                                            points[0].Y = path->GetYCoords(j) - path->GetWidth() * angleY_1 - extn_y;// + offy;
-                                        }
-                                        else{
-                                            points[0].X = path->GetXCoords(j) - path->GetWidth() * angleX_1;// + offx;
-                                            points[0].Y = path->GetYCoords(j) - path->GetWidth() * angleY_1;// + offy;
-                                        }
-                                        //points[0].Z = z2;
-                                        
-                                        // 2
-                                        if(j==0){
-                                            points[1].X = path->GetXCoords(j) + path->GetWidth() * angleX_1 + extn_x;// + offx;
-                                            points[1].Y = path->GetYCoords(j) + path->GetWidth() * angleY_1 - extn_y;// + offy;
-                                        }
-                                        else{
-                                            points[1].X = path->GetXCoords(j) + path->GetWidth() * angleX_1; 
-                                            points[1].Y = path->GetYCoords(j) + path->GetWidth() * angleY_1;
-                                        }
-                                        //points[1].Z = z2;
-                                        
-                                        // 3 
-                                        if(j==path->GetPoints()-2){
-                                            points[2].X = path->GetXCoords(j+1) + path->GetWidth() * angleX_2 - extn_x2;// + offx;
-                                            points[2].Y = path->GetYCoords(j+1) + path->GetWidth() * angleY_2 + extn_y2;// + offy;
-                                        }
-                                        else{
-                                            points[2].X = path->GetXCoords(j+1) + path->GetWidth() * angleX_2;// + offx;
-                                            points[2].Y = path->GetYCoords(j+1) + path->GetWidth() * angleY_2;// + offy;
-                                        }
-                                        //points[2].Z = z2;
-                                        
-                                        // 4
-                                        if(j==path->GetPoints()-2){
-                                            points[3].X = path->GetXCoords(j+1) - path->GetWidth() * angleX_2 - extn_x2;// + offx;
-                                            points[3].Y = path->GetYCoords(j+1) - path->GetWidth() * angleY_2 + extn_y2;// + offy;
-                                        }
-                                        else{
-                                            points[3].X = path->GetXCoords(j+1) - path->GetWidth() * angleX_2;// + offx;
-                                            points[3].Y = path->GetYCoords(j+1) - path->GetWidth() * angleY_2;// + offy;
-                                        }
-                                        //points[3].Z = z2;
-                                        
-                                        
-                                        if(j==0)
-                                        {
-                                            P[0].X = points[0].X; P[0].Y = points[0].Y;
-                                            P[1].X = points[1].X; P[1].Y = points[1].Y;
-                                            
-                                            //poly->AddPoint(points[0].X, points[0].Y);
-                                            //poly->AddPoint(points[1].X, points[1].Y);
-                                            //poly->AddPoint(poly->GetPoints()-1, points[0].X, points[0].Y); // Close contour
-                                        }
-                                        P[j+2].X = points[2].X; P[j+2].Y = points[2].Y;
-                                        P[path->GetPoints()*2-1-j].X = points[3].X; P[path->GetPoints()*2-1-j].Y = points[3].Y;
-                                        //poly->AddPoint(points[2].X, points[2].Y);
-                                        //verts[j+2] = points[2];
-                                        //poly->AddPoint(points[3].X, points[3].Y);
-                                        //verts[numVerts-1-j] = points[3];
-                                    }
-
-                                    poly->Clear();
-                                    for(unsigned j=0;j<path->GetPoints()*2;j++)
-                                        poly->AddPoint(P[j].X, P[j].Y);
-									poly->Tesselate();
-                                    
-                                }
-                            }
-                        }
-                        break;
-                        
-                    default:
-                        break;
-                }
-				_currentstrans = 0;
-				break;
-			case rnBgnStr:
-				v_printf(3, "BGNSTR\n");
-				while(_recordlen){
-					GetTwoByteSignedInt();
+				index = newindex[child->GetID()];
+				if(index < 0 || reuse[index] < 0 || old->getObject(reuse[index]) != child){
+					break;
 				}
-				break;
-			case rnStrName:
-				v_printf(3, "STRNAME ");
-				ParseStrName();
-				break;
-			case rnBoundary:
-				v_printf(3, "BOUNDARY ");
-				_currentelement = elBoundary;
-				break;
-			case rnPath:
-				v_printf(3, "PATH ");
-				_currentelement = elPath;
-				break;
+			}
+			if(j < refcount){
+				used[reuse[i]] = false;
+				reuse[i] = -1;
+				changed = true;
+			}
+		}
+	}while(changed);
+
+	for(unsigned int i=0; i<structures.size(); i++){
+		if(reuse[i] < 0){
+			index = oldindex[structures[i].object->GetID()];
+			if(index >= 0 && !_Pending.count(old->getObject(index))){
+				decode.push_back(structures[i].object);
+			}
+			pending[structures[i].object] = structures[i];
+			_Structures.push_back(structures[i]);
+			parsed++;
+		}else if(_Pending.count(old->getObject(reuse[i]))){
+			pending[old->getObject(reuse[i])] = structures[i]; // At its new offset
+			pending[old->getObject(reuse[i])].object = old->getObject(reuse[i]);
+		}
+	}
+	if(ParseStructures(GDS_PARSE_REFS)){
+		_reader.Close();
+		delete _Objects;
+		_Objects = old;
+		return true;
+	}
+	_reader.Close();
+
+	// Move the unchanged objects over, both lists are in file order
+	j = 0;
+	for(unsigned int i=0; i<structures.size(); i++){
+		while(_Objects->getObject(j) != structures[i].object){
+			j++;
+		}
+		if(reuse[i] >= 0){
+			delete _Objects->setObject(j, old->setObject(reuse[i], NULL));
+		}
+	}
+	delete old;
+
+	for(unsigned int i=0; i<structures.size(); i++){
+		if(reuse[i] < 0){
+			structures[i].object->ConnectReferences(_Objects);
+		}
+	}
+
+	v_printf(1, "Reparsed %d of %d structures.\n", parsed, (int)structures.size());
+	_Pending.swap(pending);
+	LoadCells(decode);
+	return false;
+}
+
+// Parses structures into objects created by the main parser. Messages are
+// kept quiet and reported by the main parser after merging.
+class GDSParseWorker : public GDSParse
+{
+public:
+	bool	_failed;
+
+	GDSParseWorker(class GDSProcess *process, float units, int elements) : GDSParse(process, false)
+	{
+		_units = units;
+		_elements = elements;
+		_newnames = false;
+		_quiet = true;
+		_failed = false;
+	}
+
+	class GDSObject *NewObject(char *Name)
+	{
+		return NULL;
+	}
+};
+
+static bool CompareStructureLength(const GDSStructure &a, const GDSStructure &b)
+{
+	return a.length > b.length;
+}
+
+// Pass 2: parse the structure bodies concurrently
+bool GDSParse::ParseStructures(int elements)
+{
+	GDSThreadPool pool;
+	GDSParseWorker *worker;
+	bool result = false;
+
+	// Biggest structures first, so no thread is left with a big one at the end
+	sort(_Structures.begin(), _Structures.end(), CompareStructureLength);
+
+	for(int i=0; i<pool.GetThreads(); i++){
+		_Workers.push_back(new GDSParseWorker(_process, _units, elements));
+	}
+
+	v_printf(2, "Parsing %d structures using %d threads.\n", (int)_Structures.size(), pool.GetThreads());
+	pool.Run(ParseStructureJob, this, (int)_Structures.size());
+
+	for(unsigned int i=0; i<_Workers.size(); i++){
+		worker = (GDSParseWorker*)_Workers[i];
+		if(worker->_failed){
+			result = true;
+		}
+
+		_PathElements += worker->_PathElements;
+		_BoundaryElements += worker->_BoundaryElements;
+		_BoxElements += worker->_BoxElements;
+		_TextElements += worker->_TextElements;
+		_SRefElements += worker->_SRefElements;
+		_ARefElements += worker->_ARefElements;
+
+		for(int rn=0; rn<70; rn++){
+			if(worker->_unsupported[rn]){
+				ReportUnsupported(worker->_unsupported[rn], (enum RecordNumbers)rn);
+			}
+		}
+		for(set<pair<int,int> >::iterator it=worker->_layer_warning.begin(); it!=worker->_layer_warning.end(); it++){
+			ReportLayer(it->first, it->second);
+		}
+		delete worker;
+	}
+	_Workers.clear();
+	_Structures.clear();
+
+	return result;
+}
+
+void GDSParse::ParseStructureJob(void *data, int job, int thread)
+{
+	GDSParse *parse = (GDSParse*)data;
+	GDSParseWorker *worker = (GDSParseWorker*)parse->_Workers[thread];
+	GDSStructure &structure = parse->_Structures[job];
+	const byte *records = parse->_reader.GetData(structure.offset);
+	uint64_t hash = GDSCache::Hash(records, structure.length, 0);
+
+	// Geometry decoded on demand must come from the records that were indexed
+	if(structure.object->GetRecordHash() && structure.object->GetRecordHash() != hash){
+		worker->_failed = true;
+		return;
+	}
+	structure.object->SetRecordHash(hash);
+
+	if(worker->ParseStructure(structure, records)){
+		worker->_failed = true;
+	}
+}
+
+// Polygons of a tesselation batch, biggest first, and the progress made on them
+typedef struct GDSTesselateBatch
+{
+	vector<GDSPolygon*>	polygons;
+	vector<uint64_t>	hashes; // Of the shape of each polygon
+	vector<unsigned int>	members; // Polygons by shard of the shape table
+	vector<unsigned int>	shards; // First member of each shard, and one past the last
+	vector<char>		queued; // Per polygon, tesselated by a job
+	vector<GDSPolygon*>	tesselate; // One per new shape, and the polygons that keep their points
+	vector<unsigned int>	first; // First item of each job, and one past the last
+	GDSMutex		lock;
+	unsigned long		points;
+	unsigned long		done; // Points tesselated so far
+	int			reported; // Tenths of the points
+	bool			quiet;
+} GDSTesselateBatch;
+
+#define GDS_TESSELATE_POINTS 16384 // Per job, large polygons get a job of their own
+
+// Points and position of a polygon, ordered biggest first
+static bool ComparePolygonPoints(const pair<unsigned int, unsigned int> &a, const pair<unsigned int, unsigned int> &b)
+{
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+// Splits items sorted biggest first into jobs of about the same number of points
+static unsigned long SplitJobs(vector<unsigned int> &first, const vector<unsigned int> &points)
+{
+	unsigned long total = 0, job = 0;
+
+	first.clear();
+	for(unsigned int i=0; i<points.size(); i++){
+		if(job == 0){
+			first.push_back(i);
+		}
+		job += points[i];
+		total += points[i];
+		if(job >= GDS_TESSELATE_POINTS){
+			job = 0;
+		}
+	}
+	first.push_back(points.size());
+
+	return total;
+}
+
+static void OrientateJob(void *data, int job, int thread)
+{
+	GDSTesselateBatch *batch = (GDSTesselateBatch*)data;
+
+	for(unsigned int i=batch->first[job]; i<batch->first[job+1]; i++){
+		batch->polygons[i]->Orientate(); // Check normal pointing
+		batch->hashes[i] = batch->polygons[i]->ShapeHash();
+	}
+}
+
+static void ShareJob(void *data, int job, int thread)
+{
+	GDSTesselateBatch *batch = (GDSTesselateBatch*)data;
+	vector<pair<uint64_t, unsigned int> > counts; // Polygons per hash, open addressing
+	unsigned int first = batch->shards[job], last = batch->shards[job+1];
+	unsigned int mask, k;
+
+	for(mask=63; mask < (last-first)*2; mask=mask*2+1);
+	counts.assign(mask+1, make_pair((uint64_t)0, 0u));
+	for(unsigned int i=first; i<last; i++){
+		uint64_t hash = batch->hashes[batch->members[i]];
+		for(k=hash & mask; counts[k].second && counts[k].first != hash; k=(k+1) & mask);
+		counts[k].first = hash;
+		counts[k].second++;
+	}
+
+	// Only points that repeat get a new shape, others stay with their polygon
+	for(unsigned int i=first; i<last; i++){
+		unsigned int j = batch->members[i];
+		uint64_t hash = batch->hashes[j];
+		for(k=hash & mask; counts[k].first != hash; k=(k+1) & mask);
+		if(!batch->polygons[j]->Share(hash, counts[k].second > 1)){
+			continue;
+		}
+
+		// A new shape is tesselated once, through the polygon that made it
+		GDSShape *shape = batch->polygons[j]->GetShape();
+		batch->queued[j] = !shape || shape->refs == 1;
+	}
+}
+
+static void TesselateJob(void *data, int job, int thread)
+{
+	GDSTesselateBatch *batch = (GDSTesselateBatch*)data;
+	unsigned int first = batch->first[job], last = batch->first[job+1];
+	vector<unsigned int> ends; // Indices and rectangle floats after each polygon
+	unsigned long points = 0;
+	unsigned int index = 0, rect = 0;
+	GDSTesselation out;
+
+	// Polygons of a cell can be in several jobs, their arena only takes the results under the lock
+	for(unsigned int i=first; i<last; i++){
+		batch->tesselate[i]->Tesselate(out);
+		ends.push_back(out.indices.size());
+		ends.push_back(out.rects.size());
+		points += batch->tesselate[i]->GetPoints();
+	}
+
+	batch->lock.Lock();
+	for(unsigned int i=first; i<last; i++){
+		unsigned int indices = ends[(i-first)*2+0] - index, rects = ends[(i-first)*2+1] - rect;
+		if(indices || rects){
+			batch->tesselate[i]->SetTesselation(indices ? &out.indices[index] : NULL, indices, rects ? &out.rects[rect] : NULL, rects);
+		}
+		index += indices;
+		rect += rects;
+	}
+	batch->done += points;
+	while(batch->reported < (int)(batch->done*10/batch->points)){
+		batch->reported++;
+		if(!batch->quiet){
+			v_printf(1, "%d%% ", batch->reported*10);
+		}
+	}
+	batch->lock.Unlock();
+}
+
+static void PackJob(void *data, int job, int thread)
+{
+	(*(const vector<GDSObject*>*)data)[job]->PackPolygons();
+}
+
+// Tesselation is kept out of the parse, so no thread is held up by a big
+// polygon while others wait for records, and rendering never tesselates.
+// Polygons with the same points up to an offset share one shape, which is
+// tesselated only once. Afterwards the cells squeeze the points their shared
+// polygons left behind out of their arenas.
+void GDSParse::TesselatePolygons(const vector<GDSObject*> &objects)
+{
+	GDSTesselateBatch batch;
+	vector<unsigned int> points;
+	vector<pair<unsigned int, unsigned int> > sizes;
+	vector<GDSPolygon*> found;
+	vector<unsigned int> fill;
+	GDSPolygon *polygon;
+	GDSObject *object;
+
+	for(unsigned int i=0; i<objects.size(); i++){
+		object = objects[i];
+		for(unsigned int j=0; j<object->PolygonItems.size(); j++){
+			polygon = object->PolygonItems[j];
+			if(!polygon->GetShape() && polygon->GetPoints() >= 3){
+				sizes.push_back(make_pair(polygon->GetPoints(), (unsigned int)found.size()));
+				found.push_back(polygon);
+			}
+		}
+	}
+	if(found.empty()){
+		return;
+	}
+
+	// Biggest polygons first, so no thread is left with a big one at the end
+	sort(sizes.begin(), sizes.end(), ComparePolygonPoints);
+	for(unsigned int i=0; i<sizes.size(); i++){
+		batch.polygons.push_back(found[sizes[i].second]);
+		points.push_back(sizes[i].first);
+	}
+	SplitJobs(batch.first, points);
+	batch.hashes.resize(batch.polygons.size());
+
+	// Boundaries are orientated here rather than at their ENDEL, once the cells are loaded
+	GDSThreadPool pool;
+	pool.Run(OrientateJob, &batch, (int)batch.first.size()-1);
+
+	// Equal points hash to the same shard of the shape table, a job fills each
+	batch.shards.assign(GDS_SHAPE_SHARDS+1, 0);
+	for(unsigned int i=0; i<batch.polygons.size(); i++){
+		batch.shards[GDSShapeTable::Shard(batch.hashes[i])+1]++;
+	}
+	for(unsigned int s=0; s<GDS_SHAPE_SHARDS; s++){
+		batch.shards[s+1] += batch.shards[s];
+	}
+	fill.assign(batch.shards.begin(), batch.shards.end()-1);
+	batch.members.resize(batch.polygons.size());
+	for(unsigned int i=0; i<batch.polygons.size(); i++){
+		batch.members[fill[GDSShapeTable::Shard(batch.hashes[i])]++] = i;
+	}
+	batch.queued.assign(batch.polygons.size(), 0);
+	pool.Run(ShareJob, &batch, GDS_SHAPE_SHARDS);
+	vector<unsigned int>().swap(batch.members);
+	vector<uint64_t>().swap(batch.hashes);
+
+	// Still biggest first
+	points.clear();
+	for(unsigned int i=0; i<batch.polygons.size(); i++){
+		if(batch.queued[i]){
+			batch.tesselate.push_back(batch.polygons[i]);
+			points.push_back(sizes[i].first);
+		}
+	}
+	batch.points = SplitJobs(batch.first, points);
+	batch.done = 0;
+	batch.reported = 0;
+	batch.quiet = _quiet;
+
+	if(!batch.tesselate.empty()){
+		if(!_quiet){
+			v_printf(1, "Tesselating %d of %d polygons.. ", (int)batch.tesselate.size(), (int)batch.polygons.size());
+		}
+		pool.Run(TesselateJob, &batch, (int)batch.first.size()-1);
+		if(!_quiet){
+			v_printf(1, "done\n");
+		}
+	}
+
+	pool.Run(PackJob, (void*)&objects, (int)objects.size());
+}
+
+void GDSParse::TesselatePolygons()
+{
+	vector<GDSObject*> objects;
+
+	for(unsigned int i=0; i<_Objects->getNumObjects(); i++){
+		objects.push_back(_Objects->getObject(i));
+	}
+	TesselatePolygons(objects);
+}
+
+// One layer of one cell to merge
+typedef struct GDSUnionJob
+{
+	GDSObject		*object;
+	vector<unsigned int>	polygons; // Going into the union
+	vector<GDSPolygon*>	outlines; // Coming out of it
+	unsigned long		rects;
+	bool			merged;
+} GDSUnionJob;
+
+static bool CompareUnionJobs(const GDSUnionJob *a, const GDSUnionJob *b)
+{
+	return a->rects > b->rects;
+}
+
+static void MergeJob(void *data, int job, int thread)
+{
+	GDSUnionJob *item = (*(vector<GDSUnionJob*>*)data)[job];
+	GDSPolygon *polygon = item->object->PolygonItems[item->polygons[0]];
+	GDSPolygonUnion merger;
+	vector<bool> covered;
+	unsigned int n = 0;
+
+	for(unsigned int i=0; i<item->polygons.size(); i++){
+		merger.Add(item->object->PolygonItems[item->polygons[i]]);
+	}
+	item->merged = merger.Merge(item->outlines, covered, polygon->GetHeight(), polygon->GetThickness(), polygon->GetLayer());
+
+	// Polygons touching no other one are drawn as they are
+	for(unsigned int i=0; i<item->polygons.size(); i++){
+		if(covered[i]){
+			item->polygons[n++] = item->polygons[i];
+		}
+	}
+	item->polygons.resize(n);
+}
+
+// Abutting and overlapping polygons of a layer draw walls inside the solid.
+// Each layer of the cells below top is merged into the outlines of its union
+// once they are collapsed, see GDSPolygonUnion. Only Manhattan polygons take
+// part, and those touching no other one stay as they are. Every layer of
+// every cell is a job of its own.
+void GDSParse::MergePolygons(GDSObject *top)
+{
+	map<pair<struct ProcessLayer*, pair<float, float> >, GDSUnionJob*> layers; // Of a cell, by height and thickness
+	map<pair<struct ProcessLayer*, pair<float, float> >, GDSUnionJob*>::iterator it;
+	vector<GDSObject*> stack;
+	vector<GDSUnionJob*> jobs;
+	unsigned long polygons = 0, outlines = 0;
+	GDSPolygon *polygon;
+	GDSObject *object;
+	GDSUnionJob *job;
+
+	if(!top || top->isMerged()){
+		return;
+	}
+	top->SetMerged();
+	stack.push_back(top);
+	while(!stack.empty()){
+		object = stack.back();
+		stack.pop_back();
+		for(unsigned int i=0; i<object->refs.size(); i++){
+			if(!object->refs[i]->object->isMerged()){
+				object->refs[i]->object->SetMerged();
+				stack.push_back(object->refs[i]->object);
+			}
+		}
+
+		layers.clear();
+		for(unsigned int i=0; i<object->PolygonItems.size(); i++){
+			polygon = object->PolygonItems[i];
+			if(!polygon->GetLayer() || !GDSPolygonUnion::isManhattan(polygon)){
+				continue;
+			}
+			it = layers.find(make_pair(polygon->GetLayer(), make_pair(polygon->GetHeight(), polygon->GetThickness())));
+			if(it == layers.end()){
+				job = new GDSUnionJob;
+				job->object = object;
+				job->rects = 0;
+				job->merged = false;
+				it = layers.insert(make_pair(make_pair(polygon->GetLayer(), make_pair(polygon->GetHeight(), polygon->GetThickness())), job)).first;
+			}
+			it->second->polygons.push_back(i);
+			it->second->rects += polygon->GetNumRectangles() ? polygon->GetNumRectangles() : polygon->GetPoints()/2;
+		}
+		for(it=layers.begin(); it!=layers.end(); it++){
+			if(it->second->polygons.size() > 1){
+				jobs.push_back(it->second);
+			}else{
+				delete it->second;
+			}
+		}
+	}
+	if(jobs.empty()){
+		return;
+	}
+
+	// Biggest first, so no thread is left with a big one at the end
+	sort(jobs.begin(), jobs.end(), CompareUnionJobs);
+	if(!_quiet){
+		v_printf(1, "Merging %d layers.. ", (int)jobs.size());
+	}
+	GDSThreadPool pool;
+	pool.Run(MergeJob, &jobs, (int)jobs.size());
+
+	for(unsigned int i=0; i<jobs.size(); i++){
+		if(jobs[i]->merged){
+			jobs[i]->object->AddUnion(jobs[i]->polygons, jobs[i]->outlines);
+			polygons += jobs[i]->polygons.size();
+			outlines += jobs[i]->outlines.size();
+		}else{
+			for(unsigned int j=0; j<jobs[i]->outlines.size(); j++){
+				delete jobs[i]->outlines[j];
+			}
+		}
+		delete jobs[i];
+	}
+	if(!_quiet){
+		v_printf(1, "%lu polygons into %lu outlines\n", polygons, outlines);
+	}
+}
+
+bool GDSParse::ParseStructure(const GDSStructure &structure, const byte *data)
+{
+	byte recordtype, datatype;
+	bool result = false;
+	bool skip = false; // Inside an element that is not decoded
+
+	if(!_reader.Open(data, structure.length, structure.offset)){
+		return true;
+	}
+
+	// Start every structure from the same state, whichever thread parses it
+	_currentelement = elNone;
+	_currentlayer = -1;
+	_currentdatatype = -1;
+	_currentwidth = 0.0;
+	_currentpathtype = 0;
+	_currentstrans = 0;
+	_currentangle = 0.0;
+	_currentmag = 1.0;
+	_currentbgnextn = 0.0;
+	_currentendextn = 0.0;
+	_currenttexttype = 0;
+	_currentpresentation = 0;
+	_arrayrows = 0;
+	_arraycols = 0;
+	_CurrentObject = structure.object;
+
+	while(_reader.NextRecord(recordtype, datatype, _recptr, _recordlen)){
+		if(skip){
+			skip = recordtype != rnEndEl;
+			continue;
+		}
+		switch(recordtype){
 			case rnSRef:
-				v_printf(3, "SREF ");
-				_currentelement = elSRef;
-				break;
 			case rnARef:
-				v_printf(3, "AREF ");
-				_currentelement = elARef;
+				skip = !(_elements & GDS_PARSE_REFS);
 				break;
+			case rnBoundary:
+			case rnPath:
 			case rnText:
-				v_printf(3, "TEXT ");
-				_currentelement = elText;
-				break;
-			case rnLayer:
-				_currentlayer = GetTwoByteSignedInt();
-				v_printf(3, "LAYER (%d)\n", _currentlayer);
-				break;
-			case rnDataType:
-				_currentdatatype = GetTwoByteSignedInt();
-				v_printf(3, "DATATYPE (%d)\n", _currentdatatype);
-				break;
-			case rnWidth:
-				_currentwidth = (float)(GetFourByteSignedInt()/2);
-				if(_currentwidth > 0){
-					_currentwidth *= _units;
-				}
-				v_printf(3, "WIDTH (%.3f)\n", _currentwidth*2);
-				// Scale to a half to make width correct when adding and
-				// subtracting
-				break;
-			case rnXY:
-				v_printf(3, "XY ");
-				switch(_currentelement){
-					case elBoundary:
-						_BoundaryElements++;
-						ParseXYBoundary();
-						break;
-					case elBox:
-						_BoxElements++;
-						ParseXYBoundary();
-						break;
-					case elPath:
-						_PathElements++;
-						ParseXYPath();
-						break;
-					default:
-						ParseXY();
-						break;
-				}
-				break;
-			case rnColRow:
-				_arraycols = GetTwoByteSignedInt();
-				_arrayrows = GetTwoByteSignedInt();
-				v_printf(3, "COLROW (Columns = %d Rows = %d)\n", _arraycols, _arrayrows);
-				break;
-			case rnSName:
-				ParseSName();
-				break;
-			case rnPathType:
-				if(!_unsupported[rnPathType]){
-					v_printf(2, "Incomplete support for GDS2 record type: PATHTYPE\n");
-					_unsupported[rnPathType] = true;
-				}
-				//FIXME
-				_currentpathtype = GetTwoByteSignedInt();
-				v_printf(3, "PATHTYPE (%d)\n", _currentpathtype);
-				break;
-			case rnTextType:
-				ReportUnsupported("TEXTTYPE", rnTextType);
-				_currenttexttype = GetTwoByteSignedInt();
-				v_printf(3, "TEXTTYPE (%d)\n", _currenttexttype);
-				break;
-			case rnPresentation:
-				_currentpresentation = GetTwoByteSignedInt();
-				v_printf(3, "PRESENTATION (%d)\n", _currentpresentation);
+			case rnNode:
+			case rnBox:
+				skip = !(_elements & GDS_PARSE_GEOMETRY);
 				break;
-			case rnString:
-				v_printf(3, "STRING ");
-				if(_textstring){
-					delete [] _textstring;
-					_textstring = NULL;
-				}
-				_textstring = GetAsciiString();
-				/* Only set string if the current object is valid, the text string is valid 
-				 * and we are using a layer that is defined and being shown.
-				 */
-				if(_CurrentObject && _CurrentObject->GetCurrentText() && _textstring){
-					if(_process != NULL){
-						layer = _process->GetLayer(_currentlayer, _currentdatatype);
-						//if(layer && layer->Show){
-							_CurrentObject->GetCurrentText()->SetString(_textstring);
-						//}
-					}else{
+		}
+		if(skip){
+			continue;
+		}
+
+		if(!ParseRecord(recordtype)){
+			result = true;
+			break;
+		}
+	}
+	_paths.Expand(); // Structure cut short
+	_reader.Close();
+
+	return result;
+}
+
+bool GDSParse::ParseRecord(byte recordtype)
+{
+	char *tempstr;
+
+	switch(recordtype){
+		case rnHeader:
+			v_printf(3, "HEADER\n");
+			ParseHeader();
+			break;
+		case rnBgnLib:
+			v_printf(3, "BGNLIB\n");
+			while(_recordlen){
+				GetTwoByteSignedInt();
+			}
+			break;
+		case rnLibName:
+			v_printf(3, "LIBNAME ");
+			ParseLibName();
+			break;
+		case rnUnits:
+			v_printf(3, "UNITS\n");
+			ParseUnits();
+			break;
+		case rnEndLib:
+			v_printf(3, "ENDLIB\n");
+			return false;
+			break;
+		case rnEndStr:
+			v_printf(3, "ENDSTR\n");				
+			_paths.Expand();
+
+			// Reset transformation matrix
+			_currentstrans = 0;
+			break;
+		case rnEndEl:
+			v_printf(3, "ENDEL\n\n");
+            
+            // End of path, text or boundary
+            switch(_currentelement){
+				case elPath:
+                    
+                    if(_CurrentObject)
+                    {
+                        if(_CurrentObject->GetCurrentPath())
+                        {
+                            GDSPath *path;
+                            path = _CurrentObject->GetCurrentPath();
+                            _CurrentObject->AddPolygon(path->GetHeight(), path->GetThickness(), path->GetPoints()*2, path->GetLayer());
+                            GDSPolygon* poly = _CurrentObject->GetCurrentPolygon();
+                            
+                            // Outlined together with the other paths at the end of the structure
+                            if(path->GetWidth() && path->GetLayer()){
+                                _paths.Add(path, poly);
+                            }
+                        }
+                    }
+                    break;
+                    
+                default:
+                    break;
+            }
+			_currentstrans = 0;
+			break;
+		case rnBgnStr:
+			v_printf(3, "BGNSTR\n");
+			while(_recordlen){
+				GetTwoByteSignedInt();
+			}
+			break;
+		case rnStrName:
+			v_printf(3, "STRNAME ");
+			ParseStrName();
+			break;
+		case rnBoundary:
+			v_printf(3, "BOUNDARY ");
+			_currentelement = elBoundary;
+			break;
+		case rnPath:
+			v_printf(3, "PATH ");
+			_currentelement = elPath;
+			break;
+		case rnSRef:
+			v_printf(3, "SREF ");
+			_currentelement = elSRef;
+			break;
+		case rnARef:
+			v_printf(3, "AREF ");
+			_currentelement = elARef;
+			break;
+		case rnText:
+			v_printf(3, "TEXT ");
+			_currentelement = elText;
+			break;
+		case rnLayer:
+			_currentlayer = (uint16_t)GetTwoByteSignedInt(); // Unsigned, as most tools write it
+			v_printf(3, "LAYER (%d)\n", _currentlayer);
+			break;
+		case rnDataType:
+			_currentdatatype = (uint16_t)GetTwoByteSignedInt();
+			v_printf(3, "DATATYPE (%d)\n", _currentdatatype);
+			break;
+		case rnWidth:
+			_currentwidth = (float)(GetFourByteSignedInt()/2);
+			if(_currentwidth > 0){
+				_currentwidth *= _units;
+			}
+			v_printf(3, "WIDTH (%.3f)\n", _currentwidth*2);
+			// Scale to a half to make width correct when adding and
+			// subtracting
+			break;
+		case rnXY:
+			v_printf(3, "XY ");
+			switch(_currentelement){
+				case elBoundary:
+					_BoundaryElements++;
+					ParseXYBoundary();
+					break;
+				case elBox:
+					_BoxElements++;
+					ParseXYBoundary();
+					break;
+				case elPath:
+					_PathElements++;
+					ParseXYPath();
+					break;
+				default:
+					ParseXY();
+					break;
+			}
+			break;
+		case rnColRow:
+			_arraycols = GetTwoByteSignedInt();
+			_arrayrows = GetTwoByteSignedInt();
+			v_printf(3, "COLROW (Columns = %d Rows = %d)\n", _arraycols, _arrayrows);
+			break;
+		case rnSName:
+			ParseSName();
+			break;
+		case rnPathType:
+			ReportUnsupported("PATHTYPE", rnPathType);
+			//FIXME
+			_currentpathtype = GetTwoByteSignedInt();
+			v_printf(3, "PATHTYPE (%d)\n", _currentpathtype);
+			break;
+		case rnTextType:
+			ReportUnsupported("TEXTTYPE", rnTextType);
+			_currenttexttype = GetTwoByteSignedInt();
+			v_printf(3, "TEXTTYPE (%d)\n", _currenttexttype);
+			break;
+		case rnPresentation:
+			_currentpresentation = GetTwoByteSignedInt();
+			v_printf(3, "PRESENTATION (%d)\n", _currentpresentation);
+			break;
+		case rnString:
+			v_printf(3, "STRING ");
+			if(_textstring){
+				delete [] _textstring;
+				_textstring = NULL;
+			}
+			_textstring = GetAsciiString();
+			/* Only set string if the current object is valid, the text string is valid 
+			 * and we are using a layer that is defined and being shown.
+			 */
+			if(_CurrentObject && _CurrentObject->GetCurrentText() && _textstring){
+				if(_process != NULL){
+					//struct ProcessLayer *layer = _process->GetLayer(_currentlayer, _currentdatatype);
+					//if(layer && layer->Show){
 						_CurrentObject->GetCurrentText()->SetString(_textstring);
-					}
-					v_printf(3, "(\"%s\")", _textstring);
-					delete [] _textstring;
-					_textstring = NULL;
-				}else if(!_textstring){
-					return true;
+					//}
+				}else{
+					_CurrentObject->GetCurrentText()->SetString(_textstring);
 				}
-				v_printf(3, "\n");
-				break;
-			case rnSTrans:
-				//if(!_unsupported[rnSTrans]){
-				//	v_printf(1, "Incomplete support for GDS2 record type: STRANS\n");
-				//	_unsupported[rnSTrans] = true;
-				//}
-				//Fixed by Silencer
-				_currentstrans = GetTwoByteSignedInt();
-				v_printf(3, "STRANS (%d)\n", _currentstrans);
-				break;
-			case rnMag:
-				_currentmag = (float) GetEightByteReal();
-				v_printf(3, "MAG (%f)\n", _currentmag);
-				break;
-			case rnAngle:
-				_currentangle = (float)GetEightByteReal();
-				v_printf(3, "ANGLE (%f)\n", _currentangle);
-				break;
-/*			case rnUInteger:
-				break;
+				v_printf(3, "(\"%s\")", _textstring);
+				delete [] _textstring;
+				_textstring = NULL;
+			}else if(!_textstring){
+				return false;
+			}
+			v_printf(3, "\n");
+			break;
+		case rnSTrans:
+			//if(!_unsupported[rnSTrans]){
+			//	v_printf(1, "Incomplete support for GDS2 record type: STRANS\n");
+			//	_unsupported[rnSTrans] = true;
+			//}
+			//Fixed by Silencer
+			_currentstrans = GetTwoByteSignedInt();
+			v_printf(3, "STRANS (%d)\n", _currentstrans);
+			break;
+		case rnMag:
+			_currentmag = (float) GetEightByteReal();
+			v_printf(3, "MAG (%f)\n", _currentmag);
+			break;
+		case rnAngle:
+			_currentangle = (float)GetEightByteReal();
+			v_printf(3, "ANGLE (%f)\n", _currentangle);
+			break;
+/*		case rnUInteger:
+			break;
 Not used in GDS2 spec	case rnUString:
-				break;
+			break;
 */
-			case rnRefLibs:
-				ReportUnsupported("REFLIBS", rnRefLibs);
-				tempstr = GetAsciiString();
-				v_printf(3, "REFLIBS (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnFonts:
-				ReportUnsupported("FONTS", rnFonts);
-				tempstr = GetAsciiString();
-				v_printf(3, "FONTS (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnGenerations:
-				ReportUnsupported("GENERATIONS", rnGenerations);
-				v_printf(3, "GENERATIONS\n");
-				v_printf(3, "\t");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, "\n");
-				break;
-			case rnAttrTable:
-				ReportUnsupported("ATTRTABLE", rnAttrTable);
-				tempstr = GetAsciiString();
-				v_printf(3, "ATTRTABLE (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnStypTable:
-				ReportUnsupported("STYPTABLE", rnStypTable);
-				v_printf(3, "STYPTABLE (\"%d\")\n", GetTwoByteSignedInt());
-				break;
-			case rnStrType:
-				ReportUnsupported("STRTYPE", rnStrType);
-				tempstr = GetAsciiString();
-				v_printf(3, "STRTYPE (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnElFlags:
-				ReportUnsupported("ELFLAGS", rnElFlags);
-				v_printf(3, "ELFLAGS (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnElKey:
-				ReportUnsupported("ELKEY", rnElKey);
-				v_printf(3, "ELKEY (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnLinkType:
-				ReportUnsupported("LINKTYPE", rnLinkType);
-				v_printf(3, "LINKTYPE (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnLinkKeys:
-				ReportUnsupported("LINKKEYS", rnLinkKeys);
-				v_printf(3, "LINKKEYS (");
-				while(_recordlen){
-					v_printf(3, "%ld ", GetFourByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnNodeType:
-				ReportUnsupported("NODETYPE", rnNodeType);
-				v_printf(3, "NODETYPE (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnPropAttr:
-				ReportUnsupported("PROPATTR", rnPropAttr);
-				v_printf(3, "PROPATTR (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnPropValue:
-				ReportUnsupported("PROPVALUE", rnPropValue);
-				tempstr = GetAsciiString();
-				v_printf(3, "PROPVALUE (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnBox:
-				ReportUnsupported("BOX", rnBox);
-				v_printf(3, "BOX\n");
-				/* Empty */
-				_currentelement = elBox;
-				break;
-			case rnBoxType:
-				ReportUnsupported("BOXTYPE", rnBoxType);
-				v_printf(3, "BOXTYPE (%d)\n", GetTwoByteSignedInt());
-				break;
-			case rnPlex:
-				ReportUnsupported("PLEX", rnPlex);
-				v_printf(3, "PLEX (");
-				while(_recordlen){
-					v_printf(3, "%ld ", GetFourByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnBgnExtn:
-				ReportUnsupported("BGNEXTN", rnBgnExtn);
-				_currentbgnextn = _units * (float)GetFourByteSignedInt();
-				v_printf(3, "BGNEXTN (%f)\n", _currentbgnextn);
-				break;
-			case rnEndExtn:
-				ReportUnsupported("ENDEXTN", rnEndExtn);
-				_currentendextn = _units * (float)GetFourByteSignedInt();
-				v_printf(3, "ENDEXTN (%ld)\n", _currentendextn);
-				break;
-			case rnTapeNum:
-				ReportUnsupported("TAPENUM", rnTapeNum);
-				v_printf(3, "TAPENUM\n");
-				v_printf(3, "\t");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, "\n");
-				break;
-			case rnTapeCode:
-				ReportUnsupported("TAPECODE", rnTapeCode);
-				v_printf(3, "TAPECODE\n");
-				v_printf(3, "\t");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, "\n");
-				break;
-			case rnStrClass:
-				ReportUnsupported("STRCLASS", rnStrClass);
-				v_printf(3, "STRCLASS (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnReserved:
-				ReportUnsupported("RESERVED", rnReserved);
-				v_printf(3, "RESERVED\n");
-				/* Empty */
-				break;
-			case rnFormat:
-				ReportUnsupported("FORMAT", rnFormat);
-				v_printf(3, "FORMAT (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnMask:
-				ReportUnsupported("MASK", rnMask);
-				tempstr = GetAsciiString();
-				v_printf(3, "MASK (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnEndMasks:
-				ReportUnsupported("ENDMASKS", rnEndMasks);
-				v_printf(3, "ENDMASKS\n");
-				/* Empty */
-				break;
-			case rnLibDirSize:
-				ReportUnsupported("LIBDIRSIZE", rnLibDirSize);
-				v_printf(3, "LIBDIRSIZE (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnSrfName:
-				ReportUnsupported("SRFNAME", rnSrfName);
-				tempstr = GetAsciiString();
-				v_printf(3, "SRFNAME (\"%s\")\n", tempstr);
-				delete [] tempstr;
-				break;
-			case rnLibSecur:
-				ReportUnsupported("LIBSECUR", rnLibSecur);
-				v_printf(3, "LIBSECUR (");
-				while(_recordlen){
-					v_printf(3, "%d ", GetTwoByteSignedInt());
-				}
-				v_printf(3, ")\n");
-				break;
-			case rnBorder:
-				ReportUnsupported("BORDER", rnBorder);
-				v_printf(3, "BORDER\n");
-				/* Empty */
-				break;
-			case rnSoftFence:
-				ReportUnsupported("SOFTFENCE", rnSoftFence);
-				v_printf(3, "SOFTFENCE\n");
-				/* Empty */
-				break;
-			case rnHardFence:
-				ReportUnsupported("HARDFENCE", rnHardFence);
-				v_printf(3, "HARDFENCE\n");
-				/* Empty */
-				break;
-			case rnSoftWire:
-				ReportUnsupported("SOFTWIRE", rnSoftWire);
-				v_printf(3, "SOFTWIRE\n");
-				/* Empty */
-				break;
-			case rnHardWire:
-				ReportUnsupported("HARDWIRE", rnHardWire);
-				v_printf(3, "HARDWIRE\n");
-				/* Empty */
-				break;
-			case rnPathPort:
-				ReportUnsupported("PATHPORT", rnPathPort);
-				v_printf(3, "PATHPORT\n");
-				/* Empty */
-				break;
-			case rnNodePort:
-				ReportUnsupported("NODEPORT", rnNodePort);
-				v_printf(3, "NODEPORT\n");
-				/* Empty */
-				break;
-			case rnUserConstraint:
-				ReportUnsupported("USERCONSTRAINT", rnUserConstraint);
-				v_printf(3, "USERCONSTRAINT\n");
-				/* Empty */
-				break;
-			case rnSpacerError:
-				ReportUnsupported("SPACERERROR", rnSpacerError);
-				v_printf(3, "SPACERERROR\n");
-				/* Empty */
-				break;
-			case rnContact:
-				ReportUnsupported("CONTACT", rnContact);
-				v_printf(3, "CONTACT\n");
-				/* Empty */
-				break;
-			default:
-				v_printf(2, "Unknown record type (%d) at position %ld.\n", recordtype, ftell(_iptr));
-				//return true;
-				break;
-		}
+		case rnRefLibs:
+			ReportUnsupported("REFLIBS", rnRefLibs);
+			tempstr = GetAsciiString();
+			v_printf(3, "REFLIBS (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnFonts:
+			ReportUnsupported("FONTS", rnFonts);
+			tempstr = GetAsciiString();
+			v_printf(3, "FONTS (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnGenerations:
+			ReportUnsupported("GENERATIONS", rnGenerations);
+			v_printf(3, "GENERATIONS\n");
+			v_printf(3, "\t");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, "\n");
+			break;
+		case rnAttrTable:
+			ReportUnsupported("ATTRTABLE", rnAttrTable);
+			tempstr = GetAsciiString();
+			v_printf(3, "ATTRTABLE (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnStypTable:
+			ReportUnsupported("STYPTABLE", rnStypTable);
+			v_printf(3, "STYPTABLE (\"%d\")\n", GetTwoByteSignedInt());
+			break;
+		case rnStrType:
+			ReportUnsupported("STRTYPE", rnStrType);
+			tempstr = GetAsciiString();
+			v_printf(3, "STRTYPE (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnElFlags:
+			ReportUnsupported("ELFLAGS", rnElFlags);
+			v_printf(3, "ELFLAGS (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnElKey:
+			ReportUnsupported("ELKEY", rnElKey);
+			v_printf(3, "ELKEY (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnLinkType:
+			ReportUnsupported("LINKTYPE", rnLinkType);
+			v_printf(3, "LINKTYPE (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnLinkKeys:
+			ReportUnsupported("LINKKEYS", rnLinkKeys);
+			v_printf(3, "LINKKEYS (");
+			while(_recordlen){
+				v_printf(3, "%ld ", GetFourByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnNodeType:
+			ReportUnsupported("NODETYPE", rnNodeType);
+			v_printf(3, "NODETYPE (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnPropAttr:
+			ReportUnsupported("PROPATTR", rnPropAttr);
+			v_printf(3, "PROPATTR (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnPropValue:
+			ReportUnsupported("PROPVALUE", rnPropValue);
+			tempstr = GetAsciiString();
+			v_printf(3, "PROPVALUE (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnBox:
+			ReportUnsupported("BOX", rnBox);
+			v_printf(3, "BOX\n");
+			/* Empty */
+			_currentelement = elBox;
+			break;
+		case rnBoxType:
+			ReportUnsupported("BOXTYPE", rnBoxType);
+			v_printf(3, "BOXTYPE (%d)\n", GetTwoByteSignedInt());
+			break;
+		case rnPlex:
+			ReportUnsupported("PLEX", rnPlex);
+			v_printf(3, "PLEX (");
+			while(_recordlen){
+				v_printf(3, "%ld ", GetFourByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnBgnExtn:
+			ReportUnsupported("BGNEXTN", rnBgnExtn);
+			_currentbgnextn = _units * (float)GetFourByteSignedInt();
+			v_printf(3, "BGNEXTN (%f)\n", _currentbgnextn);
+			break;
+		case rnEndExtn:
+			ReportUnsupported("ENDEXTN", rnEndExtn);
+			_currentendextn = _units * (float)GetFourByteSignedInt();
+			v_printf(3, "ENDEXTN (%ld)\n", _currentendextn);
+			break;
+		case rnTapeNum:
+			ReportUnsupported("TAPENUM", rnTapeNum);
+			v_printf(3, "TAPENUM\n");
+			v_printf(3, "\t");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, "\n");
+			break;
+		case rnTapeCode:
+			ReportUnsupported("TAPECODE", rnTapeCode);
+			v_printf(3, "TAPECODE\n");
+			v_printf(3, "\t");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, "\n");
+			break;
+		case rnStrClass:
+			ReportUnsupported("STRCLASS", rnStrClass);
+			v_printf(3, "STRCLASS (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnReserved:
+			ReportUnsupported("RESERVED", rnReserved);
+			v_printf(3, "RESERVED\n");
+			/* Empty */
+			break;
+		case rnFormat:
+			ReportUnsupported("FORMAT", rnFormat);
+			v_printf(3, "FORMAT (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnMask:
+			ReportUnsupported("MASK", rnMask);
+			tempstr = GetAsciiString();
+			v_printf(3, "MASK (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnEndMasks:
+			ReportUnsupported("ENDMASKS", rnEndMasks);
+			v_printf(3, "ENDMASKS\n");
+			/* Empty */
+			break;
+		case rnLibDirSize:
+			ReportUnsupported("LIBDIRSIZE", rnLibDirSize);
+			v_printf(3, "LIBDIRSIZE (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnSrfName:
+			ReportUnsupported("SRFNAME", rnSrfName);
+			tempstr = GetAsciiString();
+			v_printf(3, "SRFNAME (\"%s\")\n", tempstr);
+			delete [] tempstr;
+			break;
+		case rnLibSecur:
+			ReportUnsupported("LIBSECUR", rnLibSecur);
+			v_printf(3, "LIBSECUR (");
+			while(_recordlen){
+				v_printf(3, "%d ", GetTwoByteSignedInt());
+			}
+			v_printf(3, ")\n");
+			break;
+		case rnBorder:
+			ReportUnsupported("BORDER", rnBorder);
+			v_printf(3, "BORDER\n");
+			/* Empty */
+			break;
+		case rnSoftFence:
+			ReportUnsupported("SOFTFENCE", rnSoftFence);
+			v_printf(3, "SOFTFENCE\n");
+			/* Empty */
+			break;
+		case rnHardFence:
+			ReportUnsupported("HARDFENCE", rnHardFence);
+			v_printf(3, "HARDFENCE\n");
+			/* Empty */
+			break;
+		case rnSoftWire:
+			ReportUnsupported("SOFTWIRE", rnSoftWire);
+			v_printf(3, "SOFTWIRE\n");
+			/* Empty */
+			break;
+		case rnHardWire:
+			ReportUnsupported("HARDWIRE", rnHardWire);
+			v_printf(3, "HARDWIRE\n");
+			/* Empty */
+			break;
+		case rnPathPort:
+			ReportUnsupported("PATHPORT", rnPathPort);
+			v_printf(3, "PATHPORT\n");
+			/* Empty */
+			break;
+		case rnNodePort:
+			ReportUnsupported("NODEPORT", rnNodePort);
+			v_printf(3, "NODEPORT\n");
+			/* Empty */
+			break;
+		case rnUserConstraint:
+			ReportUnsupported("USERCONSTRAINT", rnUserConstraint);
+			v_printf(3, "USERCONSTRAINT\n");
+			/* Empty */
+			break;
+		case rnSpacerError:
+			ReportUnsupported("SPACERERROR", rnSpacerError);
+			v_printf(3, "SPACERERROR\n");
+			/* Empty */
+			break;
+		case rnContact:
+			ReportUnsupported("CONTACT", rnContact);
+			v_printf(3, "CONTACT\n");
+			/* Empty */
+			break;
+		default:
+			v_printf(2, "Unknown record type (%d) at position %lu.\n", recordtype, (unsigned long)_reader.Tell());
+			//return true;
+			break;
 	}
-	return 0;
+	return true;
 }
 
 void GDSParse::ParseHeader()
@@ -810,25 +1468,22 @@ void GDSParse::ParseSName()
 {
 	v_printf(3, "SNAME ");
 
-	char *str;
-	str = GetAsciiString();
 	if(_sname){
 		delete [] _sname;
-		_sname = NULL;
 	}
-	_sname = new char[strlen(str)+1];
+	_sname = GetAsciiString();
+	_snameid = -1;
 	if(_sname){
-		strcpy(_sname, str);
-		for(unsigned int i=0; i<strlen(_sname); i++){
-			if(_sname[i] && (_sname[i] < 48 || _sname[i] > 57) && (_sname[i] < 65 || _sname[i] > 90) && (_sname[i] < 97 || _sname[i] > 122)){
-				_sname[i] = '_';
+		for(char *c=_sname; *c; c++){
+			if((*c < 48 || *c > 57) && (*c < 65 || *c > 90) && (*c < 97 || *c > 122)){
+				*c = '_';
 			}
 		}
 		v_printf(3, "(\"%s\")\n", _sname);
-	}else{
-		v_printf(1, "Unable to allocate memory for string (%d)\n", strlen(str)+1);
+
+		// Workers only look up, the structure names are interned while indexing
+		_snameid = _newnames ? gds_names.Intern(_sname) : gds_names.Find(_sname);
 	}
-	delete [] str;
 }
 
 void GDSParse::ParseUnits()
@@ -864,33 +1519,15 @@ void GDSParse::ParseStrName()
 
 void GDSParse::ParseXYPath()
 {
-	float X, Y;
 	int points = _recordlen/8;
-	int i;
 	struct ProcessLayer *thislayer = NULL;
 
 	if(_process != NULL){
 		thislayer = _process->GetLayer(_currentlayer, _currentdatatype);
 
 		if(thislayer==NULL){
-			// _layer_warning only has fixed bounds at the moment.
-			// Not sure how to best make it dynamic.
-
-			if(!_generate_process){
-				if(!_layer_warning[_currentlayer+1][_currentdatatype+1]){
-					v_printf(2, "Notice: Layer %d, datatype %d is in the GDS, but not in the process.\n", _currentlayer, _currentdatatype);
-					//v_printf(1, "\tIgnoring this layer.\n");
-					_layer_warning[_currentlayer+1][_currentdatatype+1] = true;
-				}
-			}else{
-				if(!_layer_warning[_currentlayer+1][_currentdatatype+1]){
-					_process->AddLayer(_currentlayer, _currentdatatype);
-					_layer_warning[_currentlayer+1][_currentdatatype+1] = true;
-				}
-			}
-			while(_recordlen){
-				GetFourByteSignedInt();
-			}
+			ReportLayer(_currentlayer, _currentdatatype);
+			_recordlen = 0; // Skip coordinates
 			_currentwidth = 0.0; // Always reset to default for paths in case width not specified
 			_currentpathtype = 0;
 			_currentangle = 0.0;
@@ -902,24 +1539,16 @@ void GDSParse::ParseXYPath()
 		}
 	}
 
-	if(_currentwidth){
+	if(_currentwidth && points > 0){
+		GetXY(points);
+
 		/* FIXME - need to check for -ve value and then not scale */
 		if(thislayer && thislayer->Thickness && _CurrentObject){
 			_CurrentObject->AddPath(_currentpathtype, _units*thislayer->Height, _units*thislayer->Thickness, points, _currentwidth, _currentbgnextn, _currentendextn, thislayer);
-		}
-		for(i=0; i<points; i++){
-			X = _units * (float)GetFourByteSignedInt();
-			Y = _units * (float)GetFourByteSignedInt();
-			v_printf(3, "(%.3f,%.3f) ", X, Y);
-			if(thislayer && thislayer->Thickness &&  _CurrentObject){
-				_CurrentObject->GetCurrentPath()->AddPoint(i, X, Y);
-			}
+			_CurrentObject->GetCurrentPath()->SetPoints(&_XY[0]);
 		}
 	}else{
-		for(i=0; i<points; i++){
-			GetFourByteSignedInt();
-			GetFourByteSignedInt();
-		}
+		_recordlen = 0;
 	}
 	v_printf(3, "\n");
 	_currentwidth = 0.0; // Always reset to default for paths in case width not specified
@@ -1010,7 +1639,6 @@ void GDSParse::AddSubstrate(char *topcell)
      _Objects->SearchObject(topcell)->GetCurrentPolygon()->AddPoint(X, Y);
     }
 	}
-	_Objects->SearchObject(topcell)->GetCurrentPolygon()->Tesselate();
 	v_printf(3, "\n");
 	_currentwidth = 0.0; // Always reset to default for paths in case width not specified
 	_currentpathtype = 0;
@@ -1025,31 +1653,16 @@ _currentstrans=0; //Oh yeah!*/
 
 void GDSParse::ParseXYBoundary()
 {
-	float X, Y;
 	//float firstX=0.0, firstY=0.0;
 	int points = _recordlen/8;
-	int i;
 	struct ProcessLayer *thislayer = NULL;
 
 	if(_process != NULL){
 		thislayer = _process->GetLayer(_currentlayer, _currentdatatype);
 
 		if(thislayer==NULL){
-			if(!_generate_process){
-				if(!_layer_warning[_currentlayer+1][_currentdatatype+1]){
-					v_printf(2, "Notice: Layer %d, datatype %d is in the GDS, but not in the process.\n", _currentlayer, _currentdatatype);
-					//v_printf(1, "\tIgnoring this layer.\n");
-					_layer_warning[_currentlayer+1][_currentdatatype+1] = true;
-				}
-			}else{
-				if(!_layer_warning[_currentlayer+1][_currentdatatype+1]){
-					_process->AddLayer(_currentlayer, _currentdatatype);
-					_layer_warning[_currentlayer+1][_currentdatatype+1] = true;
-				}
-			}
-			while(_recordlen){
-				GetFourByteSignedInt();
-			}
+			ReportLayer(_currentlayer, _currentdatatype);
+			_recordlen = 0; // Skip coordinates
 			_currentwidth = 0.0; // Always reset to default for paths in case width not specified
 			_currentpathtype = 0;
 			_currentangle = 0.0;
@@ -1065,14 +1678,9 @@ void GDSParse::ParseXYBoundary()
 		_CurrentObject->AddPolygon(_units*thislayer->Height, _units*thislayer->Thickness, points-1, thislayer);
 	}
 
-	for(i=0; i<points; i++){
-		X = _units * (float)GetFourByteSignedInt();
-		Y = _units * (float)GetFourByteSignedInt();
-		v_printf(3, "(%.3f,%.3f) ", X, Y);
-
-		if(thislayer && thislayer->Thickness && _CurrentObject && i!=points-1){ // Don't close the contour!
-			_CurrentObject->GetCurrentPolygon()->AddPoint(X, Y);
-		}
+	GetXY(points);
+	if(thislayer && thislayer->Thickness && _CurrentObject && points > 1){
+		_CurrentObject->GetCurrentPolygon()->AddPoints(&_XY[0], points-1); // Don't close the contour!
 	}
 	v_printf(3, "\n");
 	
@@ -1107,7 +1715,7 @@ void GDSParse::ParseXY()
 			v_printf(3, "(%.3f,%.3f)\n", X, Y);
 
 			if(_CurrentObject){
-				_CurrentObject->AddSRef(_sname, X, Y, Flipped, _currentmag);
+				_CurrentObject->AddSRef(_snameid, X, Y, Flipped, _currentmag);
 				if(_currentangle){
 					_CurrentObject->SetSRefRotation(0, -_currentangle, 0);
 				}
@@ -1128,7 +1736,7 @@ void GDSParse::ParseXY()
 
 			if(_CurrentObject){
 				
-				_CurrentObject->AddARef(_sname, firstX, firstY, secondX, secondY, X, Y, _arraycols, _arrayrows, Flipped, _currentmag);
+				_CurrentObject->AddARef(_snameid, firstX, firstY, secondX, secondY, X, Y, _arraycols, _arrayrows, Flipped, _currentmag);
 				if(_currentangle){
 					_CurrentObject->SetARefRotation(0, -_currentangle, 0);
 				}
@@ -1139,22 +1747,8 @@ void GDSParse::ParseXY()
 			_TextElements++;
 
 			if(thislayer==NULL){
-				if(!_generate_process)
-				{
-					if(!_layer_warning[_currentlayer+1][_currentdatatype+1]){
-						v_printf(2, "Notice: Layer %d, datatype %d is in the GDS, but not in the process.\n", _currentlayer, _currentdatatype);
-						//v_printf(1, "\tIgnoring this string.\n");
-						_layer_warning[_currentlayer+1][_currentdatatype+1] = true;
-					}
-				}else{
-					if(!_layer_warning[_currentlayer+1][_currentdatatype+1]){
-						_process->AddLayer(_currentlayer, _currentdatatype);
-						_layer_warning[_currentlayer+1][_currentdatatype+1] = true;
-					}
-				}
-				while(_recordlen){
-					GetFourByteSignedInt();
-				}
+				ReportLayer(_currentlayer, _currentdatatype);
+				_recordlen = 0; // Skip coordinates
 				_currentwidth = 0.0; // Always reset to default for paths in case width not specified
 				_currentpathtype = 0;
 				_currentangle = 0.0;
@@ -1182,9 +1776,7 @@ void GDSParse::ParseXY()
 			}
 			break;
 		default:
-			while(_recordlen){
-				GetFourByteSignedInt();
-			}
+			_recordlen = 0; // Skip coordinates
 			break;
 	}
 	_currentwidth = 0.0; // Always reset to default for paths in case width not specified
@@ -1200,87 +1792,81 @@ _currentstrans=0; //Oh yeah!
 
 short GDSParse::GetBitArray()
 {
-	byte byte1;
-
-	fread(&byte1, 1, 1, _iptr);
-	fread(&byte1, 1, 1, _iptr);
+	if(_recordlen < 2){
+		_recordlen = 0;
+		return 0;
+	}
 
+	_recptr+=2;
 	_recordlen-=2;
 	return 0;
 }
 
 double GDSParse::GetEightByteReal()
 {
-	byte value;
-	byte b8, b2, b3, b4, b5, b6, b7;
-	double sign=1.0;
-	double exponent;
-	double mant;
-
-	fread(&value, 1, 1, _iptr);
-	if(value & 128){
-		value -= 128;
-		sign = -1.0;
-	}
-	exponent = (double )value;
-	exponent -= 64.0;
-	mant=0.0;
-
-	fread(&b2, 1, 1, _iptr);
-	fread(&b3, 1, 1, _iptr);
-	fread(&b4, 1, 1, _iptr);
-	fread(&b5, 1, 1, _iptr);
-	fread(&b6, 1, 1, _iptr);
-	fread(&b7, 1, 1, _iptr);
-	fread(&b8, 1, 1, _iptr);
-
-	mant += b8;
-	mant /= 256.0;
-	mant += b7;
-	mant /= 256.0;
-	mant += b6;
-	mant /= 256.0;
-	mant += b5;
-	mant /= 256.0;
-	mant += b4;
-	mant /= 256.0;
-	mant += b3;
-	mant /= 256.0;
-	mant += b2;
-	mant /= 256.0;
+	double value;
 
+	if(_recordlen < 8){
+		_recordlen = 0;
+		return 0.0;
+	}
+
+	value = GDSReadReal64(_recptr);
+	_recptr+=8;
 	_recordlen-=8;
 
-	return sign*(mant*pow(16.0,exponent));
+	return value;
 }
 
 int32_t GDSParse::GetFourByteSignedInt()
 {
 	int32_t value;
-	fread(&value, 4, 1, _iptr);
-	
+
+	if(_recordlen < 4){
+		_recordlen = 0;
+		return 0;
+	}
+
+	value = GDSReadInt32(_recptr);
+	_recptr+=4;
 	_recordlen-=4;
 
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	return endian_swap_long(value);
-#else
 	return value;
-#endif
 }
 
 int16_t GDSParse::GetTwoByteSignedInt()
 {
 	int16_t value;
 
-	fread(&value, 2, 1, _iptr);
+	if(_recordlen < 2){
+		_recordlen = 0;
+		return 0;
+	}
 
+	value = GDSReadInt16(_recptr);
+	_recptr+=2;
 	_recordlen-=2;
 
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	return endian_swap_short(value);
-#else
 	return value;
-#endif
+}
+
+void GDSParse::GetXY(int points)
+{
+	if(points*8 > _recordlen){
+		points = _recordlen/8;
+	}
+
+	// Decode the whole record at once
+	_XY.resize(points*2+2);
+	GDSReadXY(_recptr, points, _units, &_XY[0]);
+	_recptr += points*8;
+	_recordlen -= points*8;
+
+	if(verbose_output >= 3){
+		for(int i=0; i<points; i++){
+			v_printf(3, "(%.3f,%.3f) ", _XY[i*2], _XY[i*2+1]);
+		}
+	}
 }
 
 char *GDSParse::GetAsciiString()
@@ -1288,14 +1874,14 @@ char *GDSParse::GetAsciiString()
 	char *str=NULL;
 	
 	if(_recordlen>0){
-		_recordlen += _recordlen%2; /* Make sure length is even, why would you do this? */
 		str = new char[_recordlen+1];
 		if(!str){
 			v_printf(1, "Unable to allocate memory for ascii string (%d)\n", _recordlen);
 			return NULL;
 		}
-		fread(str, 1, _recordlen, _iptr);
+		memcpy(str, _recptr, _recordlen);
 		str[_recordlen] = 0;
+		_recptr += _recordlen;
 		_recordlen = 0;
 	}
 	return str;
@@ -1304,12 +1890,31 @@ char *GDSParse::GetAsciiString()
 void GDSParse::ReportUnsupported(const char *Name, enum RecordNumbers rn)
 {
 	if(!_unsupported[rn]){
-		v_printf(2, "Unsupported GDS2 record type: %s\n", Name);
-		_unsupported[rn] = true;
+		if(!_quiet){
+			if(rn == rnPathType){
+				v_printf(2, "Incomplete support for GDS2 record type: %s\n", Name);
+			}else{
+				v_printf(2, "Unsupported GDS2 record type: %s\n", Name);
+			}
+		}
+		_unsupported[rn] = Name;
 	}
 
 }
 
+void GDSParse::ReportLayer(int layer, int datatype)
+{
+	if(_layer_warning.insert(make_pair(layer, datatype)).second){
+		if(!_generate_process){
+			if(!_quiet){
+				v_printf(2, "Notice: Layer %d, datatype %d is in the GDS, but not in the process.\n", layer, datatype);
+			}
+		}else{
+			_process->AddLayer(layer, datatype);
+		}
+	}
+}
+
 class GDSProcess *GDSParse::GetProcess() {
   if(_process != NULL){
 		return _process;
@@ -26,14 +26,32 @@
 #include "gds_globals.h"
 #include "gdsobject.h"
 #include "gdsobjectlist.h"
+#include "gdsrecord.h"
+#include "gdspathexpand.h"
+
+// Byte range of a structure body in the file
+typedef struct GDSStructure
+{
+	class GDSObject	*object;
+	size_t		offset; // Record after STRNAME
+	size_t		length; // Up to and including ENDSTR
+} GDSStructure;
+
+// Elements decoded by ParseStructure
+#define GDS_PARSE_REFS		1 // SREF and AREF
+#define GDS_PARSE_GEOMETRY	2 // Everything else
+#define GDS_PARSE_ALL		3
 
 class GDSParse
 {
+	friend class GDSCache; // Reads and restores the parsed data
+
 protected:
 	char			*_libname;
 	char			*_topcellname;
+	char			*_cachefile;
 
-	int16_t			_currentlayer;
+	int			_currentlayer; // 0-65535, -1 if not set
 	float			_currentwidth;
 	int16_t			_currentpathtype;
 	gds_element_type	_currentelement;
@@ -42,12 +60,14 @@ protected:
 	char			*_textstring;
 	int16_t			_currentstrans;
 	float			_currentangle;
-	int16_t			_currentdatatype;
+	int			_currentdatatype; // 0-65535, -1 if not set
 	float			_currentmag;
 	float			_currentbgnextn;
 	float			_currentendextn;
 
 	char			*_sname;
+	int			_snameid; // In gds_names
+	bool			_newnames; // Intern unknown SNAMEs, off in the workers
 	int16_t			_arrayrows, _arraycols;
 	float			_units;
 	float			_angle;
@@ -55,26 +75,35 @@ protected:
 	FILE			*_optr;
 	class GDSProcess	*_process;
 	
-	int16_t			_recordlen;
+	GDSRecordReader		_reader;
+	GDSPathExpander		_paths; // Of the current structure
+	const byte		*_recptr; // Data of the current record
+	int			_recordlen; // Bytes left in the current record
+	vector<float>		_XY; // Decoded XY record
+
+	vector<GDSStructure>	_Structures; // Structures left for the parallel pass
+	vector<GDSParse*>	_Workers; // One parser per thread
+	map<class GDSObject*, GDSStructure> _Pending; // Structures without decoded geometry
+	int			_elements; // GDS_PARSE_* of the structures being parsed
 
 	/* Output options */
 	bool			_allow_multiple_output;
 	bool			_output_children_first;
 	bool			_use_outfile;
 	bool			_generate_process;
+	bool			_quiet; // Record warnings without printing them
 
 	/*
-	** Both of these variables have fixed bounds because
-	** they are not dependant on the GDS2 spec, not on the
-	** file we are parsing.
-	** There will never be more than 70 records.
-	** The maximum layer and datatype are both defined as
-	** 255, but but could be as high as 32,767 because of
-	** the way they are stored (2 byte int). It might be worth
-	** checking if they are greater than 255
+	** Warnings are given once per parse, and the workers hand
+	** theirs to the main parser to report.
+	** _unsupported is indexed by record number, the GDS2 spec
+	** has fewer than 70, and holds the name of each unsupported
+	** record type met so far.
+	** _layer_warning holds the layer and datatype pairs that are
+	** missing from the process, both unsigned 16-bit values.
 	*/
-	bool			_unsupported[70];
-	bool			_layer_warning[257][257];
+	const char		*_unsupported[70]; // Name once reported
+	set<pair<int,int> >	_layer_warning; // Layer and datatype, reported once
 
 	long			_PathElements;
 	long			_BoundaryElements;
@@ -108,10 +137,23 @@ protected:
 	int32_t GetFourByteSignedInt();
 	int16_t GetTwoByteSignedInt();
 	char *GetAsciiString();
+	void GetXY(int points); // Fills _XY
 
 	void ReportUnsupported(const char *Name, enum RecordNumbers rn);
+	void ReportLayer(int layer, int datatype); // Layer missing from the process
 	
 	bool ParseFile(char *topcell);
+	bool ParseRecords();
+	bool ParseRecord(byte recordtype); // Returns false to stop
+	bool IndexStructures();
+	bool ParseStructures(int elements);
+	bool ParseStructure(const GDSStructure &structure, const byte *data);
+	bool ReloadChanged(); // Returns true when a full reload is needed
+	bool LoadCells(const vector<class GDSObject*> &objects);
+	void TesselatePolygons(const vector<class GDSObject*> &objects); // What is not tesselated yet, on all cores
+	void TesselatePolygons(); // In all cells
+	class GDSObject *GetTopcell(const char *topcell); // Named cell, or else the first unreferenced one
+	static void ParseStructureJob(void *data, int job, int thread);
 
 public:
 	class GDSObjectList	*_Objects; // Move to protected later on
@@ -120,8 +162,11 @@ public:
 	virtual ~GDSParse ();
 
 	bool Parse(FILE *iptr, char *topcell);
+	void SetCacheFile(const char *gdsfile); // Keep a scene cache next to the GDS file
 	virtual class GDSObject *NewObject(char *Name) = 0;
 	void Reload();
+	bool LoadCell(class GDSObject *object); // Decode the geometry below a cell on demand
+	void MergePolygons(class GDSObject *top); // Union of each layer in the collapsed cells below top, on all cores
 
 	class GDSProcess *GetProcess();
 };
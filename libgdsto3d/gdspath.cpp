@@ -47,6 +47,13 @@ void GDSPath::AddPoint(unsigned int Index, float X, float Y)
 	}
 }
 
+void GDSPath::SetPoints(const float *XY)
+{
+	for(unsigned int i=0;i<_Points;i++){
+		_Coords[i].X = XY[i*2];
+		_Coords[i].Y = XY[i*2+1];
+	}
+}
 
 void GDSPath::SetRotation(float X, float Y, float Z)
 {
@@ -42,6 +42,7 @@ public:
 	~GDSPath();
 
 	void AddPoint(unsigned int Index, float X, float Y);
+	void SetPoints(const float *XY); // Interleaved X,Y for all points
 	void SetRotation(float X, float Y, float Z);
 
 	float GetXCoords(unsigned int Index);
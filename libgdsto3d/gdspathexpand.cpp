@@ -0,0 +1,230 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+#include "gdsobject.h"
+#include "gdspathexpand.h"
+#include <math.h>
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+// Unit half circle for round path ends, filled at startup so the parser
+// threads only read it
+static float round_cos[GDS_PATH_ROUND_SEGMENTS+1];
+static float round_sin[GDS_PATH_ROUND_SEGMENTS+1];
+
+static struct RoundTable
+{
+	RoundTable()
+	{
+		for(int k=0; k<=GDS_PATH_ROUND_SEGMENTS; k++){
+			round_cos[k] = (float)cos(M_PI*k/GDS_PATH_ROUND_SEGMENTS);
+			round_sin[k] = (float)sin(M_PI*k/GDS_PATH_ROUND_SEGMENTS);
+		}
+	}
+} round_table;
+
+// Scale a corner offset to unit length, then stretch it so the sides keep
+// the path width along the segment with normal (rx, ry)
+static inline void Miter(float &nx, float &ny, float rx, float ry)
+{
+	float l;
+
+	l = sqrt(nx*nx + ny*ny);
+	if(l > 0.01f){
+		nx /= l; ny /= l;
+	}
+	l = nx*rx + ny*ry;
+	if(l > 0.01f){
+		nx /= l; ny /= l;
+	}
+}
+
+void GDSPathExpander::Add(GDSPath *path, GDSPolygon *polygon)
+{
+	unsigned int points = path->GetPoints();
+
+	if(points < 2){
+		return; // Nothing to outline, the polygon stays empty
+	}
+
+	_First.push_back(_XY.size()/2);
+	_Points.push_back(points);
+	for(unsigned int i=0; i<points; i++){
+		_XY.push_back(path->GetXCoords(i));
+		_XY.push_back(path->GetYCoords(i));
+	}
+
+	_Width.push_back(path->GetWidth()); // Width has already been scaled to half
+	switch(path->GetType()){
+		case 2: // Square ends, extended by half the width
+			_BgnExtn.push_back(path->GetWidth());
+			_EndExtn.push_back(path->GetWidth());
+			break;
+		case 4: // Custom extensions
+			_BgnExtn.push_back(path->GetBgnExtn());
+			_EndExtn.push_back(path->GetEndExtn());
+			break;
+		default: // Flush and round ends
+			_BgnExtn.push_back(0.0f);
+			_EndExtn.push_back(0.0f);
+			break;
+	}
+	_Round.push_back(path->GetType() == 1);
+	_Polygons.push_back(polygon);
+}
+
+void GDSPathExpander::Expand()
+{
+	unsigned int points;
+
+	for(unsigned int i=0; i<_Polygons.size(); i++){
+		if(_Outline.size() < OutlinePoints(_Points[i], _Round[i])*2){
+			_Outline.resize(OutlinePoints(_Points[i], _Round[i])*2);
+		}
+		if(_Normals.size() < _Points[i]*4){
+			_Normals.resize(_Points[i]*4);
+		}
+
+		points = ExpandPath(&_XY[_First[i]*2], _Points[i], _Width[i], _BgnExtn[i], _EndExtn[i], _Round[i], &_Outline[0], &_Normals[0]);
+
+		_Polygons[i]->Clear();
+		_Polygons[i]->AddPoints(&_Outline[0], points);
+	}
+
+	_XY.clear();
+	_First.clear();
+	_Points.clear();
+	_Width.clear();
+	_BgnExtn.clear();
+	_EndExtn.clear();
+	_Round.clear();
+	_Polygons.clear();
+}
+
+unsigned int GDSPathExpander::GetCount()
+{
+	return _Polygons.size();
+}
+
+unsigned int GDSPathExpander::OutlinePoints(unsigned int points, bool round)
+{
+	if(points < 2){
+		return 0;
+	}
+	return points*2 + (round ? 2*(GDS_PATH_ROUND_SEGMENTS-1) : 0);
+}
+
+// The outline runs from the left side of the start over the right side to
+// the end and back along the left side. Corners sit on the averaged normals
+// of both segments, stretched to keep the width.
+unsigned int GDSPathExpander::ExpandPath(const float *XY, unsigned int points, float width, float bgnextn, float endextn, bool round, float *outline, float *scratch)
+{
+	float *normals = scratch; // Of each segment, pointing right
+	float *offsets = scratch + points*2; // Of each point
+	unsigned int segments, last, k = 0;
+	float dx, dy, l, nx, ny, ex, ey, x, y;
+
+	if(points < 2){
+		return 0;
+	}
+	segments = points-1;
+	last = segments-1;
+
+	// Segment normals from the coordinates, no trig. A zero length segment
+	// gets (1, 0).
+	for(unsigned int j=0; j<segments; j++){
+		dx = XY[j*2+2] - XY[j*2];
+		dy = XY[j*2+3] - XY[j*2+1];
+		l = sqrt(dx*dx + dy*dy);
+		normals[j*2] = l > 0.0f ? dy/l : 1.0f;
+		normals[j*2+1] = l > 0.0f ? -dx/l : 0.0f;
+	}
+
+	// Corner offsets, the first point only has its own segment
+	offsets[0] = normals[0];
+	offsets[1] = normals[1];
+	Miter(offsets[0], offsets[1], normals[0], normals[1]);
+	for(unsigned int j=0; j<segments; j++){
+		nx = normals[j*2];
+		ny = normals[j*2+1];
+		if(j < last){
+			nx = (nx + normals[j*2+2])/2;
+			ny = (ny + normals[j*2+3])/2;
+		}
+		Miter(nx, ny, normals[j*2], normals[j*2+1]);
+		offsets[j*2+2] = nx;
+		offsets[j*2+3] = ny;
+	}
+
+	// Start, extended backwards along the first segment
+	ex = bgnextn * normals[1];
+	ey = bgnextn * normals[0];
+	outline[k++] = XY[0] - width*offsets[0] + ex;
+	outline[k++] = XY[1] - width*offsets[1] - ey;
+	if(round){
+		// Half circle around the back, from the left to the right side
+		for(int s=1; s<GDS_PATH_ROUND_SEGMENTS; s++){
+			outline[k++] = XY[0] + width*(-round_cos[s]*normals[0] + round_sin[s]*normals[1]);
+			outline[k++] = XY[1] + width*(-round_cos[s]*normals[1] - round_sin[s]*normals[0]);
+		}
+	}
+	outline[k++] = XY[0] + width*offsets[0] + ex;
+	outline[k++] = XY[1] + width*offsets[1] - ey;
+
+	// Right side, the end extended forwards along the last segment
+	ex = endextn * normals[last*2+1];
+	ey = endextn * normals[last*2];
+	for(unsigned int i=1; i<points; i++){
+		x = XY[i*2] + width*offsets[i*2];
+		y = XY[i*2+1] + width*offsets[i*2+1];
+		if(i == points-1){
+			x -= ex;
+			y += ey;
+		}
+		outline[k++] = x;
+		outline[k++] = y;
+	}
+	if(round){
+		// Half circle around the front, from the right to the left side
+		x = XY[segments*2];
+		y = XY[segments*2+1];
+		for(int s=1; s<GDS_PATH_ROUND_SEGMENTS; s++){
+			outline[k++] = x + width*(round_cos[s]*normals[last*2] - round_sin[s]*normals[last*2+1]);
+			outline[k++] = y + width*(round_cos[s]*normals[last*2+1] + round_sin[s]*normals[last*2]);
+		}
+	}
+
+	// Left side back to the start
+	for(unsigned int i=points-1; i>=1; i--){
+		x = XY[i*2] - width*offsets[i*2];
+		y = XY[i*2+1] - width*offsets[i*2+1];
+		if(i == points-1){
+			x -= ex;
+			y += ey;
+		}
+		outline[k++] = x;
+		outline[k++] = y;
+	}
+
+	return k/2;
+}
@@ -0,0 +1,60 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+
+#ifndef __GDSPATHEXPAND_H__
+#define __GDSPATHEXPAND_H__
+
+#include "gds_globals.h"
+
+#define GDS_PATH_ROUND_SEGMENTS 8 // Per half circle of a round path end
+
+// Turns paths into outline polygons. Paths are queued while a structure is
+// parsed and expanded together, with their attributes in separate arrays so
+// the inner loops only touch plain floats.
+class GDSPathExpander
+{
+private:
+	// Queued paths
+	vector<float>			_XY; // Centre lines, interleaved X,Y
+	vector<unsigned int>	_First; // Of each path in _XY, in points
+	vector<unsigned int>	_Points;
+	vector<float>			_Width; // Half width
+	vector<float>			_BgnExtn;
+	vector<float>			_EndExtn;
+	vector<bool>			_Round;
+	vector<class GDSPolygon*> _Polygons; // Receive the outlines
+
+	// Scratch space, grows to the longest path
+	vector<float>			_Normals;
+	vector<float>			_Outline;
+
+public:
+	void Add(class GDSPath *path, class GDSPolygon *polygon);
+	void Expand(); // Fills the polygons, then empties the queue
+	unsigned int GetCount();
+
+	// Outline of a single path into outline, OutlinePoints() X,Y pairs.
+	// Scratch needs room for 4*points floats. Returns the number of points.
+	static unsigned int ExpandPath(const float *XY, unsigned int points, float width, float bgnextn, float endextn, bool round, float *outline, float *scratch);
+	static unsigned int OutlinePoints(unsigned int points, bool round);
+};
+
+#endif // __GDSPATHEXPAND_H__
@@ -20,6 +20,7 @@
 
 #include "gdsobject.h"
 #include "gdspolygon.h"
+#include "gdsarena.h"
 #include "../math/Maths.h"
 
 #ifndef M_PI
@@ -241,56 +242,220 @@ bool GDSTriangle::intersect(const GDSTriangle& T1, const GDSTriangle& T2)
 }
 
 // GDSPolygon Class
+const double GDSPolygon::epsilon = 0.001; // Default precision of 1nm
+
 GDSPolygon::GDSPolygon(float Height, float Thickness, struct ProcessLayer *Layer)
 {
 	_Height = Height;
 	_Thickness = Thickness;
 	_Layer = Layer;
+	_Shape = NULL;
+	_Offset = Point2D(0.0f, 0.0f);
+	_Arena = NULL;
+	_First = _Points = _FirstIndex = _Indices = _FirstRect = _Rects = 0;
+}
 
-	epsilon = 0.001; // Default precision of 1nm
+GDSPolygon::GDSPolygon(const GDSPolygon &p)
+{
+	_Shape = NULL;
+	_Arena = NULL;
+	_First = _Points = _FirstIndex = _Indices = _FirstRect = _Rects = 0;
+	*this = p;
 }
 
 GDSPolygon::~GDSPolygon()
 {
+	if(_Shape)
+		gds_shapes.Release(_Shape);
+	if(_Arena && _Arena->isPrivate())
+		delete _Arena;
+}
+
+// Appends count items to an arena array, they may come from the same array
+template<class T> static unsigned int Append(vector<T> &to, const T *from, unsigned int count)
+{
+	unsigned int first = to.size();
+
+	if(count == 0)
+		return first;
+	if(first > 0 && from >= &to[0] && from < &to[0]+first)
+	{
+		vector<T> items(from, from+count);
+		to.insert(to.end(), items.begin(), items.end());
+	}
+	else
+		to.insert(to.end(), from, from+count);
+	return first;
+}
+
+GDSPolygon& GDSPolygon::operator=(const GDSPolygon &p)
+{
+	if(this == &p)
+		return *this;
+
+	// Take the new shape before the old one can be freed
+	if(p._Shape)
+		p._Shape->refs++;
+	if(_Shape)
+		gds_shapes.Release(_Shape);
+
+	_Height = p._Height;
+	_Thickness = p._Thickness;
+	_Shape = p._Shape;
+	_Offset = p._Offset;
+	_Layer = p._Layer;
+	bbox = p.bbox;
+
+	// The copy goes into its own arena, the old range stays unused
+	if(_Arena && _Arena->isPrivate())
+	{
+		_Arena->coords.clear();
+		_Arena->indices.clear();
+		_Arena->rects.clear();
+	}
+	_First = _Points = _FirstIndex = _Indices = _FirstRect = _Rects = 0;
+	if(p._Points)
+		_First = Append(GetArena()->coords, &p._Arena->coords[p._First], _Points = p._Points);
+	if(p._Indices || p._Rects)
+		SetTesselation(p._Indices ? &p._Arena->indices[p._FirstIndex] : NULL, p._Indices, p._Rects ? &p._Arena->rects[p._FirstRect] : NULL, p._Rects);
+
+	return *this;
 }
 
 void
 GDSPolygon::Clear()
 {
-    _Coords.clear();
-    indices.clear();
+	if(_Shape)
+		gds_shapes.Release(_Shape);
+	_Shape = NULL;
+	_Offset = Point2D(0.0f, 0.0f);
+
+	// The points stay behind in the arena of a cell
+	if(_Arena && _Arena->isPrivate())
+	{
+		_Arena->coords.clear();
+		_Arena->indices.clear();
+		_Arena->rects.clear();
+	}
+	_First = _Points = _FirstIndex = _Indices = _FirstRect = _Rects = 0;
 	bbox.clear();
 }
 
 void 
 GDSPolygon::CopyInto(GDSPolygon *p)
 {
-	// Nothing special happens here
-	p->_Height = _Height;
-	p->_Thickness = _Thickness;
-	p->_Layer = _Layer;
-    p->indices = indices;
-    p->_Coords = _Coords;
-	p->bbox = bbox;
+	// Nothing special happens here, flattened vias only take a reference
+	*p = *this;
+}
+
+GDSPolygonArena *GDSPolygon::GetArena()
+{
+	if(!_Arena)
+		_Arena = new GDSPolygonArena();
+	return _Arena;
+}
+
+Point2D *GDSPolygon::Grow(unsigned int Points)
+{
+	vector<Point2D> &coords = GetArena()->coords;
+
+	// Points added later move the range to the end first
+	if(_First+_Points != coords.size())
+		_First = Append(coords, _Points ? &coords[_First] : NULL, _Points);
+	coords.resize(coords.size()+Points);
+	_Points += Points;
+	return &coords[_First+_Points-Points];
 }
 
 void 
 GDSPolygon::AddPoint(float X, float Y)
 {
-    _Coords.push_back(Point2D(X,Y));
+	Unshare();
+	*Grow(1) = Point2D(X,Y);
 	bbox.addPoint(Point2D(X,Y));
 }
 
+void 
+GDSPolygon::AddPoints(const float *XY, unsigned int Points)
+{
+	Unshare();
+	Point2D *P = Grow(Points);
+	for(unsigned int i=0;i<Points;i++)
+	{
+		P[i] = Point2D(XY[i*2], XY[i*2+1]);
+		bbox.addPoint(P[i]);
+	}
+}
+
+void
+GDSPolygon::SetTesselation(const int *Indices, unsigned int NumIndices, const float *Rects, unsigned int NumRects)
+{
+	GDSPolygonArena *arena = GetArena();
+
+	_FirstIndex = Append(arena->indices, Indices, _Indices = NumIndices);
+	_FirstRect = Append(arena->rects, Rects, _Rects = NumRects);
+}
+
 void
 GDSPolygon::Tesselate()
 {
-	if(indices.size() > 0 || _Coords.size() < 3)
+	GDSTesselation out;
+
+	if(Tesselate(out))
+		SetTesselation(out.indices.empty() ? NULL : &out.indices[0], out.indices.size(), out.rects.empty() ? NULL : &out.rects[0], out.rects.size());
+}
+
+bool
+GDSPolygon::Tesselate(GDSTesselation &out)
+{
+	if(_Shape)
+	{
+		_Shape->Tesselate();
+		return false;
+	}
+	if(isTesselated() || _Points < 3)
+		return false;
+
+	Tesselate(GetCoords(), _Points, out);
+	return true;
+}
+
+void
+GDSPolygon::Tesselate(const Point2D *coords, unsigned int n, GDSTesselation &out)
+{
+	unsigned int rects = out.rects.size();
+
+	// Manhattan outlines are cut into as few rectangles as they allow, and drawn from them when that is cheaper.
+	// A plain rectangle is its own fan
+	if(isRectilinear(coords, n) && n > 4 && Decompose(coords, n, out.rects) && Cheaper(coords, n, &out.rects[rects], out.rects.size()-rects))
+		return;
+	out.rects.resize(rects);
+
+	Triangulate(coords, n, out.indices);
+}
+
+void
+GDSPolygon::Triangulate()
+{
+	vector<int> out;
+
+	if(_Shape || _Indices > 0 || _Points < 3)
+		return;
+
+	Triangulate(GetCoords(), _Points, out);
+	SetTesselation(out.empty() ? NULL : &out[0], out.size(), _Rects ? &_Arena->rects[_FirstRect] : NULL, _Rects);
+}
+
+void
+GDSPolygon::Triangulate(const Point2D *coords, unsigned int n, vector<int> &indices)
+{
+	if(n < 3)
 		return;
 
 	// Fast path for simple polygons
-	if(isSimple())
+	if(isSimple(coords, n))
 	{
-		for(unsigned int j=0;j<_Coords.size()-2;j++)
+		for(unsigned int j=0;j<n-2;j++)
         {
                 indices.push_back(0);
                 indices.push_back(j+1);
@@ -298,115 +463,424 @@ GDSPolygon::Tesselate()
         }
 		return;
 	}
-    
-    // Build double linked list, with N indices
-    vector<int> V;
-    for (unsigned int i = 0; i <_Coords.size(); i++)
-        V.push_back(i);
-    
-    // Prepare to build N-2 triangles
-    int a,b,c;
-    for (unsigned int i = 0; i < _Coords.size()-2; i++)
-    {
-        // Go through the double linked list
-        for(unsigned int j=0;j<V.size();j++)
-        {
-            a = j; b = (j+1)%V.size(); c = (j+2)%V.size();
-            bool flagged = false;     
-            
-            // Orientation or degenerate?
-            if(area(_Coords[V[a]], _Coords[V[b]], _Coords[V[c]]) < (epsilon))
-                continue;
-            
-            // Go through all of the points
-            for(unsigned int k=0;k<V.size();k++) 
-            {
-				// Same point as triangle
-                if(k==a || k==b || k==c) 
-                    continue;
-
-				// Check if on polygon edge				
-                if( abs(V[a]-V[b])==1 ||  abs(V[a]-V[b])==_Coords.size()-1)
-				{
-					if(onLine(_Coords[V[a]], _Coords[V[b]], _Coords[V[k]]))
-						continue;
-				}
-				if( abs(V[b]-V[c])==1 ||  abs(V[b]-V[c])==_Coords.size()-1)
+
+	// Winding of the whole polygon, ears must turn the same way
+	double winding = 0.0;
+	for(unsigned int i=0;i<n;i++)
+		winding += (double)coords[i].X*coords[(i+1)%n].Y - (double)coords[(i+1)%n].X*coords[i].Y;
+	double sign = (winding < 0.0) ? -1.0 : 1.0;
+
+	// Double linked list over the vertices
+	EarList list;
+	list.Build(n);
+
+	// Collinear vertices add no area, unlink them so they cannot block ears
+	int b = 0;
+	unsigned int good = 0;
+	while(good < list.remaining && list.remaining > 3)
+	{
+		if(collinear(coords[list.prev[b]], coords[b], coords[list.next[b]]))
+		{
+			list.Unlink(b);
+			b = list.prev[b];
+			good = (good > 0) ? good-1 : 0;
+			continue;
+		}
+		b = list.next[b];
+		good++;
+	}
+
+	// Only reflex vertices can lie inside an ear, hash them on a uniform grid
+	unsigned int numReflex = 0;
+	int v = b;
+	do
+	{
+		list.reflex[v] = !convex(coords[list.prev[v]], coords[v], coords[list.next[v]], sign);
+		numReflex += list.reflex[v];
+		v = list.next[v];
+	}while(v != b);
+
+	EarGrid grid;
+	grid.Build(coords, n, list.reflex, numReflex);
+
+	indices.reserve(indices.size()+(n-2)*3);
+
+	int stop = b;
+	bool forced = false;
+	while(list.remaining > 3)
+	{
+		int a = list.prev[b];
+		int c = list.next[b];
+
+		if(forced || isEar(coords, n, a, b, c, sign, list, grid))
+		{
+			// Clip the ear
+			indices.push_back(a);
+			indices.push_back(b);
+			indices.push_back(c);
+			list.Unlink(b);
+			forced = false;
+
+			// Neighbours that became collinear are dropped as well
+			while(list.remaining > 3)
+			{
+				if(collinear(coords[list.prev[a]], coords[a], coords[c]))
 				{
-					if(onLine(_Coords[V[b]], _Coords[V[c]], _Coords[V[k]]))
-						continue;
+					list.Unlink(a);
+					a = list.prev[a];
 				}
-				if( abs(V[c]-V[a])==1 ||  abs(V[c]-V[a])==_Coords.size()-1)
+				else if(collinear(coords[a], coords[c], coords[list.next[c]]))
 				{
-					if(onLine(_Coords[V[c]], _Coords[V[a]], _Coords[V[k]]))
-						continue;
+					list.Unlink(c);
+					c = list.next[c];
 				}
+				else
+					break;
+			}
+
+			// Neighbours can only turn from reflex to convex
+			if(list.reflex[a] && convex(coords[list.prev[a]], coords[a], coords[c], sign))
+				list.reflex[a] = 0;
+			if(list.reflex[c] && convex(coords[a], coords[c], coords[list.next[c]], sign))
+				list.reflex[c] = 0;
+
+			b = c;
+			stop = b;
+			continue;
+		}
+
+		b = c;
+		if(b != stop)
+			continue;
+
+		// Went around without finding an ear, the outline intersects itself. Clip the first convex vertex regardless
+		do
+		{
+			if(convex(coords[list.prev[b]], coords[b], coords[list.next[b]], sign))
+			{
+				forced = true;
+				break;
+			}
+			b = list.next[b];
+		}while(b != stop);
+
+		if(!forced)
+			break; // Nothing left to clip
+	}
+
+	if(list.remaining == 3 && convex(coords[list.prev[b]], coords[b], coords[list.next[b]], sign))
+	{
+		indices.push_back(list.prev[b]);
+		indices.push_back(b);
+		indices.push_back(list.next[b]);
+	}
+}
+
+bool
+GDSPolygon::isEar(const Point2D *coords, unsigned int n, int a, int b, int c, double sign, const EarList &list, const EarGrid &grid)
+{
+	const Point2D &A = coords[a];
+	const Point2D &B = coords[b];
+	const Point2D &C = coords[c];
+
+	// Orientation or degenerate?
+	if(!convex(A, B, C, sign))
+		return false;
+
+	// Edges of the original outline, points on those do not count
+	bool edgeAB = ((unsigned int)(a+1)%n == (unsigned int)b) || ((unsigned int)(b+1)%n == (unsigned int)a);
+	bool edgeBC = ((unsigned int)(b+1)%n == (unsigned int)c) || ((unsigned int)(c+1)%n == (unsigned int)b);
+	bool edgeCA = ((unsigned int)(c+1)%n == (unsigned int)a) || ((unsigned int)(a+1)%n == (unsigned int)c);
+
+	float minX = min(A.X, min(B.X, C.X));
+	float minY = min(A.Y, min(B.Y, C.Y));
+	float maxX = max(A.X, max(B.X, C.X));
+	float maxY = max(A.Y, max(B.Y, C.Y));
+
+	int x0, y0, x1, y1;
+	grid.Cells(minX, minY, x0, y0);
+	grid.Cells(maxX, maxY, x1, y1);
+
+	for(int y=y0;y<=y1;y++)
+	{
+		for(int x=x0;x<=x1;x++)
+		{
+			// Skip to the bounding box of the triangle
+			unsigned int cell = y*grid.nx+x;
+			vector<pair<float, int> >::const_iterator it = lower_bound(grid.items.begin()+grid.first[cell], grid.items.begin()+grid.first[cell+1], make_pair(minX, -1));
+			for(;it!=grid.items.begin()+grid.first[cell+1] && it->first<=maxX;++it)
+			{
+				int k = it->second;
+
+				// Same point as triangle, or no longer reflex
+				if(k==a || k==b || k==c || !list.reflex[k])
+					continue;
+
+				const Point2D &P = coords[k];
+				if(P.Y < minY || P.Y > maxY)
+					continue;
+
+				// Check if on polygon edge
+				if(edgeAB && onLine(A, B, P))
+					continue;
+				if(edgeBC && onLine(B, C, P))
+					continue;
+				if(edgeCA && onLine(C, A, P))
+					continue;
 
 				// Check if in triangle
-                if(insideTriangle(_Coords[V[a]], _Coords[V[b]], _Coords[V[c]], _Coords[V[k]]))
-                {
-                    flagged = true;
-                    break;
-                }
-            }
-            
-            // We have an ear
-            if(!flagged)
-            {
-                indices.push_back(V[a]);
-                indices.push_back(V[b]);
-                indices.push_back(V[c]);
-                V.erase(V.begin()+b);
-                break;
-            }
-        }
-    }
-    
-    
-    //Clean up
-    V.clear();
+				if(sign > 0.0 ? insideTriangle(A, B, C, P) : insideTriangle(C, B, A, P))
+					return false;
+
+				// Points on a diagonal touch it, rounding must not let them through
+				if(onLine(A, B, P) || onLine(B, C, P) || onLine(C, A, P))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// EarList Class
+void EarList::Build(unsigned int n)
+{
+	prev.resize(n);
+	next.resize(n);
+	reflex.assign(n, 0);
+	for(unsigned int i=0;i<n;i++)
+	{
+		prev[i] = (i+n-1)%n;
+		next[i] = (i+1)%n;
+	}
+	remaining = n;
+}
+
+// EarGrid Class
+void EarGrid::Build(const Point2D *coords, unsigned int n, const vector<char> &reflex, unsigned int count)
+{
+	minX = minY = 0.0f;
+	scaleX = scaleY = 0.0f;
+	nx = ny = 1;
+
+	bool empty = true;
+	float maxX = 0.0f, maxY = 0.0f;
+	for(unsigned int i=0;i<n;i++)
+	{
+		if(!reflex[i])
+			continue;
+		if(empty || coords[i].X < minX) minX = coords[i].X;
+		if(empty || coords[i].Y < minY) minY = coords[i].Y;
+		if(empty || coords[i].X > maxX) maxX = coords[i].X;
+		if(empty || coords[i].Y > maxY) maxY = coords[i].Y;
+		empty = false;
+	}
+
+	// About one reflex vertex per cell, cells follow the aspect ratio of the polygon
+	if(count > 1)
+	{
+		double w = maxX - minX;
+		double h = maxY - minY;
+		if(w > 0.0 && h > 0.0)
+		{
+			nx = (int)sqrt(count * w / h);
+			nx = (nx < 1) ? 1 : ((nx > (int)count) ? (int)count : nx);
+			ny = count / nx;
+		}
+		else if(w > 0.0)
+			nx = count;
+		else if(h > 0.0)
+			ny = count;
+		if(w > 0.0)
+			scaleX = (float)(nx / w);
+		if(h > 0.0)
+			scaleY = (float)(ny / h);
+	}
+
+	// Bucket the vertices by cell
+	first.assign(nx*ny+1, 0);
+	items.resize(count);
+	vector<int> cell(n);
+	for(unsigned int i=0;i<n;i++)
+	{
+		if(!reflex[i])
+			continue;
+		int x, y;
+		Cells(coords[i].X, coords[i].Y, x, y);
+		cell[i] = y*nx+x;
+		first[cell[i]+1]++;
+	}
+	for(int i=0;i<nx*ny;i++)
+		first[i+1] += first[i];
+	vector<int> fill(first.begin(), first.end()-1);
+	for(unsigned int i=0;i<n;i++)
+	{
+		if(reflex[i])
+			items[fill[cell[i]]++] = make_pair(coords[i].X, (int)i);
+	}
+	for(int i=0;i<nx*ny;i++)
+		sort(items.begin()+first[i], items.begin()+first[i+1]);
 }
 
 float GDSPolygon::GetXCoords(unsigned int Index)
 {
-	return _Coords[Index].X;
+	if(_Shape)
+		return _Shape->coords[Index].X + _Offset.X;
+	return _Arena->coords[_First+Index].X;
 }
 
 float GDSPolygon::GetYCoords(unsigned int Index)
 {
-	return _Coords[Index].Y;
+	if(_Shape)
+		return _Shape->coords[Index].Y + _Offset.Y;
+	return _Arena->coords[_First+Index].Y;
 }
 
 unsigned int GDSPolygon::GetPoints()
 {
-	return _Coords.size();
+	if(_Shape)
+		return _Shape->coords.size();
+	return _Points;
+}
+
+const Point2D *GDSPolygon::GetCoords()
+{
+	if(GetPoints() == 0)
+		return NULL;
+	if(_Shape)
+		return &_Shape->coords[0];
+	return &_Arena->coords[_First];
+}
+
+const float *GDSPolygon::GetRectangles()
+{
+	if(GetNumRectangles() == 0)
+		return NULL;
+	if(_Shape)
+		return &_Shape->rects[0];
+	return &_Arena->rects[_FirstRect];
+}
+
+unsigned int GDSPolygon::GetNumRectangles()
+{
+	if(_Shape)
+		return _Shape->rects.size()/4;
+	return _Rects/4;
+}
+
+Point2D GDSPolygon::GetOffset()
+{
+	return _Offset;
+}
+
+const int *GDSPolygon::GetIndices()
+{
+	if(GetNumIndices() == 0)
+		return NULL;
+	if(_Shape)
+		return &_Shape->indices[0];
+	return &_Arena->indices[_FirstIndex];
+}
+
+unsigned int GDSPolygon::GetNumIndices()
+{
+	if(_Shape)
+		return _Shape->indices.size();
+	return _Indices;
+}
+
+bool GDSPolygon::isTesselated()
+{
+	return GetNumIndices() > 0 || GetNumRectangles() > 0;
+}
+
+uint64_t GDSPolygon::ShapeHash()
+{
+	return GDSShapeTable::Hash(GetCoords(), GetPoints());
 }
 
-vector<int>* GDSPolygon::GetIndices()
+bool GDSPolygon::Share(uint64_t hash, bool add)
 {
-	// Tesselate if not done before
-	if(indices.size() == 0)
-		Tesselate();
+	const Point2D *points = GetCoords();
+	unsigned int n = GetPoints();
+	GDSShape *shape;
+
+	if(_Shape || n == 0)
+		return !isTesselated();
+
+	shape = gds_shapes.Find(points, n, hash);
+	if(!shape && !add)
+		return !isTesselated();
+	if(!shape)
+	{
+		// First of its kind, keeps what was tesselated already
+		shape = gds_shapes.Add(points, n, hash);
+		if(GetNumIndices())
+			shape->indices.assign(GetIndices(), GetIndices() + GetNumIndices());
+		if(GetNumRectangles())
+			shape->rects.assign(GetRectangles(), GetRectangles() + GetNumRectangles()*4);
+		for(unsigned int i=0;i<shape->rects.size();i+=2)
+		{
+			shape->rects[i+0] -= points[0].X;
+			shape->rects[i+1] -= points[0].Y;
+		}
+	}
+	shape->refs++;
+	_Shape = shape;
+	_Offset = points[0];
+
+	// Its ranges stay unused until the arena is packed
+	_Points = _Indices = _Rects = 0;
+
+	return !shape->isTesselated();
+}
 
-	return &indices;
+GDSShape *GDSPolygon::GetShape()
+{
+	return _Shape;
+}
+
+void GDSPolygon::Unshare()
+{
+	GDSShape *shape = _Shape;
+
+	if(!shape)
+		return;
+
+	_Shape = NULL;
+	Point2D *P = Grow(shape->coords.size());
+	for(unsigned int i=0;i<shape->coords.size();i++)
+		P[i] = Point2D(shape->coords[i].X + _Offset.X, shape->coords[i].Y + _Offset.Y);
+	SetTesselation(shape->indices.empty() ? NULL : &shape->indices[0], shape->indices.size(), shape->rects.empty() ? NULL : &shape->rects[0], shape->rects.size());
+	for(unsigned int i=0;i<_Rects;i+=2)
+	{
+		_Arena->rects[_FirstRect+i+0] += _Offset.X;
+		_Arena->rects[_FirstRect+i+1] += _Offset.Y;
+	}
+
+	gds_shapes.Release(shape);
+	_Offset = Point2D(0.0f, 0.0f);
 }
 
 void GDSPolygon::Flip()
 {
-	// Flip points for boundary
-    vector<Point2D> TCoords = _Coords;
-    for(unsigned int i=0;i<TCoords.size();i++)
-        _Coords[i] = TCoords[TCoords.size()-1-i];
+	Unshare();
+
+	// Flip points for boundary, in place
+	Point2D *coords = _Points ? &_Arena->coords[_First] : NULL;
+	for(unsigned int i=0;i<_Points/2;i++)
+		swap(coords[i], coords[_Points-1-i]);
 
 	// Adjust indices?
     int a,b,c;
+	int *indices = _Indices ? &_Arena->indices[_FirstIndex] : NULL;
 
-    for(unsigned int i=0;i<indices.size()/3;i++)
+    for(unsigned int i=0;i<_Indices/3;i++)
     {
         // New index numbers
-        a = _Coords.size()-1-indices[i*3+0];
-        b = _Coords.size()-1-indices[i*3+1];
-        c = _Coords.size()-1-indices[i*3+2];
+        a = _Points-1-indices[i*3+0];
+        b = _Points-1-indices[i*3+1];
+        c = _Points-1-indices[i*3+2];
 
         // Swap Order
         indices[i*3+0] = a;
@@ -420,19 +894,24 @@ void GDSPolygon::Orientate()
     float x0,y0,x1,y1,x2,y2,nz;
     float dx1,dy1,dx2,dy2;
     nz = 0.0f;
+
+	// Shapes are orientated before they are shared
+	if(_Shape)
+		return;
+	const Point2D *coords = GetCoords();
     
     // Do we have to flip?    
-    for(unsigned int j=1; j<_Coords.size(); j++){
+    for(unsigned int j=1; j<_Points; j++){
 		if(j==1)
 		{
-			x0 = _Coords[0].X;
-			y0 = _Coords[0].Y;
+			x0 = coords[0].X;
+			y0 = coords[0].Y;
 		}
-        x1 = _Coords[j].X;// + offx;
-        y1 = _Coords[j].Y;// + offy;
+        x1 = coords[j].X;// + offx;
+        y1 = coords[j].Y;// + offy;
         
-        x2 = _Coords[(j+1)%_Coords.size()].X;// + offx;
-        y2 = _Coords[(j+1)%_Coords.size()].Y;// + offy;
+        x2 = coords[(j+1)%_Points].X;// + offx;
+        y2 = coords[(j+1)%_Points].Y;// + offy;
         
         dx1 = x2 - x0;
         dy1 = y2 - y0;
@@ -448,18 +927,24 @@ void GDSPolygon::Orientate()
 
 bool
 GDSPolygon::isSimple()
+{
+	return isSimple(GetCoords(), GetPoints());
+}
+
+bool
+GDSPolygon::isSimple(const Point2D *coords, unsigned int n)
 {
     int numPos, numNeg;
     numPos = numNeg = 0;
     
     float dx1, dy1, dx2, dy2, nz;
     
-    for(unsigned int j=0; j<_Coords.size(); j++){ // Iterate over edges
-        dx1 = _Coords[(j+1)%_Coords.size()].X - _Coords[j].X;
-        dy1 = _Coords[(j+1)%_Coords.size()].Y - _Coords[j].Y;
+    for(unsigned int j=0; j<n; j++){ // Iterate over edges
+        dx1 = coords[(j+1)%n].X - coords[j].X;
+        dy1 = coords[(j+1)%n].Y - coords[j].Y;
         
-        dx2 = _Coords[(j+2)%_Coords.size()].X - _Coords[(j+1)%_Coords.size()].X;
-        dy2 = _Coords[(j+2)%_Coords.size()].Y - _Coords[(j+1)%_Coords.size()].Y;
+        dx2 = coords[(j+2)%n].X - coords[(j+1)%n].X;
+        dy2 = coords[(j+2)%n].Y - coords[(j+1)%n].Y;
         
         nz = dx1*dy2 - dy1*dx2;
         
@@ -475,15 +960,389 @@ GDSPolygon::isSimple()
     return true;
 }
 
+bool
+GDSPolygon::isRectilinear()
+{
+	return isRectilinear(GetCoords(), GetPoints());
+}
+
+bool
+GDSPolygon::isRectilinear(const Point2D *coords, unsigned int n)
+{
+	if(n < 4)
+		return false;
+
+	for(unsigned int j=0; j<n; j++){
+		const Point2D &A = coords[j];
+		const Point2D &B = coords[(j+1)%n];
+		if(A.X != B.X && A.Y != B.Y)
+			return false;
+	}
+
+	return true;
+}
+
+// Three points on one horizontal or vertical line
+static bool straight(const Point2D &A, const Point2D &B, const Point2D &C)
+{
+	return (A.X == B.X && B.X == C.X) || (A.Y == B.Y && B.Y == C.Y);
+}
+
+bool
+GDSPolygon::Decompose(const Point2D *coords, unsigned int n, vector<float> &rects)
+{
+	// Corners only, without repeated points or points along a straight run
+	vector<Point2D> corners;
+	unsigned int first = rects.size();
+	for(unsigned int j=0; j<n; j++){
+		corners.push_back(coords[j]);
+		while(corners.size() >= 3 && straight(corners[corners.size()-3], corners[corners.size()-2], corners[corners.size()-1]))
+			corners.erase(corners.end()-2);
+	}
+	while(corners.size() >= 3)
+	{
+		// Where the outline closes
+		unsigned int m = corners.size();
+		if((corners[m-1].X == corners[0].X && corners[m-1].Y == corners[0].Y) || straight(corners[m-2], corners[m-1], corners[0]))
+			corners.pop_back();
+		else if(straight(corners[m-1], corners[0], corners[1]))
+			corners.erase(corners.begin());
+		else
+			break;
+	}
+
+	// Chords between reflex corners in both directions, vertical ones transposed
+	vector<float> hchords, vchords;
+	if(corners.size() >= 6)
+	{
+		Chords(corners, hchords, false);
+		Chords(corners, vchords, true);
+	}
+	unsigned int h = hchords.size()/3, v = vchords.size()/3;
+
+	// Crossing chords cannot both be cut, chords sharing a corner neither
+	vector<vector<int> > cross(h);
+	for(unsigned int i=0; i<h; i++){
+		for(unsigned int j=0; j<v; j++){
+			if(vchords[j*3] >= hchords[i*3+1] && vchords[j*3] <= hchords[i*3+2] &&
+				hchords[i*3] >= vchords[j*3+1] && hchords[i*3] <= vchords[j*3+2])
+				cross[i].push_back(j);
+		}
+	}
+
+	// Maximum matching of the crossings, along augmenting paths
+	vector<int> matchH(h, -1), matchV(v, -1), from(v), queue;
+	vector<char> seen(v);
+	for(unsigned int i=0; i<h; i++){
+		if(cross[i].empty())
+			continue;
+		seen.assign(v, 0);
+		queue.assign(1, i);
+		int end = -1;
+		for(unsigned int q=0; q<queue.size() && end < 0; q++){
+			int a = queue[q];
+			for(unsigned int k=0; k<cross[a].size(); k++){
+				int b = cross[a][k];
+				if(seen[b])
+					continue;
+				seen[b] = 1;
+				from[b] = a;
+				if(matchV[b] < 0)
+				{
+					end = b;
+					break;
+				}
+				queue.push_back(matchV[b]);
+			}
+		}
+		while(end >= 0)
+		{
+			int a = from[end];
+			int next = matchH[a];
+			matchH[a] = end;
+			matchV[end] = a;
+			end = next;
+		}
+	}
+
+	// Largest set of chords that do not cross (Konig): vertical chords outside the alternating
+	// paths from unmatched horizontal ones. The horizontal chords of the set come out of the sweep
+	vector<char> reach(h, 0);
+	seen.assign(v, 0);
+	queue.clear();
+	for(unsigned int i=0; i<h; i++){
+		if(matchH[i] < 0)
+		{
+			reach[i] = 1;
+			queue.push_back(i);
+		}
+	}
+	for(unsigned int q=0; q<queue.size(); q++){
+		int a = queue[q];
+		for(unsigned int k=0; k<cross[a].size(); k++){
+			int b = cross[a][k];
+			if(seen[b] || matchH[a] == b)
+				continue;
+			seen[b] = 1;
+			if(matchV[b] >= 0 && !reach[matchV[b]])
+			{
+				reach[matchV[b]] = 1;
+				queue.push_back(matchV[b]);
+			}
+		}
+	}
+	vector<float> cuts;
+	for(unsigned int j=0; j<v; j++){
+		if(!seen[j])
+			cuts.insert(cuts.end(), vchords.begin()+j*3, vchords.begin()+j*3+3);
+	}
+
+	// Every other reflex corner is cut sideways by the sweep
+	Slabs(coords, n, rects, false, &cuts);
+	return rects.size() > first;
+}
+
+bool
+GDSPolygon::Cheaper(const Point2D *coords, unsigned int n, const float *rects, unsigned int m)
+{
+	// Walls run between the corners, as OutputOGLRectangles draws them
+	vector<pair<float, float> > keys;
+	unsigned int corners = 0;
+	for(unsigned int j=0; j<n; j++){
+		if(straight(coords[(j+n-1)%n], coords[j], coords[(j+1)%n]))
+			continue;
+		keys.push_back(make_pair(coords[j].X, coords[j].Y));
+		corners++;
+	}
+	if(corners < 4)
+		return false;
+
+	// The ear clipper fans convex outlines over all points and drops the others down to their corners.
+	// Top and bottom have a vertex per point, with a wall per edge
+	unsigned long earVertices = 2*n;
+	unsigned long earTriangles = 2*((isSimple(coords, n) ? n : corners)-2) + 2*n;
+
+	// Rectangle corners off the outline add a vertex on top and one on the bottom. A bottom face ends on a vertex
+	// that no wall uses, and gets one of its own when all its corners are on the outline
+	for(unsigned int j=0; j<m; j+=4){
+		for(unsigned int k=0; k<4; k++)
+			keys.push_back(make_pair(rects[j + ((k==1 || k==2) ? 2 : 0)], rects[j + ((k>=2) ? 3 : 1)]));
+	}
+	sort(keys.begin(), keys.begin()+corners);
+	sort(keys.begin()+corners, keys.end());
+	vector<pair<float, float> > inside;
+	set_difference(keys.begin()+corners, keys.end(), keys.begin(), keys.begin()+corners, back_inserter(inside));
+	inside.erase(unique(inside.begin(), inside.end()), inside.end());
+
+	unsigned long vertices = 2*corners + 2*inside.size();
+	unsigned long triangles = 2*corners + m;
+	vector<char> owned(corners, 0);
+	for(unsigned int j=0; j<m; j+=4){
+		bool own = false;
+		for(unsigned int k=0; k<4 && !own; k++){
+			pair<float, float> key(rects[j + ((k==1 || k==2) ? 2 : 0)], rects[j + ((k>=2) ? 3 : 1)]);
+			vector<pair<float, float> >::iterator it = lower_bound(keys.begin(), keys.begin()+corners, key);
+			own = (it == keys.begin()+corners || *it != key || owned[it-keys.begin()]);
+		}
+		if(own)
+			continue;
+		vertices++;
+		pair<float, float> key(rects[j+2], rects[j+3]);
+		owned[lower_bound(keys.begin(), keys.begin()+corners, key)-keys.begin()] = 1;
+	}
+
+	return vertices <= earVertices && triangles < earTriangles;
+}
+
+void
+GDSPolygon::Chords(const vector<Point2D> &corners, vector<float> &out, bool transpose)
+{
+	// Horizontal segments between two reflex corners through the inside, as Y,X0,X1. X and Y swapped when transposed
+	unsigned int n = corners.size();
+	vector<Point2D> P(n);
+	for(unsigned int j=0; j<n; j++)
+		P[j] = transpose ? Point2D(corners[j].Y, corners[j].X) : corners[j];
+
+	double winding = 0.0;
+	for(unsigned int j=0; j<n; j++)
+		winding += (double)P[j].X*P[(j+1)%n].Y - (double)P[(j+1)%n].X*P[j].Y;
+
+	// Corners run on sideways past a reflex corner, the way its horizontal edge comes in
+	vector<int> ray(n, 0);
+	vector<pair<float, float> > starts, ends; // Of the vertical edges, Y and X
+	for(unsigned int j=0; j<n; j++){
+		const Point2D &A = P[(j+n-1)%n];
+		const Point2D &B = P[j];
+		const Point2D &C = P[(j+1)%n];
+		if((area(A, B, C) < 0.0) != (winding < 0.0))
+			ray[j] = (A.Y == B.Y) ? (B.X > A.X ? 1 : -1) : (B.X > C.X ? 1 : -1);
+		if(B.X == C.X)
+		{
+			starts.push_back(make_pair(min(B.Y, C.Y), B.X));
+			ends.push_back(make_pair(max(B.Y, C.Y), B.X));
+		}
+	}
+	sort(starts.begin(), starts.end());
+	sort(ends.begin(), ends.end());
+
+	vector<pair<pair<float, float>, int> > order(n); // Y, X, corner
+	for(unsigned int j=0; j<n; j++)
+		order[j] = make_pair(make_pair(P[j].Y, P[j].X), (int)j);
+	sort(order.begin(), order.end());
+
+	// Sweep upwards, a chord must not pass an edge that crosses its row
+	vector<float> active; // X of the vertical edges across the row, sorted
+	unsigned int s = 0, e = 0;
+	for(unsigned int i=0; i<n;){
+		float y = order[i].first.first;
+		unsigned int last = i;
+		while(last < n && order[last].first.first == y)
+			last++;
+
+		for(;e < ends.size() && ends[e].first <= y;e++)
+		{
+			vector<float>::iterator it = lower_bound(active.begin(), active.end(), ends[e].second);
+			if(it != active.end() && *it == ends[e].second)
+				active.erase(it);
+		}
+
+		for(unsigned int k=i; k+1<last; k++){
+			int a = order[k].second, b = order[k+1].second;
+			float x0 = P[a].X, x1 = P[b].X;
+			if(ray[a] != 1 || ray[b] != -1 || x0 >= x1)
+				continue;
+			vector<float>::iterator it = upper_bound(active.begin(), active.end(), x0);
+			if(it != active.end() && *it < x1)
+				continue;
+			out.push_back(y); out.push_back(x0); out.push_back(x1);
+		}
+
+		for(;s < starts.size() && starts[s].first <= y;s++)
+			active.insert(upper_bound(active.begin(), active.end(), starts[s].second), starts[s].second);
+		i = last;
+	}
+}
+
+void
+GDSPolygon::Slabs(const Point2D *coords, unsigned int n, vector<float> &out, bool transpose, const vector<float> *cuts)
+{
+	// Vertical edges by their lower and upper end, X and Y swapped when transposed
+	vector<pair<float, float> > starts, ends; // Y, X
+	for(unsigned int j=0; j<n; j++){
+		Point2D A = coords[j];
+		Point2D B = coords[(j+1)%n];
+		if(transpose)
+		{
+			A = Point2D(A.Y, A.X);
+			B = Point2D(B.Y, B.X);
+		}
+		if(A.X != B.X || A.Y == B.Y)
+			continue;
+		starts.push_back(make_pair(min(A.Y, B.Y), A.X));
+		ends.push_back(make_pair(max(A.Y, B.Y), A.X));
+	}
+
+	// Cuts go in as a pair of edges, X,Y0,Y1 in the frame of the sweep. They split the interval they are in
+	for(unsigned int j=0; cuts && j+2<cuts->size(); j+=3){
+		for(unsigned int k=0; k<2; k++){
+			starts.push_back(make_pair((*cuts)[j+1], (*cuts)[j]));
+			ends.push_back(make_pair((*cuts)[j+2], (*cuts)[j]));
+		}
+	}
+	sort(starts.begin(), starts.end());
+	sort(ends.begin(), ends.end());
+
+	// Sweep upwards, the edges crossing a slab pair up into intervals (even-odd)
+	vector<float> active; // X of the crossing edges, sorted
+	vector<float> open, next; // X0,X1,Y0 of rectangles still growing upwards
+	unsigned int s = 0, e = 0;
+	while(s < starts.size() || e < ends.size())
+	{
+		float y;
+		if(e == ends.size() || (s < starts.size() && starts[s].first < ends[e].first))
+			y = starts[s].first;
+		else
+			y = ends[e].first;
+
+		for(;e < ends.size() && ends[e].first == y;e++)
+		{
+			vector<float>::iterator it = lower_bound(active.begin(), active.end(), ends[e].second);
+			if(it != active.end() && *it == ends[e].second)
+				active.erase(it);
+		}
+		for(;s < starts.size() && starts[s].first == y;s++)
+			active.insert(upper_bound(active.begin(), active.end(), starts[s].second), starts[s].second);
+
+		// Continue rectangles with the same interval, close the others
+		next.clear();
+		unsigned int i = 0, k = 0;
+		while(i < open.size() || k+1 < active.size())
+		{
+			if(k+1 < active.size() && active[k] == active[k+1])
+			{
+				k += 2; // Empty interval
+				continue;
+			}
+
+			bool closing = (k+1 >= active.size()) || (i < open.size() && open[i] < active[k]);
+			bool starting = (i >= open.size()) || (k+1 < active.size() && active[k] < open[i]);
+			if(!closing && !starting && open[i+1] != active[k+1])
+				closing = starting = true;
+
+			if(!closing && !starting)
+			{
+				next.push_back(open[i]); next.push_back(open[i+1]); next.push_back(open[i+2]);
+				i += 3;
+				k += 2;
+				continue;
+			}
+			if(closing)
+			{
+				if(open[i+2] < y && transpose)
+				{
+					out.push_back(open[i+2]); out.push_back(open[i]);
+					out.push_back(y); out.push_back(open[i+1]);
+				}
+				else if(open[i+2] < y)
+				{
+					out.push_back(open[i]); out.push_back(open[i+2]);
+					out.push_back(open[i+1]); out.push_back(y);
+				}
+				i += 3;
+			}
+			if(starting)
+			{
+				next.push_back(active[k]); next.push_back(active[k+1]); next.push_back(y);
+				k += 2;
+			}
+		}
+		open.swap(next);
+	}
+}
+
 bool 
 GDSPolygon::isPointInside(const Point2D& P)
 {
 	//GDSTriangle T;
+	const Point2D *C = GetCoords();
+	const int *I = GetIndices();
+	const float *R = GetRectangles();
+	unsigned int triangles = GetNumIndices()/3;
+	unsigned int rectangles = GetNumRectangles();
+
+	// Shared shapes are tested at the origin
+	Point2D Q(P.X - _Offset.X, P.Y - _Offset.Y);
+
+	for(unsigned int i=0;i<rectangles*4;i+=4)
+	{
+		if(Q.X >= R[i+0] && Q.X <= R[i+2] && Q.Y >= R[i+1] && Q.Y <= R[i+3])
+			return true;
+	}
 
 	//We are doing this brute force
-	for(unsigned int i=0;i<indices.size()/3;i++)
+	for(unsigned int i=0;i<triangles;i++)
 	{
-		if( insideTriangle(_Coords[indices[i*3+0]], _Coords[indices[i*3+1]], _Coords[indices[i*3+2]], P))
+		if( insideTriangle(C[I[i*3+0]], C[I[i*3+1]], C[I[i*3+2]], Q))
 			return true;
 	}
 	return false;
@@ -497,6 +1356,23 @@ GDSPolygon::area(const Point2D& A, const Point2D& B, const Point2D& C)
     return ((B.X - A.X) * (C.Y - A.Y)) - ((B.Y - A.Y) * (C.X - A.X));
 }
 
+bool 
+GDSPolygon::convex(const Point2D& A, const Point2D& B, const Point2D& C, double sign)
+{
+	// Turns the same way as the polygon, and not flat
+	return (sign*area(A, B, C) > 0.0) && !collinear(A, B, C);
+}
+
+bool 
+GDSPolygon::collinear(const Point2D& A, const Point2D& B, const Point2D& C)
+{
+	// B closer than epsilon to the line through A and C, or a spike back onto itself
+	double cross = area(A, B, C);
+	double dx = C.X - A.X;
+	double dy = C.Y - A.Y;
+	return cross*cross <= epsilon*epsilon*(dx*dx+dy*dy);
+}
+
 bool 
 GDSPolygon::onLine(const Point2D& A, const Point2D& B,const Point2D& P)
 {
@@ -566,31 +1442,86 @@ GDSPolygon::insideTriangle(const Point2D& A, const Point2D& B, const Point2D& C,
 
 void GDSPolygon::transformPoints(const GDSMat& M)
 {
+	// A translated shape stays shared
+	if(_Shape && M.isTranslation())
+	{
+		_Offset.X += M[4];
+		_Offset.Y += M[5];
+		bbox.min.X += M[4];
+		bbox.min.Y += M[5];
+		bbox.max.X += M[4];
+		bbox.max.Y += M[5];
+		return;
+	}
+	Unshare();
+
 	// Clear bounding box
 	bbox.clear();
 
-	for(unsigned int i=0;i<_Coords.size();i++)
+	// In place, the range stays where it is
+	Point2D *coords = _Points ? &_Arena->coords[_First] : NULL;
+	for(unsigned int i=0;i<_Points;i++)
 	{
-		_Coords[i] = M * _Coords[i];
-		bbox.addPoint(_Coords[i]);
+		coords[i] = M * coords[i];
+		bbox.addPoint(coords[i]);
+	}
+
+	if(_Rects == 0)
+		return;
+
+	// Rectangles survive multiples of 90 degrees, anything else goes back to triangles
+	if((M[1] != 0.0f || M[2] != 0.0f) && (M[0] != 0.0f || M[3] != 0.0f))
+	{
+		_Rects = 0;
+		Triangulate();
+		return;
+	}
+	float *rects = &_Arena->rects[_FirstRect];
+	for(unsigned int i=0;i<_Rects;i+=4)
+	{
+		Point2D A = M * Point2D(rects[i+0], rects[i+1]);
+		Point2D B = M * Point2D(rects[i+2], rects[i+3]);
+		rects[i+0] = min(A.X, B.X);
+		rects[i+1] = min(A.Y, B.Y);
+		rects[i+2] = max(A.X, B.X);
+		rects[i+3] = max(A.Y, B.Y);
 	}
 }
 
 bool GDSPolygon::intersect(GDSPolygon *P1, GDSPolygon *P2)
 {
 	GDSTriangle		T1, T2;
+	GDSPolygon		C1, C2;
 
 	// Bounding box intersection
 	if(!GDSBB::intersect(P1->bbox, P2->bbox))
 		return false;
 
+	// Shared polygons and those drawn from rectangles stay as they are, their copies get triangles
+	if(P1->_Shape || !P1->_Indices)
+	{
+		C1 = *P1;
+		P1 = &C1;
+		P1->Unshare();
+		P1->Triangulate();
+	}
+	if(P2->_Shape || !P2->_Indices)
+	{
+		C2 = *P2;
+		P2 = &C2;
+		P2->Unshare();
+		P2->Triangulate();
+	}
+
 	//We are doing this brute force
-	for(unsigned int i=0;i<P1->indices.size()/3;i++)
+	const Point2D *C = P1->GetCoords(), *D = P2->GetCoords();
+	const int *I = P1->GetIndices(), *J = P2->GetIndices();
+	for(unsigned int i=0;i<P1->_Indices/3;i++)
 	{
-		for(unsigned int j=0;j<P2->indices.size()/3;j++)
+		for(unsigned int j=0;j<P2->_Indices/3;j++)
 		{
-			T1.set(P1->_Coords[P1->indices[i*3+0]], P1->_Coords[P1->indices[i*3+1]], P1->_Coords[P1->indices[i*3+2]]);
-			T2.set(P2->_Coords[P2->indices[j*3+0]], P2->_Coords[P2->indices[j*3+1]], P2->_Coords[P2->indices[j*3+2]]);
+			T1.set(C[I[i*3+0]], C[I[i*3+1]], C[I[i*3+2]]);
+			T2.set(D[J[j*3+0]], D[J[j*3+1]], D[J[j*3+2]]);
 
 			if(GDSTriangle::intersect(T1, T2))
 				return true;
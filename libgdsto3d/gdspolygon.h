@@ -23,6 +23,7 @@
 
 #include "gds_globals.h"
 #include "process_cfg.h"
+#include "gdsshape.h"
 #include <math.h>
 
 // All these types are 2D
@@ -50,6 +51,7 @@ public:
 	void setRotation(const float& angle);
 
 	bool NegativeTrace() const;
+	bool isTranslation() const; // Only moves points
 	GDSMat Inverse() const;
 	void Round();
 };
@@ -60,6 +62,12 @@ bool GDSMat::NegativeTrace() const
 	return ((entries[0] < 0) != (entries[3] < 0));
 }
 
+inline
+bool GDSMat::isTranslation() const
+{
+	return entries[0] == 1.0f && entries[1] == 0.0f && entries[2] == 0.0f && entries[3] == 1.0f;
+}
+
 // | 0 2 4 |   | X |
 // | 1 3 5 | X | Y | 
 inline Point2D GDSMat::operator*(const Point2D& P) const
@@ -140,36 +148,124 @@ public:
 	static bool intersect(const GDSTriangle& T1, const GDSTriangle& T2);	
 };
 
+// Double linked list over the vertices of a polygon, used by the ear clipper
+class EarList
+{
+public:
+	vector<int> prev, next;
+	vector<char> reflex; // Vertex may block an ear
+	unsigned int remaining;
+
+	void Build(unsigned int n);
+	void Unlink(int v);
+};
+
+inline void EarList::Unlink(int v)
+{
+	// Links of v stay valid, to walk back from it
+	next[prev[v]] = next[v];
+	prev[next[v]] = prev[v];
+	reflex[v] = 0;
+	remaining--;
+}
+
+// Uniform grid over the reflex vertices of a polygon, used by the ear clipper
+class EarGrid
+{
+public:
+	float minX, minY;
+	float scaleX, scaleY;
+	int nx, ny;
+	vector<int> first; // Per cell offset into items, nx*ny+1 entries
+	vector<pair<float, int> > items; // X and vertex index, grouped by cell and sorted on X
+
+	void Build(const Point2D *coords, unsigned int n, const vector<char> &reflex, unsigned int count);
+	void Cells(float X, float Y, int &x, int &y) const;
+};
+
+inline void EarGrid::Cells(float X, float Y, int &x, int &y) const
+{
+	x = (int)((X - minX) * scaleX);
+	y = (int)((Y - minY) * scaleY);
+	x = (x < 0) ? 0 : ((x >= nx) ? nx-1 : x);
+	y = (y < 0) ? 0 : ((y >= ny) ? ny-1 : y);
+}
+
+// Triangles and rectangles of polygons, one polygon after the other
+class GDSTesselation
+{
+public:
+	vector<int> indices;
+	vector<float> rects; // X0,Y0,X1,Y1
+};
+
 class GDSPolygon
 {
+	friend class GDSCache; // Reads and restores the parsed data
+	friend class GDSPolygonArena; // Packs the polygons of a cell
+	friend class GDSPolygonUnion; // Fills in the outlines of a merged layer
+
 private:
 	float			_Height;
 	float			_Thickness;
-	vector<Point2D>	_Coords;
-	vector<int>		indices;
+	class GDSPolygonArena	*_Arena; // Holds the points and tesselation, of the cell or of the polygon alone
+	unsigned int	_First, _Points; // Range of the points in the arena
+	unsigned int	_FirstIndex, _Indices;
+	unsigned int	_FirstRect, _Rects; // Of the rectangle floats, Manhattan outlines are drawn from these instead
+	GDSShape		*_Shape; // Points and tesselation when shared, the ranges above stay empty
+	Point2D			_Offset; // Of the shared shape
 	struct ProcessLayer	*_Layer;
 	GDSBB			bbox;
 
-	double epsilon;
-	double area(const Point2D& A, const Point2D& B, const Point2D& C);
-	bool onLine(const Point2D& A, const Point2D& B, const Point2D& P);
-    bool insideTriangle(const Point2D& A, const Point2D& B, const Point2D& C,const Point2D& P);
+	static const double epsilon;
+	static double area(const Point2D& A, const Point2D& B, const Point2D& C);
+	static bool onLine(const Point2D& A, const Point2D& B, const Point2D& P);
+	static bool collinear(const Point2D& A, const Point2D& B, const Point2D& C);
+	static bool convex(const Point2D& A, const Point2D& B, const Point2D& C, double sign);
+    static bool insideTriangle(const Point2D& A, const Point2D& B, const Point2D& C,const Point2D& P);
+	static bool isEar(const Point2D *coords, unsigned int n, int a, int b, int c, double sign, const EarList &list, const EarGrid &grid);
+	static bool isSimple(const Point2D *coords, unsigned int n);
+	static bool isRectilinear(const Point2D *coords, unsigned int n);
+	static void Triangulate(const Point2D *coords, unsigned int n, vector<int> &out);
+	static bool Decompose(const Point2D *coords, unsigned int n, vector<float> &out);
+	static bool Cheaper(const Point2D *coords, unsigned int n, const float *rects, unsigned int m); // Rectangles take fewer vertices and triangles than the ear clipper
+	static void Chords(const vector<Point2D> &corners, vector<float> &out, bool transpose);
+	static void Slabs(const Point2D *coords, unsigned int n, vector<float> &out, bool transpose, const vector<float> *cuts = NULL);
+	void Triangulate(); // Triangles as well, when it has none
+	void Unshare(); // Back to points of its own before they change
+	GDSPolygonArena *GetArena(); // Made for the polygon alone outside a cell
+	Point2D *Grow(unsigned int Points); // Room for more points at the end of its range
 
 public:
-	GDSPolygon() {_Layer = NULL;};
+	GDSPolygon() {_Layer = NULL; _Shape = NULL; _Offset = Point2D(0.0f, 0.0f); _Arena = NULL; _First = _Points = _FirstIndex = _Indices = _FirstRect = _Rects = 0;};
 	GDSPolygon(float Height, float Thickness, struct ProcessLayer *Layer);
+	GDSPolygon(const GDSPolygon &p);
 	~GDSPolygon();
+	GDSPolygon& operator=(const GDSPolygon &p);
 
     void Clear();
 	void CopyInto(GDSPolygon *p); // Remove? nothing really different from default copy..
 	void AddPoint(float X, float Y);
-	void Tesselate(); // Build a triangle index list
+	void AddPoints(const float *XY, unsigned int Points); // Interleaved X,Y
+	void Tesselate(); // Build a triangle index list, or rectangles for a Manhattan outline
+	bool Tesselate(GDSTesselation &out); // Adds them to out instead, false if there is nothing to add
+	static void Tesselate(const Point2D *coords, unsigned int n, GDSTesselation &out);
+	void SetTesselation(const int *Indices, unsigned int NumIndices, const float *Rects, unsigned int NumRects); // Replaces it, Rects counts floats
+	bool isTesselated(); // Has triangles or rectangles
+	uint64_t ShapeHash(); // Of the points relative to the first, for Share()
+	bool Share(uint64_t hash, bool add = true); // Use a shape from gds_shapes, true if it still has to be tesselated
+	GDSShape *GetShape(); // NULL unless shared
 
 	GDSBB* GetBBox();
 	float GetHeight();
 	float GetThickness();
 	unsigned int GetPoints();
-	vector<int>* GetIndices();
+	const Point2D *GetCoords(); // All points in a row, relative to GetOffset()
+	const int *GetIndices(); // None until tesselated, or when drawn from rectangles
+	unsigned int GetNumIndices();
+	const float *GetRectangles(); // X0,Y0,X1,Y1, none unless drawn from rectangles, relative to GetOffset()
+	unsigned int GetNumRectangles();
+	Point2D GetOffset(); // Of a shared shape, else zero
 	float GetXCoords(unsigned int Index);
 	float GetYCoords(unsigned int Index);
 	float GetAngleCoords(unsigned int Index);
@@ -178,6 +274,7 @@ public:
     void Orientate(); // Make sure normal points upwards
 	struct ProcessLayer *GetLayer();
     bool isSimple();
+	bool isRectilinear(); // All edges horizontal or vertical
 	bool isPointInside(const Point2D& P);
 
 	void transformPoints(const GDSMat& M);
@@ -0,0 +1,274 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdsrecord.h"
+#include <math.h>
+
+#ifdef WIN32
+	#include <windows.h>
+	#include <io.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+GDSRecordReader::GDSRecordReader()
+{
+	_iptr = NULL;
+	_data = NULL;
+	_size = 0;
+	_pos = 0;
+	_offset = 0;
+	_record = 0;
+	_mapped = false;
+	_view = false;
+	_eof = true;
+#ifdef WIN32
+	_mapping = NULL;
+#endif
+}
+
+GDSRecordReader::~GDSRecordReader()
+{
+	Close();
+}
+
+bool GDSRecordReader::Open(FILE *iptr)
+{
+	Close();
+
+	if(!iptr)
+		return false;
+
+	_iptr = iptr;
+	_eof = false;
+
+	if(Map())
+		return true;
+
+	// Streaming fallback
+	_data = new byte[GDS_STREAM_BUFFER];
+	fseek(_iptr, 0, SEEK_SET); // Fails silently on pipes
+	return true;
+}
+
+bool GDSRecordReader::Open(const byte *data, size_t size, size_t offset)
+{
+	Close();
+
+	if(!data)
+		return false;
+
+	_data = (byte*)data;
+	_size = size;
+	_offset = offset;
+	_mapped = true;
+	_view = true;
+	_eof = false;
+	return true;
+}
+
+void GDSRecordReader::Close()
+{
+	if(_data && !_view)
+	{
+		if(_mapped)
+		{
+#ifdef WIN32
+			UnmapViewOfFile(_data);
+			CloseHandle((HANDLE)_mapping);
+			_mapping = NULL;
+#else
+			munmap(_data, _size);
+#endif
+		}
+		else
+			delete [] _data;
+	}
+
+	_iptr = NULL;
+	_data = NULL;
+	_size = 0;
+	_pos = 0;
+	_offset = 0;
+	_record = 0;
+	_mapped = false;
+	_view = false;
+	_eof = true;
+}
+
+bool GDSRecordReader::Map()
+{
+#ifdef WIN32
+	HANDLE file = (HANDLE)_get_osfhandle(_fileno(_iptr));
+	LARGE_INTEGER filesize;
+
+	if(file == INVALID_HANDLE_VALUE || GetFileType(file) != FILE_TYPE_DISK)
+		return false;
+	if(!GetFileSizeEx(file, &filesize) || filesize.QuadPart <= 0 || (unsigned long long)filesize.QuadPart > (size_t)-1)
+		return false;
+
+	_mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!_mapping)
+		return false;
+
+	_data = (byte*)MapViewOfFile((HANDLE)_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!_data)
+	{
+		CloseHandle((HANDLE)_mapping);
+		_mapping = NULL;
+		return false;
+	}
+	_size = (size_t)filesize.QuadPart;
+#else
+	struct stat filestat;
+	void *data;
+
+	if(fstat(fileno(_iptr), &filestat) != 0 || !S_ISREG(filestat.st_mode) || filestat.st_size <= 0)
+		return false;
+	if((unsigned long long)filestat.st_size > (size_t)-1)
+		return false;
+
+	data = mmap(NULL, (size_t)filestat.st_size, PROT_READ, MAP_PRIVATE, fileno(_iptr), 0);
+	if(data == MAP_FAILED)
+		return false;
+#ifdef MADV_SEQUENTIAL
+	madvise(data, (size_t)filestat.st_size, MADV_SEQUENTIAL);
+#endif
+
+	_data = (byte*)data;
+	_size = (size_t)filestat.st_size;
+#endif
+
+	v_printf(2, "Memory mapped %lu bytes.\n", (unsigned long)_size);
+	_mapped = true;
+	return true;
+}
+
+bool GDSRecordReader::Fill(size_t bytes)
+{
+	size_t count;
+
+	if(_size - _pos >= bytes)
+		return true;
+	if(_mapped || _eof)
+		return false;
+
+	// Move the remainder to the front and refill the buffer
+	memmove(_data, _data+_pos, _size-_pos);
+	_offset += _pos;
+	_size -= _pos;
+	_pos = 0;
+
+	while(_size < bytes)
+	{
+		count = fread(_data+_size, 1, GDS_STREAM_BUFFER-_size, _iptr);
+		if(count == 0)
+		{
+			_eof = true;
+			return false;
+		}
+		_size += count;
+	}
+	return true;
+}
+
+bool GDSRecordReader::NextRecord(byte &recordtype, byte &datatype, const byte *&data, int &length)
+{
+	int recordlen;
+
+	if(!_data || !Fill(4))
+		return false;
+
+	recordlen = ((int)_data[_pos]<<8) | (int)_data[_pos+1];
+	if(recordlen < 4) // Zero padding after ENDLIB or a corrupt stream
+		return false;
+
+	if(!Fill(recordlen))
+	{
+		v_printf(1, "Truncated GDS record at position %lu.\n", (unsigned long)(_offset+_pos));
+		return false;
+	}
+
+	_record = _offset + _pos;
+	recordtype = _data[_pos+2];
+	datatype = _data[_pos+3];
+	data = _data + _pos + 4;
+	length = recordlen - 4;
+
+	_pos += recordlen;
+	return true;
+}
+
+size_t GDSRecordReader::Tell()
+{
+	return _record;
+}
+
+size_t GDSRecordReader::GetSize()
+{
+	return _mapped ? _size : 0;
+}
+
+bool GDSRecordReader::IsMapped()
+{
+	return _mapped;
+}
+
+const byte *GDSRecordReader::GetData(size_t offset)
+{
+	if(!_mapped || offset < _offset || offset > _offset+_size)
+		return NULL;
+
+	return _data + (offset-_offset);
+}
+
+double GDSReadReal64(const byte *p)
+{
+	byte value;
+	double sign=1.0;
+	double exponent;
+	double mant;
+
+	value = p[0];
+	if(value & 128){
+		value -= 128;
+		sign = -1.0;
+	}
+	exponent = (double )value;
+	exponent -= 64.0;
+
+	mant = 0.0;
+	for(int i=7; i>=1; i--)
+	{
+		mant += p[i];
+		mant /= 256.0;
+	}
+
+	return sign*(mant*pow(16.0,exponent));
+}
+
+void GDSReadXY(const byte *p, int points, float units, float *XY)
+{
+	// Plain loop over the whole record so the compiler can vectorize the byte swapping
+	for(int i=0; i<points*2; i++)
+		XY[i] = units * (float)GDSReadInt32(p+i*4);
+}
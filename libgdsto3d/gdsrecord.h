@@ -0,0 +1,84 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSRECORD_H__
+#define __GDSRECORD_H__
+
+#include "gds_globals.h"
+#include <stdint.h>
+
+#define GDS_STREAM_BUFFER 1024*1024*4 // Streaming fallback buffer, must hold at least one record (64K)
+
+// Record level reader for GDSII streams.
+// Regular files are memory mapped and walked by pointer, anything else (pipes,
+// huge files on 32-bit systems) is read through a large buffer instead.
+class GDSRecordReader
+{
+private:
+	FILE		*_iptr;
+	byte		*_data;		// Mapped file or streaming buffer
+	size_t		_size;		// Valid bytes in _data
+	size_t		_pos;		// Start of the next record in _data
+	size_t		_offset;	// File offset of _data[0]
+	size_t		_record;	// File offset of the current record
+	bool		_mapped;
+	bool		_view;		// Reading memory owned by another reader
+	bool		_eof;
+#ifdef WIN32
+	void		*_mapping;
+#endif
+
+	bool Map();
+	bool Fill(size_t bytes);
+
+public:
+	GDSRecordReader();
+	~GDSRecordReader();
+
+	bool Open(FILE *iptr);
+	bool Open(const byte *data, size_t size, size_t offset); // Records in memory, e.g. one structure
+	void Close();
+
+	// Returns false at the end of the stream or on a truncated record
+	bool NextRecord(byte &recordtype, byte &datatype, const byte *&data, int &length);
+
+	size_t Tell();
+	size_t GetSize(); // Bytes mapped
+	bool IsMapped();
+	const byte *GetData(size_t offset); // Only when mapped
+};
+
+// Big endian decoding, independent of the host byte order
+inline int16_t GDSReadInt16(const byte *p)
+{
+	return (int16_t)(((uint16_t)p[0]<<8) | (uint16_t)p[1]);
+}
+
+inline int32_t GDSReadInt32(const byte *p)
+{
+	return (int32_t)(((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | (uint32_t)p[3]);
+}
+
+double GDSReadReal64(const byte *p);
+
+// Decode a whole XY record into interleaved X,Y floats scaled by units
+void GDSReadXY(const byte *p, int points, float units, float *XY);
+
+#endif // __GDSRECORD_H__
@@ -0,0 +1,190 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdsshape.h"
+#include "gdspolygon.h"
+
+GDSShapeTable gds_shapes;
+
+// GDSShape Class
+GDSShape::GDSShape(const Point2D *points, unsigned int n, uint64_t hash)
+{
+	coords.resize(n);
+	for(unsigned int i=0;i<n;i++)
+		coords[i] = Point2D(points[i].X - points[0].X, points[i].Y - points[0].Y);
+
+	this->hash = hash;
+	refs = 0;
+	next = NULL;
+}
+
+bool GDSShape::isTesselated()
+{
+	return indices.size() > 0 || rects.size() > 0;
+}
+
+void GDSShape::Tesselate()
+{
+	GDSTesselation out;
+
+	if(isTesselated())
+		return;
+
+	// Tesselated once at the origin for all polygons using it
+	GDSPolygon::Tesselate(&coords[0], coords.size(), out);
+	indices.swap(out.indices);
+	rects.swap(out.rects);
+}
+
+// GDSShapeTable Class
+GDSShapeTable::GDSShapeTable()
+{
+	for(unsigned int s=0;s<GDS_SHAPE_SHARDS;s++)
+		count[s] = 0;
+}
+
+GDSShapeTable::~GDSShapeTable()
+{
+	GDSShape *shape;
+
+	for(unsigned int s=0;s<GDS_SHAPE_SHARDS;s++)
+	{
+		for(unsigned int i=0;i<buckets[s].size();i++)
+		{
+			while(buckets[s][i])
+			{
+				shape = buckets[s][i];
+				buckets[s][i] = shape->next;
+				delete shape;
+			}
+		}
+	}
+}
+
+void GDSShapeTable::Grow(unsigned int shard)
+{
+	vector<GDSShape*> old;
+	vector<GDSShape*> &table = buckets[shard];
+	GDSShape *shape;
+
+	old.swap(table);
+	table.assign(std::max((size_t)64, old.size()*2), (GDSShape*)NULL);
+	for(unsigned int i=0;i<old.size();i++)
+	{
+		while(old[i])
+		{
+			shape = old[i];
+			old[i] = shape->next;
+			shape->next = table[shape->hash & (table.size()-1)];
+			table[shape->hash & (table.size()-1)] = shape;
+		}
+	}
+}
+
+uint64_t GDSShapeTable::Hash(const Point2D *points, unsigned int n)
+{
+	uint64_t hash = n;
+	uint32_t bits[2];
+	Point2D P;
+
+	for(unsigned int i=0;i<n;i++)
+	{
+		P = Point2D(points[i].X - points[0].X, points[i].Y - points[0].Y);
+		memcpy(bits, &P, sizeof(bits));
+		hash = (hash ^ bits[0]) * 0x100000001B3ULL;
+		hash = (hash ^ bits[1]) * 0x100000001B3ULL;
+		hash ^= hash >> 29;
+	}
+
+	return hash;
+}
+
+unsigned int GDSShapeTable::Shard(uint64_t hash)
+{
+	return (unsigned int)(hash >> 58); // Buckets go by the low bits
+}
+
+GDSShape *GDSShapeTable::Find(const Point2D *points, unsigned int n, uint64_t hash)
+{
+	vector<GDSShape*> &table = buckets[Shard(hash)];
+	GDSShape *shape;
+	unsigned int i;
+
+	if(table.empty())
+		return NULL;
+
+	for(shape=table[hash & (table.size()-1)]; shape; shape=shape->next)
+	{
+		if(shape->hash != hash || shape->coords.size() != n)
+			continue;
+		for(i=0;i<n;i++)
+		{
+			if(shape->coords[i].X != points[i].X - points[0].X || shape->coords[i].Y != points[i].Y - points[0].Y)
+				break;
+		}
+		if(i == n)
+			return shape;
+	}
+
+	return NULL;
+}
+
+GDSShape *GDSShapeTable::Add(const Point2D *points, unsigned int n, uint64_t hash)
+{
+	GDSShape *shape = new GDSShape(points, n, hash);
+	unsigned int s = Shard(hash);
+
+	if(count[s] >= buckets[s].size())
+		Grow(s);
+	shape->next = buckets[s][hash & (buckets[s].size()-1)];
+	buckets[s][hash & (buckets[s].size()-1)] = shape;
+	count[s]++;
+
+	return shape;
+}
+
+void GDSShapeTable::Release(GDSShape *shape)
+{
+	vector<GDSShape*> &table = buckets[Shard(shape->hash)];
+	GDSShape **link;
+
+	if(--shape->refs > 0)
+		return;
+
+	for(link=&table[shape->hash & (table.size()-1)]; *link; link=&(*link)->next)
+	{
+		if(*link == shape)
+		{
+			*link = shape->next;
+			count[Shard(shape->hash)]--;
+			break;
+		}
+	}
+	delete shape;
+}
+
+unsigned int GDSShapeTable::GetCount()
+{
+	unsigned int total = 0;
+
+	for(unsigned int s=0;s<GDS_SHAPE_SHARDS;s++)
+		total += count[s];
+	return total;
+}
@@ -0,0 +1,74 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSSHAPE_H__
+#define __GDSSHAPE_H__
+
+#include "gds_globals.h"
+#include "gdselements.h"
+#include <stdint.h>
+
+// Outline and tesselation shared by all polygons with the same points relative
+// to their first one. Vias and contacts repeat the same few shapes everywhere,
+// their polygons only keep an offset to one of these.
+class GDSShape
+{
+public:
+	vector<Point2D>	coords; // First point at the origin
+	vector<int>	indices;
+	vector<float>	rects; // X0,Y0,X1,Y1, relative like the points
+	uint64_t	hash;
+	unsigned int	refs; // Polygons using the shape
+	GDSShape	*next; // In the same bucket of the table
+
+	GDSShape(const Point2D *points, unsigned int n, uint64_t hash);
+
+	bool isTesselated();
+	void Tesselate();
+};
+
+#define GDS_SHAPE_SHARDS 64 // By the top bits of the hash
+
+// Shapes by the hash of their relative points. Each shard is filled by one
+// thread at a time, so polygons are shared by a parallel job per shard.
+// Polygons are released by the main thread only.
+class GDSShapeTable
+{
+private:
+	vector<GDSShape*>	buckets[GDS_SHAPE_SHARDS]; // Power of two, chained
+	unsigned int		count[GDS_SHAPE_SHARDS];
+
+	void Grow(unsigned int shard);
+
+public:
+	GDSShapeTable();
+	~GDSShapeTable();
+
+	static uint64_t Hash(const Point2D *points, unsigned int n); // Of the points relative to the first
+	static unsigned int Shard(uint64_t hash);
+	GDSShape *Find(const Point2D *points, unsigned int n, uint64_t hash); // NULL if there is none yet
+	GDSShape *Add(const Point2D *points, unsigned int n, uint64_t hash); // Unused until a polygon takes it
+	void Release(GDSShape *shape); // Freed with the last polygon
+	unsigned int GetCount();
+};
+
+extern GDSShapeTable gds_shapes;
+
+#endif // __GDSSHAPE_H__
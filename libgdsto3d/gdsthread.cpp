@@ -0,0 +1,199 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdsthread.h"
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#define GDS_MAX_THREADS 64
+
+typedef struct GDSThreadArg
+{
+	class GDSThreadPool	*pool;
+	int					thread;
+} GDSThreadArg;
+
+// GDSMutex Class
+GDSMutex::GDSMutex()
+{
+#ifdef WIN32
+	_handle = new CRITICAL_SECTION;
+	InitializeCriticalSection((CRITICAL_SECTION*)_handle);
+#else
+	_handle = new pthread_mutex_t;
+	pthread_mutex_init((pthread_mutex_t*)_handle, NULL);
+#endif
+}
+
+GDSMutex::~GDSMutex()
+{
+#ifdef WIN32
+	DeleteCriticalSection((CRITICAL_SECTION*)_handle);
+	delete (CRITICAL_SECTION*)_handle;
+#else
+	pthread_mutex_destroy((pthread_mutex_t*)_handle);
+	delete (pthread_mutex_t*)_handle;
+#endif
+}
+
+void GDSMutex::Lock()
+{
+#ifdef WIN32
+	EnterCriticalSection((CRITICAL_SECTION*)_handle);
+#else
+	pthread_mutex_lock((pthread_mutex_t*)_handle);
+#endif
+}
+
+void GDSMutex::Unlock()
+{
+#ifdef WIN32
+	LeaveCriticalSection((CRITICAL_SECTION*)_handle);
+#else
+	pthread_mutex_unlock((pthread_mutex_t*)_handle);
+#endif
+}
+
+// GDSThreadPool Class
+GDSThreadPool::GDSThreadPool(int threads)
+{
+	if(threads <= 0)
+		threads = ProcessorCount();
+
+	_threads = std::max(1, std::min(threads, GDS_MAX_THREADS));
+	_func = NULL;
+	_data = NULL;
+	_jobs = 0;
+	_next = 0;
+}
+
+GDSThreadPool::~GDSThreadPool()
+{
+}
+
+int GDSThreadPool::GetThreads()
+{
+	return _threads;
+}
+
+int GDSThreadPool::ProcessorCount()
+{
+	static int processors = 0; // Asked once, pools are made for every batch
+
+	if(processors)
+		return processors;
+
+#ifdef WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	processors = (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	processors = count > 0 ? (int)count : 1;
+#endif
+	return processors;
+}
+
+int GDSThreadPool::NextJob()
+{
+	int job;
+
+	_lock.Lock();
+	job = _next < _jobs ? _next++ : -1;
+	_lock.Unlock();
+
+	return job;
+}
+
+void GDSThreadPool::Work(int thread)
+{
+	int job;
+
+	while((job = NextJob()) >= 0)
+		_func(_data, job, thread);
+}
+
+#ifdef WIN32
+unsigned long __stdcall GDSThreadPool::ThreadMain(void *arg)
+#else
+void *GDSThreadPool::ThreadMain(void *arg)
+#endif
+{
+	GDSThreadArg *t = (GDSThreadArg*)arg;
+
+	t->pool->Work(t->thread);
+	return 0;
+}
+
+void GDSThreadPool::Run(GDSJobFunc func, void *data, int jobs)
+{
+	GDSThreadArg args[GDS_MAX_THREADS];
+	int started = 0;
+	int threads;
+
+	_func = func;
+	_data = data;
+	_jobs = jobs;
+	_next = 0;
+
+	threads = std::min(_threads, jobs);
+
+#ifdef WIN32
+	HANDLE handles[GDS_MAX_THREADS];
+
+	for(int i=1; i<threads; i++)
+	{
+		args[i].pool = this;
+		args[i].thread = i;
+		handles[started] = CreateThread(NULL, 0, ThreadMain, &args[i], 0, NULL);
+		if(handles[started])
+			started++;
+	}
+
+	Work(0);
+
+	WaitForMultipleObjects(started, handles, TRUE, INFINITE);
+	for(int i=0; i<started; i++)
+		CloseHandle(handles[i]);
+#else
+	pthread_t handles[GDS_MAX_THREADS];
+
+	for(int i=1; i<threads; i++)
+	{
+		args[i].pool = this;
+		args[i].thread = i;
+		if(pthread_create(&handles[started], NULL, ThreadMain, &args[i]) == 0)
+			started++;
+	}
+
+	Work(0);
+
+	for(int i=0; i<started; i++)
+		pthread_join(handles[i], NULL);
+#endif
+
+	_func = NULL;
+	_data = NULL;
+}
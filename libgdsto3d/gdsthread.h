@@ -0,0 +1,75 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSTHREAD_H__
+#define __GDSTHREAD_H__
+
+#include "gds_globals.h"
+
+// Job callback, thread is in [0, GetThreads())
+typedef void (*GDSJobFunc)(void *data, int job, int thread);
+
+class GDSMutex
+{
+private:
+	void	*_handle;
+
+public:
+	GDSMutex();
+	~GDSMutex();
+
+	void Lock();
+	void Unlock();
+};
+
+// Runs a batch of independent jobs on all cores. The calling thread works
+// along as thread 0, the other threads only live for the duration of Run().
+class GDSThreadPool
+{
+private:
+	int			_threads;
+
+	// Shared state of the running batch
+	GDSJobFunc	_func;
+	void		*_data;
+	int			_jobs;
+	int			_next;
+	GDSMutex	_lock;
+
+	int NextJob();
+	void Work(int thread);
+
+#ifdef WIN32
+	static unsigned long __stdcall ThreadMain(void *arg);
+#else
+	static void *ThreadMain(void *arg);
+#endif
+
+public:
+	GDSThreadPool(int threads = 0); // 0 uses all processors
+	~GDSThreadPool();
+
+	int GetThreads();
+	void Run(GDSJobFunc func, void *data, int jobs);
+
+	static int ProcessorCount();
+};
+
+#endif // __GDSTHREAD_H__
@@ -0,0 +1,537 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#include "gdsunion.h"
+
+#define GDS_UNION_NONE 0xFFFFFFFF // Node that starts a bridge, not a wall
+
+// Rectangle of the queue in ranks
+typedef struct GDSUnionRect
+{
+	int x0, y0, x1, y1;
+} GDSUnionRect;
+
+static bool CompareBottom(const GDSUnionRect &a, const GDSUnionRect &b)
+{
+	return a.y0 < b.y0;
+}
+
+static bool CompareLeft(const GDSUnionRect &a, const GDSUnionRect &b)
+{
+	return a.x0 < b.x0;
+}
+
+static int Rank(const vector<float> &coords, float value)
+{
+	return lower_bound(coords.begin(), coords.end(), value) - coords.begin();
+}
+
+// GDSPolygonUnion Class
+void GDSPolygonUnion::Add(GDSPolygon *polygon)
+{
+	const float *rects = polygon->GetRectangles();
+	unsigned int n = polygon->GetNumRectangles();
+	Point2D offset = polygon->GetOffset(); // Rectangles of shared shapes are relative
+
+	// Triangulated Manhattan outlines are cut into slabs here
+	if(n == 0 && isManhattan(polygon))
+	{
+		_Slabs.clear();
+		GDSPolygon::Slabs(polygon->GetCoords(), polygon->GetPoints(), _Slabs, false);
+		rects = _Slabs.empty() ? NULL : &_Slabs[0];
+		n = _Slabs.size()/4;
+	}
+
+	for(unsigned int i=0; i<n*4; i+=4){
+		_Rects.push_back(rects[i+0] + offset.X);
+		_Rects.push_back(rects[i+1] + offset.Y);
+		_Rects.push_back(rects[i+2] + offset.X);
+		_Rects.push_back(rects[i+3] + offset.Y);
+		_Source.push_back(_Polygons);
+	}
+	_Polygons++;
+}
+
+bool GDSPolygonUnion::isManhattan(GDSPolygon *polygon)
+{
+	if(polygon->GetNumRectangles() > 0)
+		return true;
+
+	const Point2D *coords = polygon->GetCoords();
+	unsigned int n = polygon->GetPoints();
+	if(n < 4)
+		return false;
+
+	for(unsigned int j=0; j<n; j++){
+		const Point2D &A = coords[j];
+		const Point2D &B = coords[(j+1)%n];
+		if(A.X != B.X && A.Y != B.Y)
+			return false;
+	}
+
+	return true;
+}
+
+unsigned int GDSPolygonUnion::GetCount()
+{
+	return _Rects.size()/4;
+}
+
+unsigned int GDSPolygonUnion::Find(unsigned int interval)
+{
+	while(_Part[interval] != interval){
+		_Part[interval] = _Part[_Part[interval]]; // Halve the path
+		interval = _Part[interval];
+	}
+	return interval;
+}
+
+void GDSPolygonUnion::Join(unsigned int a, unsigned int b)
+{
+	a = Find(a);
+	b = Find(b);
+	if(a < b){
+		_Part[b] = a;
+	}else{
+		_Part[a] = b;
+	}
+}
+
+float GDSPolygonUnion::GetX(int x)
+{
+	if(x%2 == 0){
+		return _X[x/2];
+	}
+	return (_X[x/2] + _X[x/2+1])*0.5f;
+}
+
+float GDSPolygonUnion::GetY(int y)
+{
+	if(y%2 == 0){
+		return _Y[y/2];
+	}
+	return (_Y[y/2] + _Y[y/2+1])*0.5f;
+}
+
+// Covered intervals of each band, and the walls at their ends. A wall runs
+// on while the band above has an interval ending at the same rank.
+void GDSPolygonUnion::Scan()
+{
+	vector<GDSUnionRect> rects, active, entering, merged;
+	GDSUnionRect r;
+	GDSUnionEdge edge;
+	unsigned int next = 0, below, j, k;
+	int x0, x1;
+
+	_X.reserve(_Rects.size()/2);
+	_Y.reserve(_Rects.size()/2);
+	for(unsigned int i=0; i<_Rects.size(); i+=4){
+		_X.push_back(_Rects[i+0]);
+		_X.push_back(_Rects[i+2]);
+		_Y.push_back(_Rects[i+1]);
+		_Y.push_back(_Rects[i+3]);
+	}
+	sort(_X.begin(), _X.end());
+	_X.erase(unique(_X.begin(), _X.end()), _X.end());
+	sort(_Y.begin(), _Y.end());
+	_Y.erase(unique(_Y.begin(), _Y.end()), _Y.end());
+
+	rects.reserve(_Rects.size()/4);
+	_Corners.reserve(_Rects.size()/2);
+	for(unsigned int i=0; i<_Rects.size(); i+=4){
+		r.x0 = Rank(_X, min(_Rects[i+0], _Rects[i+2]));
+		r.x1 = Rank(_X, max(_Rects[i+0], _Rects[i+2]));
+		r.y0 = Rank(_Y, min(_Rects[i+1], _Rects[i+3]));
+		r.y1 = Rank(_Y, max(_Rects[i+1], _Rects[i+3]));
+		if(r.x0 < r.x1 && r.y0 < r.y1){
+			rects.push_back(r);
+			_Corners.push_back(r.x0);
+			_Corners.push_back(r.y0);
+		}else{
+			_Corners.push_back(-1);
+			_Corners.push_back(-1);
+		}
+	}
+	sort(rects.begin(), rects.end(), CompareBottom);
+
+	_First.push_back(0);
+	for(int y=0; y+1<(int)_Y.size(); y++){
+		// Rectangles leave below the band and enter at its bottom, the active
+		// ones stay ordered by their left side
+		for(j=0, k=0; j<active.size(); j++){
+			if(active[j].y1 > y){
+				active[k++] = active[j];
+			}
+		}
+		active.resize(k);
+		entering.clear();
+		while(next < rects.size() && rects[next].y0 == y){
+			entering.push_back(rects[next++]);
+		}
+		if(!entering.empty()){
+			sort(entering.begin(), entering.end(), CompareLeft);
+			merged.resize(active.size() + entering.size());
+			merge(active.begin(), active.end(), entering.begin(), entering.end(), merged.begin(), CompareLeft);
+			active.swap(merged);
+		}
+
+		// Touching rectangles make one interval
+		for(j=0; j<active.size(); ){
+			x0 = active[j].x0;
+			x1 = active[j].x1;
+			for(j++; j<active.size() && active[j].x0 <= x1; j++){
+				x1 = max(x1, active[j].x1);
+			}
+			_X0.push_back(x0);
+			_X1.push_back(x1);
+			_Part.push_back(_Part.size());
+		}
+		_First.push_back(_X0.size());
+	}
+
+	_Left.resize(_X0.size());
+	_Right.resize(_X0.size());
+	for(unsigned int y=0; y+1<_First.size(); y++){
+		below = y > 0 ? _First[y-1] : 0;
+
+		// Left walls run down, right walls up
+		for(unsigned int i=_First[y], j=below; i<_First[y+1]; i++){
+			while(j < _First[y] && _X0[j] < _X0[i]){
+				j++;
+			}
+			if(j < _First[y] && _X0[j] == _X0[i]){
+				_Left[i] = _Left[j];
+				_Edges[_Left[i]].y0 = y+1;
+			}else{
+				edge.x0 = edge.x1 = _X0[i];
+				edge.y0 = y+1;
+				edge.y1 = y;
+				edge.part = i;
+				_Left[i] = _Edges.size();
+				_Edges.push_back(edge);
+			}
+		}
+		for(unsigned int i=_First[y], j=below; i<_First[y+1]; i++){
+			while(j < _First[y] && _X1[j] < _X1[i]){
+				j++;
+			}
+			if(j < _First[y] && _X1[j] == _X1[i]){
+				_Right[i] = _Right[j];
+				_Edges[_Right[i]].y1 = y+1;
+			}else{
+				edge.x0 = edge.x1 = _X1[i];
+				edge.y0 = y;
+				edge.y1 = y+1;
+				edge.part = i;
+				_Right[i] = _Edges.size();
+				_Edges.push_back(edge);
+			}
+		}
+
+		// Intervals overlapping the band below belong to the same part
+		for(unsigned int i=_First[y], j=below; i<_First[y+1]; i++){
+			while(j < _First[y] && _X1[j] <= _X0[i]){
+				j++;
+			}
+			for(k=j; k<_First[y] && _X0[k] < _X1[i]; k++){
+				Join(i, k);
+			}
+		}
+	}
+
+	// Walls along each rank, under the bottom and over the top of the solid
+	for(unsigned int y=0; y<_First.size(); y++){
+		below = y > 0 ? _First[y-1] : 0;
+		if(y+1 < _First.size()){
+			Walls(_First[y], _First[y+1], below, _First[y], y, true);
+		}
+		if(y > 0){
+			Walls(below, _First[y], _First[y], y+1 < _First.size() ? _First[y+1] : _First[y], y, false);
+		}
+	}
+}
+
+// Walls along Y rank y over the parts of the intervals first to last that
+// the cut intervals do not cover. Bottom walls run right, top walls left.
+void GDSPolygonUnion::Walls(unsigned int first, unsigned int last, unsigned int cut, unsigned int cutlast, int y, bool bottom)
+{
+	GDSUnionEdge edge;
+	int x;
+
+	edge.y0 = edge.y1 = y;
+	for(unsigned int i=first; i<last; i++){
+		edge.part = i;
+		x = _X0[i];
+		while(cut < cutlast && _X1[cut] <= x){
+			cut++;
+		}
+		for(unsigned int j=cut; j<cutlast && _X0[j] < _X1[i]; j++){
+			if(_X0[j] > x){
+				edge.x0 = bottom ? x : _X0[j];
+				edge.x1 = bottom ? _X0[j] : x;
+				_Edges.push_back(edge);
+			}
+			x = max(x, _X1[j]);
+		}
+		if(x < _X1[i]){
+			edge.x0 = bottom ? x : _X1[i];
+			edge.x1 = bottom ? _X1[i] : x;
+			_Edges.push_back(edge);
+		}
+	}
+}
+
+// Follows the walls into closed outlines. Where two corners of the solid
+// touch, the left turn is taken, which keeps them apart.
+bool GDSPolygonUnion::Trace(vector<unsigned int> &loops, vector<int64_t> &areas)
+{
+	vector<pair<pair<int, int>, unsigned int> > starts; // Walls by their first point
+	vector<pair<pair<int, int>, unsigned int> >::iterator it;
+	vector<bool> done(_Edges.size(), false);
+	GDSUnionNode node;
+	unsigned int current, next;
+	int64_t area;
+
+	for(unsigned int e=0; e<_Edges.size(); e++){
+		starts.push_back(make_pair(make_pair(_Edges[e].x0, _Edges[e].y0), e));
+	}
+	sort(starts.begin(), starts.end());
+
+	_Start.resize(_Edges.size());
+	for(unsigned int e=0; e<_Edges.size(); e++){
+		if(done[e]){
+			continue;
+		}
+
+		loops.push_back(_Nodes.size());
+		area = 0;
+		current = e;
+		do{
+			const GDSUnionEdge &wall = _Edges[current];
+			done[current] = true;
+			node.x = wall.x0*2;
+			node.y = wall.y0*2;
+			node.edge = current;
+			node.next = _Nodes.size()+1;
+			_Start[current] = _Nodes.size();
+			_Nodes.push_back(node);
+			area += (int64_t)wall.x0*wall.y1 - (int64_t)wall.x1*wall.y0;
+
+			it = lower_bound(starts.begin(), starts.end(), make_pair(make_pair(wall.x1, wall.y1), 0U));
+			if(it == starts.end() || it->first != make_pair(wall.x1, wall.y1)){
+				return false; // Open outline, the walls are broken
+			}
+			next = it->second;
+			if(it+1 != starts.end() && (it+1)->first == it->first){
+				const GDSUnionEdge &other = _Edges[next];
+				if((int64_t)(wall.x1-wall.x0)*(other.y1-other.y0) - (int64_t)(wall.y1-wall.y0)*(other.x1-other.x0) < 0){
+					next = (it+1)->second;
+				}
+			}
+			if(done[next] && next != e){
+				return false;
+			}
+			current = next;
+		}while(current != e);
+		_Nodes.back().next = loops.back();
+		areas.push_back(area);
+	}
+
+	return true;
+}
+
+// Cuts a hole into the outline around it. The bridge runs right from the
+// rightmost wall of the hole, halfway up its lowest band, to the wall at the
+// other end of the interval there. That wall is always further right, so
+// bridged holes end up in an outer outline.
+void GDSPolygonUnion::Bridge(unsigned int first)
+{
+	map<pair<unsigned int, int>, unsigned int>::iterator it;
+	unsigned int hole = GDS_UNION_NONE, n = first, i, wall, below;
+	GDSUnionNode node;
+	int x, y, h;
+
+	do{
+		if(_Nodes[n].edge != GDS_UNION_NONE){
+			const GDSUnionEdge &edge = _Edges[_Nodes[n].edge];
+			if(edge.x0 == edge.x1 && edge.y1 < edge.y0 && (hole == GDS_UNION_NONE || edge.x0*2 > _Nodes[hole].x)){
+				hole = n;
+			}
+		}
+		n = _Nodes[n].next;
+	}while(n != first);
+	if(hole == GDS_UNION_NONE){
+		return;
+	}
+
+	x = _Edges[_Nodes[hole].edge].x0;
+	y = _Edges[_Nodes[hole].edge].y1;
+	h = y*2+1;
+	i = lower_bound(_X0.begin()+_First[y], _X0.begin()+_First[y+1], x) - _X0.begin();
+	wall = _Right[i];
+
+	// Part of the wall below the bridge, earlier bridges may have cut it
+	below = _Start[wall];
+	it = _Splits.lower_bound(make_pair(wall, h));
+	if(it != _Splits.begin() && (--it)->first.first == wall){
+		below = it->second;
+	}
+
+	node.y = h;
+	node.x = _X1[i]*2; // Over to the hole
+	node.edge = GDS_UNION_NONE;
+	node.next = _Nodes.size()+1;
+	_Nodes.push_back(node);
+	node.x = x*2; // Down the rest of the hole wall
+	node.edge = _Nodes[hole].edge;
+	node.next = _Nodes[hole].next;
+	_Nodes.push_back(node);
+	node.x = x*2; // Back from the hole
+	node.edge = GDS_UNION_NONE;
+	node.next = _Nodes.size()+1;
+	_Nodes[hole].next = _Nodes.size();
+	_Nodes.push_back(node);
+	node.x = _X1[i]*2; // Up the rest of the wall
+	node.edge = wall;
+	node.next = _Nodes[below].next;
+	_Nodes[below].next = _Nodes.size()-3;
+	_Splits[make_pair(wall, h)] = _Nodes.size();
+	_Nodes.push_back(node);
+}
+
+bool GDSPolygonUnion::Merge(vector<GDSPolygon*> &outlines, vector<bool> &covered, float Height, float Thickness, struct ProcessLayer *layer)
+{
+	vector<unsigned int> loops;
+	vector<int64_t> areas;
+	vector<int> owner; // Outline of each part
+	vector<unsigned int> source; // First polygon of each part, GDS_UNION_NONE once there are more
+	vector<unsigned int> part; // Of each rectangle
+	vector<unsigned int> open; // Rectangle of each interval
+	vector<vector<float> > rects; // Of each outline
+	GDSPolygon *polygon;
+	unsigned int n, below, j;
+	bool result;
+	int o, x, y;
+
+	Scan();
+	result = Trace(loops, areas);
+	if(!result){
+		loops.clear();
+	}
+
+	for(unsigned int i=0; i<loops.size(); i++){
+		if(areas[i] < 0){
+			Bridge(loops[i]);
+		}
+	}
+
+	// A part made of one polygon draws the same as that polygon, unless the
+	// polygon also went into another part
+	source.resize(_X0.size(), _Polygons);
+	part.resize(_Source.size(), GDS_UNION_NONE);
+	for(unsigned int i=0; i<_Source.size() && !loops.empty(); i++){
+		x = _Corners[i*2+0];
+		y = _Corners[i*2+1];
+		if(x < 0){
+			continue;
+		}
+		j = Find(upper_bound(_X0.begin() + _First[y], _X0.begin() + _First[y+1], x) - _X0.begin() - 1);
+		if(source[j] == _Polygons){
+			source[j] = _Source[i];
+		}else if(source[j] != _Source[i]){
+			source[j] = GDS_UNION_NONE;
+		}
+		part[i] = j;
+	}
+
+	covered.assign(_Polygons, false);
+	for(unsigned int i=0; i<_Source.size(); i++){
+		if(part[i] != GDS_UNION_NONE && source[part[i]] == GDS_UNION_NONE){
+			covered[_Source[i]] = true;
+		}
+	}
+
+	owner.resize(_X0.size(), -1);
+	for(unsigned int i=0; i<loops.size(); i++){
+		j = source[Find(_Edges[_Nodes[loops[i]].edge].part)];
+		if(areas[i] <= 0 || (j != GDS_UNION_NONE && !covered[j])){
+			continue;
+		}
+		polygon = new GDSPolygon(Height, Thickness, layer);
+		n = loops[i];
+		do{
+			polygon->AddPoint(GetX(_Nodes[n].x), GetY(_Nodes[n].y));
+			n = _Nodes[n].next;
+		}while(n != loops[i]);
+		owner[Find(_Edges[_Nodes[loops[i]].edge].part)] = outlines.size();
+		outlines.push_back(polygon);
+	}
+
+	// Tops of the parts, an interval grows the rectangle of the same one below
+	open.resize(_X0.size());
+	rects.resize(outlines.size());
+	for(unsigned int y=0; y+1<_First.size(); y++){
+		below = y > 0 ? _First[y-1] : 0;
+		for(unsigned int i=_First[y], j=below; i<_First[y+1]; i++){
+			o = owner[Find(i)];
+			if(o < 0){
+				continue;
+			}
+			vector<float> &tops = rects[o];
+			while(j < _First[y] && _X0[j] < _X0[i]){
+				j++;
+			}
+			if(j < _First[y] && _X0[j] == _X0[i] && _X1[j] == _X1[i]){
+				open[i] = open[j];
+				tops[open[i]+3] = _Y[y+1];
+			}else{
+				open[i] = tops.size();
+				tops.push_back(_X[_X0[i]]);
+				tops.push_back(_Y[y]);
+				tops.push_back(_X[_X1[i]]);
+				tops.push_back(_Y[y+1]);
+			}
+		}
+	}
+	for(unsigned int i=0; i<rects.size(); i++){
+		if(!rects[i].empty()){
+			outlines[i]->SetTesselation(NULL, 0, &rects[i][0], rects[i].size());
+		}
+	}
+
+	_Rects.clear();
+	_Source.clear();
+	_Polygons = 0;
+	_X.clear();
+	_Y.clear();
+	_Corners.clear();
+	_First.clear();
+	_X0.clear();
+	_X1.clear();
+	_Left.clear();
+	_Right.clear();
+	_Part.clear();
+	_Edges.clear();
+	_Nodes.clear();
+	_Start.clear();
+	_Splits.clear();
+
+	return result;
+}
@@ -0,0 +1,92 @@
+//  GDS3D, a program for viewing GDSII files in 3D.
+//  Created by Jasper Velner and Michiel Soer, http://icd.el.utwente.nl
+//  Based on code by Roger Light, http://atchoo.org/gds2pov/
+//
+//  Copyright (C) 2013 IC-Design Group, University of Twente.
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+
+#ifndef __GDSUNION_H__
+#define __GDSUNION_H__
+
+#include "gds_globals.h"
+#include "gdspolygon.h"
+#include <stdint.h>
+
+// Wall between solid and empty on the rank grid, solid on its left
+typedef struct GDSUnionEdge
+{
+	int		x0, y0, x1, y1; // From, to
+	unsigned int	part; // Interval on the solid side
+} GDSUnionEdge;
+
+// Corner of an outline, on a grid of twice the ranks so bridges to holes
+// can run halfway between two ranks
+typedef struct GDSUnionNode
+{
+	int		x, y;
+	unsigned int	next;
+	unsigned int	edge; // Starting here
+} GDSUnionNode;
+
+// Union of the Manhattan polygons of one layer. Abutting and overlapping
+// polygons are extruded on their own, which draws walls inside the solid
+// that can never be seen. The rectangles of the polygons are merged by a
+// scanline over the ranks of their coordinates, so nothing is rounded, into
+// the covered intervals of each band between two Y ranks. Walls only follow
+// the outlines of the union, holes are bridged into the outline around them.
+class GDSPolygonUnion
+{
+private:
+	// Queued rectangles, absolute X0,Y0,X1,Y1
+	vector<float>			_Rects;
+	vector<unsigned int>	_Source; // Polygon of each rectangle, in the order they were added
+	unsigned int			_Polygons;
+	vector<float>			_Slabs; // Of a triangulated polygon
+
+	// Coordinates by rank
+	vector<float>			_X, _Y;
+	vector<int>				_Corners; // Ranks of the bottom left of each queued rectangle, X,Y, -1 when it is empty
+
+	// Covered intervals of each band, from left to right
+	vector<unsigned int>	_First; // Of each band, and one past the last
+	vector<int>				_X0, _X1; // Ranks
+	vector<unsigned int>	_Left, _Right; // Walls at both ends
+	vector<unsigned int>	_Part; // Union-find over the intervals, connected ones are one part
+
+	vector<GDSUnionEdge>	_Edges;
+	vector<GDSUnionNode>	_Nodes;
+	vector<unsigned int>	_Start; // Node of each wall
+	map<pair<unsigned int, int>, unsigned int>	_Splits; // Upper part of a wall cut by a bridge, by wall and height
+
+	unsigned int Find(unsigned int interval);
+	void Join(unsigned int a, unsigned int b);
+	void Scan(); // Intervals and walls
+	void Walls(unsigned int first, unsigned int last, unsigned int cut, unsigned int cutlast, int y, bool bottom);
+	bool Trace(vector<unsigned int> &loops, vector<int64_t> &areas); // Walls into outlines, first node and area of each
+	void Bridge(unsigned int node); // Hole into the outline right of it
+	float GetX(int x); // Of a node
+	float GetY(int y);
+
+public:
+	void Add(class GDSPolygon *polygon); // Its rectangles, or slabs of a triangulated Manhattan outline
+	GDSPolygonUnion() {_Polygons = 0;};
+	bool Merge(vector<class GDSPolygon*> &outlines, vector<bool> &covered, float Height, float Thickness, struct ProcessLayer *layer); // Then empties the queue, false if it failed. Parts of a single polygon are left to it, the others are covered
+	unsigned int GetCount(); // Queued rectangles
+
+	static bool isManhattan(class GDSPolygon *polygon); // Drawn from rectangles, or all edges horizontal or vertical
+};
+
+#endif // __GDSUNION_H__
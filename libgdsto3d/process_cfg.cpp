@@ -454,21 +454,16 @@ void GDSProcess::Parse(char *processfile)
 
 struct ProcessLayer *GDSProcess::GetLayer(int Number, int Datatype)
 {
-	struct ProcessLayer *layer;
-
-	layer = _FirstLayer;
+	struct ProcessLayerRow *row;
 
-	if(Number == -1) return NULL;
+	if(Number < 0 || Number >= (int)_Lookup.size()) return NULL;
 
-	while(layer){
-		if(layer->Layer == Number && layer->Datatype == -1){
-			return layer;
-		}else if(layer->Layer == Number && layer->Datatype == Datatype){
-			return layer;
-		}
-		layer = layer->Next;
+	// The table holds the first matching layer of the list, like a search would
+	row = &_Lookup[Number];
+	if(Datatype >= 0 && Datatype < (int)row->Datatypes.size() && row->Datatypes[Datatype]){
+		return row->Datatypes[Datatype];
 	}
-	return NULL;
+	return row->Any;
 }
 
 struct ProcessLayer *GDSProcess::GetLayer(int Index)
@@ -511,6 +506,11 @@ int GDSProcess::LayerCount()
 	return _Count;
 }
 
+int GDSProcess::PositionCount()
+{
+	return _Layers.size();
+}
+
 
 void GDSProcess::AddLayer(int Layer, int Datatype)
 {
@@ -554,13 +554,10 @@ void GDSProcess::ChangeLegendIndex(struct ProcessLayer *Layer, int LegendIndex)
 void GDSProcess::AddLayer(struct ProcessLayer *NewLayer)
 {
 	struct ProcessLayer *layer;
-
-	layer = _FirstLayer;
+	struct ProcessLayerRow *row;
 
 	if(_FirstLayer){
-		while(layer->Next){
-			layer = layer->Next;
-		}
+		layer = _Layers.back();
 		layer->Next = new struct ProcessLayer;
 		layer = layer->Next;
 		layer->Next = NULL;
@@ -591,6 +588,33 @@ void GDSProcess::AddLayer(struct ProcessLayer *NewLayer)
 	layer->Shift = NewLayer->Shift;
 	layer->ShortKey = NewLayer->ShortKey;
 	layer->LegendIndex = NewLayer->LegendIndex;
+
+	layer->Position = _Layers.size();
+	_Layers.push_back(layer);
+
+	// Lookup table, an earlier layer keeps matching the datatypes it covers
+	if(layer->Layer < 0){
+		return;
+	}
+	if(layer->Layer >= (int)_Lookup.size()){
+		struct ProcessLayerRow empty;
+		empty.Any = NULL;
+		_Lookup.resize(layer->Layer+1, empty);
+	}
+	row = &_Lookup[layer->Layer];
+	if(row->Any){
+		return;
+	}
+	if(layer->Datatype == -1){
+		row->Any = layer;
+	}else if(layer->Datatype >= 0){
+		if(layer->Datatype >= (int)row->Datatypes.size()){
+			row->Datatypes.resize(layer->Datatype+1, NULL);
+		}
+		if(!row->Datatypes[layer->Datatype]){
+			row->Datatypes[layer->Datatype] = layer;
+		}
+	}
 }
 
 bool GDSProcess::IsValid()
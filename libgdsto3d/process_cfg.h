@@ -21,6 +21,8 @@
 #ifndef _PROCESS_CFG2_H
 #define _PROCESS_CFG2_H
 
+#include "gds_globals.h"
+
 struct ProcessLayer{
 	struct ProcessLayer *Next;
 	char *Name;
@@ -35,6 +37,7 @@ struct ProcessLayer{
 	float Filter;
 	int Metal;
 	int Index;
+	int Position; // In the layer list, dense so it can index per-layer arrays
 	int LegendIndex;
 	bool Alt;
 	bool Ctrl;
@@ -44,12 +47,21 @@ struct ProcessLayer{
 
 typedef struct ProcessLayer layers;
 
+// Process layers with one GDS layer number, by datatype
+struct ProcessLayerRow{
+	struct ProcessLayer *Any; // First layer with datatype -1
+	vector<struct ProcessLayer*> Datatypes;
+};
+
 class GDSProcess
 {
 private:
 	struct ProcessLayer	*_FirstLayer;
 	int _Count;		/* Number of layers found */
 
+	vector<struct ProcessLayer*> _Layers; // By position
+	vector<struct ProcessLayerRow> _Lookup; // By GDS layer number, up to the highest one in use
+
 	bool _Valid;		/* Is the process file valid? */
 public:
 	GDSProcess ();
@@ -67,6 +79,7 @@ public:
 	struct ProcessLayer *GetLayer();
 	struct ProcessLayer *GetLayer(const char *Name);
 	int LayerCount();
+	int PositionCount(); // Size of arrays indexed by ProcessLayer::Position
 	bool IsValid();
 	float GetHighest();
 	float GetLowest();